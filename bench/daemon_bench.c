@@ -0,0 +1,143 @@
+/*
+ * daemon_bench.c:
+ *	Compare the per-command latency of the 16relind direct path
+ *	(one process per command) with the daemon path (one request on
+ *	a persistent socket, or one thin client process per command)
+ *
+ *	Usage: daemon_bench [<stack> [<iterations> [<16relind path>]]]
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "../src/client.h"
+
+static double nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *name, double *lat, int n)
+{
+	double sum = 0;
+	int i;
+
+	qsort(lat, n, sizeof(double), cmpDouble);
+	for (i = 0; i < n; i++)
+	{
+		sum += lat[i];
+	}
+	printf("%-22s n=%-6d mean=%10.1fus p50=%10.1fus p99=%10.1fus max=%10.1fus\n",
+		name, n, sum / n, lat[n / 2], lat[(n * 99) / 100], lat[n - 1]);
+}
+
+static int runCli(const char *exe, const char *stack, int direct)
+{
+	pid_t pid;
+	int status;
+	int fd;
+
+	pid = fork();
+	if (pid < 0)
+	{
+		return -1;
+	}
+	if (pid == 0)
+	{
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		if (direct)
+		{
+			setenv("RELAY16_NODAEMON", "1", 1);
+		}
+		execl(exe, exe, stack, "read", (char*)NULL);
+		_exit(127);
+	}
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *stack = argc > 1 ? argv[1] : "0";
+	int n = argc > 2 ? atoi(argv[2]) : 1000;
+	const char *exe = argc > 3 ? argv[3] : "./16relind";
+	char line[32];
+	double *lat;
+	double t;
+	int sock;
+	int i;
+
+	if (n <= 0)
+	{
+		printf("Invalid iterations number\n");
+		return 1;
+	}
+	lat = malloc(n * sizeof(double));
+	if (lat == NULL)
+	{
+		return 1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		t = nowUs();
+		runCli(exe, stack, 1);
+		lat[i] = nowUs() - t;
+	}
+	report("direct process", lat, n);
+
+	sock = clientConnect(clientSocketPath());
+	if (sock < 0)
+	{
+		printf("No daemon on %s, start it with \"16relind -daemon\"\n",
+			clientSocketPath());
+		free(lat);
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+	{
+		t = nowUs();
+		runCli(exe, stack, 0);
+		lat[i] = nowUs() - t;
+	}
+	report("thin client process", lat, n);
+
+	snprintf(line, sizeof(line), "%s read", stack);
+	for (i = 0; i < n; i++)
+	{
+		t = nowUs();
+		if (clientRequest(sock, line, NULL) != 0)
+		{
+			printf("Daemon request failed\n");
+			break;
+		}
+		lat[i] = nowUs() - t;
+	}
+	if (i > 0)
+	{
+		report("daemon socket", lat, i);
+	}
+	close(sock);
+	free(lat);
+	return 0;
+}
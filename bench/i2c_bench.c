@@ -0,0 +1,157 @@
+/*
+ * i2c_bench.c:
+ *	Per-operation latency of the I2C access methods implemented in comm.c
+ *
+ *	Usage: i2c_bench [<stack> [<iterations>]]
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/comm.h"
+#include "../src/relay.h"
+
+static const char *modeName[] = {"auto", "i2c_rdwr", "smbus", "write+read"};
+
+static double nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static void report(const char *mode, const char *op, double *lat, int n,
+	int errors)
+{
+	double sum = 0;
+	int i;
+
+	qsort(lat, n, sizeof(double), cmpDouble);
+	for (i = 0; i < n; i++)
+	{
+		sum += lat[i];
+	}
+	printf("%-11s %-22s mean=%8.1fus p50=%8.1fus p99=%8.1fus errors=%d\n", mode,
+		op, sum / n, lat[n / 2], lat[(n * 99) / 100], errors);
+}
+
+static int boardOpen(int stack)
+{
+	u8 cfg;
+	int dev;
+
+	dev = i2cSetup(RELAY16_BUS_DEFAULT,
+		(RELAY16_HW_I2C_BASE_ADD + stack) ^ 0x07);
+	if (dev >= 0 && 0 == i2cMem8Read(dev, RELAY16_CFG_REG_ADD, &cfg, 1))
+	{
+		return dev;
+	}
+	if (dev >= 0)
+	{
+		i2cClose(dev);
+	}
+	dev = i2cSetup(RELAY16_BUS_DEFAULT,
+		(RELAY16_HW_I2C_ALTERNATE_BASE_ADD + stack) ^ 0x07);
+	if (dev >= 0 && 0 == i2cMem8Read(dev, RELAY16_CFG_REG_ADD, &cfg, 1))
+	{
+		return dev;
+	}
+	if (dev >= 0)
+	{
+		i2cClose(dev);
+	}
+	return -1;
+}
+
+int main(int argc, char *argv[])
+{
+	int stack = argc > 1 ? atoi(argv[1]) : 0;
+	int n = argc > 2 ? atoi(argv[2]) : 1000;
+	I2cRegMsgType msgs[3];
+	u8 in[2];
+	u8 fs[4];
+	u8 wdt[2];
+	double *lat;
+	double t;
+	int mode;
+	int dev;
+	int err;
+	int i;
+
+	if (n <= 0 || stack < 0 || stack > 7)
+	{
+		printf("Usage: %s [<stack> [<iterations>]]\n", argv[0]);
+		return 1;
+	}
+	lat = malloc(n * sizeof(double));
+	if (lat == NULL)
+	{
+		return 1;
+	}
+	for (mode = I2C_MODE_RDWR; mode <= I2C_MODE_RW; mode++)
+	{
+		i2cModeSet(mode);
+		dev = boardOpen(stack);
+		if (dev < 0)
+		{
+			printf("16relind board id %d not detected\n", stack);
+			free(lat);
+			return 1;
+		}
+		if (i2cModeGet(dev) != mode)
+		{
+			printf("%-11s not supported by the adapter\n", modeName[mode]);
+			i2cClose(dev);
+			continue;
+		}
+
+		err = 0;
+		for (i = 0; i < n; i++)
+		{
+			t = nowUs();
+			err += 0 != i2cMem8Read(dev, RELAY16_INPORT_REG_ADD, in, 2);
+			lat[i] = nowUs() - t;
+		}
+		report(modeName[mode], "read INPORT (2B)", lat, n, err);
+
+		// inputs, failsafe enable and value, watchdog period
+		msgs[0].add = RELAY16_INPORT_REG_ADD;
+		msgs[0].read = 1;
+		msgs[0].size = 2;
+		msgs[0].buff = in;
+		msgs[1].add = I2C_MEM_RELAY_FAILSAFE_EN_ADD;
+		msgs[1].read = 1;
+		msgs[1].size = 4;
+		msgs[1].buff = fs;
+		msgs[2].add = I2C_MEM_WDT_INTERVAL_GET_ADD;
+		msgs[2].read = 1;
+		msgs[2].size = 2;
+		msgs[2].buff = wdt;
+		err = 0;
+		for (i = 0; i < n; i++)
+		{
+			t = nowUs();
+			err += 0 != i2cMem8Transfer(dev, msgs, 3);
+			lat[i] = nowUs() - t;
+		}
+		report(modeName[mode], "3 register reads", lat, n, err);
+		i2cClose(dev);
+	}
+	free(lat);
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ * lock_bench.c:
+ *	Bus lock contention: N processes take the lock in a loop, hold it for a
+ *	simulated transaction and release it. Reports the throughput, the wait
+ *	time percentiles and the fairness (Jain index of the per-client counts).
+ *
+ *	Usage: lock_bench [-sem] [-crash] [<clients> [<seconds> [<hold us>]]]
+ *	  -sem    use the former /SMI2C_SEM style semaphore (on a private name)
+ *	  -crash  client 0 exits while holding the lock after its first acquisition
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "../src/lib16relind.h"
+
+#define CLIENTS_MAX	64
+#define SAMPLES_MAX	200000
+#define SEM_NAME	"/16relind_bench_sem"
+#define SEM_TIMEOUT_S	3
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t errors;
+	uint32_t samples;
+	float waitUs[SAMPLES_MAX];
+} ClientStatsType;
+
+static sem_t *gSem = SEM_FAILED;
+
+static double nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void spinUs(double us)
+{
+	double end = nowUs() + us;
+
+	while (nowUs() < end)
+		;
+}
+
+/* the lock used before, kept here as the reference */
+static int semLock(void)
+{
+	int semVal = 2;
+	struct timespec ts;
+
+	while (semVal > 0)
+	{
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += SEM_TIMEOUT_S;
+		while (sem_timedwait(gSem, &ts) == -1 && errno == EINTR)
+			continue;
+		sem_getvalue(gSem, &semVal);
+	}
+	return 0;
+}
+
+static void semUnlock(void)
+{
+	int semVal = 2;
+
+	sem_getvalue(gSem, &semVal);
+	if (semVal < 1)
+	{
+		sem_post(gSem);
+	}
+}
+
+static void client(int id, int useSem, int crash, double endUs, double holdUs,
+	ClientStatsType *st)
+{
+	double t;
+	int ret;
+
+	while ( (t = nowUs()) < endUs)
+	{
+		ret = useSem ? semLock() : relay16Lock();
+		if (ret != 0)
+		{
+			st->errors++;
+			continue;
+		}
+		if (st->samples < SAMPLES_MAX)
+		{
+			st->waitUs[st->samples++] = (float) (nowUs() - t);
+		}
+		st->count++;
+		if (crash && id == 0)
+		{
+			_exit(0);
+		}
+		spinUs(holdUs);
+		if (useSem)
+		{
+			semUnlock();
+		}
+		else
+		{
+			relay16Unlock();
+		}
+	}
+}
+
+static int cmpFloat(const void *a, const void *b)
+{
+	float x = *(const float*)a;
+	float y = *(const float*)b;
+
+	return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+	ClientStatsType *st;
+	float *all;
+	int clients = 4;
+	int seconds = 3;
+	double holdUs = 50;
+	int useSem = 0;
+	int crash = 0;
+	int pos = 0;
+	double start;
+	double end;
+	double sum = 0;
+	double sumSq = 0;
+	uint32_t minCnt = UINT32_MAX;
+	uint32_t maxCnt = 0;
+	uint32_t errors = 0;
+	size_t n = 0;
+	int i;
+	uint32_t j;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-sem") == 0)
+		{
+			useSem = 1;
+		}
+		else if (strcmp(argv[i], "-crash") == 0)
+		{
+			crash = 1;
+		}
+		else if (pos == 0)
+		{
+			clients = atoi(argv[i]);
+			pos++;
+		}
+		else if (pos == 1)
+		{
+			seconds = atoi(argv[i]);
+			pos++;
+		}
+		else
+		{
+			holdUs = atof(argv[i]);
+		}
+	}
+	if (clients < 1 || clients > CLIENTS_MAX || seconds < 1)
+	{
+		printf("Usage: lock_bench [-sem] [-crash] [<clients 1..%d> [<seconds> [<hold us>]]]\n",
+			CLIENTS_MAX);
+		return 1;
+	}
+	if (useSem)
+	{
+		sem_unlink(SEM_NAME);
+		gSem = sem_open(SEM_NAME, O_CREAT, 0666, 3);
+		if (gSem == SEM_FAILED)
+		{
+			perror("sem_open");
+			return 1;
+		}
+	}
+	st = mmap(NULL, clients * sizeof(ClientStatsType), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (st == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+	memset(st, 0, clients * sizeof(ClientStatsType));
+	start = nowUs();
+	end = start + seconds * 1e6;
+	for (i = 0; i < clients; i++)
+	{
+		if (fork() == 0)
+		{
+			client(i, useSem, crash, end, holdUs, &st[i]);
+			_exit(0);
+		}
+	}
+	while (wait(NULL) > 0)
+		;
+	end = nowUs();
+	if (useSem)
+	{
+		sem_close(gSem);
+		sem_unlink(SEM_NAME);
+	}
+
+	all = malloc(clients * (size_t)SAMPLES_MAX * sizeof(float));
+	if (all == NULL)
+	{
+		return 1;
+	}
+	for (i = 0; i < clients; i++)
+	{
+		for (j = 0; j < st[i].samples; j++)
+		{
+			all[n++] = st[i].waitUs[j];
+		}
+		sum += st[i].count;
+		sumSq += (double)st[i].count * st[i].count;
+		minCnt = st[i].count < minCnt ? st[i].count : minCnt;
+		maxCnt = st[i].count > maxCnt ? st[i].count : maxCnt;
+		errors += st[i].errors;
+	}
+	if (n == 0)
+	{
+		printf("no lock acquired\n");
+		return 1;
+	}
+	qsort(all, n, sizeof(float), cmpFloat);
+	printf("lock=%s clients=%d hold=%.0fus time=%.2fs%s\n",
+		useSem ? "semaphore" : "ticket", clients, holdUs, (end - start) / 1e6,
+		crash ? " (client 0 crashed holding the lock)" : "");
+	printf("throughput=%.0f locks/s errors=%u\n", sum / ((end - start) / 1e6),
+		errors);
+	printf("wait p50=%.1fus p99=%.1fus p999=%.1fus max=%.1fus\n", all[n / 2],
+		all[(n * 99) / 100], all[(n * 999) / 1000], all[n - 1]);
+	printf("fairness jain=%.3f min=%u max=%u per client\n",
+		sumSq > 0 ? (sum * sum) / (clients * sumSq) : 0, minCnt, maxCnt);
+	free(all);
+	munmap(st, clients * sizeof(ClientStatsType));
+	return 0;
+}
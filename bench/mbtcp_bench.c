@@ -0,0 +1,343 @@
+/*
+ * mbtcp_bench.c:
+ *	Coil write rate and latency of the Modbus TCP gateway (16relind -mbtcp).
+ *	Every client is one connection sending Write Single Coil requests to its
+ *	own coil, with up to <depth> requests in flight, for the given time. The
+ *	coils are read back at the end and compared with the last values written.
+ *	The gateway counters (kill -USR1) show how many board writes the coil
+ *	writes took.
+ *
+ *	Usage: mbtcp_bench [-port <port>] [-clients <n>] [-depth <n>] [-s <seconds>]
+ *	                   [-units <n>] [-unit <unit ID of stack level 0>]
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define CLIENTS_MAX		128
+#define DEPTH_MAX		16
+#define SAMPLES_MAX		200000
+
+typedef struct
+{
+	int id;
+	int unit;
+	int coil;
+	int fd;
+	int state; /* last value written */
+	uint32_t sent;
+	uint32_t done;
+	uint32_t errors;
+	int samples;
+	double *lat;
+} ClientType;
+
+static int gPort = 502;
+static int gDepth = 1;
+static double gSeconds = 2;
+
+static double nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+static int connectGateway(void)
+{
+	struct sockaddr_in sin;
+	int fd;
+	int on = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(gPort);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if ( (fd < 0) || (connect(fd, (struct sockaddr*)&sin, sizeof(sin)) != 0))
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+	return fd;
+}
+
+static int readFull(int fd, uint8_t *buff, int size)
+{
+	int got = 0;
+	int n;
+
+	while (got < size)
+	{
+		n = read(fd, buff + got, size - got);
+		if (n <= 0)
+		{
+			return -1;
+		}
+		got += n;
+	}
+	return 0;
+}
+
+/*
+ * request:
+ *	Send one request PDU, the transaction identifier is tid
+ *********************************************************************************
+ */
+static int request(int fd, uint16_t tid, int unit, const uint8_t *pdu, int len)
+{
+	uint8_t buff[64];
+
+	buff[0] = tid >> 8;
+	buff[1] = tid & 0xff;
+	buff[2] = 0;
+	buff[3] = 0;
+	buff[4] = 0;
+	buff[5] = len + 1;
+	buff[6] = unit;
+	memcpy(buff + 7, pdu, len);
+	return write(fd, buff, len + 7) == len + 7 ? 0 : -1;
+}
+
+/*
+ * response:
+ *	Read one response, return its PDU size or -1
+ *********************************************************************************
+ */
+static int response(int fd, uint16_t *tid, uint8_t *pdu)
+{
+	uint8_t hdr[7];
+	int len;
+
+	if (readFull(fd, hdr, 7) != 0)
+	{
+		return -1;
+	}
+	len = ( (hdr[4] << 8) | hdr[5]) - 1;
+	if ( (len < 1) || (len > 253) || (readFull(fd, pdu, len) != 0))
+	{
+		return -1;
+	}
+	*tid = (hdr[0] << 8) | hdr[1];
+	return len;
+}
+
+static void* clientRun(void *arg)
+{
+	ClientType *c = arg;
+	double sentAt[DEPTH_MAX];
+	double end = nowUs() + gSeconds * 1e6;
+	uint8_t pdu[256];
+	uint16_t tid;
+	int inFlight = 0;
+
+	while ( (nowUs() < end) || (inFlight > 0))
+	{
+		while ( (inFlight < gDepth) && (nowUs() < end))
+		{
+			c->state = (c->sent & 1) == 0;
+			pdu[0] = 0x05;
+			pdu[1] = 0;
+			pdu[2] = c->coil;
+			pdu[3] = c->state ? 0xff : 0;
+			pdu[4] = 0;
+			sentAt[c->sent % DEPTH_MAX] = nowUs();
+			if (request(c->fd, (uint16_t)c->sent, c->unit, pdu, 5) != 0)
+			{
+				c->errors++;
+				return NULL;
+			}
+			c->sent++;
+			inFlight++;
+		}
+		if (response(c->fd, &tid, pdu) < 0)
+		{
+			c->errors++;
+			return NULL;
+		}
+		inFlight--;
+		if ( (pdu[0] != 0x05) || (tid != (uint16_t)c->done))
+		{
+			c->errors++;
+		}
+		if (c->samples < SAMPLES_MAX)
+		{
+			c->lat[c->samples++] = nowUs() - sentAt[c->done % DEPTH_MAX];
+		}
+		c->done++;
+	}
+	return NULL;
+}
+
+/*
+ * coilsCheck:
+ *	Read the coils of every unit and compare them with the last writes
+ *********************************************************************************
+ */
+static int coilsCheck(ClientType *c, int n, int unit, int units)
+{
+	const uint8_t rd[5] = {0x01, 0, 0, 0, 16};
+	uint8_t pdu[256];
+	uint16_t tid;
+	uint16_t val;
+	int mismatch = 0;
+	int fd;
+	int u;
+	int i;
+
+	usleep(100000); // the gateway drops the closed clients first, it may be full
+	fd = connectGateway();
+	if (fd < 0)
+	{
+		return -1;
+	}
+	for (u = unit; u < unit + units; u++)
+	{
+		if ( (request(fd, 0, u, rd, 5) != 0) || (response(fd, &tid, pdu) != 4))
+		{
+			close(fd);
+			return -1;
+		}
+		val = pdu[2] | (pdu[3] << 8);
+		for (i = 0; i < n; i++)
+		{
+			if ( (c[i].unit == u) && ( ( (val >> c[i].coil) & 1) != c[i].state))
+			{
+				mismatch++;
+			}
+		}
+	}
+	close(fd);
+	return mismatch;
+}
+
+int main(int argc, char *argv[])
+{
+	ClientType c[CLIENTS_MAX];
+	pthread_t th[CLIENTS_MAX];
+	double *all;
+	double start;
+	double elapsed;
+	uint32_t done = 0;
+	uint32_t errors = 0;
+	int clients = 8;
+	int units = 1;
+	int unit = 1;
+	int total = 0;
+	int mismatch;
+	int i;
+	int k;
+
+	for (k = 1; k + 1 < argc; k += 2)
+	{
+		if (strcmp(argv[k], "-port") == 0)
+		{
+			gPort = atoi(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-clients") == 0)
+		{
+			clients = atoi(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-depth") == 0)
+		{
+			gDepth = atoi(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-s") == 0)
+		{
+			gSeconds = atof(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-units") == 0)
+		{
+			units = atoi(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-unit") == 0)
+		{
+			unit = atoi(argv[k + 1]);
+		}
+		else
+		{
+			break;
+		}
+	}
+	if ( (k != argc) || (clients < 1) || (clients > CLIENTS_MAX) || (gDepth < 1)
+		|| (gDepth > DEPTH_MAX) || (units < 1) || (units > 8) || (gSeconds <= 0))
+	{
+		printf("Usage: %s [-port <port>] [-clients <n>] [-depth <n>] [-s <seconds>]"
+			" [-units <n>] [-unit <unit ID of stack level 0>]\n", argv[0]);
+		return 1;
+	}
+	memset(c, 0, sizeof(c));
+	for (i = 0; i < clients; i++)
+	{
+		c[i].id = i;
+		c[i].unit = unit + i % units;
+		c[i].coil = (i / units) % 16;
+		c[i].lat = malloc(SAMPLES_MAX * sizeof(double));
+		c[i].fd = connectGateway();
+		if ( (c[i].lat == NULL) || (c[i].fd < 0))
+		{
+			printf("Fail to connect to the gateway on port %d\n", gPort);
+			return 1;
+		}
+	}
+	start = nowUs();
+	for (i = 0; i < clients; i++)
+	{
+		pthread_create(&th[i], NULL, clientRun, &c[i]);
+	}
+	for (i = 0; i < clients; i++)
+	{
+		pthread_join(th[i], NULL);
+		done += c[i].done;
+		errors += c[i].errors;
+		total += c[i].samples;
+	}
+	elapsed = nowUs() - start;
+	all = malloc(total * sizeof(double));
+	if (all == NULL)
+	{
+		return 1;
+	}
+	for (i = 0, k = 0; i < clients; i++)
+	{
+		memcpy(all + k, c[i].lat, c[i].samples * sizeof(double));
+		k += c[i].samples;
+		close(c[i].fd);
+		free(c[i].lat);
+	}
+	qsort(all, total, sizeof(double), cmpDouble);
+	// the clients sharing a coil make its final state unknown
+	mismatch = clients > 16 * units ? 0 : coilsCheck(c, clients, unit, units);
+	printf("clients %d depth %d units %d: %u coil writes %.0f/s latency p50=%.0fus"
+		" p99=%.0fus max=%.0fus errors %u, coils %s\n", clients, gDepth, units, done,
+		done * 1e6 / elapsed, total ? all[total / 2] : 0,
+		total ? all[(total * 99) / 100] : 0, total ? all[total - 1] : 0, errors,
+		mismatch < 0 ? "not read" : mismatch ? "WRONG" : "ok");
+	free(all);
+	return errors || mismatch ? 1 : 0;
+}
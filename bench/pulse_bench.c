@@ -0,0 +1,230 @@
+/*
+ * pulse_bench.c:
+ *	Timing accuracy of the timed relay changes. The output register writes of
+ *	a simulated board are time stamped and compared with the schedule:
+ *	  sleep  the pulse train done with relative sleeps and relay16ChSet, the
+ *	         way a script or a "write; sleep; write" loop does it
+ *	  heap   the same train scheduled with relay16Pulse
+ *	  merge  two channels with the same train, expected one write per edge
+ *	Optional busy threads load the CPUs while the trains run.
+ *
+ *	Usage: pulse_bench [-load <threads>] [-n <pulses>] [-period <ms>]
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../src/relay.h"
+#include "../src/comm.h"
+#include "../src/sim.h"
+
+#define BENCH_SIM_SPEC	"boards=0;latency=120"
+#define BENCH_DISCOVERY	"/tmp/16relind_pulse_bench.boards"
+#define WRITES_MAX		4096
+#define LOAD_MAX		64
+
+static I2cTransportType gStamp; /* the simulator, output writes time stamped */
+static const I2cTransportType *gSim = NULL;
+static double gWriteUs[WRITES_MAX];
+static int gWrites = 0;
+static volatile int gLoadStop = 0;
+
+static double nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void stamp(void)
+{
+	int i = __atomic_fetch_add(&gWrites, 1, __ATOMIC_RELAXED);
+
+	if (i < WRITES_MAX)
+	{
+		gWriteUs[i] = nowUs();
+	}
+}
+
+static int stampWrite(int dev, int add, uint8_t* buff, int size)
+{
+	int ret = gSim->write(dev, add, buff, size);
+
+	if (add == RELAY16_OUTPORT_REG_ADD)
+	{
+		stamp();
+	}
+	return ret;
+}
+
+static int stampTransfer(int dev, I2cRegMsgType* msgs, int count)
+{
+	int ret = gSim->transfer(dev, msgs, count);
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (!msgs[i].read && msgs[i].add == RELAY16_OUTPORT_REG_ADD)
+		{
+			stamp();
+		}
+	}
+	return ret;
+}
+
+static void* loadThread(void *arg)
+{
+	volatile uint64_t n = 0;
+
+	(void)arg;
+	while (!gLoadStop)
+	{
+		n++;
+	}
+	return NULL;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * report:
+ *	Error of the edge i write against t0 + (i + 1) * period
+ *********************************************************************************
+ */
+static void report(const char *name, double t0, int edges, int period)
+{
+	double err[WRITES_MAX];
+	int n = gWrites < WRITES_MAX ? gWrites : WRITES_MAX;
+	int i;
+
+	if (n > edges)
+	{
+		n = edges;
+	}
+	for (i = 0; i < n; i++)
+	{
+		err[i] = gWriteUs[i] - (t0 + (i + 1) * period * 1000.0);
+	}
+	printf("%-6s edges %d writes %d", name, edges, gWrites);
+	if (n > 0)
+	{
+		printf("  drift %.0fus", err[n - 1] - err[0]);
+		qsort(err, n, sizeof(double), cmpDouble);
+		printf("  error p50 %.0fus p99 %.0fus max %.0fus", err[n / 2],
+			err[(n * 99) / 100], err[n - 1]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	Relay16PulseStatsType st;
+	Relay16Board *board;
+	pthread_t load[LOAD_MAX];
+	int loads = 0;
+	int pulses = 50;
+	int period = 10;
+	double t0;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-load") == 0 && i + 1 < argc)
+		{
+			loads = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			pulses = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-period") == 0 && i + 1 < argc)
+		{
+			period = atoi(argv[++i]);
+		}
+		else
+		{
+			printf("Usage: %s [-load <threads>] [-n <pulses>] [-period <ms>]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if ( (loads < 0) || (loads > LOAD_MAX) || (pulses <= 0)
+		|| (pulses * 2 > WRITES_MAX) || (period <= 0))
+	{
+		printf("Invalid parameters!\n");
+		return 1;
+	}
+
+	setenv("RELAY16_NODAEMON", "1", 1);
+	setenv("RELAY16_DISCOVERY", BENCH_DISCOVERY, 1);
+	unlink(BENCH_DISCOVERY);
+	simConfigure(BENCH_SIM_SPEC);
+	gSim = simTransport();
+	gStamp = *gSim;
+	gStamp.name = "sim-stamp";
+	gStamp.write = stampWrite;
+	gStamp.transfer = stampTransfer;
+	i2cTransportSet(&gStamp);
+	if (relay16Open(0, &board) != RELAY16_OK)
+	{
+		printf("Fail to open the simulated board!\n");
+		return 1;
+	}
+	for (i = 0; i < loads; i++)
+	{
+		pthread_create(&load[i], NULL, loadThread, NULL);
+	}
+	printf("%d pulses of %dms on / %dms off, %d load thread(s)\n", pulses, period,
+		period, loads);
+
+	gWrites = 0;
+	t0 = nowUs();
+	for (i = 0; i < pulses * 2; i++)
+	{
+		usleep(period * 1000);
+		relay16ChSet(board, 1, (i & 1) ? OFF : ON);
+	}
+	report("sleep", t0, pulses * 2, period);
+
+	relay16PulseStatsGet(&st, 1);
+	gWrites = 0;
+	t0 = nowUs();
+	relay16Pulse(board, 0x0001, period, period, period, pulses);
+	relay16PulseWait(board, 0);
+	report("heap", t0, pulses * 2, period);
+
+	gWrites = 0;
+	t0 = nowUs();
+	relay16Pulse(board, 0x0001, period, period, period, pulses);
+	relay16Pulse(board, 0x0002, period, period, period, pulses);
+	relay16PulseWait(board, 0);
+	report("merge", t0, pulses * 2, period);
+
+	relay16PulseStatsGet(&st, 1);
+	printf("engine writes %u late %u errors %u latency avg %uus max %uus\n",
+		st.writes, st.late, st.errors,
+		st.writes ? (unsigned int) (st.totalLateUs / st.writes) : 0, st.maxLateUs);
+
+	gLoadStop = 1;
+	for (i = 0; i < loads; i++)
+	{
+		pthread_join(load[i], NULL);
+	}
+	relay16Close(board);
+	return 0;
+}
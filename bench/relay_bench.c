@@ -0,0 +1,462 @@
+/*
+ * relay_bench.c:
+ *	Microbenchmarks of the relay hot paths: the bit order conversions, the
+ *	channel and bitmap accesses, a 16 channel burst with and without write
+ *	coalescing, the board open (doBoardInit), the CLI dispatch in process and a
+ *	whole 16relind process.
+ *
+ *	Every benchmark reports the throughput, the p50/p99/p999 latency of one
+ *	operation and the system calls per operation (counted with ptrace in a
+ *	separate run). The boards are simulated in process unless -hw is given.
+ *
+ *	Usage: relay_bench [-hw] [-stack <n>] [-n <iterations>] [-json <file>]
+ *	                   [-cli <16relind path>] [<benchmark name>...]
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include "../src/relay.h"
+#include "../src/sim.h"
+
+#define BENCH_SIM_SPEC	"boards=0"
+#define BENCH_DISCOVERY	"/tmp/16relind_bench.boards"
+
+typedef struct
+{
+	const char *name;
+	int batch; /* operations timed together, for the very short ones */
+	int scale; /* iterations divider, for the long ones */
+	int (*op)(void);
+} BenchType;
+
+typedef struct
+{
+	double opsPerSec;
+	double p50;
+	double p99;
+	double p999;
+	double syscalls;
+	double xfers;
+	int errors;
+} BenchResultType;
+
+static Relay16Board *gBoard = NULL;
+static Relay16Board *gTrust = NULL; /* same board, shadow cache trusted */
+static Relay16Board *gCoalesce = NULL; /* same board, changes written on flush */
+static int gStack = 0;
+static int gHw = 0;
+static const char *gCli = "./16relind";
+static volatile uint16_t gSink;
+static uint16_t gVal = 0;
+static int gCh = 1;
+
+static int opToIO(void)
+{
+	gSink = relay16ToIO(gVal++);
+	return 0;
+}
+
+static int opFromIO(void)
+{
+	gSink = relay16FromIO(gVal++);
+	return 0;
+}
+
+static int chSet(Relay16Board *board)
+{
+	int ret = relay16ChSet(board, gCh, gVal & 1);
+
+	gCh = gCh % RELAY16_CH_MAX + 1;
+	gVal++;
+	return ret;
+}
+
+static int opChSet(void)
+{
+	return chSet(gBoard);
+}
+
+static int opChSetTrust(void)
+{
+	return chSet(gTrust);
+}
+
+/* a burst of changes on every channel, as a control loop update does */
+static int burst(Relay16Board *board)
+{
+	int ret = 0;
+	int i;
+
+	for (i = 1; i <= RELAY16_CH_MAX; i++)
+	{
+		ret |= relay16ChSet(board, i, (gVal + i) & 1);
+	}
+	gVal++;
+	return ret;
+}
+
+static int opBurst(void)
+{
+	return burst(gBoard);
+}
+
+static int opBurstCoalesce(void)
+{
+	return burst(gCoalesce) | relay16CoalesceFlush(gCoalesce);
+}
+
+static int opGet(void)
+{
+	uint16_t val;
+	int ret = relay16Get(gBoard, &val);
+
+	gSink = val;
+	return ret;
+}
+
+static int opSet(void)
+{
+	return relay16Set(gBoard, gVal++);
+}
+
+static int opOpen(void)
+{
+	Relay16Board *b = NULL;
+	int ret = relay16Open(gStack, &b);
+
+	relay16Close(b);
+	return ret;
+}
+
+static int cliRun(const char *line)
+{
+	char buff[CLI_LINE_MAX];
+	char *argv[CLI_ARGS_MAX + 1];
+	int argc;
+
+	snprintf(buff, sizeof(buff), "%d %s", gStack, line);
+	argc = cliSplit(buff, argv, CLI_ARGS_MAX);
+	if (argc < 0)
+	{
+		return -1;
+	}
+	return cliExec(argc, argv) == OK ? 0 : -1;
+}
+
+static int opCliWrite(void)
+{
+	return cliRun( (gVal++ & 1) ? "write 2 on" : "write 2 off");
+}
+
+static int opCliRead(void)
+{
+	return cliRun("read");
+}
+
+static int opProcess(void)
+{
+	char stack[8];
+	int status;
+	pid_t pid;
+
+	snprintf(stack, sizeof(stack), "%d", gStack);
+	pid = fork();
+	if (pid == 0)
+	{
+		execl(gCli, gCli, stack, "read", (char*)NULL);
+		_exit(127);
+	}
+	if ( (pid < 0) || (waitpid(pid, &status, 0) != pid))
+	{
+		return -1;
+	}
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static const BenchType gBench[] = {
+	{"relay16ToIO", 1000, 1, opToIO},
+	{"relay16FromIO", 1000, 1, opFromIO},
+	{"relay16ChSet", 1, 1, opChSet},
+	{"relay16ChSet_trust", 1, 1, opChSetTrust},
+	{"burst16", 1, 10, opBurst},
+	{"burst16_coalesce", 1, 1, opBurstCoalesce},
+	{"relay16Get", 1, 1, opGet},
+	{"relay16Set", 1, 1, opSet},
+	{"doBoardInit", 1, 10, opOpen},
+	{"cli_write", 1, 1, opCliWrite},
+	{"cli_read", 1, 1, opCliRead},
+	{"cli_process", 1, 100, opProcess},
+	{NULL, 0, 0, NULL}};
+
+static double nowNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmpDouble(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * syscallCount:
+ *	System calls made by n operations, the operations run in a child process
+ *	traced with ptrace (and its children, for the process benchmark)
+ *********************************************************************************
+ */
+static long syscallCount(const BenchType *b, int n)
+{
+	long stops = 0;
+	int status;
+	int sig;
+	pid_t child;
+	pid_t pid;
+	int i;
+
+	child = fork();
+	if (child == 0)
+	{
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) != 0)
+		{
+			_exit(1);
+		}
+		raise(SIGSTOP);
+		for (i = 0; i < n; i++)
+		{
+			b->op();
+		}
+		_exit(0);
+	}
+	if ( (child < 0) || (waitpid(child, &status, 0) != child) || !WIFSTOPPED(status))
+	{
+		return -1;
+	}
+	ptrace(PTRACE_SETOPTIONS, child, NULL,
+		PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL | PTRACE_O_TRACEFORK
+			| PTRACE_O_TRACEVFORK | PTRACE_O_TRACECLONE);
+	ptrace(PTRACE_SYSCALL, child, NULL, NULL);
+	while ( (pid = waitpid(-1, &status, __WALL)) > 0)
+	{
+		if (!WIFSTOPPED(status))
+		{
+			continue;
+		}
+		sig = 0;
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80))
+		{
+			stops++;
+		}
+		else if ( (WSTOPSIG(status) != SIGTRAP) && (WSTOPSIG(status) != SIGSTOP))
+		{
+			sig = WSTOPSIG(status);
+		}
+		ptrace(PTRACE_SYSCALL, pid, NULL, (void*) (long)sig);
+	}
+	// one stop at the entry and one at the exit of every call
+	return stops / 2;
+}
+
+static void benchRun(const BenchType *b, int iterations, BenchResultType *r)
+{
+	SimStatsType st;
+	double *lat;
+	double total = 0;
+	double t;
+	long base;
+	long calls;
+	int n = iterations / b->scale;
+	int i;
+	int k;
+
+	if (n < 10)
+	{
+		n = 10;
+	}
+	memset(r, 0, sizeof(*r));
+	lat = malloc(n * sizeof(double));
+	if (lat == NULL)
+	{
+		return;
+	}
+	for (i = 0; i < n / 10; i++) // warm up
+	{
+		b->op();
+	}
+	simStatsGet(NULL, 1);
+	for (i = 0; i < n; i++)
+	{
+		t = nowNs();
+		for (k = 0; k < b->batch; k++)
+		{
+			r->errors += b->op() != 0;
+		}
+		lat[i] = nowNs() - t;
+		total += lat[i];
+		lat[i] /= b->batch;
+	}
+	simStatsGet(&st, 1);
+	r->xfers = gHw ? -1 : (double)st.transactions / ( (double)n * b->batch);
+	qsort(lat, n, sizeof(double), cmpDouble);
+	r->opsPerSec = (double)n * b->batch / (total / 1e9);
+	r->p50 = lat[n / 2];
+	r->p99 = lat[(n * 99) / 100];
+	r->p999 = lat[(n * 999) / 1000];
+	free(lat);
+
+	n = 100 * b->batch / b->scale;
+	base = syscallCount(b, 0);
+	calls = syscallCount(b, n);
+	r->syscalls = (base < 0 || calls < 0) ? -1 : (double) (calls - base) / n;
+}
+
+static int selected(const char *name, int argc, char *argv[], int first)
+{
+	int i;
+
+	if (first >= argc)
+	{
+		return 1;
+	}
+	for (i = first; i < argc; i++)
+	{
+		if (strcmp(argv[i], name) == 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	BenchResultType r;
+	FILE *json = NULL;
+	int iterations = 20000;
+	int devNull;
+	int out;
+	int first;
+	int ret;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (strcmp(argv[i], "-hw") == 0)
+		{
+			gHw = 1;
+		}
+		else if (strcmp(argv[i], "-stack") == 0 && i + 1 < argc)
+		{
+			gStack = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			iterations = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-json") == 0 && i + 1 < argc)
+		{
+			json = fopen(argv[++i], "w");
+			if (json == NULL)
+			{
+				perror(argv[i]);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "-cli") == 0 && i + 1 < argc)
+		{
+			gCli = argv[++i];
+		}
+		else
+		{
+			printf("Usage: %s [-hw] [-stack <n>] [-n <iterations>] [-json <file>]"
+				" [-cli <16relind path>] [<benchmark name>...]\n", argv[0]);
+			return 1;
+		}
+	}
+	first = i; // the benchmark names, all of them when none is given
+	if (iterations < 100)
+	{
+		iterations = 100;
+	}
+	setenv("RELAY16_NODAEMON", "1", 1);
+	if (!gHw)
+	{
+		// the 16relind processes started by cli_process use the simulator too
+		setenv("RELAY16_SIM", BENCH_SIM_SPEC, 1);
+		// the simulated boards start unconfigured, forget the previous run
+		setenv("RELAY16_DISCOVERY", BENCH_DISCOVERY, 1);
+		unlink(BENCH_DISCOVERY);
+	}
+	ret = relay16Open(gStack, &gBoard);
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16Open(gStack, &gTrust);
+	}
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16Open(gStack, &gCoalesce);
+	}
+	if (ret != RELAY16_OK)
+	{
+		printf("Fail to open board %d: %s\n", gStack, relay16StrError(ret));
+		return 1;
+	}
+	relay16CachePolicySet(gTrust, RELAY16_CACHE_TRUST, 0);
+	relay16CoalesceSet(gCoalesce, RELAY16_COALESCE_MANUAL);
+	printf("%-20s %12s %10s %10s %10s %10s %8s %6s\n", "benchmark", "ops/s",
+		"p50 ns", "p99 ns", "p999 ns", "syscall/op", "xfer/op", "errors");
+	for (i = 0; gBench[i].name != NULL; i++)
+	{
+		if (!selected(gBench[i].name, argc, argv, first))
+		{
+			continue;
+		}
+		fflush(stdout);
+		// the CLI benchmarks print their results
+		devNull = open("/dev/null", O_WRONLY);
+		out = dup(STDOUT_FILENO);
+		dup2(devNull, STDOUT_FILENO);
+		benchRun(&gBench[i], iterations, &r);
+		fflush(stdout);
+		dup2(out, STDOUT_FILENO);
+		close(out);
+		close(devNull);
+		printf("%-20s %12.0f %10.0f %10.0f %10.0f %10.2f %8.2f %6d\n",
+			gBench[i].name, r.opsPerSec, r.p50, r.p99, r.p999, r.syscalls, r.xfers,
+			r.errors);
+		if (json != NULL)
+		{
+			fprintf(json, "{\"bench\":\"%s\",\"mode\":\"%s\",\"ops_per_s\":%.0f,"
+				"\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,"
+				"\"syscalls_per_op\":%.2f,\"xfers_per_op\":%.2f,\"errors\":%d}\n",
+				gBench[i].name, gHw ? "hw" : "sim", r.opsPerSec, r.p50, r.p99,
+				r.p999, r.syscalls, r.xfers, r.errors);
+		}
+	}
+	if (json != NULL)
+	{
+		fclose(json);
+	}
+	relay16Close(gBoard);
+	relay16Close(gTrust);
+	relay16Close(gCoalesce);
+	boardCacheFlush();
+	return 0;
+}
@@ -0,0 +1,407 @@
+/*
+ * rtu_bench.c:
+ *	Throughput of the Modbus RTU transport at every supported baud rate,
+ *	against a slave simulated on a pseudo terminal. The simulated slaves
+ *	answer the coil requests of the boards (slave addresses offset + stack
+ *	level) after the time the request and the response would take on the
+ *	wire, the master side runs the real transport (frame silence, timeouts,
+ *	CRC checks) on the pty.
+ *	  write    relay16Set, one Write Multiple Coils frame
+ *	  read     relay16Get, one Read Coils frame
+ *	  ch       relay16ChSet without cache, read and write frames
+ *	  ch/trust relay16ChSet with the TRUST cache policy, one write frame
+ *	The wire column is the floor: both frames and the 3.5 character silence.
+ *
+ *	With -slave the simulator only runs, the pty to use is displayed:
+ *	  ./bench/rtu_bench -slave 9600 &
+ *	  RELAY16_RTU="20=/dev/pts/3:9600" 16relind 0@20 write 0x00ff
+ *
+ *	Usage: rtu_bench [-ms <time per test>] [-baud <baud>] [-offset <n>]
+ *	       rtu_bench -slave [<baud> [<offset>]]
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include "../src/relay.h"
+#include "../src/rtu.h"
+
+#define BENCH_BUS		20
+#define BENCH_DISCOVERY	"/tmp/16relind_rtu_bench.boards"
+#define SLAVE_MAX		248
+
+typedef struct
+{
+	int master;
+	int keep; /* pty side kept open, the master reads do not fail between tests */
+	char name[64];
+	int baud;
+	uint32_t charUs;
+	int offset;
+	uint16_t coils[SLAVE_MAX];
+	uint32_t requests;
+	uint32_t dropped;
+	volatile int stop;
+	pthread_t thread;
+} SlaveType;
+
+static const int gBauds[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200,
+	230400, 460800, 921600};
+
+static double nowUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void sleepUntil(double us)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t) (us / 1e6);
+	ts.tv_nsec = (long) ( (us - ts.tv_sec * 1e6) * 1e3);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+	{
+	}
+}
+
+/*
+ * frameSize:
+ *	Size of the request in buff, 0 while more bytes are needed, -1 if the
+ *	function is not one of the coil functions
+ *********************************************************************************
+ */
+static int frameSize(const uint8_t *buff, int got)
+{
+	if (got < 2)
+	{
+		return 0;
+	}
+	switch (buff[1])
+	{
+	case RTU_FC_READ_COILS:
+		return got >= 8 ? 8 : 0;
+	case RTU_FC_WRITE_COILS:
+		if (got < 7)
+		{
+			return 0;
+		}
+		return got >= 9 + buff[6] ? 9 + buff[6] : 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * slaveAnswer:
+ *	Response to a request, 0 if the slave address is not simulated
+ *********************************************************************************
+ */
+static int slaveAnswer(SlaveType *s, const uint8_t *req, uint8_t *rsp)
+{
+	uint16_t *coils;
+	uint16_t mask;
+	int start;
+	int count;
+	int n = 0;
+	uint16_t crc;
+
+	if ( (req[0] < s->offset) || (req[0] >= s->offset + RELAY16_STACK_MAX))
+	{
+		return 0;
+	}
+	coils = &s->coils[req[0]];
+	start = (req[2] << 8) | req[3];
+	count = (req[4] << 8) | req[5];
+	rsp[n++] = req[0];
+	if ( (count == 0) || (start + count > RELAY_CH_NR_MAX))
+	{
+		rsp[n++] = req[1] | RTU_EXCEPTION;
+		rsp[n++] = 0x02; // illegal data address
+	}
+	else if (req[1] == RTU_FC_READ_COILS)
+	{
+		mask = (uint16_t) ( ( (1u << count) - 1) << start);
+		rsp[n++] = req[1];
+		rsp[n++] = (count + 7) / 8;
+		rsp[n++] = ( (*coils & mask) >> start) & 0xff;
+		if (count > 8)
+		{
+			rsp[n++] = ( (*coils & mask) >> start) >> 8;
+		}
+	}
+	else
+	{
+		mask = (uint16_t) ( ( (1u << count) - 1) << start);
+		*coils = (*coils & ~mask) | ( ( (req[7] | (req[8] << 8)) << start) & mask);
+		memcpy(rsp + n, req + 1, 5);
+		n += 5;
+	}
+	crc = rtuCrc(rsp, n);
+	rsp[n++] = crc & 0xff;
+	rsp[n++] = crc >> 8;
+	return n;
+}
+
+static void* slaveRun(void *arg)
+{
+	SlaveType *s = arg;
+	struct pollfd pfd = {s->master, POLLIN, 0};
+	uint8_t buff[RTU_FRAME_MAX];
+	uint8_t rsp[RTU_FRAME_MAX];
+	double first = 0;
+	int got = 0;
+	int size;
+	int n;
+
+	while (!s->stop)
+	{
+		if (poll(&pfd, 1, 100) <= 0)
+		{
+			got = 0; // a silence ends any partial frame
+			continue;
+		}
+		n = read(s->master, buff + got, sizeof(buff) - got);
+		if (n <= 0)
+		{
+			continue;
+		}
+		if (got == 0)
+		{
+			first = nowUs();
+		}
+		got += n;
+		size = frameSize(buff, got);
+		if (size == 0)
+		{
+			continue;
+		}
+		if ( (size < 0) || (rtuCrc(buff, size - 2) != (buff[size - 2]
+			| (buff[size - 1] << 8))))
+		{
+			s->dropped++;
+			got = 0;
+			continue;
+		}
+		s->requests++;
+		n = slaveAnswer(s, buff, rsp);
+		if (n > 0)
+		{
+			// the request and the response on the wire
+			sleepUntil(first + (double)s->charUs * (size + n));
+			if (write(s->master, rsp, n) != n)
+			{
+				s->dropped++;
+			}
+		}
+		got = 0;
+	}
+	return NULL;
+}
+
+static int slaveStart(SlaveType *s, int baud, int offset)
+{
+	struct termios tio;
+
+	memset(s, 0, sizeof(*s));
+	s->baud = baud;
+	s->charUs = (uint32_t) ( (10000000ULL + baud - 1) / baud); // 8N1
+	s->offset = offset;
+	s->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ( (s->master < 0) || (grantpt(s->master) != 0) || (unlockpt(s->master) != 0)
+		|| (ptsname_r(s->master, s->name, sizeof(s->name)) != 0))
+	{
+		return -1;
+	}
+	s->keep = open(s->name, O_RDWR | O_NOCTTY);
+	if ( (s->keep < 0) || (tcgetattr(s->keep, &tio) != 0))
+	{
+		return -1;
+	}
+	cfmakeraw(&tio);
+	tcsetattr(s->keep, TCSANOW, &tio);
+	return pthread_create(&s->thread, NULL, slaveRun, s);
+}
+
+static void slaveStop(SlaveType *s)
+{
+	s->stop = 1;
+	pthread_join(s->thread, NULL);
+	close(s->keep);
+	close(s->master);
+}
+
+typedef int (*OpFn)(Relay16Board *b, int i);
+
+static int opWrite(Relay16Board *b, int i)
+{
+	return relay16Set(b, (uint16_t) (i * 0x9e37));
+}
+
+static int opRead(Relay16Board *b, int i)
+{
+	uint16_t val;
+
+	(void)i;
+	return relay16Get(b, &val);
+}
+
+static int opCh(Relay16Board *b, int i)
+{
+	return relay16ChSet(b, i % RELAY_CH_NR_MAX + 1, (i / RELAY_CH_NR_MAX) & 1);
+}
+
+static void measure(Relay16Board *b, const char *name, OpFn op, int frames,
+	int rspBytes, int reqBytes, int baud, int ms)
+{
+	double start = nowUs();
+	double end = start + ms * 1000.0;
+	double now = start;
+	double wire;
+	int errors = 0;
+	int n = 0;
+
+	// at least a few operations at the low rates
+	while ( (now < end) || (n < 3))
+	{
+		errors += op(b, n) != RELAY16_OK;
+		n++;
+		now = nowUs();
+	}
+	wire = frames * rtuT35Us(baud, 10) + (reqBytes + rspBytes) * 1e7 / baud;
+	printf("%7d %-9s %9.1f ops/s %10.0fus %10.0fus %7d\n", baud, name,
+		n * 1e6 / (now - start), (now - start) / n, wire, errors);
+}
+
+static int benchBaud(int baud, int offset, int ms)
+{
+	Relay16Board *b = NULL;
+	SlaveType s;
+	char line[128];
+	uint16_t val = 0;
+	int ret;
+
+	if (slaveStart(&s, baud, offset) != 0)
+	{
+		printf("Fail to open a pseudo terminal\n");
+		return -1;
+	}
+	snprintf(line, sizeof(line), "%s:%d:8N1:%d", s.name, baud, offset);
+	ret = relay16RtuAttach(BENCH_BUS, line);
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16OpenBus(BENCH_BUS, 0, &b);
+	}
+	if (ret != RELAY16_OK)
+	{
+		printf("%7d %s\n", baud, relay16StrError(ret));
+		slaveStop(&s);
+		return -1;
+	}
+	// frames: read coils 8 + 7 bytes, write 16 coils 11 + 8 bytes
+	measure(b, "write", opWrite, 1, 8, 11, baud, ms);
+	measure(b, "read", opRead, 1, 7, 8, baud, ms);
+	measure(b, "ch", opCh, 2, 15, 19, baud, ms);
+	relay16CachePolicySet(b, RELAY16_CACHE_TRUST, 0);
+	measure(b, "ch/trust", opCh, 1, 8, 11, baud, ms);
+	relay16CachePolicySet(b, RELAY16_CACHE_OFF, 0);
+	if ( (relay16Set(b, 0x1234) != RELAY16_OK) || (relay16Get(b, &val) != RELAY16_OK)
+		|| (val != 0x1234) || (s.coils[offset] != 0x1234))
+	{
+		printf("%7d read back 0x%04x, slave coils 0x%04x, expected 0x1234\n", baud,
+			val, s.coils[offset]);
+	}
+	relay16Close(b);
+	relay16RtuAttach(BENCH_BUS, NULL);
+	slaveStop(&s);
+	return 0;
+}
+
+static int slaveOnly(int baud, int offset)
+{
+	SlaveType s;
+
+	if (slaveStart(&s, baud, offset) != 0)
+	{
+		printf("Fail to open a pseudo terminal\n");
+		return 1;
+	}
+	printf("%s %d bps, slaves %d..%d\n", s.name, baud, offset,
+		offset + RELAY16_STACK_MAX - 1);
+	fflush(stdout);
+	pthread_join(s.thread, NULL);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	RtuStatsType st;
+	int baud = 0;
+	int offset = RTU_OFFSET_DEFAULT;
+	int ms = 500;
+	unsigned int i;
+	int k;
+
+	if ( (argc > 1) && (strcmp(argv[1], "-slave") == 0))
+	{
+		return slaveOnly(argc > 2 ? atoi(argv[2]) : 9600,
+			argc > 3 ? atoi(argv[3]) : RTU_OFFSET_DEFAULT);
+	}
+	for (k = 1; k + 1 < argc; k += 2)
+	{
+		if (strcmp(argv[k], "-ms") == 0)
+		{
+			ms = atoi(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-baud") == 0)
+		{
+			baud = atoi(argv[k + 1]);
+		}
+		else if (strcmp(argv[k], "-offset") == 0)
+		{
+			offset = atoi(argv[k + 1]);
+		}
+		else
+		{
+			break;
+		}
+	}
+	if ( (k != argc) || (ms <= 0) || (offset < 1) || (offset > 240))
+	{
+		printf("Usage: %s [-ms <time per test>] [-baud <baud>] [-offset <n>]\n"
+			"       %s -slave [<baud> [<offset>]]\n", argv[0], argv[0]);
+		return 1;
+	}
+	setenv("RELAY16_NODAEMON", "1", 1);
+	setenv("RELAY16_DISCOVERY", BENCH_DISCOVERY, 1);
+	unlink(BENCH_DISCOVERY);
+	printf("%7s %-9s %15s %12s %12s %7s\n", "baud", "test", "rate", "latency",
+		"wire", "errors");
+	for (i = 0; i < sizeof(gBauds) / sizeof(gBauds[0]); i++)
+	{
+		if ( (baud == 0) || (baud == gBauds[i]))
+		{
+			benchBaud(gBauds[i], offset, ms);
+		}
+	}
+	rtuStatsGet(&st, 0);
+	printf("frames %u, bytes %u, timeouts %u, crc errors %u, exceptions %u\n",
+		st.frames, st.bytes, st.timeouts, st.crcErrors, st.exceptions);
+	unlink(BENCH_DISCOVERY);
+	return 0;
+}
@@ -5,6 +5,9 @@ module.exports = function(RED) {
     const ALTERNATE_HW_ADD = 0x38;
     const OUT_REG = 0x02;
     const CFG_REG = 0x06;
+    const I2C_BUS = 1;
+    const RESYNC_MS = 1000; // the cached relay states are read again after this time
+    const STATUS_MS = 250; // node status refresh
     const mask = new ArrayBuffer(16);
 	mask[0] = 0x8000;
 	mask[1] = 0x4000;
@@ -22,6 +25,271 @@ module.exports = function(RED) {
 	mask[13] = 0x4;
 	mask[14] = 0x2;
 	mask[15] = 0x1;
+
+    // One I2C bus for all the nodes, with the state of every stack level:
+    // expander address, direction register done and last relay states.
+    // The bus accesses run one at a time from a queue, the requests for a stack
+    // level that arrive while its job waits are merged into that job
+    var bus = null;
+    var busUsers = 0;
+    var stacks = [];
+    var queue = [];
+    var busy = false;
+    var queued = 0; // messages waiting for the bus
+    var writeJobs = []; // per stack level, the write job not started yet
+    var readJobs = [];
+
+    function busOpen() {
+        // the bus of the previous deploy may still end a job
+        if (bus == null) {
+            bus = I2C.openSync(I2C_BUS);
+        }
+        busUsers++;
+        return bus;
+    }
+
+    function busEnd() {
+        bus.closeSync();
+        bus = null;
+        stacks = [];
+        queue = [];
+        queued = 0;
+        writeJobs = [];
+        readJobs = [];
+    }
+
+    function busClose() {
+        busUsers--;
+        if (busUsers == 0 && !busy) {
+            busEnd();
+        }
+    }
+
+    function busQueue(job) {
+        queue.push(job);
+        busNext();
+    }
+
+    function busNext() {
+        var job;
+        if (busy || queue.length == 0) {
+            return;
+        }
+        busy = true;
+        job = queue.shift();
+        job(function() {
+            busy = false;
+            if (busUsers == 0) {
+                busEnd();
+            } else {
+                busNext();
+            }
+        });
+    }
+
+    function toIO(val) {
+        var io = 0;
+        var i;
+        for (i = 0; i < 16; i++) {
+            if (((1 << i) & val) != 0) {
+                io |= mask[i];
+            }
+        }
+        return io;
+    }
+
+    function fromIO(io) {
+        var val = 0;
+        var i;
+        for (i = 0; i < 16; i++) {
+            if (io & mask[i]) {
+                val += 1 << i;
+            }
+        }
+        return val;
+    }
+
+    // a failed access forgets the stack level, the next message detects it again
+    function stackInvalidate(stack) {
+        stacks[stack] = undefined;
+    }
+
+    // Find the expander of the stack level and set its pins as outputs, once
+    function stackGet(stack, callback) {
+        var st = stacks[stack];
+        if (st !== undefined) {
+            callback(null, st);
+            return;
+        }
+        st = {hwAdd: 0, io: 0, ioTime: 0};
+
+        function init(hwAdd, direction) {
+            st.hwAdd = hwAdd;
+            if (direction == 0x00) {
+                stacks[stack] = st;
+                callback(null, st);
+                return;
+            }
+            bus.writeWord(hwAdd, OUT_REG, 0x00, function(err) {
+                if (err) {
+                    callback(err);
+                    return;
+                }
+                bus.writeWord(hwAdd, CFG_REG, 0x00, function(err) {
+                    if (err) {
+                        callback(err);
+                        return;
+                    }
+                    st.ioTime = Date.now();
+                    stacks[stack] = st;
+                    callback(null, st);
+                });
+            });
+        }
+        bus.readWord(DEFAULT_HW_ADD + (stack ^ 0x07), CFG_REG, function(err, direction) {
+            if (!err) {
+                init(DEFAULT_HW_ADD + (stack ^ 0x07), direction);
+                return;
+            }
+            bus.readWord(ALTERNATE_HW_ADD + (stack ^ 0x07), CFG_REG, function(err, direction) {
+                if (err) {
+                    callback(err);
+                } else {
+                    init(ALTERNATE_HW_ADD + (stack ^ 0x07), direction);
+                }
+            });
+        });
+    }
+
+    // Relay states of the stack level (expander order), from the cache if read
+    // less than RESYNC_MS ago
+    function stackRead(st, fresh, callback) {
+        if (fresh && st.ioTime != 0 && Date.now() - st.ioTime < RESYNC_MS) {
+            callback(null, st.io);
+            return;
+        }
+        bus.readWord(st.hwAdd, OUT_REG, function(err, io) {
+            if (!err) {
+                st.io = io;
+                st.ioTime = Date.now();
+            }
+            callback(err, io);
+        });
+    }
+
+    // Turn on the relays of set and off the relays of clr (expander order) with
+    // one OUT_REG write, merged with the other changes queued for the stack level.
+    // The write needs no read if all the relays are given
+    function stackWrite(stack, set, clr, done) {
+        var job = writeJobs[stack];
+        queued++;
+        if (job !== undefined) {
+            job.set = (job.set & ~clr) | set;
+            job.clr = (job.clr & ~set) | clr;
+            job.done.push(done);
+            return;
+        }
+        job = {set: set, clr: clr, done: [done]};
+        writeJobs[stack] = job;
+        // a read queued before must not see this change, nor merge the next reads
+        readJobs[stack] = undefined;
+        busQueue(function(next) {
+            function finish(err) {
+                if (err) {
+                    stackInvalidate(stack);
+                }
+                queued -= job.done.length;
+                job.done.forEach(function(cb) { cb(err); });
+                next();
+            }
+            if (writeJobs[stack] === job) {
+                writeJobs[stack] = undefined;
+            }
+            stackGet(stack, function(err, st) {
+                if (err) {
+                    finish(err);
+                    return;
+                }
+                function write(io) {
+                    bus.writeWord(st.hwAdd, OUT_REG, io, function(err) {
+                        if (!err) {
+                            st.io = io;
+                        }
+                        finish(err);
+                    });
+                }
+                if ((job.set | job.clr) == 0xffff) {
+                    write(job.set);
+                    return;
+                }
+                stackRead(st, true, function(err, io) {
+                    if (err) {
+                        finish(err);
+                    } else {
+                        write((io & ~job.clr) | job.set);
+                    }
+                });
+            });
+        });
+    }
+
+    // One OUT_REG read for all the read requests queued for the stack level
+    function stackReadQueued(stack, done) {
+        var job = readJobs[stack];
+        queued++;
+        if (job !== undefined) {
+            job.done.push(done);
+            return;
+        }
+        job = {done: [done]};
+        readJobs[stack] = job;
+        writeJobs[stack] = undefined;
+        busQueue(function(next) {
+            function finish(err, io) {
+                if (err) {
+                    stackInvalidate(stack);
+                }
+                queued -= job.done.length;
+                job.done.forEach(function(cb) { cb(err, io); });
+                next();
+            }
+            if (readJobs[stack] === job) {
+                readJobs[stack] = undefined;
+            }
+            stackGet(stack, function(err, st) {
+                if (err) {
+                    finish(err);
+                } else {
+                    // always from the board, the relays may change outside Node-RED
+                    stackRead(st, false, finish);
+                }
+            });
+        });
+    }
+
+    // queue depth and latency of the last message, at most every STATUS_MS
+    function nodeStatus(node, start) {
+        node.latency = Date.now() - start;
+        if (node.statusTimer != null) {
+            return;
+        }
+        node.statusTimer = setTimeout(function() {
+            node.statusTimer = null;
+            node.status({fill:"green",shape:"dot",text:"queue " + queued + ", " + node.latency + "ms"});
+        }, STATUS_MS);
+    }
+
+    function stackParse(stack) {
+        stack = parseInt(stack);
+        if(stack < 0){
+            stack = 0;
+        }
+        if(stack > 7){
+          stack = 7;
+        }
+        return stack;
+    }
+
     // The relay Node
     function RelayNode(n) {
         RED.nodes.createNode(this, n);
@@ -30,52 +298,21 @@ module.exports = function(RED) {
         this.payload = n.payload;
         this.payloadType = n.payloadType;
         var node = this;
-		var buffer = Buffer.alloc(2);
- 
-        node.port = I2C.openSync( 1 );
+
+        busOpen();
         node.on("input", function(msg) {
             var myPayload;
+            var start = Date.now();
+            var updates = [];
+            var pending;
+            var failed = false;
+            var i;
             var stack = node.stack;
             if (isNaN(stack)) stack = msg.stack;
             stack = parseInt(stack);
-            var relay = msg.relay; // 
+            var relay = msg.relay; //
             if (isNaN(relay)) relay = node.relay;
             relay = parseInt(relay);
-            //var buffcount = parseInt(node.count);
-            if (isNaN(stack + 1)) {
-                this.status({fill:"red",shape:"ring",text:"Stack level ("+stack+") value is missing or incorrect"});
-                return;
-            } else if (isNaN(relay) ) {
-                this.status({fill:"red",shape:"ring",text:"Relay number  ("+relay+") value is missing or incorrect"});
-                return;
-            } else {
-                this.status({});
-            }
-            var hwAdd = DEFAULT_HW_ADD;
-            var found = 1;
-            if(stack < 0){
-                stack = 0;
-            }
-            if(stack > 7){
-              stack = 7;
-            }
-            //check the type of io_expander
-            hwAdd += stack ^ 0x07;
-            var direction = 0xaa;
-            try{
-                direction = node.port.readWordSync(hwAdd, CFG_REG );
-            }catch(err) {
-                hwAdd = ALTERNATE_HW_ADD;
-                hwAdd += stack ^ 0x07;
-                try{
-                    direction = node.port.readWordSync(hwAdd, CFG_REG );
-                }catch(err) {
-                    found = 0;
-                    this.error(err,msg);
-                }
-            }
-            
-            if(1 == found){
             try {
                 if (this.payloadType == null) {
                     myPayload = this.payload;
@@ -84,56 +321,75 @@ module.exports = function(RED) {
                 } else {
                     myPayload = RED.util.evaluateNodeProperty(this.payload, this.payloadType, this,msg);
                 }
-                //node.log('Direction ' + String(direction));   
-                if(direction != 0x00){
-					
-                    node.port.writeWordSync(hwAdd, OUT_REG, 0x00);
-                    //node.log('First update output');   
-                    node.port.writeWordSync(hwAdd, CFG_REG, 0x00);
-                    //node.log('First update direction');  
-                }
-                var relayVal = 0;    
-                
-                //node.log('Relays ' + String(relayVal));
+            } catch(err) {
+                this.error(err,msg);
+                return;
+            }
+            if (myPayload != null && typeof myPayload == 'object') {
+                // several stack levels: {"<stack>": <relays>, "<stack>": {mask: <relays>, value: <states>}}
+                var keys = Object.keys(myPayload);
+                for (i = 0; i < keys.length; i++) {
+                    var val = myPayload[keys[i]];
+                    if (!/^[0-7]$/.test(keys[i])) {
+                        this.status({fill:"red",shape:"ring",text:"Stack level ("+keys[i]+") value is missing or incorrect"});
+                        return;
+                    }
+                    if (val != null && typeof val == 'object') {
+                        updates.push({stack: parseInt(keys[i]), mask: parseInt(val.mask), value: parseInt(val.value)});
+                    } else {
+                        updates.push({stack: parseInt(keys[i]), mask: 0xffff, value: parseInt(val)});
+                    }
+                }
+            } else if (isNaN(stack + 1)) {
+                this.status({fill:"red",shape:"ring",text:"Stack level ("+stack+") value is missing or incorrect"});
+                return;
+            } else if (msg.relayMask !== undefined) {
+                // several relays: the ones in msg.relayMask take the states of msg.payload
+                updates.push({stack: stackParse(stack), mask: parseInt(msg.relayMask), value: parseInt(myPayload)});
+            } else if (isNaN(relay) ) {
+                this.status({fill:"red",shape:"ring",text:"Relay number  ("+relay+") value is missing or incorrect"});
+                return;
+            } else {
                 if(relay < 0){
                   relay = 0;
                 }
                 if(relay > 16){
                   relay = 16;
                 }
-                if(relay > 0)
-                {
-                  relayVal = node.port.readWordSync(hwAdd, OUT_REG);
-                  relay-= 1;//zero based
-                  if (myPayload == null || myPayload == false || myPayload == 0 || myPayload == 'off') {
-                    relayVal &= ~mask[relay];
-                  } else {
-                    relayVal |= mask[relay];
-                  }
-                }
-                else if(myPayload >= 0 && myPayload < 65536)
-                {
-                  var i = 0; 
-                  for(i = 0; i<16; i++){
-                    if(( (1 << i) & myPayload) != 0){
-                        relayVal |= mask[i];
-                    }                   
-                  }
-                }
-                node.port.writeWord(hwAdd, OUT_REG, relayVal,  function(err) {
-                    if (err) { node.error(err, msg);
-                    } else {
-                      node.send(msg);
+                if (relay > 0) {
+                    var on = !(myPayload == null || myPayload == false || myPayload == 0 || myPayload == 'off');
+                    updates.push({stack: stackParse(stack), mask: 1 << (relay - 1), value: on ? 0xffff : 0});
+                } else {
+                    updates.push({stack: stackParse(stack), mask: 0xffff, value: (myPayload >= 0 && myPayload < 65536) ? myPayload : 0});
+                }
+            }
+            for (i = 0; i < updates.length; i++) {
+                if (isNaN(updates[i].mask) || isNaN(updates[i].value) || updates[i].mask < 0 || updates[i].mask > 0xffff) {
+                    this.status({fill:"red",shape:"ring",text:"Relay mask or value of stack " + updates[i].stack + " is incorrect"});
+                    return;
+                }
+            }
+            // the message goes on once all its stack levels are written
+            pending = updates.length;
+            updates.forEach(function(up) {
+                var set = toIO(up.mask & up.value);
+                var clr = toIO(up.mask & ~up.value);
+                stackWrite(up.stack, set, clr, function(err) {
+                    if (err && !failed) {
+                        failed = true;
+                        node.error(err, msg);
+                    }
+                    if (--pending == 0 && !failed) {
+                        nodeStatus(node, start);
+                        node.send(msg);
                     }
                 });
-            } catch(err) {
-                this.error(err,msg);
-            }
-          }
+            });
         });
 
         node.on("close", function() {
-            node.port.closeSync();
+            clearTimeout(node.statusTimer);
+            busClose();
         });
     }
     RED.nodes.registerType("16relind", RelayNode);
@@ -146,10 +402,10 @@ module.exports = function(RED) {
         this.payload = n.payload;
         this.payloadType = n.payloadType;
         var node = this;
- 
-        node.port = I2C.openSync( 1 );
+
+        busOpen();
         node.on("input", function(msg) {
-            var myPayload;
+            var start = Date.now();
             var stack = node.stack;
             if (isNaN(stack)) stack = msg.stack;
             stack = parseInt(stack);
@@ -163,89 +419,31 @@ module.exports = function(RED) {
             } else if (isNaN(relay) ) {
                 this.status({fill:"red",shape:"ring",text:"Relay number  ("+relay+") value is missing or incorrect"});
                 return;
-            } else {
-                this.status({});
-            }
-            var hwAdd = DEFAULT_HW_ADD;
-            var found = 1;
-            if(stack < 0){
-                stack = 0;
-            }
-            if(stack > 7){
-              stack = 7;
-            }
-            //check the type of io_expander
-            hwAdd += stack ^ 0x07;
-            var direction = 0xaa;
-            try{
-                direction = node.port.readWordSync(hwAdd, CFG_REG );
-            }catch(err) {
-                hwAdd = ALTERNATE_HW_ADD;
-                hwAdd += stack ^ 0x07;
-                try{
-                    direction = node.port.readWordSync(hwAdd, CFG_REG );
-                }catch(err) {
-                    found = 0;
-                    this.error(err,msg);
-                }
-            }
-            
-            if(1 == found){
-            try {
-                if (this.payloadType == null) {
-                    myPayload = this.payload;
-                } else if (this.payloadType == 'none') {
-                    myPayload = null;
-                } else {
-                    myPayload = RED.util.evaluateNodeProperty(this.payload, this.payloadType, this,msg);
-                }
-                
-                if(direction != 0x00){
-                    node.port.writeWordSync(hwAdd, OUT_REG, 0x00);
-                     
-                    node.port.writeWordSync(hwAdd, CFG_REG, 0x00);
-                }
-                var relayVal = 0;    
-                relayVal = node.port.readWordSync(hwAdd, OUT_REG);
-                if(relay < 0){
-                  relay = 0;
+            }
+            if(relay < 0){
+              relay = 0;
+            }
+            if(relay > 16){
+              relay = 16;
+            }
+            stackReadQueued(stackParse(stack), function(err, relayVal) {
+                if (err) {
+                    node.error(err, msg);
+                    return;
                 }
-                if(relay > 16){
-                  relay = 16;
+                if (relay > 0) {
+                  msg.payload = (relayVal & mask[relay - 1]) ? 1 : 0;
+                } else {
+                  msg.payload = fromIO(relayVal);
                 }
-                if(relay > 0){
-                  relay-= 1;//zero based
-                  if(relayVal & mask[relay])
-                  {
-                    msg.payload = 1;
-                  }
-                  else
-                  {
-                    msg.payload = 0;
-                  }
-                }
-                else {
-                  var i;
-                  var outVal;
-                  outVal = 0;
-                  for(i = 0; i< 16; i++)
-                  {
-                    if( relayVal & mask[i])
-                    {
-                      outVal += 1 << i;
-                    }
-                  }
-                  msg.payload = outVal;                 
-                }               
-                node.send(msg);               
-            } catch(err) {
-                this.error(err,msg);
-            }
-          }
+                nodeStatus(node, start);
+                node.send(msg);
+            });
         });
 
         node.on("close", function() {
-            node.port.closeSync();
+            clearTimeout(node.statusTimer);
+            busClose();
         });
     }
     RED.nodes.registerType("16relindrd", RelayReadNode);
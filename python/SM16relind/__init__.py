@@ -1,6 +1,13 @@
-import smbus2
+try:
+    import smbus2
+except ImportError:
+    smbus2 = None
+try:
+    from . import _c16relind
+except ImportError:
+    _c16relind = None
 
-__version__ = "1.0.5"
+__version__ = "1.0.6"
 _CARD_BASE_ADDRESS = 0x20
 _INPORT_REG_ADD = 0x00
 _OUTPORT_REG_ADD = 0x02
@@ -8,17 +15,43 @@ _POLINV_REG_ADD = 0x04
 _CFG_REG_ADD = 0x06
 _STACK_LEVEL_MAX = 7
 _RELAY_COUNT = 16
+_RELAY_MASK_ALL = 0xffff
 
 relayMaskRemap =[0x8000, 0x4000, 0x2000, 0x1000, 0x800,	0x400, 0x200, 0x100, 0x80, 0x40, 0x20, 0x10, 0x8, 0x4, 0x2,0x1]
 
 relayChRemap = [15,	14,	13,	12,	11,	10,	9,	8,	7,	6,	5,	4,	3,	2,	1,	0]
 
+# the expander pins are the relays in reverse order: one lookup per byte
+_bitReverse = [int('{:08b}'.format(i)[::-1], 2) for i in range(256)]
+
 class SM16relind:
-    def __init__(self, stack = 0, i2c = 1):
+    """
+    16 relays card on stack level [0..7] of the I2C port i2c.
+    backend: "c" for the compiled lib16relind backend (the card stays open
+    until close()), "smbus" for smbus2, "auto" for "c" when it was built.
+    keep_open: with smbus2, keep the I2C port open until close() instead of
+    opening it for every call. Used as a context manager the card is kept
+    open inside the with block.
+    """
+    def __init__(self, stack = 0, i2c = 1, keep_open = False, backend = "auto"):
         if stack < 0 or stack > _STACK_LEVEL_MAX:
             raise ValueError('Invalid stack level!')
+        if backend not in ("auto", "c", "smbus"):
+            raise ValueError('Invalid backend!')
+        if backend == "c" and _c16relind is None:
+            raise ImportError('The compiled backend is not built')
         self._hw_address_ = _CARD_BASE_ADDRESS + (0x07 ^ stack)
         self._i2c_bus_no = i2c
+        self._bus = None
+        self._board = None
+        if backend == "c" or (backend == "auto" and _c16relind is not None):
+            try:
+                self._board = _c16relind.Board(stack, i2c)
+            except Exception as e:
+                raise Exception("Fail to init the card with exception " + str(e))
+            return
+        if smbus2 is None:
+            raise ImportError('smbus2 is needed without the compiled backend')
         bus = smbus2.SMBus(self._i2c_bus_no)
         try:
             val = bus.read_word_data(self._hw_address_, _CFG_REG_ADD)
@@ -29,74 +62,131 @@ class SM16relind:
         except Exception as e:
             bus.close()
             raise Exception("Fail to init the card with exception " + str(e))
-        bus.close()
+        if keep_open:
+            self._bus = bus
+        else:
+            bus.close()
+
+    def __enter__(self):
+        self.open()
+        return self
+
+    def __exit__(self, exc_type, exc_value, traceback):
+        self.close()
+
+    def __del__(self):
+        try:
+            self.close()
+        except Exception:
+            pass
+
+    def open(self):
+        """Keep the I2C port open until close(), or open the compiled backend
+        handle again after close()"""
+        if self._board is not None:
+            self._board.open()
+        elif self._bus is None:
+            self._bus = smbus2.SMBus(self._i2c_bus_no)
+
+    def close(self):
+        """Release the I2C port or the compiled backend handle"""
+        if self._bus is not None:
+            self._bus.close()
+            self._bus = None
+        if self._board is not None:
+            # the calls fail until open()
+            self._board.close()
+
+    def _access(self, op, what):
+        bus = self._bus
+        if bus is None:
+            bus = smbus2.SMBus(self._i2c_bus_no)
+        try:
+            return op(bus)
+        except Exception as e:
+            raise Exception("Fail " + what + " with exception " + str(e))
+        finally:
+            if bus is not self._bus:
+                bus.close()
+
+    def _update(self, mask, val):
+        # the relays in mask take the states in val, one write if all are given
+        mask &= _RELAY_MASK_ALL
+        val &= mask
+        def op(bus):
+            if mask == _RELAY_MASK_ALL:
+                newVal = val
+            else:
+                oldVal = IOToRelay(bus.read_word_data(self._hw_address_, _OUTPORT_REG_ADD))
+                newVal = (oldVal & ~mask) | val
+            bus.write_word_data(self._hw_address_, _OUTPORT_REG_ADD, relayToIO(newVal))
+        self._access(op, "set relay")
 
     def set(self, relay, state):
         if relay < 1 or relay > _RELAY_COUNT:
             raise ValueError('Invalid relay number!')
-        bus = smbus2.SMBus(self._i2c_bus_no)
-        try:
-            oldVal = bus.read_word_data(self._hw_address_, _OUTPORT_REG_ADD)
-            oldVal =IOToRelay(oldVal)
-            if state == 0:
-                oldVal = oldVal & (~(1 << (relay - 1)))
-            else:
-                oldVal = oldVal | (1 << (relay - 1))
-            oldVal = relayToIO(oldVal)
-            bus.write_word_data(self._hw_address_, _OUTPORT_REG_ADD, oldVal)
-        except Exception as e:
-            bus.close()
-            raise Exception("Fail set relay with exception " + str(e))
-        bus.close()
+        if self._board is not None:
+            self._board.set(relay, state)
+            return
+        bit = 1 << (relay - 1)
+        self._update(bit, 0 if state == 0 else bit)
 
     def set_all(self, val):
-        bus = smbus2.SMBus(self._i2c_bus_no)
-        val = relayToIO(val)
-        try:
-            bus.write_word_data(self._hw_address_, _OUTPORT_REG_ADD, val)
-        except Exception as e:
-            bus.close()
-            raise Exception("Fail set relay with exception " + str(e))
-        bus.close()
+        if self._board is not None:
+            self._board.set_all(val)
+            return
+        self._update(_RELAY_MASK_ALL, val)
+
+    def set_mask(self, mask, val):
+        """The relays in mask (bit 0 = relay 1) take the states of the same bits in val"""
+        if mask < 0 or mask > _RELAY_MASK_ALL or val < 0 or val > _RELAY_MASK_ALL:
+            raise ValueError('Invalid relay mask or value!')
+        if self._board is not None:
+            self._board.set_mask(mask, val)
+            return
+        self._update(mask, val)
+
+    def set_many(self, states):
+        """
+        Several relays with one write: states is a dict {relay: state} or a
+        list of (relay, state) pairs, relay [1..16], state 0 = off else on
+        """
+        if isinstance(states, dict):
+            states = states.items()
+        mask = 0
+        val = 0
+        for relay, state in states:
+            if relay < 1 or relay > _RELAY_COUNT:
+                raise ValueError('Invalid relay number!')
+            bit = 1 << (relay - 1)
+            mask |= bit
+            if state == 0:
+                val &= ~bit
+            else:
+                val |= bit
+        if mask != 0:
+            self.set_mask(mask, val)
 
     def get(self, relay):
         if relay < 1 or relay > _RELAY_COUNT:
             raise ValueError('Invalid relay number!')
-        bus = smbus2.SMBus(self._i2c_bus_no)
-        try:
-            oldVal = bus.read_word_data(self._hw_address_, _OUTPORT_REG_ADD)
-        except Exception as e:
-            bus.close()
-            raise Exception("Fail set relay with exception " + str(e))
-        bus.close()
-        oldVal = IOToRelay(oldVal)
-        if (1 << (relay - 1)) & oldVal :
+        if self._board is not None:
+            return self._board.get(relay)
+        if (1 << (relay - 1)) & self.get_all() :
             return 1
         return 0
 
     def get_all(self):
-        bus = smbus2.SMBus(self._i2c_bus_no)
-        try:
-            oldVal = bus.read_word_data(self._hw_address_, _OUTPORT_REG_ADD)
-        except Exception as e:
-            bus.close()
-            raise Exception("Fail set relay with exception " + str(e))
-        bus.close()
-        oldVal = IOToRelay(oldVal)
-        return oldVal
+        if self._board is not None:
+            return self._board.get_all()
+        oldVal = self._access(lambda bus: bus.read_word_data(self._hw_address_, _OUTPORT_REG_ADD),
+                              "get relay")
+        return IOToRelay(oldVal)
 
 
 def relayToIO(relay):
-    val = 0
-    for i in range(0, _RELAY_COUNT):
-        if (relay & (1 << i)) != 0:
-            val = val + relayMaskRemap[i]
-    return val
+    return (_bitReverse[relay & 0xff] << 8) | _bitReverse[(relay >> 8) & 0xff]
 
 
 def IOToRelay(iov):
-    val = 0
-    for i in range(0, _RELAY_COUNT):
-        if (iov & relayMaskRemap[i]) != 0:
-            val = val + (1 << i)
-    return val
+    return (_bitReverse[iov & 0xff] << 8) | _bitReverse[(iov >> 8) & 0xff]
@@ -0,0 +1,353 @@
+/*
+ * _c16relind.c:
+ *	Optional compiled backend of the SM16relind package: a board handle of the
+ *	C library (lib16relind), kept open between the calls. Every call takes the
+ *	bus lock shared with the 16relind tool, the simulator (RELAY16_SIM) of the
+ *	library applies. The GIL is released during the bus transactions.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "lib16relind.h"
+
+/*
+ * The board handle is shared by the object and the calls running without the
+ * GIL, the last one to let it go closes it. The counter is changed with the
+ * GIL held.
+ */
+typedef struct
+{
+	Relay16Board *board;
+	int refs;
+} HandleType;
+
+typedef struct
+{
+	PyObject_HEAD
+	HandleType *h;
+	int stack;
+	int bus;
+} BoardObject;
+
+static PyObject* boardError(int ret)
+{
+	if (ret == RELAY16_ERR_PARAM)
+	{
+		PyErr_SetString(PyExc_ValueError, relay16StrError(ret));
+	}
+	else
+	{
+		PyErr_SetString(PyExc_OSError, relay16StrError(ret));
+	}
+	return NULL;
+}
+
+static HandleType* handleTake(BoardObject *self)
+{
+	if (self->h == NULL)
+	{
+		PyErr_SetString(PyExc_ValueError, "board closed");
+		return NULL;
+	}
+	self->h->refs++;
+	return self->h;
+}
+
+static void handleGive(HandleType *h)
+{
+	if ( (h != NULL) && (--h->refs == 0))
+	{
+		relay16Close(h->board);
+		PyMem_Free(h);
+	}
+}
+
+static int boardOpen(BoardObject *self)
+{
+	Relay16Board *board = NULL;
+	HandleType *h;
+	int ret;
+
+	h = PyMem_Malloc(sizeof(HandleType));
+	if (h == NULL)
+	{
+		PyErr_NoMemory();
+		return -1;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = relay16OpenBus(self->bus, self->stack, &board);
+	Py_END_ALLOW_THREADS
+	if (ret != RELAY16_OK)
+	{
+		PyMem_Free(h);
+		boardError(ret);
+		return -1;
+	}
+	h->board = board;
+	h->refs = 1;
+	handleGive(self->h);
+	self->h = h;
+	return 0;
+}
+
+static int boardInit(BoardObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"stack", "i2c", NULL};
+	int stack = 0;
+	int bus = RELAY16_BUS_DEFAULT;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwlist, &stack, &bus))
+	{
+		return -1;
+	}
+	self->stack = stack;
+	self->bus = bus;
+	return boardOpen(self);
+}
+
+static void boardDealloc(BoardObject *self)
+{
+	handleGive(self->h);
+	Py_TYPE(self)->tp_free((PyObject*)self);
+}
+
+static PyObject* boardClose(BoardObject *self, PyObject *unused)
+{
+	HandleType *h = self->h;
+
+	(void)unused;
+	// closed now, or by the last call still running in another thread
+	self->h = NULL;
+	handleGive(h);
+	Py_RETURN_NONE;
+}
+
+static PyObject* boardReopen(BoardObject *self, PyObject *unused)
+{
+	(void)unused;
+	if ( (self->h == NULL) && (boardOpen(self) != 0))
+	{
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* boardSet(BoardObject *self, PyObject *args)
+{
+	HandleType *h;
+	int relay;
+	int state;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "ii", &relay, &state))
+	{
+		return NULL;
+	}
+	h = handleTake(self);
+	if (h == NULL)
+	{
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = relay16Lock();
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16ChSet(h->board, relay, state ? 1 : 0);
+		relay16Unlock();
+	}
+	Py_END_ALLOW_THREADS
+	handleGive(h);
+	if (ret != RELAY16_OK)
+	{
+		return boardError(ret);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* boardSetAll(BoardObject *self, PyObject *args)
+{
+	HandleType *h;
+	unsigned int val;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "I", &val))
+	{
+		return NULL;
+	}
+	if (val > 0xffff)
+	{
+		return boardError(RELAY16_ERR_PARAM);
+	}
+	h = handleTake(self);
+	if (h == NULL)
+	{
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = relay16Lock();
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16Set(h->board, (uint16_t)val);
+		relay16Unlock();
+	}
+	Py_END_ALLOW_THREADS
+	handleGive(h);
+	if (ret != RELAY16_OK)
+	{
+		return boardError(ret);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* boardSetMask(BoardObject *self, PyObject *args)
+{
+	HandleType *h;
+	unsigned int mask;
+	unsigned int val;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "II", &mask, &val))
+	{
+		return NULL;
+	}
+	if ( (mask > 0xffff) || (val > 0xffff))
+	{
+		return boardError(RELAY16_ERR_PARAM);
+	}
+	h = handleTake(self);
+	if (h == NULL)
+	{
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = relay16Lock();
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16MaskApply(h->board, (uint16_t)mask, (uint16_t)val);
+		relay16Unlock();
+	}
+	Py_END_ALLOW_THREADS
+	handleGive(h);
+	if (ret != RELAY16_OK)
+	{
+		return boardError(ret);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* boardGet(BoardObject *self, PyObject *args)
+{
+	HandleType *h;
+	int relay;
+	int state = 0;
+	int ret;
+
+	if (!PyArg_ParseTuple(args, "i", &relay))
+	{
+		return NULL;
+	}
+	h = handleTake(self);
+	if (h == NULL)
+	{
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = relay16Lock();
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16ChGet(h->board, relay, &state);
+		relay16Unlock();
+	}
+	Py_END_ALLOW_THREADS
+	handleGive(h);
+	if (ret != RELAY16_OK)
+	{
+		return boardError(ret);
+	}
+	return PyLong_FromLong(state);
+}
+
+static PyObject* boardGetAll(BoardObject *self, PyObject *unused)
+{
+	HandleType *h;
+	uint16_t val = 0;
+	int ret;
+
+	(void)unused;
+	h = handleTake(self);
+	if (h == NULL)
+	{
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = relay16Lock();
+	if (ret == RELAY16_OK)
+	{
+		ret = relay16Get(h->board, &val);
+		relay16Unlock();
+	}
+	Py_END_ALLOW_THREADS
+	handleGive(h);
+	if (ret != RELAY16_OK)
+	{
+		return boardError(ret);
+	}
+	return PyLong_FromLong(val);
+}
+
+static PyMethodDef boardMethods[] = {
+	{"close", (PyCFunction)boardClose, METH_NOARGS, "Close the board"},
+	{"open", (PyCFunction)boardReopen, METH_NOARGS, "Open the board again after close()"},
+	{"set", (PyCFunction)boardSet, METH_VARARGS, "set(relay, state)"},
+	{"set_all", (PyCFunction)boardSetAll, METH_VARARGS, "set_all(val)"},
+	{"set_mask", (PyCFunction)boardSetMask, METH_VARARGS,
+		"set_mask(mask, val): the relays in mask take the states in val"},
+	{"get", (PyCFunction)boardGet, METH_VARARGS, "get(relay)"},
+	{"get_all", (PyCFunction)boardGetAll, METH_NOARGS, "get_all()"},
+	{NULL, NULL, 0, NULL}};
+
+static PyTypeObject BoardType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "SM16relind._c16relind.Board",
+	.tp_basicsize = sizeof(BoardObject),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Board(stack=0, i2c=1): 16 relays card opened with lib16relind",
+	.tp_new = PyType_GenericNew,
+	.tp_init = (initproc)boardInit,
+	.tp_dealloc = (destructor)boardDealloc,
+	.tp_methods = boardMethods,
+};
+
+static struct PyModuleDef c16relindModule = {
+	PyModuleDef_HEAD_INIT,
+	.m_name = "_c16relind",
+	.m_doc = "lib16relind backend of SM16relind",
+	.m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit__c16relind(void)
+{
+	PyObject *m;
+
+	if (PyType_Ready(&BoardType) < 0)
+	{
+		return NULL;
+	}
+	m = PyModule_Create(&c16relindModule);
+	if (m == NULL)
+	{
+		return NULL;
+	}
+	Py_INCREF(&BoardType);
+	if (PyModule_AddObject(m, "Board", (PyObject*)&BoardType) < 0)
+	{
+		Py_DECREF(&BoardType);
+		Py_DECREF(m);
+		return NULL;
+	}
+	return m;
+}
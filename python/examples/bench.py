@@ -0,0 +1,39 @@
+#!/usr/bin/env python3
+# Operations per second of the SM16relind backends.
+# On a PC set RELAY16_SIM=boards=0 to run the compiled backend on the simulator.
+# Usage: python3 bench.py [<stack> [<iterations>]]
+import sys
+import time
+import SM16relind
+
+stack = int(sys.argv[1]) if len(sys.argv) > 1 else 0
+count = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+
+
+def rate(name, op):
+    start = time.perf_counter()
+    for i in range(count):
+        op(i)
+    elapsed = time.perf_counter() - start
+    print("  %-22s %8.0f ops/s %7.1f us/op" % (name, count / elapsed, elapsed * 1e6 / count))
+
+
+def run(title, **kwargs):
+    try:
+        rel = SM16relind.SM16relind(stack, **kwargs)
+    except Exception as e:
+        print(title + ": not available (" + str(e) + ")")
+        return
+    print(title + ":")
+    with rel:
+        rate("set(relay, state)", lambda i: rel.set(i % 16 + 1, i & 1))
+        rate("set_many(4 relays)", lambda i: rel.set_many({1: i & 1, 2: 1, 3: 0, 4: i & 1}))
+        rate("set_mask(mask, val)", lambda i: rel.set_mask(0x00ff, i & 0xff))
+        rate("set_all(val)", lambda i: rel.set_all(i & 0xffff))
+        rate("get_all()", lambda i: rel.get_all())
+        rel.set_all(0)
+
+
+run("smbus2, open per call", backend="smbus")
+run("smbus2, kept open", backend="smbus", keep_open=True)
+run("compiled backend", backend="c")
@@ -12,11 +12,25 @@
 with open("README.md", 'r') as f:
     long_description = f.read()
 
-from setuptools import setup, find_packages
+import os
+from setuptools import setup, find_packages, Extension
+
+# optional compiled backend on the C library of ../src, skipped if it fails to build
+_LIB_DIR = os.path.join('..', 'src')
+_LIB_SRC = ['lib16relind.c', 'comm.c', 'lock.c', 'discovery.c', 'worker.c', 'sim.c', 'trace.c', 'pulse.c', 'rtu.c']
+ext_modules = []
+if all(os.path.exists(os.path.join(_LIB_DIR, f)) for f in _LIB_SRC):
+    ext_modules.append(Extension('SM16relind._c16relind',
+        sources=['SM16relind/_c16relind.c'] + [os.path.join(_LIB_DIR, f) for f in _LIB_SRC],
+        include_dirs=[_LIB_DIR],
+        libraries=['pthread', 'rt'],
+        optional=True))
+
 setup(
     name='sm16relind',
     packages=find_packages(),
-    version='1.0.4',
+    ext_modules=ext_modules,
+    version='1.0.6',
     license='MIT',
     description='Library to control Multi-IO Automation Card',
     long_description=long_description,
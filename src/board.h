@@ -0,0 +1,54 @@
+#ifndef BOARD_H_
+#define BOARD_H_
+
+#include <pthread.h>
+
+#include "lib16relind.h"
+
+#define SHADOW_OUT		0
+#define SHADOW_FS_EN	1
+#define SHADOW_FS_VAL	2
+#define SHADOW_COUNT	3
+
+#define CACHE_RESYNC_DEFAULT_MS	1000
+#define VERIFY_SIZE_MAX			8	/* bytes written by one verified write */
+#define SNAPSHOT_BLOCK_MAX		32	/* bytes read by one transfer, one less written */
+#define VERIFY_BACKOFF_MAX_US	1000000
+
+typedef struct
+{
+	uint16_t val; /* expander bit order */
+	int valid;
+	uint64_t stampMs;
+} ShadowRegType;
+
+/*
+ * Board handle layout, private to the library modules
+ */
+struct Relay16Board
+{
+	int bus;
+	int stack;
+	int add;
+	int dev;
+	pthread_mutex_t lock;
+	Relay16CachePolicyType cachePolicy;
+	unsigned int cacheResyncMs;
+	ShadowRegType shadow[SHADOW_COUNT];
+	Relay16CacheStatsType cacheStats;
+	Relay16VerifyCfgType verify;
+	Relay16VerifyStatsType verifyStats;
+	uint32_t coalesceUs;
+	uint16_t coalesceSet; /* pending changes, expander bit order */
+	uint16_t coalesceClr;
+	int coalesceCount; /* changes pending */
+	int coalesceScheduled; /* window end in the pulse timer heap */
+	Relay16CoalesceStatsType coalesceStats;
+};
+
+uint64_t boardTimeMs(void);
+int boardMaskUpdate(Relay16Board *b, int idx, uint16_t set, uint16_t clr);
+int pulseFlushAfter(Relay16Board *b, uint32_t delayUs);
+void pulseDetach(Relay16Board *b);
+
+#endif //BOARD_H_
@@ -0,0 +1,191 @@
+/*
+ * client.c:
+ *	Thin client for the 16relind daemon. A request is one text line holding
+ *	the command arguments (without the program name, quoted as cliSplit
+ *	reads them), the answer is the command output terminated by a '\0' byte.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define _GNU_SOURCE /* secure_getenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "client.h"
+
+const char* clientSocketPath(void)
+{
+	const char *path = secure_getenv("RELAY16_SOCK");
+
+	if ( (path == NULL) || (path[0] == 0))
+	{
+		return DAEMON_SOCKET_PATH;
+	}
+	return path;
+}
+
+int clientConnect(const char* path)
+{
+	int sock;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		return -1;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/*
+ * clientRequest:
+ *	Send one command line and copy the answer to out (if not NULL)
+ *********************************************************************************
+ */
+int clientRequest(int sock, const char* line, FILE* out)
+{
+	char buff[DAEMON_LINE_MAX];
+	int len = strlen(line);
+	int n;
+	int i;
+
+	if ( (len == 0) || (len >= DAEMON_LINE_MAX - 1))
+	{
+		return -1;
+	}
+	memcpy(buff, line, len);
+	if (buff[len - 1] != '\n')
+	{
+		buff[len++] = '\n';
+	}
+	if (write(sock, buff, len) != len)
+	{
+		return -1;
+	}
+	while ( (n = read(sock, buff, sizeof(buff))) > 0)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (buff[i] == DAEMON_RESP_END)
+			{
+				if (out)
+				{
+					fwrite(buff, 1, i, out);
+				}
+				return 0;
+			}
+		}
+		if (out)
+		{
+			fwrite(buff, 1, n, out);
+		}
+	}
+	return -1;
+}
+
+static int lineAdd(char* line, int size, int *len, char c)
+{
+	if (*len >= size - 1)
+	{
+		return -1;
+	}
+	line[(*len)++] = c;
+	line[*len] = 0;
+	return 0;
+}
+
+/*
+ * clientLine:
+ *	Request line of the command arguments, without the program name. An empty
+ *	argument or one with blanks, quotes, backslashes or '#' is written between
+ *	double quotes, with \" and \\ for the quotes and backslashes in it
+ *********************************************************************************
+ */
+int clientLine(int argc, char* argv[], char* line, int size)
+{
+	const char *p;
+	int quote;
+	int len = 0;
+	int ret;
+	int i;
+
+	line[0] = 0;
+	for (i = 1; i < argc; i++)
+	{
+		if (strpbrk(argv[i], "\r\n") != NULL)
+		{
+			return -1; // the request is one line
+		}
+		quote = (argv[i][0] == 0) || (strpbrk(argv[i], " \t\"\\#") != NULL);
+		ret = i > 1 ? lineAdd(line, size, &len, ' ') : 0;
+		if (quote)
+		{
+			ret |= lineAdd(line, size, &len, '"');
+		}
+		for (p = argv[i]; (ret == 0) && (*p != 0); p++)
+		{
+			if (quote && ( (*p == '"') || (*p == '\\')))
+			{
+				ret = lineAdd(line, size, &len, '\\');
+			}
+			ret |= lineAdd(line, size, &len, *p);
+		}
+		if (quote)
+		{
+			ret |= lineAdd(line, size, &len, '"');
+		}
+		if (ret != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * clientForward:
+ *	Run the command through the daemon if one is listening.
+ *	Return -1 if no daemon is available and the command must run locally
+ *********************************************************************************
+ */
+int clientForward(int argc, char* argv[])
+{
+	char line[DAEMON_LINE_MAX];
+	int sock;
+	int ret;
+
+	if ( (secure_getenv("RELAY16_NODAEMON") != NULL)
+		|| (clientLine(argc, argv, line, sizeof(line)) != 0))
+	{
+		return -1;
+	}
+	sock = clientConnect(clientSocketPath());
+	if (sock < 0)
+	{
+		return -1;
+	}
+	ret = clientRequest(sock, line, stdout);
+	close(sock);
+	if (ret != 0)
+	{
+		printf("Lost connection with 16relind daemon\n");
+	}
+	return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef CLIENT_H_
+#define CLIENT_H_
+
+#include <stdio.h>
+
+#define DAEMON_SOCKET_PATH	"/run/16relind.sock"
+#define DAEMON_LINE_MAX		1024
+#define DAEMON_RESP_END		'\0'
+
+const char* clientSocketPath(void);
+int clientConnect(const char* path);
+int clientLine(int argc, char* argv[], char* line, int size);
+int clientRequest(int sock, const char* line, FILE* out);
+int clientForward(int argc, char* argv[]);
+
+#endif //CLIENT_H_
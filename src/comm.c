@@ -8,14 +8,21 @@
  *	Author: Alexandru Burcea
  ***********************************************************************
  */
+#define _GNU_SOURCE /* secure_getenv */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include "comm.h"
+#include "sim.h"
+#include "rtu.h"
+#include "trace.h"
 
 #define I2C_SLAVE	0x0703
 #define I2C_SMBUS	0x0720	/* SMBus-level access */
@@ -40,40 +47,231 @@
 #define I2C_SMBUS_BLOCK_MAX	32	/* As specified in SMBus standard */
 #define I2C_SMBUS_I2C_BLOCK_MAX	32	/* Not specified but we use same structure */
 
+// slave address and adapter functionality for every file descriptor opened by i2cSetup
+#define I2C_DEV_MAX	256
 
-int i2cSetup(int addr)
+typedef struct
+{
+	uint16_t add;
+	uint8_t mode;
+} I2cDevType;
+
+static I2cDevType gDev[I2C_DEV_MAX];
+static int gMode = I2C_MODE_AUTO;
+
+static int devMode(unsigned long funcs)
+{
+	if ( (gMode == I2C_MODE_RDWR || gMode == I2C_MODE_AUTO)
+		&& (funcs & I2C_FUNC_I2C))
+	{
+		return I2C_MODE_RDWR;
+	}
+	if ( (gMode == I2C_MODE_SMBUS || gMode == I2C_MODE_AUTO)
+		&& (funcs & I2C_FUNC_SMBUS_WORD_DATA)
+		&& (funcs & I2C_FUNC_SMBUS_I2C_BLOCK))
+	{
+		return I2C_MODE_SMBUS;
+	}
+	return I2C_MODE_RW;
+}
+
+/*
+ * i2cModeSet:
+ *	Select the bus access method for the next opened devices
+ *********************************************************************************
+ */
+void i2cModeSet(int mode)
+{
+	if (mode >= I2C_MODE_AUTO && mode <= I2C_MODE_RW)
+	{
+		gMode = mode;
+	}
+}
+
+static int hwMode(int fd)
+{
+	if (fd < 0 || fd >= I2C_DEV_MAX)
+	{
+		return I2C_MODE_RW;
+	}
+	return gDev[fd].mode;
+}
+
+static int hwSetup(int bus, int addr)
 {
 	int file;
 	char filename[40];
-	sprintf(filename, "/dev/i2c-1");
+	unsigned long funcs = 0;
+
+	sprintf(filename, "/dev/i2c-%d", bus);
 
 	if ( (file = open(filename, O_RDWR)) < 0)
 	{
-		printf("Failed to open the bus.");
 		return -1;
 	}
 	if (ioctl(file, I2C_SLAVE, addr) < 0)
 	{
-		printf("Failed to acquire bus access and/or talk to slave.\n");
+		close(file);
 		return -1;
 	}
-
+	if (file < I2C_DEV_MAX)
+	{
+		if (ioctl(file, I2C_FUNCS, &funcs) < 0)
+		{
+			funcs = 0;
+		}
+		gDev[file].add = addr;
+		gDev[file].mode = devMode(funcs);
+	}
 	return file;
 }
 
-int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+static int smbusAccess(int dev, char rw, uint8_t command, int size,
+	union i2c_smbus_data *data)
 {
-	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	struct i2c_smbus_ioctl_data args;
 
-	if (NULL == buff)
+	args.read_write = rw;
+	args.command = command;
+	args.size = size;
+	args.data = data;
+	return ioctl(dev, I2C_SMBUS, &args);
+}
+
+static int smbusRead(int dev, int add, uint8_t* buff, int size)
+{
+	union i2c_smbus_data data;
+
+	if (size == 2)
+	{
+		if (smbusAccess(dev, I2C_SMBUS_READ, add, I2C_SMBUS_WORD_DATA, &data) < 0)
+		{
+			return -1;
+		}
+		buff[0] = 0xff & data.word;
+		buff[1] = 0xff & (data.word >> 8);
+		return 0;
+	}
+	data.block[0] = size;
+	if (smbusAccess(dev, I2C_SMBUS_READ, add, I2C_SMBUS_I2C_BLOCK_DATA, &data) < 0)
 	{
 		return -1;
 	}
+	if (data.block[0] != size)
+	{
+		return -1;
+	}
+	memcpy(buff, &data.block[1], size);
+	return 0;
+}
+
+static int smbusWrite(int dev, int add, uint8_t* buff, int size)
+{
+	union i2c_smbus_data data;
+
+	if (size == 2)
+	{
+		data.word = buff[0] | (buff[1] << 8);
+		return smbusAccess(dev, I2C_SMBUS_WRITE, add, I2C_SMBUS_WORD_DATA, &data)
+			< 0 ? -1 : 0;
+	}
+	data.block[0] = size;
+	memcpy(&data.block[1], buff, size);
+	return smbusAccess(dev, I2C_SMBUS_WRITE, add, I2C_SMBUS_I2C_BLOCK_DATA, &data)
+		< 0 ? -1 : 0;
+}
+
+static int hwRead(int dev, int add, uint8_t* buff, int size);
+static int hwWrite(int dev, int add, uint8_t* buff, int size);
+
+/*
+ * hwTransfer:
+ *	Run several register reads and writes in one I2C_RDWR ioctl, every
+ *	read uses a repeated start after the register address and the bus
+ *	is released only at the end of the last message
+ *********************************************************************************
+ */
+static int hwTransfer(int dev, I2cRegMsgType* msgs, int count)
+{
+	struct i2c_msg iMsgs[2 * I2C_REG_MSG_MAX];
+	struct i2c_rdwr_ioctl_data rdwr;
+	uint8_t addBuff[I2C_REG_MSG_MAX];
+	uint8_t wrBuff[I2C_REG_MSG_MAX][I2C_SMBUS_BLOCK_MAX];
+	int n = 0;
+	int i;
 
-	if (size > I2C_SMBUS_BLOCK_MAX)
+	if (hwMode(dev) != I2C_MODE_RDWR)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (msgs[i].read)
+			{
+				if (0 != hwRead(dev, msgs[i].add, msgs[i].buff, msgs[i].size))
+				{
+					return -1;
+				}
+			}
+			else if (0 != hwWrite(dev, msgs[i].add, msgs[i].buff, msgs[i].size))
+			{
+				return -1;
+			}
+		}
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (msgs[i].read)
+		{
+			addBuff[i] = msgs[i].add;
+			iMsgs[n].addr = gDev[dev].add;
+			iMsgs[n].flags = 0;
+			iMsgs[n].len = 1;
+			iMsgs[n].buf = &addBuff[i];
+			n++;
+			iMsgs[n].addr = gDev[dev].add;
+			iMsgs[n].flags = I2C_M_RD;
+			iMsgs[n].len = msgs[i].size;
+			iMsgs[n].buf = msgs[i].buff;
+			n++;
+		}
+		else
+		{
+			wrBuff[i][0] = msgs[i].add;
+			memcpy(&wrBuff[i][1], msgs[i].buff, msgs[i].size);
+			iMsgs[n].addr = gDev[dev].add;
+			iMsgs[n].flags = 0;
+			iMsgs[n].len = msgs[i].size + 1;
+			iMsgs[n].buf = wrBuff[i];
+			n++;
+		}
+	}
+	rdwr.msgs = iMsgs;
+	rdwr.nmsgs = n;
+	if (ioctl(dev, I2C_RDWR, &rdwr) != n)
 	{
 		return -1;
 	}
+	return 0;
+}
+
+static int hwRead(int dev, int add, uint8_t* buff, int size)
+{
+	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	I2cRegMsgType msg;
+
+	switch (hwMode(dev))
+	{
+	case I2C_MODE_RDWR:
+		msg.add = 0xff & add;
+		msg.read = 1;
+		msg.size = size;
+		msg.buff = buff;
+		return hwTransfer(dev, &msg, 1);
+	case I2C_MODE_SMBUS:
+		return smbusRead(dev, 0xff & add, buff, size);
+	default:
+		break;
+	}
 
 	intBuff[0] = 0xff & add;
 
@@ -90,30 +288,243 @@ int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
 	return 0; //OK
 }
 
-int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
+static int hwWrite(int dev, int add, uint8_t* buff, int size)
 {
 	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
 
-	if (NULL == buff)
+	if (hwMode(dev) == I2C_MODE_SMBUS)
+	{
+		return smbusWrite(dev, 0xff & add, buff, size);
+	}
+	// a single write is already one transaction, I2C_RDWR would not save anything
+	intBuff[0] = 0xff & add;
+	memcpy(&intBuff[1], buff, size);
+
+	if (write(dev, intBuff, size + 1) != size + 1)
 	{
+		//printf("Fail to write memory!\n");
 		return -1;
 	}
+	return 0;
+}
+
+static void hwClose(int dev)
+{
+	close(dev);
+}
+
+static const I2cTransportType gHwTransport = {"i2c-dev", hwSetup, hwRead,
+	hwWrite, hwTransfer, hwClose};
 
-	if (size > I2C_SMBUS_BLOCK_MAX - 1)
+/*
+ * Transport selection: the simulator when the RELAY16_SIM environment variable
+ * is set, the Linux i2c-dev interface otherwise. The buses attached to a
+ * Modbus RTU line use the RTU transport whatever the selection. The device
+ * handles returned by i2cSetup index a table of the transport that opened each
+ * device and the value its setup returned.
+ *********************************************************************************
+ */
+#define I2C_HANDLE_MAX	256
+
+typedef struct
+{
+	const I2cTransportType *t; /* NULL = free */
+	int dev;
+} I2cHandleType;
+
+static const I2cTransportType *gTransport = NULL;
+static pthread_once_t gTransportOnce = PTHREAD_ONCE_INIT;
+static I2cHandleType gHandle[I2C_HANDLE_MAX];
+static pthread_mutex_t gHandleLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void transportInit(void)
+{
+	if (gTransport == NULL)
+	{
+		gTransport = secure_getenv("RELAY16_SIM") != NULL ? simTransport() : &gHwTransport;
+	}
+}
+
+static const I2cTransportType* transport(void)
+{
+	pthread_once(&gTransportOnce, transportInit);
+	return gTransport;
+}
+
+/*
+ * i2cTransportSet:
+ *	Replace the transport, must be called before the first i2cSetup
+ *********************************************************************************
+ */
+void i2cTransportSet(const I2cTransportType *t)
+{
+	pthread_once(&gTransportOnce, transportInit);
+	gTransport = t != NULL ? t : &gHwTransport;
+}
+
+const I2cTransportType* i2cTransportGet(void)
+{
+	return transport();
+}
+
+/*
+ * handleGet:
+ *	Transport of an opened device handle and the device for it, the entry is
+ *	set before the handle is returned and cleared at its close only
+ *********************************************************************************
+ */
+static const I2cTransportType* handleGet(int handle, int *dev)
+{
+	if ( (handle < 0) || (handle >= I2C_HANDLE_MAX) || (gHandle[handle].t == NULL))
+	{
+		return NULL;
+	}
+	*dev = gHandle[handle].dev;
+	return gHandle[handle].t;
+}
+
+int i2cSetup(int bus, int addr)
+{
+	const I2cTransportType *t = rtuBus(bus) ? rtuTransport() : transport();
+	int dev = t->setup(bus, addr);
+	int handle;
+
+	if (dev < 0)
 	{
 		return -1;
 	}
+	pthread_mutex_lock(&gHandleLock);
+	for (handle = 0; handle < I2C_HANDLE_MAX; handle++)
+	{
+		if (gHandle[handle].t == NULL)
+		{
+			gHandle[handle].t = t;
+			gHandle[handle].dev = dev;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&gHandleLock);
+	if (handle == I2C_HANDLE_MAX)
+	{
+		t->close(dev);
+		return -1;
+	}
+	traceDevSet(handle, bus, addr);
+	return handle;
+}
 
-	intBuff[0] = 0xff & add;
-	memcpy(&intBuff[1], buff, size);
+void i2cClose(int handle)
+{
+	const I2cTransportType *t;
+	int dev;
 
-	if (write(dev, intBuff, size + 1) != size + 1)
+	pthread_mutex_lock(&gHandleLock);
+	t = handleGet(handle, &dev);
+	if (t != NULL)
+	{
+		gHandle[handle].t = NULL;
+	}
+	pthread_mutex_unlock(&gHandleLock);
+	if (t != NULL)
+	{
+		traceDevClear(handle);
+		t->close(dev);
+	}
+}
+
+int i2cModeGet(int handle)
+{
+	int dev;
+
+	if (handleGet(handle, &dev) != &gHwTransport)
+	{
+		return I2C_MODE_RW;
+	}
+	return hwMode(dev);
+}
+
+int i2cMem8Read(int handle, int add, uint8_t* buff, int size)
+{
+	const I2cTransportType *t;
+	uint64_t start;
+	int dev;
+	int ret;
+
+	if ( (NULL == buff) || (size <= 0) || (size > I2C_SMBUS_BLOCK_MAX))
 	{
-		//printf("Fail to write memory!\n");
 		return -1;
 	}
-	return 0;
+	t = handleGet(handle, &dev);
+	if (NULL == t)
+	{
+		return -1;
+	}
+	start = traceStart();
+	ret = t->read(dev, add, buff, size);
+	traceIo(RELAY16_TRACE_READ, handle, add, size, ret, start);
+	return ret;
 }
 
+int i2cMem8Write(int handle, int add, uint8_t* buff, int size)
+{
+	const I2cTransportType *t;
+	uint64_t start;
+	int dev;
+	int ret;
+
+	if ( (NULL == buff) || (size <= 0) || (size > I2C_SMBUS_BLOCK_MAX - 1))
+	{
+		return -1;
+	}
+	t = handleGet(handle, &dev);
+	if (NULL == t)
+	{
+		return -1;
+	}
+	start = traceStart();
+	ret = t->write(dev, add, buff, size);
+	traceIo(RELAY16_TRACE_WRITE, handle, add, size, ret, start);
+	return ret;
+}
 
+/*
+ * i2cMem8Transfer:
+ *	Several register reads and writes in one bus transaction when the transport
+ *	supports it, in sequence otherwise
+ *********************************************************************************
+ */
+int i2cMem8Transfer(int handle, I2cRegMsgType* msgs, int count)
+{
+	const I2cTransportType *t;
+	uint64_t start;
+	int size = 0;
+	int dev;
+	int ret;
+	int i;
 
+	if ( (NULL == msgs) || (count <= 0) || (count > I2C_REG_MSG_MAX))
+	{
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if ( (NULL == msgs[i].buff) || (msgs[i].size == 0))
+		{
+			return -1;
+		}
+		if (msgs[i].size > (msgs[i].read ? I2C_SMBUS_BLOCK_MAX : I2C_SMBUS_BLOCK_MAX - 1))
+		{
+			return -1;
+		}
+		size += msgs[i].size;
+	}
+	t = handleGet(handle, &dev);
+	if (NULL == t)
+	{
+		return -1;
+	}
+	start = traceStart();
+	ret = t->transfer(dev, msgs, count);
+	traceIo(RELAY16_TRACE_TRANSFER, handle, msgs[0].add, size, ret, start);
+	return ret;
+}
@@ -3,9 +3,47 @@
 
 #include <stdint.h>
 
-int i2cSetup(int addr);
-int i2cMem8Read(int dev, int add, uint8_t* buff, int size);
-int i2cMem8Write(int dev, int add, uint8_t* buff, int size);
+// bus access methods
+#define I2C_MODE_AUTO	0	/* best method supported by the adapter */
+#define I2C_MODE_RDWR	1	/* I2C_RDWR combined transactions with repeated start */
+#define I2C_MODE_SMBUS	2	/* SMBus word / I2C block transactions */
+#define I2C_MODE_RW		3	/* write() of the register address followed by read() */
 
+#define I2C_REG_MSG_MAX	16
 
-#endif //COMM_H_
\ No newline at end of file
+typedef struct
+{
+	uint8_t add; /* register address */
+	uint8_t read; /* 1 = read, 0 = write */
+	uint8_t size;
+	uint8_t *buff;
+} I2cRegMsgType;
+
+/*
+ * Bus transport, the i2c-dev interface or the simulator, dev is the value
+ * returned by setup, private to the transport; the functions below take the
+ * handle returned by i2cSetup
+ */
+typedef struct
+{
+	const char *name;
+	int (*setup)(int bus, int addr);
+	int (*read)(int dev, int add, uint8_t* buff, int size);
+	int (*write)(int dev, int add, uint8_t* buff, int size);
+	int (*transfer)(int dev, I2cRegMsgType* msgs, int count);
+	void (*close)(int dev);
+} I2cTransportType;
+
+void i2cTransportSet(const I2cTransportType *t);
+const I2cTransportType* i2cTransportGet(void);
+
+int i2cSetup(int bus, int addr);
+void i2cClose(int handle);
+int i2cMem8Read(int handle, int add, uint8_t* buff, int size);
+int i2cMem8Write(int handle, int add, uint8_t* buff, int size);
+int i2cMem8Transfer(int handle, I2cRegMsgType* msgs, int count);
+void i2cModeSet(int mode);
+int i2cModeGet(int handle);
+
+
+#endif //COMM_H_
@@ -0,0 +1,286 @@
+/*
+ * daemon.c:
+ *	Resident server that keeps the boards open and executes the CLI commands
+ *	received over a Unix domain socket
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "relay.h"
+#include "client.h"
+#include "daemon.h"
+#include "events.h"
+
+typedef struct
+{
+	int fd;
+	int len;
+	char line[DAEMON_LINE_MAX];
+} DaemonClientType;
+
+static volatile sig_atomic_t gDaemonStop = 0;
+
+static void daemonSignal(int sig)
+{
+	UNUSED(sig);
+	gDaemonStop = 1;
+}
+
+static int daemonListen(const char* path)
+{
+	int sock;
+	struct sockaddr_un addr;
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		printf("Socket path too long!\n");
+		return ERROR;
+	}
+	// only a socket left by a previous daemon is replaced
+	if ( (lstat(path, &st) == 0) && !S_ISSOCK(st.st_mode))
+	{
+		printf("%s exists and is not a socket!\n", path);
+		return ERROR;
+	}
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		printf("Fail to create the daemon socket!\n");
+		return ERROR;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if ( (lstat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+	{
+		unlink(path);
+	}
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+	{
+		printf("Fail to bind %s!\n", path);
+		close(sock);
+		return ERROR;
+	}
+	chmod(path, 0666);
+	if (listen(sock, DAEMON_MAX_CLIENTS) < 0)
+	{
+		printf("Fail to listen on %s!\n", path);
+		close(sock);
+		unlink(path);
+		return ERROR;
+	}
+	return sock;
+}
+
+/*
+ * daemonExec:
+ *	Split one request line and run it with the standard output sent to the client.
+ *	Return 1 if the connection became an event stream
+ */
+static int daemonExec(int fd, char* line)
+{
+	char *argv[CLI_ARGS_MAX + 1];
+	int argc;
+	char end = DAEMON_RESP_END;
+	int taken = 0;
+	int out;
+
+	argc = cliSplit(line, argv, CLI_ARGS_MAX);
+
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	if (argc < 0)
+	{
+		printf("Too many arguments, at most %d\n", CLI_ARGS_MAX - 1);
+	}
+	else if (argc < 2)
+	{
+		printf("Empty command\n");
+	}
+	else if (strcasecmp(argv[1], EVENTS_CMD) == 0)
+	{
+		// no answer end, the events follow until the client leaves
+		taken = eventsSubscribe(fd, argc - 2, argv + 2) == OK;
+	}
+	else if (cliLocalOnly(argc, argv))
+	{
+		printf("Command \"%s\" not available through the daemon\n", argv[1]);
+	}
+	else if (relay16Lock() != RELAY16_OK)
+	{
+		printf("The bus is busy, try again\n");
+	}
+	else
+	{
+		if (CMD_NOT_FOUND == cliExec(argc, argv))
+		{
+			printf("Invalid command option\n");
+		}
+		relay16Unlock();
+	}
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+	if (taken)
+	{
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		return 1;
+	}
+	if (write(fd, &end, 1) != 1)
+	{
+		// the client will be dropped on the next poll
+	}
+	return 0;
+}
+
+/*
+ * daemonRead:
+ *	Collect the data received from a client, execute every complete line.
+ *	Return -1 if the client must be dropped, 1 if it is an event subscriber now
+ */
+static int daemonRead(DaemonClientType* cl)
+{
+	int n;
+	int i;
+	int start = 0;
+
+	n = read(cl->fd, cl->line + cl->len, sizeof(cl->line) - cl->len);
+	if (n <= 0)
+	{
+		return -1;
+	}
+	cl->len += n;
+	for (i = 0; i < cl->len; i++)
+	{
+		if (cl->line[i] == '\n')
+		{
+			cl->line[i] = 0;
+			if (daemonExec(cl->fd, cl->line + start))
+			{
+				return 1;
+			}
+			start = i + 1;
+		}
+	}
+	if (start == 0 && cl->len == sizeof(cl->line))
+	{
+		return -1; // line too long
+	}
+	memmove(cl->line, cl->line + start, cl->len - start);
+	cl->len -= start;
+	return 0;
+}
+
+int daemonRun(const char* path)
+{
+	int lsock;
+	struct pollfd fds[DAEMON_MAX_CLIENTS + 2];
+	DaemonClientType clients[DAEMON_MAX_CLIENTS];
+	int nClients = 0;
+	int events;
+	int i;
+	int fd;
+	int ret;
+
+	lsock = daemonListen(path);
+	if (lsock < 0)
+	{
+		return ERROR;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, daemonSignal);
+	signal(SIGTERM, daemonSignal);
+	events = eventsInit();
+	if (events < 0)
+	{
+		printf("Warning: the event stream is not available\n");
+	}
+	printf("16relind daemon listening on %s\n", path);
+	fflush(stdout);
+
+	while (!gDaemonStop)
+	{
+		fds[0].fd = lsock;
+		fds[0].events = POLLIN;
+		for (i = 0; i < nClients; i++)
+		{
+			fds[i + 1].fd = clients[i].fd;
+			fds[i + 1].events = POLLIN;
+			fds[i + 1].revents = 0;
+		}
+		// the event poller, its subscribers and timer in one epoll fd
+		fds[nClients + 1].fd = events;
+		fds[nClients + 1].events = POLLIN;
+		fds[nClients + 1].revents = 0;
+		if (poll(fds, nClients + 2, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		if (fds[nClients + 1].revents & POLLIN)
+		{
+			eventsDispatch();
+		}
+		for (i = nClients - 1; i >= 0; i--)
+		{
+			if (fds[i + 1].revents == 0)
+			{
+				continue;
+			}
+			ret = (fds[i + 1].revents & POLLIN) ? daemonRead(&clients[i]) : -1;
+			if (ret < 0)
+			{
+				close(clients[i].fd);
+			}
+			if (ret != 0)
+			{
+				// the event subscribers are served by the event poller
+				clients[i] = clients[--nClients];
+			}
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			fd = accept(lsock, NULL, NULL);
+			if (fd >= 0)
+			{
+				if (nClients < DAEMON_MAX_CLIENTS)
+				{
+					clients[nClients].fd = fd;
+					clients[nClients].len = 0;
+					nClients++;
+				}
+				else
+				{
+					close(fd);
+				}
+			}
+		}
+	}
+	for (i = 0; i < nClients; i++)
+	{
+		close(clients[i].fd);
+	}
+	close(lsock);
+	unlink(path);
+	eventsClose();
+	boardCacheFlush();
+	return OK;
+}
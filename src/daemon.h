@@ -0,0 +1,8 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#define DAEMON_MAX_CLIENTS	16
+
+int daemonRun(const char* path);
+
+#endif //DAEMON_H_
@@ -0,0 +1,203 @@
+/*
+ * discovery.c:
+ *	Cache of the detected stack levels on every bus and of the expander address
+ *	each board uses (0x20 or 0x38 base). The cache is shared between the processes through
+ *	a file in /run and is tagged with the kernel boot id, so the boards are
+ *	probed again after every power cycle.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define _GNU_SOURCE /* secure_getenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "lib16relind.h"
+#include "discovery.h"
+
+#define BOOT_ID_PATH	"/proc/sys/kernel/random/boot_id"
+#define BOOT_ID_SIZE	40
+
+static int gAdd[RELAY16_BUS_MAX][RELAY16_STACK_MAX];
+static char gBootId[BOOT_ID_SIZE];
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t gOnce = PTHREAD_ONCE_INIT;
+
+static const char* discoveryPath(void)
+{
+	const char *path = secure_getenv("RELAY16_DISCOVERY");
+
+	return (path != NULL && path[0] != 0) ? path : DISCOVERY_PATH;
+}
+
+static void bootIdRead(void)
+{
+	FILE *f = fopen(BOOT_ID_PATH, "r");
+
+	gBootId[0] = 0;
+	if (f == NULL)
+	{
+		return;
+	}
+	if (fgets(gBootId, sizeof(gBootId), f) != NULL)
+	{
+		gBootId[strcspn(gBootId, "\n")] = 0;
+	}
+	fclose(f);
+}
+
+/*
+ * discoveryLoad:
+ *	File format: "boot <boot id>" then one "<bus> <stack> <address>" line for
+ *	every known stack level, address 0 for a missing board
+ *********************************************************************************
+ */
+static void discoveryLoad(void)
+{
+	char line[64];
+	char id[BOOT_ID_SIZE];
+	FILE *f;
+	int bus;
+	int stack;
+	int add;
+	int i;
+	int j;
+
+	for (i = 0; i < RELAY16_BUS_MAX; i++)
+	{
+		for (j = 0; j < RELAY16_STACK_MAX; j++)
+		{
+			gAdd[i][j] = DISCOVERY_UNKNOWN;
+		}
+	}
+	bootIdRead();
+	f = fopen(discoveryPath(), "r");
+	if (f == NULL)
+	{
+		return;
+	}
+	if ( (fgets(line, sizeof(line), f) == NULL)
+		|| (sscanf(line, "boot %39s", id) != 1) || (strcmp(id, gBootId) != 0))
+	{
+		fclose(f);
+		return;
+	}
+	while (fgets(line, sizeof(line), f) != NULL)
+	{
+		if ( (sscanf(line, "%d %d %i", &bus, &stack, &add) == 3) && (bus >= 0)
+			&& (bus < RELAY16_BUS_MAX) && (stack >= 0) && (stack < RELAY16_STACK_MAX)
+			&& (add >= 0) && (add < 0x80))
+		{
+			gAdd[bus][stack] = add;
+		}
+	}
+	fclose(f);
+}
+
+/*
+ * discoverySave:
+ *	Replace the file atomically, a failure only costs a probe in the next process
+ *********************************************************************************
+ */
+static void discoverySave(void)
+{
+	char tmp[256];
+	FILE *f;
+	int i;
+	int j;
+
+	snprintf(tmp, sizeof(tmp), "%s.%d", discoveryPath(), (int)getpid());
+	f = fopen(tmp, "w");
+	if (f == NULL)
+	{
+		return;
+	}
+	fprintf(f, "boot %s\n", gBootId);
+	for (i = 0; i < RELAY16_BUS_MAX; i++)
+	{
+		for (j = 0; j < RELAY16_STACK_MAX; j++)
+		{
+			if (gAdd[i][j] != DISCOVERY_UNKNOWN)
+			{
+				fprintf(f, "%d %d 0x%02x\n", i, j, gAdd[i][j]);
+			}
+		}
+	}
+	if ( (fclose(f) != 0) || (rename(tmp, discoveryPath()) != 0))
+	{
+		remove(tmp);
+	}
+}
+
+/*
+ * discoveryGet:
+ *	Return the board address, DISCOVERY_ABSENT or DISCOVERY_UNKNOWN
+ *********************************************************************************
+ */
+int discoveryGet(int bus, int stack)
+{
+	int add;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX) || (stack < 0)
+		|| (stack >= RELAY16_STACK_MAX))
+	{
+		return DISCOVERY_UNKNOWN;
+	}
+	pthread_once(&gOnce, discoveryLoad);
+	pthread_mutex_lock(&gLock);
+	add = gAdd[bus][stack];
+	pthread_mutex_unlock(&gLock);
+	return add;
+}
+
+void discoverySet(int bus, int stack, int add)
+{
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX) || (stack < 0)
+		|| (stack >= RELAY16_STACK_MAX))
+	{
+		return;
+	}
+	pthread_once(&gOnce, discoveryLoad);
+	pthread_mutex_lock(&gLock);
+	if (gAdd[bus][stack] != add)
+	{
+		gAdd[bus][stack] = add;
+		discoverySave();
+	}
+	pthread_mutex_unlock(&gLock);
+}
+
+/*
+ * discoveryInvalidate:
+ *	Forget one stack level of the bus, or all of them for stack < 0
+ *********************************************************************************
+ */
+void discoveryInvalidate(int bus, int stack)
+{
+	int changed = 0;
+	int i;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX) || (stack >= RELAY16_STACK_MAX))
+	{
+		return;
+	}
+	pthread_once(&gOnce, discoveryLoad);
+	pthread_mutex_lock(&gLock);
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		if ( ( (stack < 0) || (stack == i)) && (gAdd[bus][i] != DISCOVERY_UNKNOWN))
+		{
+			gAdd[bus][i] = DISCOVERY_UNKNOWN;
+			changed = 1;
+		}
+	}
+	if (changed)
+	{
+		discoverySave();
+	}
+	pthread_mutex_unlock(&gLock);
+}
@@ -0,0 +1,13 @@
+#ifndef DISCOVERY_H_
+#define DISCOVERY_H_
+
+#define DISCOVERY_UNKNOWN	-1
+#define DISCOVERY_ABSENT	0
+
+#define DISCOVERY_PATH	"/run/16relind.boards"
+
+int discoveryGet(int bus, int stack);
+void discoverySet(int bus, int stack, int add);
+void discoveryInvalidate(int bus, int stack);
+
+#endif //DISCOVERY_H_
@@ -0,0 +1,522 @@
+/*
+ * events.c:
+ *	Relay change event stream. The subscribers get one text line for every
+ *	change of the boards they watch:
+ *	  <stack>@<bus> <old> <new> <time> <init|local|external>
+ *	The writes done by this process are published from the library change hook,
+ *	the changes done by other processes or by the Modbus side are found by one
+ *	poller shared by all the subscribers. The poll interval drops to
+ *	EVENTS_POLL_MIN_MS after a change and doubles up to EVENTS_POLL_MAX_MS
+ *	while nothing changes, the poller stops without subscribers.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "relay.h"
+#include "events.h"
+
+typedef struct
+{
+	uint8_t bus;
+	uint8_t stack;
+	uint16_t val;
+	struct timespec ts;
+} EventsChangeType;
+
+typedef struct
+{
+	Relay16Board *board;
+	int known;
+	uint16_t val; /* last state published */
+} EventsWatchType;
+
+typedef struct
+{
+	int fd;
+	uint8_t stacks[RELAY16_BUS_MAX]; /* bitmap of the watched stack levels */
+} EventsSubType;
+
+// local changes, from the writing thread to the dispatch
+static pthread_mutex_t gEventsLock = PTHREAD_MUTEX_INITIALIZER;
+static EventsChangeType gRing[EVENTS_RING_SIZE];
+static unsigned int gRingHead = 0;
+static unsigned int gRingTail = 0;
+static unsigned int gRingLost = 0;
+
+static int gEpoll = -1;
+static int gWake = -1;
+static int gTimer = -1;
+static unsigned int gPollMs = 0; /* 0 = poller stopped */
+static EventsWatchType gWatch[RELAY16_BUS_MAX][RELAY16_STACK_MAX];
+static EventsSubType gSub[EVENTS_SUBSCRIBERS_MAX];
+static int gSubs = 0;
+
+static void eventsHook(Relay16Board *board, uint16_t val, void *arg)
+{
+	EventsChangeType *ch;
+	uint64_t one = 1;
+
+	UNUSED(arg);
+	pthread_mutex_lock(&gEventsLock);
+	if (gRingHead - gRingTail < EVENTS_RING_SIZE)
+	{
+		ch = &gRing[gRingHead % EVENTS_RING_SIZE];
+		ch->bus = relay16Bus(board);
+		ch->stack = relay16Stack(board);
+		ch->val = val;
+		clock_gettime(CLOCK_REALTIME, &ch->ts);
+		gRingHead++;
+	}
+	else
+	{
+		gRingLost++;
+	}
+	pthread_mutex_unlock(&gEventsLock);
+	if (write(gWake, &one, sizeof(one)) != sizeof(one))
+	{
+		// the counter is already set
+	}
+}
+
+static void eventsArm(unsigned int ms)
+{
+	struct itimerspec its;
+
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	its.it_interval = its.it_value;
+	timerfd_settime(gTimer, 0, &its, NULL);
+	gPollMs = ms;
+}
+
+static int eventsWatched(int bus, int stack)
+{
+	int i;
+
+	for (i = 0; i < gSubs; i++)
+	{
+		if (gSub[i].stacks[bus] & (1 << stack))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void eventsDrop(int i)
+{
+	epoll_ctl(gEpoll, EPOLL_CTL_DEL, gSub[i].fd, NULL);
+	close(gSub[i].fd);
+	gSub[i] = gSub[--gSubs];
+	if (gSubs == 0)
+	{
+		relay16ChangeHook(NULL, NULL);
+		eventsArm(0);
+	}
+}
+
+static int eventsLine(char *line, int bus, int stack, uint16_t old, uint16_t val,
+	const struct timespec *ts, const char *cause)
+{
+	return snprintf(line, EVENTS_LINE_MAX, "%d@%d 0x%04x 0x%04x %ld.%06ld %s\n",
+		stack, bus, old, val, (long)ts->tv_sec, ts->tv_nsec / 1000, cause);
+}
+
+/*
+ * eventsChange:
+ *	Publish a new state of a board, return 1 if it changed
+ *********************************************************************************
+ */
+static int eventsChange(int bus, int stack, uint16_t val, const struct timespec *ts,
+	const char *cause)
+{
+	EventsWatchType *w = &gWatch[bus][stack];
+	char line[EVENTS_LINE_MAX];
+	uint16_t old = w->known ? w->val : val;
+	int len;
+	int i;
+
+	if (w->known && (w->val == val))
+	{
+		return 0;
+	}
+	w->known = 1;
+	w->val = val;
+	len = eventsLine(line, bus, stack, old, val, ts, cause);
+	for (i = gSubs - 1; i >= 0; i--)
+	{
+		// a subscriber that does not keep up is dropped, the daemon never waits
+		if ( (gSub[i].stacks[bus] & (1 << stack))
+			&& (write(gSub[i].fd, line, len) != len))
+		{
+			eventsDrop(i);
+		}
+	}
+	return 1;
+}
+
+/*
+ * eventsDrain:
+ *	Publish the local changes, return the number of changes
+ *********************************************************************************
+ */
+static int eventsDrain(void)
+{
+	EventsChangeType ch;
+	int changes = 0;
+
+	pthread_mutex_lock(&gEventsLock);
+	while (gRingTail != gRingHead)
+	{
+		ch = gRing[gRingTail++ % EVENTS_RING_SIZE];
+		pthread_mutex_unlock(&gEventsLock);
+		changes += eventsChange(ch.bus, ch.stack, ch.val, &ch.ts, "local");
+		pthread_mutex_lock(&gEventsLock);
+	}
+	pthread_mutex_unlock(&gEventsLock);
+	return changes;
+}
+
+static int eventsRead(Relay16Board *board, uint16_t *val)
+{
+	uint8_t buff[2];
+	uint16_t io;
+	int ret;
+
+	ret = relay16MemRead(board, RELAY16_INPORT_REG_ADD, buff, 2);
+	if (ret == RELAY16_OK)
+	{
+		memcpy(&io, buff, 2);
+		*val = relay16FromIO(io);
+	}
+	return ret;
+}
+
+/*
+ * eventsPoll:
+ *	One read of every watched board, whatever the number of subscribers
+ *********************************************************************************
+ */
+static int eventsPoll(void)
+{
+	struct timespec ts;
+	uint16_t val;
+	int changes = 0;
+	int bus;
+	int stack;
+
+	if (relay16Lock() != OK)
+	{
+		return 0;
+	}
+	for (bus = 0; bus < RELAY16_BUS_MAX; bus++)
+	{
+		for (stack = 0; stack < RELAY16_STACK_MAX; stack++)
+		{
+			if ( (gWatch[bus][stack].board == NULL) || !eventsWatched(bus, stack)
+				|| (eventsRead(gWatch[bus][stack].board, &val) != RELAY16_OK))
+			{
+				continue;
+			}
+			// the local writes done before the read are not external changes
+			changes += eventsDrain();
+			clock_gettime(CLOCK_REALTIME, &ts);
+			if (eventsChange(bus, stack, val, &ts, "external"))
+			{
+				relay16CacheInvalidate(gWatch[bus][stack].board);
+				changes++;
+			}
+		}
+	}
+	relay16Unlock();
+	return changes;
+}
+
+int eventsInit(void)
+{
+	struct epoll_event ev;
+
+	if (gEpoll >= 0)
+	{
+		return gEpoll;
+	}
+	gEpoll = epoll_create1(EPOLL_CLOEXEC);
+	gWake = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	gTimer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if ( (gEpoll < 0) || (gWake < 0) || (gTimer < 0))
+	{
+		eventsClose();
+		return ERROR;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = gWake;
+	epoll_ctl(gEpoll, EPOLL_CTL_ADD, gWake, &ev);
+	ev.data.fd = gTimer;
+	epoll_ctl(gEpoll, EPOLL_CTL_ADD, gTimer, &ev);
+	return gEpoll;
+}
+
+/*
+ * eventsSubscribe:
+ *	Send the changes of the boards "<stack>[@<bus>]" to fd, every board of the
+ *	default bus without ids. The subscriber starts with one "init" line per board
+ *********************************************************************************
+ */
+int eventsSubscribe(int fd, int argc, char *argv[])
+{
+	EventsSubType sub;
+	struct epoll_event ev;
+	struct timespec ts;
+	Relay16Board *board;
+	char line[EVENTS_LINE_MAX];
+	char id[16];
+	uint8_t stacks = 0;
+	uint16_t val;
+	int bus;
+	int stack;
+	int len;
+	int i;
+
+	if (eventsInit() < 0)
+	{
+		printf("Fail to create the event poller!\n");
+		return ERROR;
+	}
+	if (gSubs >= EVENTS_SUBSCRIBERS_MAX)
+	{
+		printf("Too many event subscribers [%d]!\n", EVENTS_SUBSCRIBERS_MAX);
+		return ERROR;
+	}
+	memset(&sub, 0, sizeof(sub));
+	sub.fd = fd;
+	if (argc == 0)
+	{
+		bus = cliBusDefault();
+		if ( (OK != relay16DiscoverBus(bus, 0, &stacks)) || (stacks == 0))
+		{
+			printf("No 16relind board detected!\n");
+			return ERROR;
+		}
+		sub.stacks[bus] = stacks;
+	}
+	for (i = 0; i < argc; i++)
+	{
+		board = doBoardInit(argv[i]);
+		if (board == NULL)
+		{
+			return ERROR;
+		}
+		sub.stacks[relay16Bus(board)] |= 1 << relay16Stack(board);
+	}
+	for (bus = 0; bus < RELAY16_BUS_MAX; bus++)
+	{
+		for (stack = 0; stack < RELAY16_STACK_MAX; stack++)
+		{
+			if ( (sub.stacks[bus] & (1 << stack)) && (gWatch[bus][stack].board == NULL))
+			{
+				snprintf(id, sizeof(id), "%d@%d", stack, bus);
+				gWatch[bus][stack].board = doBoardInit(id);
+				if (gWatch[bus][stack].board == NULL)
+				{
+					return ERROR;
+				}
+			}
+		}
+	}
+	if (relay16Lock() != OK)
+	{
+		printf("Fail to lock the bus!\n");
+		return ERROR;
+	}
+	if (gSubs == 0)
+	{
+		relay16ChangeHook(eventsHook, NULL);
+	}
+	eventsDrain();
+	fflush(stdout);
+	for (bus = 0; bus < RELAY16_BUS_MAX; bus++)
+	{
+		for (stack = 0; stack < RELAY16_STACK_MAX; stack++)
+		{
+			if ( ! (sub.stacks[bus] & (1 << stack))
+				|| (eventsRead(gWatch[bus][stack].board, &val) != RELAY16_OK))
+			{
+				continue;
+			}
+			clock_gettime(CLOCK_REALTIME, &ts);
+			// the subscribers already there see it as a change
+			eventsChange(bus, stack, val, &ts, "external");
+			len = eventsLine(line, bus, stack, val, val, &ts, "init");
+			if (write(fd, line, len) != len)
+			{
+				break;
+			}
+		}
+	}
+	relay16Unlock();
+	// a regular file as output has no hang up to watch
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.fd = fd;
+	epoll_ctl(gEpoll, EPOLL_CTL_ADD, fd, &ev);
+	gSub[gSubs++] = sub;
+	if (gPollMs == 0)
+	{
+		eventsArm(EVENTS_POLL_MIN_MS);
+	}
+	return OK;
+}
+
+/*
+ * eventsDispatch:
+ *	Handle the event fd ready for reading: publish the local changes, poll the
+ *	boards on the timer, drop the subscribers gone. Return the subscriber count
+ *********************************************************************************
+ */
+int eventsDispatch(void)
+{
+	struct epoll_event ev[EVENTS_SUBSCRIBERS_MAX + 2];
+	char buff[EVENTS_LINE_MAX];
+	uint64_t cnt;
+	unsigned int interval;
+	int changes;
+	int tick = 0;
+	int n;
+	int i;
+	int j;
+
+	if (gEpoll < 0)
+	{
+		return 0;
+	}
+	n = epoll_wait(gEpoll, ev, EVENTS_SUBSCRIBERS_MAX + 2, 0);
+	for (i = 0; i < n; i++)
+	{
+		if ( (ev[i].data.fd == gWake) || (ev[i].data.fd == gTimer))
+		{
+			if ( (read(ev[i].data.fd, &cnt, sizeof(cnt)) == sizeof(cnt))
+				&& (ev[i].data.fd == gTimer))
+			{
+				tick = 1;
+			}
+			continue;
+		}
+		for (j = 0; j < gSubs; j++)
+		{
+			// the subscribers only listen, anything else ends the stream
+			if ( (gSub[j].fd == ev[i].data.fd)
+				&& ( (ev[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+					|| (read(gSub[j].fd, buff, sizeof(buff)) <= 0)))
+			{
+				eventsDrop(j);
+				break;
+			}
+		}
+	}
+	changes = eventsDrain();
+	pthread_mutex_lock(&gEventsLock);
+	if (gRingLost)
+	{
+		// the last state of the lost changes is found by the poll
+		gRingLost = 0;
+		tick = 1;
+	}
+	pthread_mutex_unlock(&gEventsLock);
+	if (gSubs == 0)
+	{
+		return 0;
+	}
+	if (tick)
+	{
+		changes += eventsPoll();
+	}
+	interval = gPollMs;
+	if (changes)
+	{
+		interval = EVENTS_POLL_MIN_MS;
+	}
+	else if (tick && (interval < EVENTS_POLL_MAX_MS))
+	{
+		interval = interval * 2 < EVENTS_POLL_MAX_MS ? interval * 2 : EVENTS_POLL_MAX_MS;
+	}
+	if ( (gSubs > 0) && (interval != gPollMs))
+	{
+		eventsArm(interval);
+	}
+	return gSubs;
+}
+
+void eventsClose(void)
+{
+	relay16ChangeHook(NULL, NULL);
+	while (gSubs > 0)
+	{
+		eventsDrop(gSubs - 1);
+	}
+	if (gTimer >= 0)
+	{
+		close(gTimer);
+	}
+	if (gWake >= 0)
+	{
+		close(gWake);
+	}
+	if (gEpoll >= 0)
+	{
+		close(gEpoll);
+	}
+	gTimer = gWake = gEpoll = -1;
+	gPollMs = 0;
+	memset(gWatch, 0, sizeof(gWatch));
+}
+
+/*
+ * eventsRun:
+ *	Event stream of the boards to the standard output, without a daemon.
+ *	The writes of the other processes are seen as external changes
+ *********************************************************************************
+ */
+int eventsRun(int argc, char *argv[])
+{
+	struct pollfd pfd;
+
+	if (eventsSubscribe(STDOUT_FILENO, argc, argv) != OK)
+	{
+		eventsClose();
+		return ERROR;
+	}
+	pfd.fd = gEpoll;
+	pfd.events = POLLIN;
+	while (1)
+	{
+		if (poll(&pfd, 1, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		if (eventsDispatch() == 0)
+		{
+			break;
+		}
+	}
+	eventsClose();
+	return OK;
+}
@@ -0,0 +1,19 @@
+#ifndef EVENTS_H_
+#define EVENTS_H_
+
+#include "lib16relind.h"
+
+#define EVENTS_CMD				"-events"
+#define EVENTS_SUBSCRIBERS_MAX	16
+#define EVENTS_RING_SIZE		256	/* local changes waiting for the dispatch */
+#define EVENTS_POLL_MIN_MS		20	/* poll interval after a change */
+#define EVENTS_POLL_MAX_MS		640	/* poll interval of the idle boards */
+#define EVENTS_LINE_MAX			64
+
+int eventsInit(void);
+int eventsSubscribe(int fd, int argc, char *argv[]);
+int eventsDispatch(void);
+void eventsClose(void);
+int eventsRun(int argc, char *argv[]);
+
+#endif //EVENTS_H_
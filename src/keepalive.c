@@ -0,0 +1,234 @@
+/*
+ * keepalive.c:
+ *	Watchdog keepalive: the board stays open and the watchdog is reloaded from
+ *	a timerfd schedule at real time priority, instead of a process started by
+ *	cron or a shell loop for every reload. The reload interval follows the
+ *	watchdog period read from the board, the late and missed reloads are
+ *	counted and reported on SIGUSR1 and at exit.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+
+#include "relay.h"
+#include "thread.h"
+#include "keepalive.h"
+
+static volatile sig_atomic_t gKeepaliveStop = 0;
+static volatile sig_atomic_t gKeepaliveReport = 0;
+
+static void keepaliveSignal(int sig)
+{
+	if (sig == SIGUSR1)
+	{
+		gKeepaliveReport = 1;
+	}
+	else
+	{
+		gKeepaliveStop = 1;
+	}
+}
+
+static uint64_t keepaliveTimeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * keepaliveArm:
+ *	First expiration at the absolute time first (us), then every interval
+ *********************************************************************************
+ */
+static int keepaliveArm(int fd, uint64_t first, unsigned int intervalMs)
+{
+	struct itimerspec its;
+
+	its.it_value.tv_sec = first / 1000000;
+	its.it_value.tv_nsec = (first % 1000000) * 1000;
+	its.it_interval.tv_sec = intervalMs / 1000;
+	its.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+	return timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void keepaliveReport(const KeepaliveStatsType *st, uint16_t period,
+	unsigned int intervalMs)
+{
+	printf("period %us interval %ums reloads %u missed %u late %u errors %u"
+		" lock timeouts %u latency avg %uus max %uus longest gap %ums margin %dms\n",
+		period, intervalMs, st->ticks, st->missed, st->late, st->errors,
+		st->lockTimeouts,
+		st->ticks ? (unsigned int) (st->totalLatencyUs / st->ticks) : 0,
+		st->maxLatencyUs, st->maxGapMs, (int)period * 1000 - (int)st->maxGapMs);
+	fflush(stdout);
+}
+
+int keepaliveRun(Relay16Board *board, unsigned int intervalMs)
+{
+	KeepaliveStatsType st;
+	struct sigaction sa;
+	uint16_t period = 0;
+	uint16_t newPeriod = 0;
+	uint64_t exp;
+	uint64_t next;
+	uint64_t deadline;
+	uint64_t now;
+	uint64_t lastOk = 0;
+	uint32_t latency;
+	unsigned int interval;
+	int fd;
+	int ret;
+
+	memset(&st, 0, sizeof(st));
+	ret = relay16Lock();
+	if (ret == OK)
+	{
+		ret = relay16WdtPeriodGet(board, &period);
+		relay16Unlock();
+	}
+	if ( (ret != OK) || (period == 0))
+	{
+		printf("Fail to read the watchdog period!\n");
+		return ERROR;
+	}
+	interval = intervalMs ? intervalMs : period * 1000u / KEEPALIVE_DIVIDER;
+	if (interval >= period * 1000u)
+	{
+		printf("Warning: the reload interval is not shorter than the %us watchdog period\n",
+			period);
+	}
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		printf("Fail to create the keepalive timer!\n");
+		return ERROR;
+	}
+	// no SA_RESTART, the signals interrupt the timer read
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = keepaliveSignal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	if ( (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+		|| (piHiPri(KEEPALIVE_PRIORITY) != 0))
+	{
+		printf("Warning: running without real time priority (needs root)\n");
+	}
+	// the bus lock is tried again until the next reload is due
+	relay16LockTimeoutSet(interval / 4 ? interval / 4 : 1);
+
+	next = keepaliveTimeUs();
+	keepaliveArm(fd, next, interval);
+	printf("Watchdog keepalive, period %us, reload every %ums\n", period, interval);
+	fflush(stdout);
+	while (!gKeepaliveStop)
+	{
+		if (read(fd, &exp, sizeof(exp)) != sizeof(exp))
+		{
+			if (errno != EINTR)
+			{
+				printf("Keepalive timer error!\n");
+				break;
+			}
+			if (gKeepaliveReport)
+			{
+				gKeepaliveReport = 0;
+				keepaliveReport(&st, period, interval);
+			}
+			continue;
+		}
+		deadline = next + (exp - 1) * interval * 1000ULL;
+		next = deadline + interval * 1000ULL;
+		st.ticks++;
+		st.missed += exp - 1;
+
+		// never unlocked, a reload that can not get the bus is skipped
+		while ( (ret = relay16Lock()) != OK)
+		{
+			st.lockTimeouts++;
+			if (gKeepaliveStop || (keepaliveTimeUs() >= next))
+			{
+				break;
+			}
+			usleep(KEEPALIVE_LOCK_RETRY_US);
+		}
+		if (ret != OK)
+		{
+			st.missed++;
+			printf("Reload skipped, the bus is busy\n");
+			fflush(stdout);
+			continue;
+		}
+		ret = relay16WdtReload(board);
+		if ( (ret == OK) && (intervalMs == 0))
+		{
+			if (OK != relay16WdtPeriodGet(board, &newPeriod))
+			{
+				newPeriod = period;
+			}
+		}
+		relay16Unlock();
+
+		now = keepaliveTimeUs();
+		latency = now - deadline > UINT32_MAX ? UINT32_MAX : (uint32_t) (now - deadline);
+		st.totalLatencyUs += latency;
+		if (latency > st.maxLatencyUs)
+		{
+			st.maxLatencyUs = latency;
+		}
+		if (exp > 1)
+		{
+			printf("%u reload(s) missed\n", (unsigned int) (exp - 1));
+		}
+		if (latency > KEEPALIVE_LATE_MS * 1000)
+		{
+			st.late++;
+			printf("Late reload, %ums after the deadline\n", latency / 1000);
+		}
+		if (ret != OK)
+		{
+			st.errors++;
+			printf("Fail to reload the watchdog: %s\n", relay16StrError(ret));
+		}
+		else
+		{
+			if ( (lastOk != 0) && ( (now - lastOk) / 1000 > st.maxGapMs))
+			{
+				st.maxGapMs = (now - lastOk) / 1000;
+			}
+			lastOk = now;
+			if ( (intervalMs == 0) && (newPeriod != 0) && (newPeriod != period))
+			{
+				period = newPeriod;
+				interval = period * 1000u / KEEPALIVE_DIVIDER;
+				relay16LockTimeoutSet(interval / 4 ? interval / 4 : 1);
+				next = now + interval * 1000ULL;
+				keepaliveArm(fd, next, interval);
+				printf("Watchdog period changed to %us, reload every %ums\n", period,
+					interval);
+			}
+		}
+		fflush(stdout);
+		if (gKeepaliveReport)
+		{
+			gKeepaliveReport = 0;
+			keepaliveReport(&st, period, interval);
+		}
+	}
+	keepaliveReport(&st, period, interval);
+	close(fd);
+	return st.errors ? ERROR : OK;
+}
@@ -0,0 +1,25 @@
+#ifndef KEEPALIVE_H_
+#define KEEPALIVE_H_
+
+#include "lib16relind.h"
+
+#define KEEPALIVE_DIVIDER	3	/* reloads per watchdog period */
+#define KEEPALIVE_PRIORITY	50	/* SCHED_RR priority */
+#define KEEPALIVE_LATE_MS	100	/* a reload later than this after its deadline is late */
+#define KEEPALIVE_LOCK_RETRY_US	1000	/* before the bus lock is tried again */
+
+typedef struct
+{
+	uint32_t ticks;
+	uint32_t missed; /* timer periods that passed without a reload, or without the bus */
+	uint32_t late; /* reloads done more than KEEPALIVE_LATE_MS after the deadline */
+	uint32_t errors; /* failed reloads */
+	uint32_t lockTimeouts; /* failed bus lock attempts */
+	uint32_t maxLatencyUs; /* from the deadline to the end of the reload */
+	uint64_t totalLatencyUs;
+	uint32_t maxGapMs; /* longest time between two successful reloads */
+} KeepaliveStatsType;
+
+int keepaliveRun(Relay16Board *board, unsigned int intervalMs);
+
+#endif //KEEPALIVE_H_
@@ -0,0 +1,2122 @@
+/*
+ * lib16relind.c:
+ *	Board access library for the Sixteen Relays 8-Layer Stackable HAT.
+ *	All the functions return an error code and never print.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	Author: Alexandru Burcea
+ ***********************************************************************
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "comm.h"
+#include "board.h"
+#include "discovery.h"
+#include "worker.h"
+#include "trace.h"
+
+static Relay16ChangeFn gChangeFn = NULL;
+static void *gChangeArg = NULL;
+
+static const u16 relayMaskRemap[16] = {0x8000, 0x4000, 0x2000, 0x1000, 0x800,
+	0x400, 0x200, 0x100, 0x80, 0x40, 0x20, 0x10, 0x8, 0x4, 0x2, 0x1};
+static const int relayChRemap[16] = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3,
+	2, 1, 0};
+
+uint16_t relay16ToIO(uint16_t relay)
+{
+	u8 i;
+	u16 val = 0;
+	for (i = 0; i < 16; i++)
+	{
+		if ( (relay & (1 << i)) != 0)
+			val += relayMaskRemap[i];
+	}
+	return val;
+}
+
+uint16_t relay16FromIO(uint16_t io)
+{
+	u8 i;
+	u16 val = 0;
+	for (i = 0; i < 16; i++)
+	{
+		if ( (io & relayMaskRemap[i]) != 0)
+		{
+			val += 1 << i;
+		}
+	}
+	return val;
+}
+
+const char* relay16StrError(int err)
+{
+	switch (err)
+	{
+	case RELAY16_OK:
+		return "OK";
+	case RELAY16_ERR_IO:
+		return "I2C transaction failed";
+	case RELAY16_ERR_PARAM:
+		return "Invalid parameter";
+	case RELAY16_ERR_NODEV:
+		return "Board not detected";
+	case RELAY16_ERR_BUS:
+		return "Failed to open the bus";
+	case RELAY16_ERR_NOMEM:
+		return "Out of memory";
+	case RELAY16_ERR_LOCK:
+		return "Fail to lock the bus";
+	case RELAY16_ERR_VERIFY:
+		return "Read back value does not match";
+	case RELAY16_ERR_TIMEOUT:
+		return "Timeout";
+	default:
+		return "Unknown error";
+	}
+}
+
+/*
+ * boardSetup:
+ *	Try one expander address, return the file descriptor and the CFG register
+ *********************************************************************************
+ */
+static int boardSetup(int bus, int hwAdd, u8 *cfg)
+{
+	int dev;
+
+	dev = i2cSetup(bus, hwAdd ^ 0x07);
+	if (dev < 0)
+	{
+		return RELAY16_ERR_BUS;
+	}
+	if (OK != i2cMem8Read(dev, RELAY16_CFG_REG_ADD, cfg, 1))
+	{
+		i2cClose(dev);
+		return RELAY16_ERR_NODEV;
+	}
+	return dev;
+}
+
+/*
+ * boardFind:
+ *	Open the board expander. A stack level found in the discovery cache is
+ *	opened with the CFG register read only, it is not 0 if the expander was
+ *	reset since it was configured. Otherwise, or if the cached address does
+ *	not answer, the 0x20 and then the 0x38 based addresses are probed. Only
+ *	the configured expanders and the missing boards are recorded.
+ *********************************************************************************
+ */
+static int boardFind(int bus, int stack, int refresh, int *add, u8 *cfg)
+{
+	int hwAdd;
+	int dev;
+
+	hwAdd = refresh ? DISCOVERY_UNKNOWN : discoveryGet(bus, stack);
+	if (hwAdd > 0)
+	{
+		dev = i2cSetup(bus, hwAdd);
+		if (dev < 0)
+		{
+			return RELAY16_ERR_BUS;
+		}
+		if (OK == i2cMem8Read(dev, RELAY16_CFG_REG_ADD, cfg, 1))
+		{
+			*add = hwAdd;
+			return dev;
+		}
+		// the board was removed or replaced
+		i2cClose(dev);
+		discoveryInvalidate(bus, stack);
+	}
+	hwAdd = RELAY16_HW_I2C_BASE_ADD + stack;
+	dev = boardSetup(bus, hwAdd, cfg);
+	if (dev == RELAY16_ERR_NODEV)
+	{
+		hwAdd = RELAY16_HW_I2C_ALTERNATE_BASE_ADD + stack;
+		dev = boardSetup(bus, hwAdd, cfg);
+	}
+	if (dev >= 0)
+	{
+		*add = hwAdd ^ 0x07;
+		if (*cfg == 0)
+		{
+			// the expander is configured, the next open can skip the probe
+			discoverySet(bus, stack, *add);
+		}
+	}
+	else if (dev == RELAY16_ERR_NODEV)
+	{
+		discoverySet(bus, stack, DISCOVERY_ABSENT);
+	}
+	return dev;
+}
+
+int relay16ProbeBus(int bus, int stack)
+{
+	u8 cfg;
+	int add;
+	int dev;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX) || (stack < 0)
+		|| (stack >= RELAY16_STACK_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	add = discoveryGet(bus, stack);
+	if (add == DISCOVERY_ABSENT)
+	{
+		return RELAY16_ERR_NODEV;
+	}
+	if (add > 0)
+	{
+		return RELAY16_OK;
+	}
+	dev = boardFind(bus, stack, 1, &add, &cfg);
+	if (dev < 0)
+	{
+		return dev;
+	}
+	i2cClose(dev);
+	return RELAY16_OK;
+}
+
+int relay16Probe(int stack)
+{
+	return relay16ProbeBus(RELAY16_BUS_DEFAULT, stack);
+}
+
+int relay16DiscoverBus(int bus, int refresh, uint8_t *stacks)
+{
+	u8 cfg;
+	int add;
+	int dev;
+	int i;
+
+	if (stacks == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	*stacks = 0;
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		if (refresh)
+		{
+			dev = boardFind(bus, i, 1, &add, &cfg);
+			if (dev >= 0)
+			{
+				i2cClose(dev);
+				dev = RELAY16_OK;
+			}
+		}
+		else
+		{
+			dev = relay16ProbeBus(bus, i);
+		}
+		if (dev == RELAY16_OK)
+		{
+			*stacks |= 1 << i;
+		}
+		else if (dev != RELAY16_ERR_NODEV)
+		{
+			return dev;
+		}
+	}
+	return RELAY16_OK;
+}
+
+int relay16Discover(int refresh, uint8_t *stacks)
+{
+	return relay16DiscoverBus(RELAY16_BUS_DEFAULT, refresh, stacks);
+}
+
+int relay16OpenBus(int bus, int stack, Relay16Board **board)
+{
+	Relay16Board *b;
+	int add;
+	int dev;
+	u8 buff[2];
+
+	if ( (board == NULL) || (bus < 0) || (bus >= RELAY16_BUS_MAX) || (stack < 0)
+		|| (stack >= RELAY16_STACK_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	dev = boardFind(bus, stack, 0, &add, buff);
+	if (dev < 0)
+	{
+		return dev;
+	}
+	if (buff[0] != 0) //non initialized I/O Expander
+	{
+		// make all I/O pins output
+		buff[0] = 0;
+		buff[1] = 0;
+		if (OK != i2cMem8Write(dev, RELAY16_CFG_REG_ADD, buff, 2))
+		{
+			i2cClose(dev);
+			discoveryInvalidate(bus, stack);
+			return RELAY16_ERR_IO;
+		}
+		// put all pins in 0-logic state
+		if (OK != i2cMem8Write(dev, RELAY16_OUTPORT_REG_ADD, buff, 2))
+		{
+			i2cClose(dev);
+			discoveryInvalidate(bus, stack);
+			return RELAY16_ERR_IO;
+		}
+		discoverySet(bus, stack, add);
+	}
+	b = calloc(1, sizeof(Relay16Board));
+	if (b == NULL)
+	{
+		i2cClose(dev);
+		return RELAY16_ERR_NOMEM;
+	}
+	b->bus = bus;
+	b->stack = stack;
+	b->add = add;
+	b->dev = dev;
+	b->cachePolicy = RELAY16_CACHE_OFF;
+	b->cacheResyncMs = CACHE_RESYNC_DEFAULT_MS;
+	b->verify.policy = RELAY16_VERIFY_NONE;
+	pthread_mutex_init(&b->lock, NULL);
+	*board = b;
+	return RELAY16_OK;
+}
+
+int relay16Open(int stack, Relay16Board **board)
+{
+	return relay16OpenBus(RELAY16_BUS_DEFAULT, stack, board);
+}
+
+void relay16Close(Relay16Board *board)
+{
+	if (board == NULL)
+	{
+		return;
+	}
+	pulseDetach(board);
+	relay16CoalesceFlush(board);
+	i2cClose(board->dev);
+	pthread_mutex_destroy(&board->lock);
+	free(board);
+}
+
+int relay16Bus(const Relay16Board *board)
+{
+	return board ? board->bus : RELAY16_ERR_PARAM;
+}
+
+int relay16Stack(const Relay16Board *board)
+{
+	return board ? board->stack : RELAY16_ERR_PARAM;
+}
+
+int relay16Address(const Relay16Board *board)
+{
+	return board ? board->add : RELAY16_ERR_PARAM;
+}
+
+/*
+ * Register access helpers, the caller holds the board lock
+ *********************************************************************************
+ */
+static int regRead(Relay16Board *b, int add, u8 *buff, int size)
+{
+	if (OK != i2cMem8Read(b->dev, add, buff, size))
+	{
+		discoveryInvalidate(b->bus, b->stack);
+		return RELAY16_ERR_IO;
+	}
+	return RELAY16_OK;
+}
+
+static int regWrite(Relay16Board *b, int add, u8 *buff, int size)
+{
+	if (OK != i2cMem8Write(b->dev, add, buff, size))
+	{
+		discoveryInvalidate(b->bus, b->stack);
+		return RELAY16_ERR_IO;
+	}
+	return RELAY16_OK;
+}
+
+static int reg16Read(Relay16Board *b, int add, u16 *val)
+{
+	u8 buff[2];
+	int ret;
+
+	ret = regRead(b, add, buff, 2);
+	if (ret == RELAY16_OK)
+	{
+		memcpy(val, buff, 2);
+	}
+	return ret;
+}
+
+static int reg16Write(Relay16Board *b, int add, u16 val)
+{
+	u8 buff[2];
+
+	memcpy(buff, &val, 2);
+	return regWrite(b, add, buff, 2);
+}
+
+static uint64_t timeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * verifyWrite:
+ *	Write the registers and read them back from rdAdd following the policy and
+ *	the board verification settings, the caller holds the board lock
+ *********************************************************************************
+ */
+static int verifyWrite(Relay16Board *b, Relay16VerifyPolicyType policy, int wrAdd,
+	int rdAdd, u8 *buff, int size)
+{
+	Relay16VerifyStatsType *st = &b->verifyStats;
+	uint32_t backoff = b->verify.backoffUs;
+	uint32_t attempts = 1;
+	uint64_t start;
+	uint64_t last;
+	uint64_t now;
+	uint64_t trace;
+	u8 rd[VERIFY_SIZE_MAX];
+	int ret;
+
+	if ( (policy == RELAY16_VERIFY_NONE) || (size > VERIFY_SIZE_MAX))
+	{
+		return regWrite(b, wrAdd, buff, size);
+	}
+	st->writes++;
+	trace = traceStart();
+	start = timeUs();
+	while (1)
+	{
+		ret = regWrite(b, wrAdd, buff, size);
+		if (ret == RELAY16_OK)
+		{
+			ret = regRead(b, rdAdd, rd, size);
+		}
+		if ( (ret == RELAY16_OK) && (memcmp(rd, buff, size) != 0))
+		{
+			// a reset expander reads back its inputs, probe it on the next open
+			discoveryInvalidate(b->bus, b->stack);
+			st->mismatches++;
+			ret = RELAY16_ERR_VERIFY;
+		}
+		if ( (ret != RELAY16_ERR_VERIFY) || (policy != RELAY16_VERIFY_RETRY))
+		{
+			break;
+		}
+		if (attempts > b->verify.retries)
+		{
+			st->failures++;
+			break;
+		}
+		// give up if the next attempt, as long as the last one, ends late
+		now = timeUs();
+		last = (now - start) / attempts;
+		if ( (b->verify.budgetUs != 0)
+			&& (now - start + backoff + last > b->verify.budgetUs))
+		{
+			st->timeouts++;
+			ret = RELAY16_ERR_TIMEOUT;
+			break;
+		}
+		if (backoff != 0)
+		{
+			usleep(backoff);
+			backoff = backoff * 2 > VERIFY_BACKOFF_MAX_US ? VERIFY_BACKOFF_MAX_US
+				: backoff * 2;
+		}
+		st->retries++;
+		attempts++;
+	}
+	if (attempts > 1)
+	{
+		traceRecord(RELAY16_TRACE_RETRY, b->bus, b->add, wrAdd, attempts, ret, trace);
+	}
+	return ret;
+}
+
+/*
+ * Locked register access for the public API
+ *********************************************************************************
+ */
+static int memRead(Relay16Board *b, int add, u8 *buff, int size)
+{
+	int ret;
+
+	if ( (b == NULL) || (buff == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	ret = regRead(b, add, buff, size);
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+static int memWrite(Relay16Board *b, int add, u8 *buff, int size)
+{
+	int ret;
+
+	if ( (b == NULL) || (buff == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	ret = regWrite(b, add, buff, size);
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+int relay16CachePolicySet(Relay16Board *board, Relay16CachePolicyType policy,
+	unsigned int resyncMs)
+{
+	int i;
+
+	if ( (board == NULL) || (policy >= RELAY16_CACHE_POLICY_COUNT))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	board->cachePolicy = policy;
+	board->cacheResyncMs = resyncMs ? resyncMs : CACHE_RESYNC_DEFAULT_MS;
+	for (i = 0; i < SHADOW_COUNT; i++)
+	{
+		board->shadow[i].valid = 0;
+	}
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16CachePolicyGet(Relay16Board *board, Relay16CachePolicyType *policy,
+	unsigned int *resyncMs)
+{
+	if ( (board == NULL) || (policy == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	*policy = board->cachePolicy;
+	if (resyncMs)
+	{
+		*resyncMs = board->cacheResyncMs;
+	}
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16CacheStatsGet(Relay16Board *board, Relay16CacheStatsType *stats,
+	int clear)
+{
+	if ( (board == NULL) || (stats == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	*stats = board->cacheStats;
+	if (clear)
+	{
+		memset(&board->cacheStats, 0, sizeof(board->cacheStats));
+	}
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+void relay16CacheInvalidate(Relay16Board *board)
+{
+	int i;
+
+	if (board == NULL)
+	{
+		return;
+	}
+	pthread_mutex_lock(&board->lock);
+	for (i = 0; i < SHADOW_COUNT; i++)
+	{
+		board->shadow[i].valid = 0;
+	}
+	pthread_mutex_unlock(&board->lock);
+}
+
+int relay16VerifySet(Relay16Board *board, const Relay16VerifyCfgType *cfg)
+{
+	if ( (board == NULL) || (cfg == NULL) || (cfg->policy >= RELAY16_VERIFY_POLICY_COUNT)
+		|| (cfg->backoffUs > VERIFY_BACKOFF_MAX_US))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	board->verify = *cfg;
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16VerifyGet(Relay16Board *board, Relay16VerifyCfgType *cfg)
+{
+	if ( (board == NULL) || (cfg == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	*cfg = board->verify;
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16VerifyStatsGet(Relay16Board *board, Relay16VerifyStatsType *stats,
+	int clear)
+{
+	if ( (board == NULL) || (stats == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	*stats = board->verifyStats;
+	if (clear)
+	{
+		memset(&board->verifyStats, 0, sizeof(board->verifyStats));
+	}
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16MemRead(Relay16Board *board, int add, uint8_t *buff, int size)
+{
+	if ( (add < 0) || (size <= 0) || (add + size > SLAVE_BUFF_SIZE))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	return memRead(board, add, buff, size);
+}
+
+int relay16MemWrite(Relay16Board *board, int add, uint8_t *buff, int size)
+{
+	int ret;
+
+	if ( (add < 0) || (size <= 0) || (add + size > SLAVE_BUFF_SIZE))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	ret = memWrite(board, add, buff, size);
+	// raw writes over the relay registers make the shadow copy stale
+	if ( (add <= RELAY16_OUTPORT_REG_ADD + 1 && add + size > RELAY16_OUTPORT_REG_ADD)
+		|| (add <= I2C_MEM_RELAY_FAILSAFE_VAL_ADD + 1
+			&& add + size > I2C_MEM_RELAY_FAILSAFE_EN_ADD))
+	{
+		relay16CacheInvalidate(board);
+	}
+	return ret;
+}
+
+uint64_t boardTimeMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Relay bitmap registers: the outputs, the failsafe enable and the failsafe value
+ * share the same channel mapping. The outputs are read back from the input port.
+ *********************************************************************************
+ */
+static const struct
+{
+	int rdAdd;
+	int wrAdd;
+} gShadowReg[SHADOW_COUNT] = {
+	{RELAY16_INPORT_REG_ADD, RELAY16_OUTPORT_REG_ADD},
+	{I2C_MEM_RELAY_FAILSAFE_EN_ADD, I2C_MEM_RELAY_FAILSAFE_EN_ADD},
+	{I2C_MEM_RELAY_FAILSAFE_VAL_ADD, I2C_MEM_RELAY_FAILSAFE_VAL_ADD}};
+
+static int shadowFresh(Relay16Board *b, int idx)
+{
+	ShadowRegType *sh = &b->shadow[idx];
+
+	if (!sh->valid)
+	{
+		return 0;
+	}
+	switch (b->cachePolicy)
+	{
+	case RELAY16_CACHE_TRUST:
+	case RELAY16_CACHE_VERIFY:
+		return 1;
+	case RELAY16_CACHE_RESYNC:
+		return boardTimeMs() - sh->stampMs < b->cacheResyncMs;
+	default:
+		return 0;
+	}
+}
+
+static void shadowUpdate(Relay16Board *b, int idx, u16 val)
+{
+	if (b->cachePolicy != RELAY16_CACHE_OFF)
+	{
+		b->shadow[idx].val = val;
+		b->shadow[idx].valid = 1;
+		b->shadow[idx].stampMs = boardTimeMs();
+	}
+}
+
+/*
+ * shadowRead / shadowWrite:
+ *	Register access through the shadow copy, the caller holds the board lock
+ *********************************************************************************
+ */
+static int shadowRead(Relay16Board *b, int idx, u16 *val)
+{
+	int ret;
+
+	if (shadowFresh(b, idx))
+	{
+		b->cacheStats.hits++;
+		*val = b->shadow[idx].val;
+		return RELAY16_OK;
+	}
+	b->cacheStats.misses++;
+	ret = reg16Read(b, gShadowReg[idx].rdAdd, val);
+	if (ret == RELAY16_OK)
+	{
+		shadowUpdate(b, idx, *val);
+	}
+	else
+	{
+		b->shadow[idx].valid = 0;
+	}
+	return ret;
+}
+
+/* the cache VERIFY policy reads the relay registers back */
+static Relay16VerifyPolicyType shadowVerifyPolicy(Relay16Board *b)
+{
+	if ( (b->verify.policy == RELAY16_VERIFY_NONE)
+		&& (b->cachePolicy == RELAY16_CACHE_VERIFY))
+	{
+		return RELAY16_VERIFY_READBACK;
+	}
+	return b->verify.policy;
+}
+
+void relay16ChangeHook(Relay16ChangeFn fn, void *arg)
+{
+	gChangeArg = arg;
+	__atomic_store_n(&gChangeFn, fn, __ATOMIC_RELEASE);
+}
+
+static void changeNotify(Relay16Board *b, u16 val)
+{
+	Relay16ChangeFn fn = __atomic_load_n(&gChangeFn, __ATOMIC_ACQUIRE);
+
+	if (fn != NULL)
+	{
+		fn(b, relay16FromIO(val), gChangeArg);
+	}
+}
+
+static int shadowWrite(Relay16Board *b, int idx, u16 val)
+{
+	u8 buff[2];
+	int ret;
+
+	b->cacheStats.writes++;
+	memcpy(buff, &val, 2);
+	ret = verifyWrite(b, shadowVerifyPolicy(b), gShadowReg[idx].wrAdd,
+		gShadowReg[idx].rdAdd, buff, 2);
+	if (ret == RELAY16_ERR_VERIFY)
+	{
+		b->cacheStats.verifyErrors++;
+	}
+	if (ret == RELAY16_OK)
+	{
+		shadowUpdate(b, idx, val);
+		if (idx == SHADOW_OUT)
+		{
+			changeNotify(b, val);
+		}
+	}
+	else
+	{
+		b->shadow[idx].valid = 0;
+	}
+	return ret;
+}
+
+/*
+ * coalesceAdd:
+ *	Merge an output change (expander bit order) in the pending ones, returns 1
+ *	when the window starts and its end must be scheduled. The caller holds the
+ *	board lock.
+ *********************************************************************************
+ */
+static int coalesceAdd(Relay16Board *b, u16 set, u16 clr)
+{
+	b->coalesceSet = (b->coalesceSet & ~clr) | set;
+	b->coalesceClr = (b->coalesceClr & ~set) | clr;
+	b->coalesceCount++;
+	b->coalesceStats.changes++;
+	if (b->coalesceScheduled || (b->coalesceUs == RELAY16_COALESCE_MANUAL))
+	{
+		return 0;
+	}
+	b->coalesceScheduled = 1;
+	return 1;
+}
+
+static int coalesceSchedule(Relay16Board *b)
+{
+	uint32_t us;
+
+	pthread_mutex_lock(&b->lock);
+	us = b->coalesceUs;
+	pthread_mutex_unlock(&b->lock);
+	// the timer heap lock is taken after the board lock is released
+	if (RELAY16_OK != pulseFlushAfter(b, us))
+	{
+		return relay16CoalesceFlush(b); // no timer, write now
+	}
+	return RELAY16_OK;
+}
+
+static int maskChSet(Relay16Board *b, int idx, int channel, int state)
+{
+	u16 val = 0;
+	u16 bit;
+	int schedule;
+	int ret;
+
+	if ( (b == NULL) || (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	if ( (state != OFF) && (state != ON))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	if ( (idx == SHADOW_OUT) && (b->coalesceUs != RELAY16_COALESCE_OFF))
+	{
+		bit = 1 << relayChRemap[channel - 1];
+		schedule = coalesceAdd(b, state == ON ? bit : 0, state == ON ? 0 : bit);
+		pthread_mutex_unlock(&b->lock);
+		return schedule ? coalesceSchedule(b) : RELAY16_OK;
+	}
+	ret = shadowRead(b, idx, &val);
+	if (ret == RELAY16_OK)
+	{
+		if (state == ON)
+		{
+			val |= 1 << relayChRemap[channel - 1];
+		}
+		else
+		{
+			val &= ~ (1 << relayChRemap[channel - 1]);
+		}
+		ret = shadowWrite(b, idx, val);
+	}
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+static int maskChGet(Relay16Board *b, int idx, int channel, int *state)
+{
+	u16 val = 0;
+	int ret;
+
+	if ( (b == NULL) || (state == NULL) || (channel < CHANNEL_NR_MIN)
+		|| (channel > RELAY_CH_NR_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	ret = shadowRead(b, idx, &val);
+	if (idx == SHADOW_OUT)
+	{
+		val = (val & ~b->coalesceClr) | b->coalesceSet;
+	}
+	pthread_mutex_unlock(&b->lock);
+	if (ret == RELAY16_OK)
+	{
+		*state = (val & (1 << relayChRemap[channel - 1])) ? ON : OFF;
+	}
+	return ret;
+}
+
+static int maskSet(Relay16Board *b, int idx, uint16_t val)
+{
+	int schedule;
+	int ret;
+
+	if (b == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	if ( (idx == SHADOW_OUT) && (b->coalesceUs != RELAY16_COALESCE_OFF))
+	{
+		schedule = coalesceAdd(b, relay16ToIO(val), ~relay16ToIO(val));
+		pthread_mutex_unlock(&b->lock);
+		return schedule ? coalesceSchedule(b) : RELAY16_OK;
+	}
+	ret = shadowWrite(b, idx, relay16ToIO(val));
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+static int maskGet(Relay16Board *b, int idx, uint16_t *val)
+{
+	u16 rVal = 0;
+	int ret;
+
+	if ( (b == NULL) || (val == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	ret = shadowRead(b, idx, &rVal);
+	if (idx == SHADOW_OUT)
+	{
+		rVal = (rVal & ~b->coalesceClr) | b->coalesceSet;
+	}
+	pthread_mutex_unlock(&b->lock);
+	if (ret == RELAY16_OK)
+	{
+		*val = relay16FromIO(rVal);
+	}
+	return ret;
+}
+
+/*
+ * maskUpdate:
+ *	Turn on the bits in set, off the ones in clr and invert the ones in tgl
+ *	(expander bit order) with one register write, on top of the pending
+ *	coalesced changes for the outputs. Nothing is written if the register is
+ *	already in that state, nothing is read if all the bits are given. The
+ *	caller holds the board lock.
+ *********************************************************************************
+ */
+static int maskUpdate(Relay16Board *b, int idx, u16 set, u16 clr, u16 tgl)
+{
+	Relay16CoalesceStatsType *st = &b->coalesceStats;
+	int count = 0;
+	int wrote = 0;
+	u16 val = 0;
+	u16 newVal;
+	int ret;
+
+	if (idx == SHADOW_OUT)
+	{
+		count = b->coalesceCount;
+		set |= b->coalesceSet & ~clr;
+		clr |= b->coalesceClr & ~set;
+		b->coalesceSet = 0;
+		b->coalesceClr = 0;
+		b->coalesceCount = 0;
+		b->coalesceScheduled = 0;
+	}
+	if ( (set == 0) && (clr == 0) && (tgl == 0))
+	{
+		return RELAY16_OK;
+	}
+	if ( (tgl == 0) && ( (set | clr) == 0xffff) && !shadowFresh(b, idx))
+	{
+		ret = shadowWrite(b, idx, set); // write only
+		wrote = 1;
+	}
+	else
+	{
+		ret = shadowRead(b, idx, &val);
+		if (ret == RELAY16_OK)
+		{
+			newVal = ( (val & ~clr) | set) ^ tgl;
+			if (newVal != val)
+			{
+				ret = shadowWrite(b, idx, newVal);
+				wrote = 1;
+			}
+		}
+	}
+	if (count > 0)
+	{
+		st->flushes++;
+		st->writes += wrote;
+		st->saved += count - wrote;
+		if (ret != RELAY16_OK)
+		{
+			st->errors++;
+		}
+	}
+	return ret;
+}
+
+/*
+ * boardMaskUpdate:
+ *	maskUpdate for relay bitmaps
+ *********************************************************************************
+ */
+int boardMaskUpdate(Relay16Board *b, int idx, uint16_t set, uint16_t clr)
+{
+	int ret;
+
+	if (b == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&b->lock);
+	ret = maskUpdate(b, idx, relay16ToIO(set), relay16ToIO(clr), 0);
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+/*
+ * maskOp:
+ *	maskUpdate for the public API, the set and clear are coalesced when the
+ *	coalescing is on, a toggle needs the state and writes the pending changes
+ *********************************************************************************
+ */
+static int maskOp(Relay16Board *b, int idx, u16 set, u16 clr, u16 tgl)
+{
+	int schedule;
+	int ret;
+
+	if (b == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	if ( (set == 0) && (clr == 0) && (tgl == 0))
+	{
+		return RELAY16_OK;
+	}
+	pthread_mutex_lock(&b->lock);
+	if ( (idx == SHADOW_OUT) && (tgl == 0)
+		&& (b->coalesceUs != RELAY16_COALESCE_OFF))
+	{
+		schedule = coalesceAdd(b, set, clr);
+		pthread_mutex_unlock(&b->lock);
+		return schedule ? coalesceSchedule(b) : RELAY16_OK;
+	}
+	ret = maskUpdate(b, idx, set, clr, tgl);
+	pthread_mutex_unlock(&b->lock);
+	return ret;
+}
+
+int relay16MaskSet(Relay16Board *board, uint16_t mask)
+{
+	return maskOp(board, SHADOW_OUT, relay16ToIO(mask), 0, 0);
+}
+
+int relay16MaskClear(Relay16Board *board, uint16_t mask)
+{
+	return maskOp(board, SHADOW_OUT, 0, relay16ToIO(mask), 0);
+}
+
+int relay16MaskToggle(Relay16Board *board, uint16_t mask)
+{
+	return maskOp(board, SHADOW_OUT, 0, 0, relay16ToIO(mask));
+}
+
+int relay16MaskApply(Relay16Board *board, uint16_t mask, uint16_t val)
+{
+	return maskOp(board, SHADOW_OUT, relay16ToIO(mask & val),
+		relay16ToIO(mask & ~val), 0);
+}
+
+int relay16CoalesceSet(Relay16Board *board, uint32_t windowUs)
+{
+	int ret = RELAY16_OK;
+
+	if (board == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	board->coalesceUs = windowUs;
+	if (windowUs == RELAY16_COALESCE_OFF)
+	{
+		ret = maskUpdate(board, SHADOW_OUT, 0, 0, 0);
+	}
+	pthread_mutex_unlock(&board->lock);
+	return ret;
+}
+
+int relay16CoalesceGet(Relay16Board *board, uint32_t *windowUs)
+{
+	if ( (board == NULL) || (windowUs == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	*windowUs = board->coalesceUs;
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16CoalesceFlush(Relay16Board *board)
+{
+	int ret;
+
+	if (board == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	ret = maskUpdate(board, SHADOW_OUT, 0, 0, 0);
+	pthread_mutex_unlock(&board->lock);
+	return ret;
+}
+
+int relay16CoalesceStatsGet(Relay16Board *board, Relay16CoalesceStatsType *stats,
+	int clear)
+{
+	if ( (board == NULL) || (stats == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	*stats = board->coalesceStats;
+	if (clear)
+	{
+		memset(&board->coalesceStats, 0, sizeof(board->coalesceStats));
+	}
+	pthread_mutex_unlock(&board->lock);
+	return RELAY16_OK;
+}
+
+int relay16ChSet(Relay16Board *board, int channel, int state)
+{
+	return maskChSet(board, SHADOW_OUT, channel, state);
+}
+
+int relay16ChGet(Relay16Board *board, int channel, int *state)
+{
+	return maskChGet(board, SHADOW_OUT, channel, state);
+}
+
+int relay16Set(Relay16Board *board, uint16_t val)
+{
+	return maskSet(board, SHADOW_OUT, val);
+}
+
+int relay16Get(Relay16Board *board, uint16_t *val)
+{
+	return maskGet(board, SHADOW_OUT, val);
+}
+
+typedef struct
+{
+	Relay16Board *board;
+	u16 io;
+	int change;
+	int ret;
+	uint64_t wrStart;
+	uint64_t wrEnd;
+} SceneBoardType;
+
+typedef struct
+{
+	int bus;
+	SceneBoardType *sb;
+	int count;
+} SceneBusType;
+
+/*
+ * sceneBus:
+ *	Scene part of one bus: read the current states, then write the changed
+ *	boards back to back, the VERIFY read back is done after the last write
+ *********************************************************************************
+ */
+static void sceneBus(void *arg)
+{
+	SceneBusType *sc = arg;
+	SceneBoardType *sb;
+	u16 cur = 0;
+	u16 rd = 0;
+	int err;
+	int i;
+
+	for (i = 0; i < sc->count; i++)
+	{
+		sb = &sc->sb[i];
+		if (sb->board->bus != sc->bus)
+		{
+			continue;
+		}
+		err = shadowRead(sb->board, SHADOW_OUT, &cur);
+		// write anyway if the state is unknown
+		sb->change = (err != RELAY16_OK) || (cur != sb->io);
+	}
+	for (i = 0; i < sc->count; i++)
+	{
+		sb = &sc->sb[i];
+		if ( (sb->board->bus != sc->bus) || !sb->change)
+		{
+			continue;
+		}
+		sb->board->cacheStats.writes++;
+		sb->wrStart = timeUs();
+		sb->ret = reg16Write(sb->board, gShadowReg[SHADOW_OUT].wrAdd, sb->io);
+		sb->wrEnd = timeUs();
+		if (sb->ret == RELAY16_OK)
+		{
+			shadowUpdate(sb->board, SHADOW_OUT, sb->io);
+		}
+		else
+		{
+			sb->board->shadow[SHADOW_OUT].valid = 0;
+		}
+	}
+	for (i = 0; i < sc->count; i++)
+	{
+		sb = &sc->sb[i];
+		if ( (sb->board->bus != sc->bus) || !sb->change || (sb->ret != RELAY16_OK)
+			|| (shadowVerifyPolicy(sb->board) == RELAY16_VERIFY_NONE))
+		{
+			continue;
+		}
+		// no retry, the scene timing matters more
+		sb->board->verifyStats.writes++;
+		sb->ret = reg16Read(sb->board, gShadowReg[SHADOW_OUT].rdAdd, &rd);
+		if ( (sb->ret == RELAY16_OK) && (rd != sb->io))
+		{
+			discoveryInvalidate(sb->board->bus, sb->board->stack);
+			sb->board->verifyStats.mismatches++;
+			sb->board->cacheStats.verifyErrors++;
+			sb->ret = RELAY16_ERR_VERIFY;
+		}
+		if (sb->ret != RELAY16_OK)
+		{
+			sb->board->shadow[SHADOW_OUT].valid = 0;
+		}
+	}
+	// out of the writes, not to add to the skew
+	for (i = 0; i < sc->count; i++)
+	{
+		sb = &sc->sb[i];
+		if ( (sb->board->bus == sc->bus) && sb->change && (sb->wrEnd != 0))
+		{
+			changeNotify(sb->board, sb->io);
+		}
+	}
+}
+
+/*
+ * boardBefore:
+ *	Order of the board locks taken together, by bus, stack level and handle
+ *********************************************************************************
+ */
+static int boardBefore(const Relay16Board *a, const Relay16Board *b)
+{
+	if (a->bus != b->bus)
+	{
+		return a->bus < b->bus;
+	}
+	if (a->stack != b->stack)
+	{
+		return a->stack < b->stack;
+	}
+	return (uintptr_t)a < (uintptr_t)b;
+}
+
+/*
+ * relay16SceneSet:
+ *	Set the relays of several boards as close in time as possible. All the
+ *	boards are locked, then every bus does its part of the scene, the buses
+ *	concurrently in multi-bus mode.
+ *********************************************************************************
+ */
+int relay16SceneSet(Relay16Board *board[], const uint16_t val[], int count,
+	Relay16SceneStatsType *stats)
+{
+	SceneBoardType sb[RELAY16_SCENE_MAX];
+	SceneBusType sc[RELAY16_SCENE_MAX];
+	BusJobType job[RELAY16_SCENE_MAX];
+	Relay16Board *locked[RELAY16_SCENE_MAX];
+	uint64_t start;
+	uint64_t wrStart = 0;
+	uint64_t wrEnd = 0;
+	int changed = 0;
+	int jobs = 0;
+	int ret = RELAY16_OK;
+	int i;
+	int j;
+
+	if ( (board == NULL) || (val == NULL) || (count < 1)
+		|| (count > RELAY16_SCENE_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (board[i] == NULL)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		for (j = 0; j < i; j++)
+		{
+			if (board[j] == board[i])
+			{
+				return RELAY16_ERR_PARAM;
+			}
+		}
+	}
+	start = timeUs();
+	memset(sb, 0, sizeof(sb));
+	for (i = 0; i < count; i++)
+	{
+		sb[i].board = board[i];
+		sb[i].io = relay16ToIO(val[i]);
+		for (j = 0; (j < jobs) && (sc[j].bus != board[i]->bus); j++)
+			;
+		if (j == jobs)
+		{
+			sc[jobs].bus = board[i]->bus;
+			sc[jobs].sb = sb;
+			sc[jobs].count = count;
+			job[jobs].bus = board[i]->bus;
+			job[jobs].fn = sceneBus;
+			job[jobs].arg = &sc[jobs];
+			jobs++;
+		}
+	}
+	// the same lock order for all the callers, whatever the board order
+	for (i = 0; i < count; i++)
+	{
+		for (j = i; (j > 0) && boardBefore(board[i], locked[j - 1]); j--)
+		{
+			locked[j] = locked[j - 1];
+		}
+		locked[j] = board[i];
+	}
+	for (i = 0; i < count; i++)
+	{
+		pthread_mutex_lock(&locked[i]->lock);
+		// the scene value replaces the pending coalesced changes
+		locked[i]->coalesceStats.saved += locked[i]->coalesceCount;
+		locked[i]->coalesceSet = 0;
+		locked[i]->coalesceClr = 0;
+		locked[i]->coalesceCount = 0;
+	}
+	busJobsRun(job, jobs);
+	for (i = count - 1; i >= 0; i--)
+	{
+		pthread_mutex_unlock(&locked[i]->lock);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (!sb[i].change)
+		{
+			continue;
+		}
+		if ( (changed++ == 0) || (sb[i].wrStart < wrStart))
+		{
+			wrStart = sb[i].wrStart;
+		}
+		if (sb[i].wrEnd > wrEnd)
+		{
+			wrEnd = sb[i].wrEnd;
+		}
+		if ( (ret == RELAY16_OK) && (sb[i].ret != RELAY16_OK))
+		{
+			ret = sb[i].ret;
+		}
+	}
+	if (stats != NULL)
+	{
+		stats->boards = count;
+		stats->changed = changed;
+		stats->skewUs = (uint32_t) (wrEnd - wrStart);
+		stats->totalUs = (uint32_t) (timeUs() - start);
+	}
+	return ret;
+}
+
+typedef struct
+{
+	Relay16Board *board;
+	uint16_t *val;
+	int ret;
+} GetJobType;
+
+static void getJob(void *arg)
+{
+	GetJobType *g = arg;
+
+	g->ret = maskGet(g->board, SHADOW_OUT, g->val);
+}
+
+/*
+ * relay16GetMany:
+ *	Read the relays of several boards, the buses concurrently in multi-bus mode
+ *********************************************************************************
+ */
+int relay16GetMany(Relay16Board *board[], uint16_t val[], int count)
+{
+	GetJobType get[RELAY16_SCENE_MAX];
+	BusJobType job[RELAY16_SCENE_MAX];
+	int ret = RELAY16_OK;
+	int i;
+
+	if ( (board == NULL) || (val == NULL) || (count < 1)
+		|| (count > RELAY16_SCENE_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (board[i] == NULL)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		get[i].board = board[i];
+		get[i].val = &val[i];
+		get[i].ret = RELAY16_OK;
+		job[i].bus = board[i]->bus;
+		job[i].fn = getJob;
+		job[i].arg = &get[i];
+	}
+	busJobsRun(job, count);
+	for (i = 0; (i < count) && (ret == RELAY16_OK); i++)
+	{
+		ret = get[i].ret;
+	}
+	return ret;
+}
+
+void relay16MultiBus(int enable)
+{
+	busWorkersEnable(enable);
+}
+
+// enable failsafe state for each relay, 0 = off, 1 = on
+int relay16FailsafeEnChSet(Relay16Board *board, int channel, int state)
+{
+	return maskChSet(board, SHADOW_FS_EN, channel, state);
+}
+
+int relay16FailsafeEnChGet(Relay16Board *board, int channel, int *state)
+{
+	return maskChGet(board, SHADOW_FS_EN, channel, state);
+}
+
+int relay16FailsafeEnSet(Relay16Board *board, uint16_t val)
+{
+	return maskSet(board, SHADOW_FS_EN, val);
+}
+
+int relay16FailsafeEnGet(Relay16Board *board, uint16_t *val)
+{
+	return maskGet(board, SHADOW_FS_EN, val);
+}
+
+// set/get failsafe state for each relay, 0 = off, 1 = on
+int relay16FailsafeValChSet(Relay16Board *board, int channel, int state)
+{
+	return maskChSet(board, SHADOW_FS_VAL, channel, state);
+}
+
+int relay16FailsafeValChGet(Relay16Board *board, int channel, int *state)
+{
+	return maskChGet(board, SHADOW_FS_VAL, channel, state);
+}
+
+int relay16FailsafeValSet(Relay16Board *board, uint16_t val)
+{
+	return maskSet(board, SHADOW_FS_VAL, val);
+}
+
+int relay16FailsafeValGet(Relay16Board *board, uint16_t *val)
+{
+	return maskGet(board, SHADOW_FS_VAL, val);
+}
+
+/*
+ * profileRead:
+ *	Failsafe enable and value (expander bit order) from the shadows or with one
+ *	read of the two adjacent registers, the caller holds the board lock
+ *********************************************************************************
+ */
+static int profileRead(Relay16Board *b, u16 *en, u16 *val)
+{
+	u8 buff[4];
+	int ret;
+
+	if (shadowFresh(b, SHADOW_FS_EN) && shadowFresh(b, SHADOW_FS_VAL))
+	{
+		b->cacheStats.hits++;
+		*en = b->shadow[SHADOW_FS_EN].val;
+		*val = b->shadow[SHADOW_FS_VAL].val;
+		return RELAY16_OK;
+	}
+	b->cacheStats.misses++;
+	ret = regRead(b, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 4);
+	if (ret == RELAY16_OK)
+	{
+		memcpy(en, buff, 2);
+		memcpy(val, buff + 2, 2);
+		shadowUpdate(b, SHADOW_FS_EN, *en);
+		shadowUpdate(b, SHADOW_FS_VAL, *val);
+	}
+	else
+	{
+		b->shadow[SHADOW_FS_EN].valid = 0;
+		b->shadow[SHADOW_FS_VAL].valid = 0;
+	}
+	return ret;
+}
+
+/*
+ * profileWrite:
+ *	Write the failsafe enable and value (expander bit order) with one write of
+ *	the two adjacent registers, so the board never runs with half a profile.
+ *	Nothing is written if the board has that profile already, changed tells
+ *	if it was written. The caller holds the board lock.
+ *********************************************************************************
+ */
+static int profileWrite(Relay16Board *b, u16 en, u16 val, int *changed)
+{
+	u8 buff[4];
+	u16 curEn = 0;
+	u16 curVal = 0;
+	int ret;
+
+	ret = profileRead(b, &curEn, &curVal);
+	// write anyway if the profile is unknown
+	*changed = (ret != RELAY16_OK) || (curEn != en) || (curVal != val);
+	if (!*changed)
+	{
+		return RELAY16_OK;
+	}
+	b->cacheStats.writes++;
+	memcpy(buff, &en, 2);
+	memcpy(buff + 2, &val, 2);
+	ret = verifyWrite(b, shadowVerifyPolicy(b), I2C_MEM_RELAY_FAILSAFE_EN_ADD,
+		I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 4);
+	if (ret == RELAY16_ERR_VERIFY)
+	{
+		b->cacheStats.verifyErrors++;
+	}
+	if (ret == RELAY16_OK)
+	{
+		shadowUpdate(b, SHADOW_FS_EN, en);
+		shadowUpdate(b, SHADOW_FS_VAL, val);
+	}
+	else
+	{
+		b->shadow[SHADOW_FS_EN].valid = 0;
+		b->shadow[SHADOW_FS_VAL].valid = 0;
+	}
+	return ret;
+}
+
+int relay16FailsafeProfileSet(Relay16Board *board,
+	const Relay16FailsafeProfileType *profile)
+{
+	int changed;
+	int ret;
+
+	if ( (board == NULL) || (profile == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	ret = profileWrite(board, relay16ToIO(profile->en), relay16ToIO(profile->val),
+		&changed);
+	pthread_mutex_unlock(&board->lock);
+	return ret;
+}
+
+int relay16FailsafeProfileGet(Relay16Board *board,
+	Relay16FailsafeProfileType *profile)
+{
+	u16 en = 0;
+	u16 val = 0;
+	int ret;
+
+	if ( (board == NULL) || (profile == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&board->lock);
+	ret = profileRead(board, &en, &val);
+	pthread_mutex_unlock(&board->lock);
+	if (ret == RELAY16_OK)
+	{
+		profile->en = relay16FromIO(en);
+		profile->val = relay16FromIO(val);
+	}
+	return ret;
+}
+
+typedef struct
+{
+	Relay16Board *board;
+	const Relay16FailsafeProfileType *profile;
+	int changed;
+	int ret;
+} ProfileJobType;
+
+static void profileJob(void *arg)
+{
+	ProfileJobType *p = arg;
+
+	pthread_mutex_lock(&p->board->lock);
+	p->ret = profileWrite(p->board, relay16ToIO(p->profile->en),
+		relay16ToIO(p->profile->val), &p->changed);
+	pthread_mutex_unlock(&p->board->lock);
+}
+
+/*
+ * relay16FailsafeProfileSetMany:
+ *	Set the failsafe profile of several boards, the buses concurrently in
+ *	multi-bus mode. Only the boards with a different profile are written, their
+ *	number goes to written. All the boards are tried, the first error is
+ *	returned.
+ *********************************************************************************
+ */
+int relay16FailsafeProfileSetMany(Relay16Board *board[],
+	const Relay16FailsafeProfileType profile[], int count, int *written)
+{
+	ProfileJobType prof[RELAY16_SCENE_MAX];
+	BusJobType job[RELAY16_SCENE_MAX];
+	int ret = RELAY16_OK;
+	int i;
+	int j;
+
+	if ( (board == NULL) || (profile == NULL) || (count < 1)
+		|| (count > RELAY16_SCENE_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (board[i] == NULL)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		for (j = 0; j < i; j++)
+		{
+			if (board[j] == board[i])
+			{
+				return RELAY16_ERR_PARAM;
+			}
+		}
+		prof[i].board = board[i];
+		prof[i].profile = &profile[i];
+		prof[i].changed = 0;
+		prof[i].ret = RELAY16_OK;
+		job[i].bus = board[i]->bus;
+		job[i].fn = profileJob;
+		job[i].arg = &prof[i];
+	}
+	busJobsRun(job, count);
+	if (written != NULL)
+	{
+		*written = 0;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if ( (written != NULL) && prof[i].changed && (prof[i].ret == RELAY16_OK))
+		{
+			(*written)++;
+		}
+		if (ret == RELAY16_OK)
+		{
+			ret = prof[i].ret;
+		}
+	}
+	return ret;
+}
+
+int relay16LedModeSet(Relay16Board *board, Relay16LedModeType mode)
+{
+	u8 buff[1];
+
+	if (mode > RELAY16_LED_OFF)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	buff[0] = (u8)mode;
+	return memWrite(board, I2C_MEM_LED_MODE, buff, 1);
+}
+
+int relay16FwVersionGet(Relay16Board *board, int *major, int *minor)
+{
+	u8 buff[2];
+	int ret;
+
+	if ( (major == NULL) || (minor == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	ret = memRead(board, I2C_MEM_REVISION_MAJOR_ADD, buff, 2);
+	if (ret == RELAY16_OK)
+	{
+		*major = buff[0];
+		*minor = buff[1];
+	}
+	return ret;
+}
+
+//************************************************************* WDT *************************************************
+
+int relay16WdtReload(Relay16Board *board)
+{
+	u8 buff[1] = {WDT_RESET_SIGNATURE};
+
+	return memWrite(board, I2C_MEM_WDT_RESET_ADD, buff, 1);
+}
+
+static int wdtPeriodSet(Relay16Board *b, int add, u32 period, int size)
+{
+	u8 buff[4];
+
+	memcpy(buff, &period, size);
+	return memWrite(b, add, buff, size);
+}
+
+static int wdtPeriodGet(Relay16Board *b, int add, u32 *period, int size)
+{
+	u8 buff[4] = {0, 0, 0, 0};
+	int ret;
+
+	if (period == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	ret = memRead(b, add, buff, size);
+	if (ret == RELAY16_OK)
+	{
+		*period = 0;
+		memcpy(period, buff, size);
+	}
+	return ret;
+}
+
+int relay16WdtPeriodSet(Relay16Board *board, uint16_t period)
+{
+	if (period == 0)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	return wdtPeriodSet(board, I2C_MEM_WDT_INTERVAL_SET_ADD, period, 2);
+}
+
+int relay16WdtPeriodGet(Relay16Board *board, uint16_t *period)
+{
+	u32 val = 0;
+	int ret;
+
+	if (period == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	ret = wdtPeriodGet(board, I2C_MEM_WDT_INTERVAL_GET_ADD, &val, 2);
+	*period = (u16)val;
+	return ret;
+}
+
+int relay16WdtInitPeriodSet(Relay16Board *board, uint16_t period)
+{
+	if (period == 0)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	return wdtPeriodSet(board, I2C_MEM_WDT_INIT_INTERVAL_SET_ADD, period, 2);
+}
+
+int relay16WdtInitPeriodGet(Relay16Board *board, uint16_t *period)
+{
+	u32 val = 0;
+	int ret;
+
+	if (period == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	ret = wdtPeriodGet(board, I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, &val, 2);
+	*period = (u16)val;
+	return ret;
+}
+
+int relay16WdtOffPeriodSet(Relay16Board *board, uint32_t period)
+{
+	if ( (period == 0) || (period > WDT_MAX_OFF_INTERVAL_S))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	return wdtPeriodSet(board, I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD, period,
+		4);
+}
+
+int relay16WdtOffPeriodGet(Relay16Board *board, uint32_t *period)
+{
+	return wdtPeriodGet(board, I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, period, 4);
+}
+
+//********************************************** RS485 *******************************************************
+
+static void cfg485Pack(const Relay16Rs485CfgType *cfg, u8 *buff)
+{
+	ModbusSetingsType settings;
+
+	settings.mbBaud = cfg->baud;
+	settings.mbType = cfg->mode;
+	settings.mbParity = cfg->parity;
+	settings.mbStopB = cfg->stopBits;
+	settings.add = cfg->add;
+	memcpy(buff, &settings, sizeof(ModbusSetingsType));
+}
+
+static void cfg485Unpack(const u8 *buff, Relay16Rs485CfgType *cfg)
+{
+	ModbusSetingsType settings;
+
+	memcpy(&settings, buff, sizeof(ModbusSetingsType));
+	cfg->mode = settings.mbType;
+	cfg->baud = settings.mbBaud;
+	cfg->stopBits = settings.mbStopB;
+	cfg->parity = settings.mbParity;
+	cfg->add = settings.add;
+}
+
+int relay16Cfg485Set(Relay16Board *board, const Relay16Rs485CfgType *cfg)
+{
+	Relay16Rs485CfgType c;
+	u8 buff[5];
+	int ret;
+
+	if ( (board == NULL) || (cfg == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	c = *cfg;
+	if (c.mode > 1)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	// a disabled port accepts any setting, the invalid ones get the defaults
+	if (c.baud > 921600 || c.baud < 1200)
+	{
+		if (c.mode != 0)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		c.baud = 38400;
+	}
+	if (c.stopBits < 1 || c.stopBits > 2)
+	{
+		if (c.mode != 0)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		c.stopBits = 1;
+	}
+	if (c.parity > 2)
+	{
+		if (c.mode != 0)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		c.parity = 0;
+	}
+	if (c.add < 1)
+	{
+		if (c.mode != 0)
+		{
+			return RELAY16_ERR_PARAM;
+		}
+		c.add = 1;
+	}
+	cfg485Pack(&c, buff);
+	pthread_mutex_lock(&board->lock);
+	ret = verifyWrite(board, board->verify.policy, I2C_MODBUS_SETINGS_ADD,
+		I2C_MODBUS_SETINGS_ADD, buff, 5);
+	pthread_mutex_unlock(&board->lock);
+	return ret;
+}
+
+int relay16Cfg485Get(Relay16Board *board, Relay16Rs485CfgType *cfg)
+{
+	u8 buff[5];
+	int ret;
+
+	if (cfg == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	ret = memRead(board, I2C_MODBUS_SETINGS_ADD, buff, 5);
+	if (ret == RELAY16_OK)
+	{
+		cfg485Unpack(buff, cfg);
+	}
+	return ret;
+}
+
+//********************************************** Snapshot ****************************************************
+
+/*
+ * Configuration registers of a snapshot in address order, the watchdog periods
+ * are read from their GET registers and written to the SET ones
+ *********************************************************************************
+ */
+#define SNAP_WDT		0
+#define SNAP_WDT_INIT	1
+#define SNAP_WDT_OFF	2
+#define SNAP_RS485		3
+#define SNAP_FS_EN		4
+#define SNAP_FS_VAL		5
+#define SNAP_LED		6
+#define SNAP_COUNT		7
+
+static const struct
+{
+	int rdAdd;
+	int wrAdd;
+	int size;
+} gSnapReg[SNAP_COUNT] = {
+	{I2C_MEM_WDT_INTERVAL_GET_ADD, I2C_MEM_WDT_INTERVAL_SET_ADD, 2},
+	{I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, I2C_MEM_WDT_INIT_INTERVAL_SET_ADD, 2},
+	{I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD, 4},
+	{I2C_MODBUS_SETINGS_ADD, I2C_MODBUS_SETINGS_ADD, 5},
+	{I2C_MEM_RELAY_FAILSAFE_EN_ADD, I2C_MEM_RELAY_FAILSAFE_EN_ADD, 2},
+	{I2C_MEM_RELAY_FAILSAFE_VAL_ADD, I2C_MEM_RELAY_FAILSAFE_VAL_ADD, 2},
+	{I2C_MEM_LED_MODE, I2C_MEM_LED_MODE, 1}};
+
+/*
+ * snapRead:
+ *	Read the snapshot registers in the register image (indexed by address),
+ *	the registers closer than a block go in one transfer. The caller holds the
+ *	board lock.
+ *********************************************************************************
+ */
+static int snapRead(Relay16Board *b, u8 *img, int *reads)
+{
+	int start;
+	int end;
+	int ret;
+	int i;
+
+	for (i = 0; i < SNAP_COUNT; i++)
+	{
+		start = gSnapReg[i].rdAdd;
+		end = start + gSnapReg[i].size;
+		while ( (i + 1 < SNAP_COUNT)
+			&& (gSnapReg[i + 1].rdAdd + gSnapReg[i + 1].size - start
+				<= SNAPSHOT_BLOCK_MAX))
+		{
+			i++;
+			end = gSnapReg[i].rdAdd + gSnapReg[i].size;
+		}
+		(*reads)++;
+		ret = regRead(b, start, img + start, end - start);
+		if (ret != RELAY16_OK)
+		{
+			return ret;
+		}
+	}
+	return RELAY16_OK;
+}
+
+static void snapDecode(const u8 *img, Relay16SnapshotType *snap)
+{
+	u16 val;
+
+	memset(snap, 0, sizeof(*snap));
+	memcpy(&snap->wdtPeriod, img + gSnapReg[SNAP_WDT].rdAdd, 2);
+	memcpy(&snap->wdtInitPeriod, img + gSnapReg[SNAP_WDT_INIT].rdAdd, 2);
+	memcpy(&snap->wdtOffPeriod, img + gSnapReg[SNAP_WDT_OFF].rdAdd, 4);
+	cfg485Unpack(img + gSnapReg[SNAP_RS485].rdAdd, &snap->rs485);
+	memcpy(&val, img + gSnapReg[SNAP_FS_EN].rdAdd, 2);
+	snap->failsafeEn = relay16FromIO(val);
+	memcpy(&val, img + gSnapReg[SNAP_FS_VAL].rdAdd, 2);
+	snap->failsafeVal = relay16FromIO(val);
+	snap->ledMode = img[gSnapReg[SNAP_LED].rdAdd];
+}
+
+static void snapEncode(const Relay16SnapshotType *snap, u8 *img)
+{
+	u16 val;
+
+	memcpy(img + gSnapReg[SNAP_WDT].rdAdd, &snap->wdtPeriod, 2);
+	memcpy(img + gSnapReg[SNAP_WDT_INIT].rdAdd, &snap->wdtInitPeriod, 2);
+	memcpy(img + gSnapReg[SNAP_WDT_OFF].rdAdd, &snap->wdtOffPeriod, 4);
+	cfg485Pack(&snap->rs485, img + gSnapReg[SNAP_RS485].rdAdd);
+	val = relay16ToIO(snap->failsafeEn);
+	memcpy(img + gSnapReg[SNAP_FS_EN].rdAdd, &val, 2);
+	val = relay16ToIO(snap->failsafeVal);
+	memcpy(img + gSnapReg[SNAP_FS_VAL].rdAdd, &val, 2);
+	img[gSnapReg[SNAP_LED].rdAdd] = snap->ledMode;
+}
+
+/* the settings the board would refuse, checked only if they are written */
+static int snapValid(const Relay16SnapshotType *snap, int idx)
+{
+	const Relay16Rs485CfgType *c = &snap->rs485;
+
+	switch (idx)
+	{
+	case SNAP_WDT:
+		return snap->wdtPeriod != 0;
+	case SNAP_WDT_INIT:
+		return snap->wdtInitPeriod != 0;
+	case SNAP_WDT_OFF:
+		return (snap->wdtOffPeriod != 0)
+			&& (snap->wdtOffPeriod <= WDT_MAX_OFF_INTERVAL_S);
+	case SNAP_RS485:
+		// a disabled port accepts any setting
+		return (c->mode == 0) || ( (c->mode == 1) && (c->baud >= 1200)
+			&& (c->baud <= 921600) && (c->stopBits >= 1) && (c->stopBits <= 2)
+			&& (c->parity <= 2) && (c->add >= 1));
+	case SNAP_LED:
+		return snap->ledMode <= RELAY16_LED_OFF;
+	default:
+		return 1;
+	}
+}
+
+int relay16SnapshotGet(Relay16Board *board, Relay16SnapshotType *snap)
+{
+	u8 img[SLAVE_BUFF_SIZE];
+	int reads = 0;
+	int ret;
+
+	if ( (board == NULL) || (snap == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	memset(img, 0, sizeof(img));
+	pthread_mutex_lock(&board->lock);
+	ret = snapRead(board, img, &reads);
+	pthread_mutex_unlock(&board->lock);
+	if (ret == RELAY16_OK)
+	{
+		snapDecode(img, snap);
+	}
+	return ret;
+}
+
+/*
+ * snapWrite:
+ *	Write the changed settings from the register image, the ones adjacent at
+ *	their write address go in one transfer. The caller holds the board lock.
+ *********************************************************************************
+ */
+static int snapWrite(Relay16Board *b, const u8 *img, const int *changed,
+	int *writes)
+{
+	u8 buff[SNAPSHOT_BLOCK_MAX];
+	int start;
+	int size;
+	int ret;
+	int i;
+
+	for (i = 0; i < SNAP_COUNT; i++)
+	{
+		if (!changed[i])
+		{
+			continue;
+		}
+		start = gSnapReg[i].wrAdd;
+		size = gSnapReg[i].size;
+		memcpy(buff, img + gSnapReg[i].rdAdd, size);
+		while ( (i + 1 < SNAP_COUNT) && changed[i + 1]
+			&& (gSnapReg[i + 1].wrAdd == start + size)
+			&& (size + gSnapReg[i + 1].size < SNAPSHOT_BLOCK_MAX))
+		{
+			i++;
+			memcpy(buff + size, img + gSnapReg[i].rdAdd, gSnapReg[i].size);
+			size += gSnapReg[i].size;
+		}
+		(*writes)++;
+		ret = regWrite(b, start, buff, size);
+		if (ret != RELAY16_OK)
+		{
+			return ret;
+		}
+	}
+	return RELAY16_OK;
+}
+
+int relay16SnapshotRestore(Relay16Board *board, const Relay16SnapshotType *snap,
+	Relay16SnapshotStatsType *stats)
+{
+	Relay16SnapshotStatsType st;
+	u8 cur[SLAVE_BUFF_SIZE];
+	u8 img[SLAVE_BUFF_SIZE];
+	int changed[SNAP_COUNT];
+	int ret;
+	int i;
+
+	if ( (board == NULL) || (snap == NULL))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	memset(&st, 0, sizeof(st));
+	memset(cur, 0, sizeof(cur));
+	pthread_mutex_lock(&board->lock);
+	ret = snapRead(board, cur, &st.reads);
+	if (ret == RELAY16_OK)
+	{
+		memcpy(img, cur, sizeof(img));
+		snapEncode(snap, img);
+		for (i = 0; i < SNAP_COUNT; i++)
+		{
+			changed[i] = memcmp(cur + gSnapReg[i].rdAdd, img + gSnapReg[i].rdAdd,
+				gSnapReg[i].size) != 0;
+			if (changed[i])
+			{
+				st.changed++;
+				if (!snapValid(snap, i))
+				{
+					ret = RELAY16_ERR_PARAM;
+				}
+			}
+		}
+	}
+	if ( (ret == RELAY16_OK) && (st.changed != 0))
+	{
+		ret = snapWrite(board, img, changed, &st.writes);
+		board->shadow[SHADOW_FS_EN].valid = 0;
+		board->shadow[SHADOW_FS_VAL].valid = 0;
+		if ( (ret == RELAY16_OK) && (shadowVerifyPolicy(board) != RELAY16_VERIFY_NONE))
+		{
+			board->verifyStats.writes++;
+			ret = snapRead(board, cur, &st.reads);
+			for (i = 0; (ret == RELAY16_OK) && (i < SNAP_COUNT); i++)
+			{
+				if (changed[i] && (memcmp(cur + gSnapReg[i].rdAdd,
+					img + gSnapReg[i].rdAdd, gSnapReg[i].size) != 0))
+				{
+					discoveryInvalidate(board->bus, board->stack);
+					board->verifyStats.mismatches++;
+					ret = RELAY16_ERR_VERIFY;
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&board->lock);
+	if (stats != NULL)
+	{
+		*stats = st;
+	}
+	return ret;
+}
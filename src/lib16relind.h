@@ -0,0 +1,383 @@
+#ifndef LIB16RELIND_H_
+#define LIB16RELIND_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RELAY16_STACK_MAX	8
+#define RELAY16_BUS_MAX		32
+#define RELAY16_BUS_DEFAULT	1
+#define RELAY16_SCENE_MAX	64 /* boards in one scene, all the buses */
+#define RELAY16_CH_MAX		16
+
+// return codes, every function returns RELAY16_OK or one of the errors
+#define RELAY16_OK			0
+#define RELAY16_ERR_IO		-1	/* bus transaction failed */
+#define RELAY16_ERR_PARAM	-2	/* invalid argument */
+#define RELAY16_ERR_NODEV	-3	/* board not detected */
+#define RELAY16_ERR_BUS		-4	/* fail to open the I2C bus */
+#define RELAY16_ERR_NOMEM	-5
+#define RELAY16_ERR_LOCK	-6	/* fail to take the bus lock */
+#define RELAY16_ERR_VERIFY	-7	/* read back value differs from the written one */
+#define RELAY16_ERR_TIMEOUT	-8
+
+typedef enum
+{
+	RELAY16_LED_BLINK = 0,
+	RELAY16_LED_ON,
+	RELAY16_LED_OFF
+} Relay16LedModeType;
+
+typedef struct
+{
+	uint8_t mode; /* 0 = disable, 1 = Modbus RTU slave */
+	uint32_t baud;
+	uint8_t stopBits;
+	uint8_t parity; /* 0 = none, 1 = even, 2 = odd */
+	uint8_t add;
+} Relay16Rs485CfgType;
+
+/*
+ * Shadow copy of the output and failsafe registers:
+ * OFF     every change reads the register first (no cache)
+ * TRUST   the shadow is read once and then kept up to date by the writes
+ * RESYNC  as TRUST, but the shadow is read again when older than the period
+ * VERIFY  as TRUST, every write is read back and checked
+ */
+typedef enum
+{
+	RELAY16_CACHE_OFF = 0,
+	RELAY16_CACHE_TRUST,
+	RELAY16_CACHE_RESYNC,
+	RELAY16_CACHE_VERIFY,
+	RELAY16_CACHE_POLICY_COUNT
+} Relay16CachePolicyType;
+
+typedef struct
+{
+	uint32_t hits; /* values served from the shadow */
+	uint32_t misses; /* values read from the board */
+	uint32_t writes;
+	uint32_t verifyErrors;
+} Relay16CacheStatsType;
+
+/*
+ * Write verification of the relay, failsafe and RS485 settings writes:
+ * NONE      no read back (the cache VERIFY policy still reads the relays back)
+ * READBACK  one read back, RELAY16_ERR_VERIFY on mismatch
+ * RETRY     the write is repeated on mismatch, up to retries times, after
+ *           backoffUs doubled at every retry
+ * An operation gives up with RELAY16_ERR_TIMEOUT when the next attempt would
+ * end after budgetUs (0 = no limit).
+ */
+typedef enum
+{
+	RELAY16_VERIFY_NONE = 0,
+	RELAY16_VERIFY_READBACK,
+	RELAY16_VERIFY_RETRY,
+	RELAY16_VERIFY_POLICY_COUNT
+} Relay16VerifyPolicyType;
+
+typedef struct
+{
+	Relay16VerifyPolicyType policy;
+	uint32_t retries;
+	uint32_t backoffUs;
+	uint32_t budgetUs;
+} Relay16VerifyCfgType;
+
+typedef struct
+{
+	uint32_t writes; /* verified writes */
+	uint32_t mismatches; /* read back values that differ */
+	uint32_t retries;
+	uint32_t failures; /* writes still wrong after the last retry */
+	uint32_t timeouts; /* writes given up at the end of the budget */
+} Relay16VerifyStatsType;
+
+/*
+ * Write coalescing: while on, the relay changes of a board (relay16ChSet,
+ * relay16Set and the mask calls but the toggle) are merged and written together
+ * with one output register write at the end of the window started by the first
+ * of them, or by relay16CoalesceFlush. The reads return the state with the
+ * pending changes.
+ */
+#define RELAY16_COALESCE_OFF	0
+#define RELAY16_COALESCE_MANUAL	0xffffffffu /* written by relay16CoalesceFlush only */
+
+typedef struct
+{
+	uint32_t changes; /* relay changes merged */
+	uint32_t flushes;
+	uint32_t writes; /* register writes done for them */
+	uint32_t saved; /* register writes avoided */
+	uint32_t errors;
+} Relay16CoalesceStatsType;
+
+typedef struct
+{
+	int boards;
+	int changed; /* boards written */
+	uint32_t skewUs; /* from the first output write start to the last write end */
+	uint32_t totalUs; /* including the locking and the state reads */
+} Relay16SceneStatsType;
+
+typedef struct
+{
+	uint16_t en; /* bit 0 = relay 1, 1 = the relay goes to its failsafe value */
+	uint16_t val; /* failsafe value, bit 0 = relay 1 */
+} Relay16FailsafeProfileType;
+
+/* the configuration registers of a board, see relay16SnapshotGet() */
+typedef struct
+{
+	uint16_t wdtPeriod;
+	uint16_t wdtInitPeriod;
+	uint32_t wdtOffPeriod;
+	Relay16Rs485CfgType rs485;
+	uint16_t failsafeEn; /* bit 0 = relay 1 */
+	uint16_t failsafeVal;
+	uint8_t ledMode; /* Relay16LedModeType */
+} Relay16SnapshotType;
+
+typedef struct
+{
+	int changed; /* settings that differ from the board */
+	int reads; /* register block transfers */
+	int writes;
+} Relay16SnapshotStatsType;
+
+/*
+ * Trace shared by all the processes using the library: the last
+ * RELAY16_TRACE_SIZE bus transactions, bus lock waits and CLI write retries,
+ * with latency histograms and error counters per kind. Off by default.
+ */
+#define RELAY16_TRACE_SIZE	1024
+#define RELAY16_TRACE_HIST	20 /* bucket 0: < 1us, bucket i: 2^(i-1)..2^i-1 us, last: above */
+
+typedef enum
+{
+	RELAY16_TRACE_READ = 0,
+	RELAY16_TRACE_WRITE,
+	RELAY16_TRACE_TRANSFER,
+	RELAY16_TRACE_LOCK,
+	RELAY16_TRACE_RETRY,
+	RELAY16_TRACE_KIND_COUNT
+} Relay16TraceKindType;
+
+typedef struct
+{
+	uint64_t timeNs; /* CLOCK_MONOTONIC at the start */
+	uint32_t us;
+	int32_t pid;
+	uint8_t kind;
+	uint8_t bus;
+	uint8_t add; /* I2C address */
+	uint8_t reg; /* first register */
+	uint8_t size; /* bytes, the attempts for the retries */
+	int8_t result; /* RELAY16_OK or an error */
+} Relay16TraceRecType;
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t errors;
+	uint64_t totalUs;
+	uint32_t maxUs;
+	uint32_t hist[RELAY16_TRACE_HIST];
+} Relay16TraceStatsType;
+
+typedef struct
+{
+	uint32_t actions; /* relay changes done */
+	uint32_t writes; /* output writes, the changes due together on a board share one */
+	uint32_t errors;
+	uint32_t late; /* writes ended more than 1ms after the due time */
+	uint32_t maxLateUs;
+	uint64_t totalLateUs;
+} Relay16PulseStatsType;
+
+typedef struct Relay16Board Relay16Board;
+
+/*
+ * All the functions taking a board handle are thread safe, relay values are
+ * bitmaps with relay 1 on bit 0
+ */
+int relay16Open(int stack, Relay16Board **board);
+int relay16OpenBus(int bus, int stack, Relay16Board **board);
+void relay16Close(Relay16Board *board);
+int relay16Probe(int stack);
+int relay16ProbeBus(int bus, int stack);
+/* bitmap of the detected stack levels, from the discovery cache unless refresh */
+int relay16Discover(int refresh, uint8_t *stacks);
+int relay16DiscoverBus(int bus, int refresh, uint8_t *stacks);
+int relay16Bus(const Relay16Board *board);
+int relay16Stack(const Relay16Board *board);
+int relay16Address(const Relay16Board *board);
+const char* relay16StrError(int err);
+
+/*
+ * Bus lock shared by all the processes using the library, granted in request
+ * order and released if the holder dies. The wait is limited to 3s by default,
+ * set by relay16LockTimeoutSet() or the RELAY16_LOCK_TIMEOUT environment
+ * variable (ms, 0 = wait forever). relay16LockHeld() tells if the calling thread
+ * holds it.
+ *
+ * The other functions do not take it. Hold it around every call, or group of
+ * calls, that accesses a board (relay16Open included), as the 16relind
+ * command, its daemon and the Python module do. Otherwise the transactions
+ * can interleave on the bus with those of the other processes. Only the
+ * library thread takes it by itself, for the timed changes (relay16Pulse,
+ * relay16SwitchAfter) and the end of the coalescing windows, so it must not be
+ * held across relay16PulseWait().
+ */
+int relay16Lock(void);
+void relay16Unlock(void);
+int relay16LockHeld(void);
+void relay16LockTimeoutSet(unsigned int ms);
+
+int relay16ChSet(Relay16Board *board, int channel, int state);
+int relay16ChGet(Relay16Board *board, int channel, int *state);
+int relay16Set(Relay16Board *board, uint16_t val);
+int relay16Get(Relay16Board *board, uint16_t *val);
+/*
+ * relay bitmaps (bit 0 = relay 1) changed with one read-modify-write, or one
+ * write when the state is known (shadow cache) or all the relays are given:
+ * turn on, turn off or invert the relays in mask, or give them the state in val
+ */
+int relay16MaskSet(Relay16Board *board, uint16_t mask);
+int relay16MaskClear(Relay16Board *board, uint16_t mask);
+int relay16MaskToggle(Relay16Board *board, uint16_t mask);
+int relay16MaskApply(Relay16Board *board, uint16_t mask, uint16_t val);
+/* one value per board, the boards must be different */
+int relay16SceneSet(Relay16Board *board[], const uint16_t val[], int count,
+	Relay16SceneStatsType *stats);
+int relay16GetMany(Relay16Board *board[], uint16_t val[], int count);
+/*
+ * Multi-bus mode: the scenes and the reads spanning several buses run one
+ * worker thread per bus instead of one bus after the other (default off)
+ */
+void relay16MultiBus(int enable);
+/*
+ * Modbus RTU: the boards of the bus are reached through their RS-485 port,
+ * line = "<tty>[:<baud>[:<format>[:<offset>]]]" (9600, 8N1 and 1 by default),
+ * format 8N1, 8E1, 8O1 or 8N2, offset = slave address of the stack level 0
+ * (the cfg485wr address). Only the relays are mapped, a relay write is one
+ * Write Multiple Coils request. Before the boards of the bus are opened, NULL
+ * detaches. RELAY16_RTU="<bus>=<line>[;<bus>=<line>...]" attaches lines too.
+ */
+int relay16RtuAttach(int bus, const char *line);
+
+/*
+ * Timed relay changes run by a library thread from one timer heap, the
+ * changes due at the same time on a board are written together. mask selects
+ * the relays, the times are relative to the call. A pulse turns the relays on
+ * for onMs, count pulses are separated by offMs. The board must stay open
+ * until its changes are done or cancelled.
+ */
+int relay16SwitchAfter(Relay16Board *board, uint16_t mask, int state,
+	uint32_t delayMs);
+int relay16Pulse(Relay16Board *board, uint16_t mask, uint32_t delayMs,
+	uint32_t onMs, uint32_t offMs, int count);
+int relay16PulseCancel(Relay16Board *board, uint16_t mask);
+/*
+ * wait for the changes of the board (of all the boards if NULL) to be done,
+ * timeoutMs 0 = no limit; RELAY16_ERR_LOCK if the caller holds the bus lock
+ */
+int relay16PulseWait(Relay16Board *board, uint32_t timeoutMs);
+int relay16PulseStatsGet(Relay16PulseStatsType *stats, int clear);
+
+int relay16FailsafeEnChSet(Relay16Board *board, int channel, int state);
+int relay16FailsafeEnChGet(Relay16Board *board, int channel, int *state);
+int relay16FailsafeEnSet(Relay16Board *board, uint16_t val);
+int relay16FailsafeEnGet(Relay16Board *board, uint16_t *val);
+int relay16FailsafeValChSet(Relay16Board *board, int channel, int state);
+int relay16FailsafeValChGet(Relay16Board *board, int channel, int *state);
+int relay16FailsafeValSet(Relay16Board *board, uint16_t val);
+int relay16FailsafeValGet(Relay16Board *board, uint16_t *val);
+/*
+ * Failsafe profile: the enable and the value registers of a board read or
+ * written together in one transfer, the board is never left with a new enable
+ * and an old value. A board that has the profile already is not written.
+ */
+int relay16FailsafeProfileSet(Relay16Board *board,
+	const Relay16FailsafeProfileType *profile);
+int relay16FailsafeProfileGet(Relay16Board *board,
+	Relay16FailsafeProfileType *profile);
+/* written: number of boards with a different profile, that were written */
+int relay16FailsafeProfileSetMany(Relay16Board *board[],
+	const Relay16FailsafeProfileType profile[], int count, int *written);
+
+int relay16LedModeSet(Relay16Board *board, Relay16LedModeType mode);
+int relay16FwVersionGet(Relay16Board *board, int *major, int *minor);
+
+int relay16WdtReload(Relay16Board *board);
+int relay16WdtPeriodSet(Relay16Board *board, uint16_t period);
+int relay16WdtPeriodGet(Relay16Board *board, uint16_t *period);
+int relay16WdtInitPeriodSet(Relay16Board *board, uint16_t period);
+int relay16WdtInitPeriodGet(Relay16Board *board, uint16_t *period);
+int relay16WdtOffPeriodSet(Relay16Board *board, uint32_t period);
+int relay16WdtOffPeriodGet(Relay16Board *board, uint32_t *period);
+
+int relay16Cfg485Set(Relay16Board *board, const Relay16Rs485CfgType *cfg);
+int relay16Cfg485Get(Relay16Board *board, Relay16Rs485CfgType *cfg);
+
+/*
+ * Snapshot of the configuration registers (watchdog periods, RS485, failsafe,
+ * led mode) with a few block transfers, to set up a replacement board. The
+ * restore writes only the settings that differ from the board, the adjacent
+ * ones together, then reads them back following the verification settings.
+ */
+int relay16SnapshotGet(Relay16Board *board, Relay16SnapshotType *snap);
+int relay16SnapshotRestore(Relay16Board *board, const Relay16SnapshotType *snap,
+	Relay16SnapshotStatsType *stats);
+
+int relay16CachePolicySet(Relay16Board *board, Relay16CachePolicyType policy,
+	unsigned int resyncMs);
+int relay16CachePolicyGet(Relay16Board *board, Relay16CachePolicyType *policy,
+	unsigned int *resyncMs);
+int relay16CacheStatsGet(Relay16Board *board, Relay16CacheStatsType *stats,
+	int clear);
+void relay16CacheInvalidate(Relay16Board *board);
+
+int relay16VerifySet(Relay16Board *board, const Relay16VerifyCfgType *cfg);
+int relay16VerifyGet(Relay16Board *board, Relay16VerifyCfgType *cfg);
+int relay16VerifyStatsGet(Relay16Board *board, Relay16VerifyStatsType *stats,
+	int clear);
+
+/* windowUs: RELAY16_COALESCE_OFF, a window or RELAY16_COALESCE_MANUAL */
+int relay16CoalesceSet(Relay16Board *board, uint32_t windowUs);
+int relay16CoalesceGet(Relay16Board *board, uint32_t *windowUs);
+int relay16CoalesceFlush(Relay16Board *board);
+int relay16CoalesceStatsGet(Relay16Board *board, Relay16CoalesceStatsType *stats,
+	int clear);
+
+int relay16TraceEnable(int enable);
+int relay16TraceEnabled(void);
+/* the last records, oldest first, returns the number of records */
+int relay16TraceRead(Relay16TraceRecType *rec, int max);
+int relay16TraceStatsGet(Relay16TraceStatsType stats[RELAY16_TRACE_KIND_COUNT],
+	int clear);
+
+/*
+ * called after every relay output write of the process (val: bit 0 = relay 1),
+ * from the writing thread with the board locked: it must not call the library
+ * for that board; NULL to remove
+ */
+typedef void (*Relay16ChangeFn)(Relay16Board *board, uint16_t val, void *arg);
+void relay16ChangeHook(Relay16ChangeFn fn, void *arg);
+
+int relay16MemRead(Relay16Board *board, int add, uint8_t *buff, int size);
+int relay16MemWrite(Relay16Board *board, int add, uint8_t *buff, int size);
+
+uint16_t relay16ToIO(uint16_t relay);
+uint16_t relay16FromIO(uint16_t io);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LIB16RELIND_H_
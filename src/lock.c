@@ -0,0 +1,517 @@
+/*
+ * lock.c:
+ *	Exclusive access to the I2C bus between the processes using the library.
+ *
+ *	Ticket lock in a shared memory segment: the waiters are served in arrival
+ *	order, each one sleeping on its own futex word, so a release wakes only the
+ *	next in line. The bookkeeping is protected by a robust mutex and the
+ *	waiters check every BUS_LOCK_CHECK_MS that the holder is still alive, a
+ *	process that dies holding the bus (or waiting for it) is skipped.
+ *
+ *	The holder of the ticket also takes /SMI2C_SEM, the semaphore of the other
+ *	Sequent tools sharing the bus, the way they do: created with 3 slots and
+ *	drained to 0, posted back to 1 at the release. Only one process of the
+ *	library waits on it at a time, so the arrival order is kept. It is given
+ *	back for a holder that died with it.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define _GNU_SOURCE /* secure_getenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "lib16relind.h"
+#include "board.h"
+#include "trace.h"
+
+//#define DEBUG_LOCK
+
+#define BUS_LOCK_NAME		"/16relind_bus"
+#define BUS_LOCK_MAGIC		0x31365242
+#define BUS_LOCK_WAITERS	64
+#define BUS_LOCK_CHECK_MS	100
+#define BUS_LOCK_TIMEOUT_MS	3000
+#define SMI_SEM_NAME		"/SMI2C_SEM"
+#define SMI_SEM_FILE		"/dev/shm/sem.SMI2C_SEM"
+#define SMI_SEM_SLOTS		3
+
+typedef struct
+{
+	pid_t pid; /* 0 = free slot */
+	uint32_t ticket;
+	uint32_t seq; /* futex word, changed to wake the waiter */
+} BusWaiterType;
+
+typedef struct
+{
+	uint32_t magic;
+	pthread_mutex_t mutex;
+	uint32_t next; /* next ticket to hand out */
+	uint32_t serving; /* ticket allowed to hold the bus */
+	pid_t owner; /* 0 = free */
+	BusWaiterType waiter[BUS_LOCK_WAITERS];
+	uint32_t smiHeld; /* the owner took /SMI2C_SEM, last as older segments are grown for it */
+} BusLockType;
+
+static BusLockType *gBus = NULL;
+static sem_t *gSmi = SEM_FAILED;
+static pthread_once_t gBusOnce = PTHREAD_ONCE_INIT;
+static unsigned int gTimeoutMs = BUS_LOCK_TIMEOUT_MS;
+static __thread int gHeld = 0;
+
+static void busInit(BusLockType *bus)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&bus->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	__atomic_store_n(&bus->magic, BUS_LOCK_MAGIC, __ATOMIC_RELEASE);
+}
+
+static void smiOpen(void)
+{
+	gSmi = sem_open(SMI_SEM_NAME, O_CREAT | O_EXCL, 0666, SMI_SEM_SLOTS);
+	if (gSmi != SEM_FAILED)
+	{
+		chmod(SMI_SEM_FILE, 0666); // not limited by the umask, as the lock segment
+		return;
+	}
+	if (errno == EEXIST)
+	{
+		gSmi = sem_open(SMI_SEM_NAME, 0);
+	}
+}
+
+/*
+ * busOpen:
+ *	Map the lock segment, the process creating it initializes it
+ *********************************************************************************
+ */
+static void busOpen(void)
+{
+	BusLockType *bus;
+	struct stat st;
+	const char *env;
+	int created = 1;
+	int fd;
+	int i;
+
+	env = secure_getenv("RELAY16_LOCK_TIMEOUT");
+	if (env != NULL)
+	{
+		gTimeoutMs = (unsigned int)atoi(env);
+	}
+	smiOpen();
+	if (gSmi == SEM_FAILED)
+	{
+		return; // the other tools would not be excluded
+	}
+	fd = shm_open(BUS_LOCK_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (fd < 0 && errno == EEXIST)
+	{
+		created = 0;
+		fd = shm_open(BUS_LOCK_NAME, O_RDWR, 0);
+	}
+	if (fd < 0)
+	{
+		return;
+	}
+	if (!created && (fstat(fd, &st) == 0) && (st.st_size < (off_t)sizeof(BusLockType)))
+	{
+		// created by an older version, without the last fields
+		if (ftruncate(fd, sizeof(BusLockType)) != 0)
+		{
+			close(fd);
+			return;
+		}
+	}
+	if (created)
+	{
+		fchmod(fd, 0666); // not limited by the umask, any user may lock the bus
+		if (ftruncate(fd, sizeof(BusLockType)) != 0)
+		{
+			close(fd);
+			shm_unlink(BUS_LOCK_NAME);
+			return;
+		}
+	}
+	bus = mmap(NULL, sizeof(BusLockType), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+	if (bus == MAP_FAILED)
+	{
+		return;
+	}
+	if (created)
+	{
+		busInit(bus);
+	}
+	else
+	{
+		// wait for the creator to finish the initialization
+		for (i = 0; i < 100; i++)
+		{
+			if (__atomic_load_n(&bus->magic, __ATOMIC_ACQUIRE) == BUS_LOCK_MAGIC)
+			{
+				break;
+			}
+			usleep(1000);
+		}
+		if (i == 100)
+		{
+			// the creator died, let the next process create the segment again
+			munmap(bus, sizeof(BusLockType));
+			shm_unlink(BUS_LOCK_NAME);
+			return;
+		}
+	}
+	gBus = bus;
+}
+
+static int futexWait(uint32_t *word, uint32_t val, unsigned int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	return syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+static void futexWake(uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int pidAlive(pid_t pid)
+{
+	return (kill(pid, 0) == 0) || (errno != ESRCH);
+}
+
+/*
+ * smiLock:
+ *	Drain /SMI2C_SEM to 0 as the other tools do, 0 ms waits forever
+ *********************************************************************************
+ */
+static int smiLock(unsigned int ms)
+{
+	struct timespec ts;
+	int val = 1;
+	int ret;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += ms / 1000;
+	ts.tv_nsec += (ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L)
+	{
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	while (val > 0)
+	{
+		ret = ms != 0 ? sem_timedwait(gSmi, &ts) : sem_wait(gSmi);
+		if (ret != 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1; // held by another tool
+		}
+		sem_getvalue(gSmi, &val);
+	}
+	return 0;
+}
+
+static void smiUnlock(void)
+{
+	int val = 1;
+
+	sem_getvalue(gSmi, &val);
+	if (val < 1)
+	{
+		sem_post(gSmi);
+	}
+}
+
+static int busMutexLock(BusLockType *bus)
+{
+	int ret = pthread_mutex_lock(&bus->mutex);
+
+	if (ret == EOWNERDEAD)
+	{
+		// a process died inside the bookkeeping, the ticket state is still usable
+		pthread_mutex_consistent(&bus->mutex);
+		ret = 0;
+	}
+	return ret;
+}
+
+static BusWaiterType* busWaiterFind(BusLockType *bus, uint32_t ticket)
+{
+	int i;
+
+	for (i = 0; i < BUS_LOCK_WAITERS; i++)
+	{
+		if ( (bus->waiter[i].pid != 0) && (bus->waiter[i].ticket == ticket))
+		{
+			return &bus->waiter[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * busAdvance:
+ *	Pass the bus to the next live waiter, the caller holds the mutex
+ *********************************************************************************
+ */
+static void busAdvance(BusLockType *bus)
+{
+	BusWaiterType *w;
+
+	if (bus->smiHeld)
+	{
+		// only left set by a holder that died
+		bus->smiHeld = 0;
+		smiUnlock();
+	}
+	bus->owner = 0;
+	bus->serving++;
+	while (bus->serving != bus->next)
+	{
+		w = busWaiterFind(bus, bus->serving);
+		if ( (w != NULL) && pidAlive(w->pid))
+		{
+			__atomic_add_fetch(&w->seq, 1, __ATOMIC_RELEASE);
+			futexWake(&w->seq);
+			return;
+		}
+		// the waiter gave up or died
+#ifdef DEBUG_LOCK
+		printf("Skip bus ticket %u\n", bus->serving);
+#endif
+		if (w != NULL)
+		{
+			w->pid = 0;
+		}
+		bus->serving++;
+	}
+}
+
+/*
+ * busRecover:
+ *	Release the bus held by a dead process, the caller holds the mutex
+ *********************************************************************************
+ */
+static void busRecover(BusLockType *bus)
+{
+	BusWaiterType *w;
+
+	if (bus->owner != 0)
+	{
+		if (!pidAlive(bus->owner))
+		{
+#ifdef DEBUG_LOCK
+			printf("Bus holder %d died\n", (int)bus->owner);
+#endif
+			busAdvance(bus);
+		}
+		return;
+	}
+	if (bus->serving != bus->next)
+	{
+		w = busWaiterFind(bus, bus->serving);
+		if ( (w == NULL) || !pidAlive(w->pid))
+		{
+			bus->serving--; // busAdvance starts from the next ticket
+			busAdvance(bus);
+		}
+	}
+}
+
+static uint64_t lockTimeMs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int busLock(void)
+{
+	BusLockType *bus;
+	BusWaiterType *w = NULL;
+	uint64_t start;
+	uint64_t elapsed;
+	uint32_t ticket;
+	uint32_t seq;
+	unsigned int waitMs;
+	int i;
+
+	pthread_once(&gBusOnce, busOpen);
+	bus = gBus;
+	if ( (bus == NULL) || (gHeld != 0) || (busMutexLock(bus) != 0))
+	{
+		return RELAY16_ERR_LOCK;
+	}
+	busRecover(bus);
+	ticket = bus->next;
+	if ( (bus->owner == 0) && (bus->serving == ticket))
+	{
+		// uncontended
+		bus->next++;
+		bus->owner = getpid();
+		pthread_mutex_unlock(&bus->mutex);
+		gHeld = 1;
+		return RELAY16_OK;
+	}
+	for (i = 0; i < BUS_LOCK_WAITERS; i++)
+	{
+		if (bus->waiter[i].pid == 0)
+		{
+			w = &bus->waiter[i];
+			break;
+		}
+	}
+	if (w == NULL)
+	{
+		pthread_mutex_unlock(&bus->mutex);
+		return RELAY16_ERR_LOCK;
+	}
+	bus->next++;
+	w->pid = getpid();
+	w->ticket = ticket;
+	start = lockTimeMs();
+	while (1)
+	{
+		if (bus->serving == ticket && bus->owner == 0)
+		{
+			w->pid = 0;
+			bus->owner = getpid();
+			pthread_mutex_unlock(&bus->mutex);
+			gHeld = 1;
+			return RELAY16_OK;
+		}
+		elapsed = lockTimeMs() - start;
+		if ( (gTimeoutMs != 0) && (elapsed >= gTimeoutMs))
+		{
+			w->pid = 0; // skipped when the bus is passed on
+			pthread_mutex_unlock(&bus->mutex);
+			return RELAY16_ERR_LOCK;
+		}
+		waitMs = BUS_LOCK_CHECK_MS;
+		if ( (gTimeoutMs != 0) && (gTimeoutMs - elapsed < waitMs))
+		{
+			waitMs = gTimeoutMs - elapsed;
+		}
+		seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE);
+		pthread_mutex_unlock(&bus->mutex);
+		futexWait(&w->seq, seq, waitMs);
+		if (busMutexLock(bus) != 0)
+		{
+			return RELAY16_ERR_LOCK;
+		}
+		busRecover(bus);
+	}
+}
+
+/*
+ * smiTake:
+ *	Take /SMI2C_SEM once the ticket is granted, within the rest of the timeout
+ *********************************************************************************
+ */
+static int smiTake(uint64_t startMs)
+{
+	uint64_t elapsed = lockTimeMs() - startMs;
+	unsigned int ms = 0;
+
+	if (gTimeoutMs != 0)
+	{
+		ms = elapsed < gTimeoutMs ? gTimeoutMs - elapsed : 1;
+	}
+	if (smiLock(ms) != 0)
+	{
+		return RELAY16_ERR_LOCK;
+	}
+	if (busMutexLock(gBus) == 0)
+	{
+		gBus->smiHeld = 1;
+		pthread_mutex_unlock(&gBus->mutex);
+	}
+	return RELAY16_OK;
+}
+
+static void busRelease(int smi)
+{
+	BusLockType *bus = gBus;
+
+	gHeld = 0;
+	if (busMutexLock(bus) != 0)
+	{
+		return;
+	}
+	if (bus->owner == getpid())
+	{
+		if (smi && bus->smiHeld)
+		{
+			bus->smiHeld = 0;
+			smiUnlock();
+		}
+		busAdvance(bus);
+	}
+	pthread_mutex_unlock(&bus->mutex);
+}
+
+int relay16Lock(void)
+{
+	uint64_t start = traceStart();
+	uint64_t startMs = lockTimeMs();
+	int ret = busLock();
+
+	if ( (ret == RELAY16_OK) && (smiTake(startMs) != RELAY16_OK))
+	{
+		busRelease(0);
+		ret = RELAY16_ERR_LOCK;
+	}
+	traceRecord(RELAY16_TRACE_LOCK, 0, 0, 0, 0, ret, start);
+	return ret;
+}
+
+void relay16Unlock(void)
+{
+	if ( (gBus == NULL) || (gHeld == 0))
+	{
+		return;
+	}
+	busRelease(1);
+}
+
+/* the calling thread holds the bus lock */
+int relay16LockHeld(void)
+{
+	return gHeld;
+}
+
+void relay16LockTimeoutSet(unsigned int ms)
+{
+	pthread_once(&gBusOnce, busOpen);
+	gTimeoutMs = ms;
+}
@@ -0,0 +1,609 @@
+/*
+ * mbtcp.c:
+ *	Modbus TCP gateway: the coils 0x00..0x0f of the unit ID offset + stack
+ *	level are the relays 1..16 of the board, as on its own RS-485 slave.
+ *	Read Coils (0x01), Write Single Coil (0x05) and Write Multiple Coils (0x0f)
+ *	are served, the other functions get the illegal function exception.
+ *
+ *	The clients are served from one poll loop on non-blocking sockets. All
+ *	the requests received in one round run in one batch under one bus lock:
+ *	the coil writes to a board are merged and written with one output
+ *	register write at the end of the batch, a board read is done once for all
+ *	the reads that need the relays not written by the batch. The responses
+ *	are sent after the write, in the order of the requests of every client.
+ *	While a batch runs, the next requests queue up for the next one, so a
+ *	request waits for one batch at most. The counters are displayed on SIGUSR1
+ *	and at exit.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "relay.h"
+#include "mbtcp.h"
+
+#define MB_FC_READ_COILS	0x01
+#define MB_FC_WRITE_COIL	0x05
+#define MB_FC_WRITE_COILS	0x0f
+#define MB_EXCEPTION		0x80
+
+#define MB_EX_FUNCTION		0x01
+#define MB_EX_ADDRESS		0x02
+#define MB_EX_VALUE			0x03
+#define MB_EX_FAILURE		0x04
+#define MB_EX_BUSY			0x06
+#define MB_EX_PATH			0x0a	/* no stack level for the unit ID */
+#define MB_EX_TARGET		0x0b	/* board not detected or not answering */
+
+#define MB_COILS_READ_MAX	2000
+#define MB_COILS_WRITE_MAX	0x7b0
+
+typedef struct
+{
+	int fd;
+	int rxLen;
+	uint8_t rx[2 * MBTCP_FRAME_MAX];
+	int txLen;
+	uint8_t tx[MBTCP_TX_MAX];
+} MbtcpClientType;
+
+typedef struct
+{
+	MbtcpClientType *cl;
+	uint16_t tid; /* transaction identifier */
+	uint8_t unit;
+	uint8_t fc;
+	uint16_t start;
+	uint16_t count;
+	uint16_t val; /* written coils, bit 0 = coil start */
+	uint8_t exception;
+} MbtcpReqType;
+
+typedef struct
+{
+	Relay16Board *board;
+	uint16_t val; /* bit 0 = relay 1 */
+	uint16_t written; /* relays written by the batch */
+	int loaded; /* val read from the board */
+	int error; /* exception of the batch */
+} MbtcpBoardType;
+
+typedef struct
+{
+	uint32_t requests;
+	uint32_t batches;
+	uint32_t coilWrites; /* write requests */
+	uint32_t boardWrites; /* output register writes */
+	uint32_t boardReads;
+	uint32_t exceptions;
+	uint32_t maxBatch;
+} MbtcpStatsType;
+
+static volatile sig_atomic_t gMbtcpStop = 0;
+static volatile sig_atomic_t gMbtcpReport = 0;
+static MbtcpBoardType gUnit[RELAY16_STACK_MAX];
+static MbtcpReqType gBatch[MBTCP_BATCH_MAX];
+static MbtcpStatsType gStats;
+
+static void mbtcpSignal(int sig)
+{
+	if (sig == SIGUSR1)
+	{
+		gMbtcpReport = 1;
+	}
+	else
+	{
+		gMbtcpStop = 1;
+	}
+}
+
+static void mbtcpReport(void)
+{
+	printf("requests %u coil writes %u batches %u largest %u board writes %u"
+		" board reads %u exceptions %u\n", gStats.requests, gStats.coilWrites,
+		gStats.batches, gStats.maxBatch, gStats.boardWrites, gStats.boardReads,
+		gStats.exceptions);
+	fflush(stdout);
+}
+
+static int mbtcpListen(const char *addr, int port)
+{
+	struct sockaddr_in sin;
+	int sock;
+	int on = 1;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+	{
+		printf("Invalid address %s!\n", addr);
+		return ERROR;
+	}
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (sock < 0)
+	{
+		printf("Fail to create the gateway socket!\n");
+		return ERROR;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(sock, (struct sockaddr*)&sin, sizeof(sin)) < 0)
+	{
+		printf("Fail to bind %s:%d!\n", addr, port);
+		close(sock);
+		return ERROR;
+	}
+	if (listen(sock, MBTCP_CLIENTS_MAX) < 0)
+	{
+		printf("Fail to listen on %s:%d!\n", addr, port);
+		close(sock);
+		return ERROR;
+	}
+	return sock;
+}
+
+/*
+ * mbtcpParse:
+ *	Check one request PDU, the exception code is kept for the response
+ *********************************************************************************
+ */
+static void mbtcpParse(MbtcpReqType *r, const uint8_t *pdu, int len, int unitOffset)
+{
+	int bytes;
+
+	r->fc = pdu[0];
+	r->exception = 0;
+	if ( (r->unit < unitOffset) || (r->unit >= unitOffset + RELAY16_STACK_MAX))
+	{
+		r->exception = MB_EX_PATH;
+		return;
+	}
+	if ( (r->fc != MB_FC_READ_COILS) && (r->fc != MB_FC_WRITE_COIL)
+		&& (r->fc != MB_FC_WRITE_COILS))
+	{
+		r->exception = MB_EX_FUNCTION;
+		return;
+	}
+	if (len < 5)
+	{
+		r->exception = MB_EX_VALUE;
+		return;
+	}
+	r->start = (pdu[1] << 8) | pdu[2];
+	r->count = (pdu[3] << 8) | pdu[4];
+	switch (r->fc)
+	{
+	case MB_FC_READ_COILS:
+		if ( (len != 5) || (r->count == 0) || (r->count > MB_COILS_READ_MAX))
+		{
+			r->exception = MB_EX_VALUE;
+		}
+		break;
+	case MB_FC_WRITE_COIL:
+		if ( (len != 5) || ( (r->count != 0xff00) && (r->count != 0)))
+		{
+			r->exception = MB_EX_VALUE;
+		}
+		r->val = r->count != 0;
+		r->count = 1;
+		break;
+	default:
+		bytes = (r->count + 7) / 8;
+		if ( (r->count == 0) || (r->count > MB_COILS_WRITE_MAX) || (len < 6)
+			|| (pdu[5] != bytes) || (len != 6 + bytes))
+		{
+			r->exception = MB_EX_VALUE;
+			break;
+		}
+		r->val = pdu[6] | (bytes > 1 ? pdu[7] << 8 : 0);
+		break;
+	}
+	if ( (r->exception == 0) && (r->start + r->count > RELAY_CH_NR_MAX))
+	{
+		r->exception = MB_EX_ADDRESS;
+	}
+}
+
+/*
+ * mbtcpCollect:
+ *	Move the complete requests of a client to the batch, return the number of
+ *	requests added or -1 if the client sends something else than Modbus TCP
+ *********************************************************************************
+ */
+static int mbtcpCollect(MbtcpClientType *cl, int *count, int unitOffset)
+{
+	MbtcpReqType *r;
+	int start = 0;
+	int added = 0;
+	int len;
+
+	while ( (*count < MBTCP_BATCH_MAX) && (cl->rxLen - start >= 7))
+	{
+		len = (cl->rx[start + 4] << 8) | cl->rx[start + 5];
+		if ( (cl->rx[start + 2] != 0) || (cl->rx[start + 3] != 0) || (len < 2)
+			|| (len > MBTCP_FRAME_MAX - 6))
+		{
+			return -1; // protocol identifier or length
+		}
+		if (cl->rxLen - start < 6 + len)
+		{
+			break;
+		}
+		r = &gBatch[(*count)++];
+		r->cl = cl;
+		r->tid = (cl->rx[start] << 8) | cl->rx[start + 1];
+		r->unit = cl->rx[start + 6];
+		mbtcpParse(r, &cl->rx[start + 7], len - 1, unitOffset);
+		start += 6 + len;
+		added++;
+	}
+	memmove(cl->rx, cl->rx + start, cl->rxLen - start);
+	cl->rxLen -= start;
+	return added;
+}
+
+static MbtcpBoardType* mbtcpBoard(int bus, int stack)
+{
+	MbtcpBoardType *u = &gUnit[stack];
+
+	if ( (u->board == NULL) && (relay16OpenBus(bus, stack, &u->board) != RELAY16_OK))
+	{
+		u->board = NULL;
+		u->error = MB_EX_TARGET;
+	}
+	return u;
+}
+
+/*
+ * mbtcpLoad:
+ *	Read the relays of a board once per batch, the relays already written by
+ *	the batch keep their new state
+ *********************************************************************************
+ */
+static int mbtcpLoad(MbtcpBoardType *u)
+{
+	uint16_t val;
+
+	if (u->loaded || (u->written == 0xffff))
+	{
+		return OK;
+	}
+	gStats.boardReads++;
+	if (relay16Get(u->board, &val) != RELAY16_OK)
+	{
+		u->error = MB_EX_TARGET;
+		return ERROR;
+	}
+	u->val = (val & ~u->written) | (u->val & u->written);
+	u->loaded = 1;
+	return OK;
+}
+
+/*
+ * mbtcpExec:
+ *	Run the batch: the requests are applied in order to the relay states,
+ *	then every board written gets one output register write
+ *********************************************************************************
+ */
+static void mbtcpExec(int count, int bus, int unitOffset)
+{
+	MbtcpBoardType *u;
+	MbtcpReqType *r;
+	uint16_t mask;
+	uint8_t used = 0;
+	int locked;
+	int i;
+
+	locked = relay16Lock() == RELAY16_OK;
+	for (i = 0; i < count; i++)
+	{
+		r = &gBatch[i];
+		if (r->exception != 0)
+		{
+			continue;
+		}
+		if (!locked)
+		{
+			r->exception = MB_EX_BUSY;
+			continue;
+		}
+		u = &gUnit[r->unit - unitOffset];
+		if (!(used & (1 << (r->unit - unitOffset))))
+		{
+			used |= 1 << (r->unit - unitOffset);
+			u->written = 0;
+			u->loaded = 0;
+			u->error = 0;
+			mbtcpBoard(bus, r->unit - unitOffset);
+		}
+		if (u->error != 0)
+		{
+			continue;
+		}
+		mask = (uint16_t) ( ( (1u << r->count) - 1) << r->start);
+		if (r->fc == MB_FC_READ_COILS)
+		{
+			if ( ( (mask & u->written) != mask) && (mbtcpLoad(u) != OK))
+			{
+				continue;
+			}
+			r->val = (u->val & mask) >> r->start;
+		}
+		else
+		{
+			gStats.coilWrites++;
+			u->val = (u->val & ~mask) | ( (r->val << r->start) & mask);
+			u->written |= mask;
+		}
+	}
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		u = &gUnit[i];
+		if ( (used & (1 << i)) && (u->error == 0) && (u->written != 0))
+		{
+			gStats.boardWrites++;
+			// a board read by the batch is written without reading it again
+			if ( (u->loaded || (u->written == 0xffff) ? relay16Set(u->board, u->val)
+				: relay16MaskApply(u->board, u->written, u->val)) != RELAY16_OK)
+			{
+				u->error = MB_EX_FAILURE;
+			}
+		}
+	}
+	if (locked)
+	{
+		relay16Unlock();
+	}
+	// the board errors apply to all the requests of the batch for the board
+	for (i = 0; i < count; i++)
+	{
+		r = &gBatch[i];
+		if ( (r->exception == 0) && (gUnit[r->unit - unitOffset].error != 0))
+		{
+			r->exception = gUnit[r->unit - unitOffset].error;
+		}
+	}
+}
+
+/*
+ * mbtcpRespond:
+ *	Queue the response of a request in its client buffer, -1 if it is full
+ *********************************************************************************
+ */
+static int mbtcpRespond(const MbtcpReqType *r)
+{
+	MbtcpClientType *cl = r->cl;
+	uint8_t *p;
+	int len;
+
+	if (cl->txLen + 7 + 6 > MBTCP_TX_MAX)
+	{
+		return -1;
+	}
+	p = cl->tx + cl->txLen;
+	p[0] = r->tid >> 8;
+	p[1] = r->tid & 0xff;
+	p[2] = 0;
+	p[3] = 0;
+	p[6] = r->unit;
+	if (r->exception != 0)
+	{
+		gStats.exceptions++;
+		p[7] = r->fc | MB_EXCEPTION;
+		p[8] = r->exception;
+		len = 2;
+	}
+	else if (r->fc == MB_FC_READ_COILS)
+	{
+		p[7] = r->fc;
+		p[8] = (r->count + 7) / 8;
+		p[9] = r->val & 0xff;
+		p[10] = r->val >> 8;
+		len = 2 + p[8];
+	}
+	else
+	{
+		// echo of the start and the value or the quantity
+		p[7] = r->fc;
+		p[8] = r->start >> 8;
+		p[9] = r->start & 0xff;
+		p[10] = r->fc == MB_FC_WRITE_COIL ? (r->val ? 0xff : 0) : r->count >> 8;
+		p[11] = r->fc == MB_FC_WRITE_COIL ? 0 : r->count & 0xff;
+		len = 5;
+	}
+	p[4] = 0;
+	p[5] = len + 1;
+	cl->txLen += 7 + len;
+	return 0;
+}
+
+static int mbtcpFlush(MbtcpClientType *cl)
+{
+	int n;
+
+	if (cl->txLen == 0)
+	{
+		return 0;
+	}
+	n = send(cl->fd, cl->tx, cl->txLen, MSG_NOSIGNAL);
+	if (n < 0)
+	{
+		return (errno == EAGAIN) || (errno == EINTR) ? 0 : -1;
+	}
+	memmove(cl->tx, cl->tx + n, cl->txLen - n);
+	cl->txLen -= n;
+	return 0;
+}
+
+static void mbtcpDrop(MbtcpClientType *clients[], int *nClients, int i)
+{
+	close(clients[i]->fd);
+	free(clients[i]);
+	clients[i] = clients[--(*nClients)];
+}
+
+int mbtcpRun(int bus, const char *addr, int port, int unitOffset)
+{
+	MbtcpClientType *clients[MBTCP_CLIENTS_MAX];
+	struct pollfd fds[MBTCP_CLIENTS_MAX + 1];
+	struct sigaction sa;
+	int nClients = 0;
+	int pending = 0;
+	int first = 0;
+	int count;
+	int lsock;
+	int on = 1;
+	int fd;
+	int n;
+	int i;
+	int k;
+
+	lsock = mbtcpListen(addr, port);
+	if (lsock < 0)
+	{
+		return ERROR;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = mbtcpSignal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGUSR1, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+	memset(gUnit, 0, sizeof(gUnit));
+	printf("16relind Modbus TCP gateway on %s:%d, unit IDs %d..%d for the stack levels"
+		" 0..7 of /dev/i2c-%d\n", addr, port, unitOffset,
+		unitOffset + RELAY16_STACK_MAX - 1, bus);
+	fflush(stdout);
+
+	while (!gMbtcpStop)
+	{
+		if (gMbtcpReport)
+		{
+			gMbtcpReport = 0;
+			mbtcpReport();
+		}
+		fds[0].fd = lsock;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		for (i = 0; i < nClients; i++)
+		{
+			fds[i + 1].fd = clients[i]->fd;
+			fds[i + 1].events = POLLIN | (clients[i]->txLen ? POLLOUT : 0);
+			fds[i + 1].revents = 0;
+		}
+		// requests left over by a full batch run without waiting
+		if (poll(fds, nClients + 1, pending ? 0 : -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		count = 0;
+		pending = 0;
+		for (i = nClients - 1; i >= 0; i--)
+		{
+			// a full buffer waits for the batch to take its requests
+			if ( (fds[i + 1].revents & (POLLIN | POLLERR | POLLHUP))
+				&& (clients[i]->rxLen < (int)sizeof(clients[i]->rx)))
+			{
+				n = read(clients[i]->fd, clients[i]->rx + clients[i]->rxLen,
+					sizeof(clients[i]->rx) - clients[i]->rxLen);
+				if ( (n == 0) || ( (n < 0) && (errno != EAGAIN) && (errno != EINTR)))
+				{
+					fds[i + 1].revents = 0;
+					clients[i]->rxLen = -1;
+					continue;
+				}
+				if (n > 0)
+				{
+					clients[i]->rxLen += n;
+				}
+			}
+		}
+		// a different first client every round, a full batch must not starve the last ones
+		for (k = 0; k < nClients; k++)
+		{
+			i = (k + first) % nClients;
+			if (clients[i]->rxLen > 0)
+			{
+				n = mbtcpCollect(clients[i], &count, unitOffset);
+				if (n < 0)
+				{
+					clients[i]->rxLen = -1;
+				}
+				else if (clients[i]->rxLen >= 7)
+				{
+					pending |= count == MBTCP_BATCH_MAX;
+				}
+			}
+		}
+		first++;
+		if (count > 0)
+		{
+			gStats.batches++;
+			gStats.requests += count;
+			if ( (uint32_t)count > gStats.maxBatch)
+			{
+				gStats.maxBatch = count;
+			}
+			mbtcpExec(count, bus, unitOffset);
+			for (i = 0; i < count; i++)
+			{
+				if ( (gBatch[i].cl->rxLen >= 0) && (mbtcpRespond(&gBatch[i]) != 0))
+				{
+					gBatch[i].cl->rxLen = -1; // not reading its responses
+				}
+			}
+		}
+		for (i = nClients - 1; i >= 0; i--)
+		{
+			if ( (clients[i]->rxLen < 0) || (mbtcpFlush(clients[i]) != 0))
+			{
+				mbtcpDrop(clients, &nClients, i);
+			}
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			fd = accept(lsock, NULL, NULL);
+			if ( (fd >= 0) && (nClients < MBTCP_CLIENTS_MAX)
+				&& ( (clients[nClients] = calloc(1, sizeof(MbtcpClientType))) != NULL))
+			{
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+				clients[nClients++]->fd = fd;
+			}
+			else if (fd >= 0)
+			{
+				close(fd);
+			}
+		}
+	}
+	for (i = 0; i < nClients; i++)
+	{
+		close(clients[i]->fd);
+		free(clients[i]);
+	}
+	close(lsock);
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		relay16Close(gUnit[i].board);
+	}
+	mbtcpReport();
+	return OK;
+}
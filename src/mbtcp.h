@@ -0,0 +1,14 @@
+#ifndef MBTCP_H_
+#define MBTCP_H_
+
+#define MBTCP_PORT_DEFAULT		502
+#define MBTCP_ADDR_DEFAULT		"127.0.0.1"
+#define MBTCP_UNIT_OFFSET		1	/* unit ID of the stack level 0, as the RS-485 slave */
+#define MBTCP_CLIENTS_MAX		32
+#define MBTCP_BATCH_MAX			256	/* requests executed under one bus lock */
+#define MBTCP_FRAME_MAX			260	/* MBAP header and the largest PDU */
+#define MBTCP_TX_MAX			8192	/* responses waiting for a slow client */
+
+int mbtcpRun(int bus, const char *addr, int port, int unitOffset);
+
+#endif //MBTCP_H_
@@ -0,0 +1,510 @@
+/*
+ * pulse.c:
+ *	Timed relay changes: delayed switches, pulses and pulse trains. All the
+ *	pending changes of the process are kept in one heap ordered by due time and
+ *	run by one thread sleeping on an absolute CLOCK_MONOTONIC timerfd, re-armed
+ *	for the heap top. The changes due when the thread wakes are merged per board
+ *	and each board gets one output register write, under one bus lock. The
+ *	ends of the write coalescing windows of the boards are kept in the same heap.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+
+#include "relay.h"
+#include "board.h"
+
+#define PULSE_PRIORITY	50 /* SCHED_RR, when the process is allowed to */
+#define PULSE_LATE_US	1000
+#define PULSE_COUNT_MAX	1000000
+#define PULSE_LOCK_RETRY_US	1000 /* before the bus lock is tried again */
+
+typedef struct
+{
+	uint64_t dueNs;
+	uint64_t seq; /* request order for the changes due at the same time */
+	Relay16Board *board;
+	uint16_t mask;
+	uint8_t state; /* applied at dueNs */
+	uint32_t onMs;
+	uint32_t offMs;
+	int remaining; /* changes after this one */
+	uint8_t flush; /* end of the board write coalescing window, no change */
+} PulseActionType;
+
+typedef struct
+{
+	Relay16Board *board;
+	uint16_t set;
+	uint16_t clr;
+	uint64_t firstDueNs;
+	int timed; /* relay changes, not only coalescing window ends */
+} PulseWriteType;
+
+static pthread_mutex_t gPulseLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gPulseDone;
+static pthread_once_t gPulseOnce = PTHREAD_ONCE_INIT;
+static PulseActionType *gHeap = NULL;
+static int gHeapCount = 0;
+static int gHeapSize = 0;
+static uint64_t gSeq = 0;
+static int gTimerFd = -1;
+static Relay16PulseStatsType gPulseStats;
+
+static uint64_t pulseTimeNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int actionBefore(const PulseActionType *a, const PulseActionType *b)
+{
+	return (a->dueNs < b->dueNs) || ( (a->dueNs == b->dueNs) && (a->seq < b->seq));
+}
+
+static void heapUp(int i)
+{
+	PulseActionType a = gHeap[i];
+
+	while (i > 0 && actionBefore(&a, &gHeap[(i - 1) / 2]))
+	{
+		gHeap[i] = gHeap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	gHeap[i] = a;
+}
+
+static void heapDown(int i)
+{
+	PulseActionType a = gHeap[i];
+	int child;
+
+	while ( (child = 2 * i + 1) < gHeapCount)
+	{
+		if ( (child + 1 < gHeapCount) && actionBefore(&gHeap[child + 1], &gHeap[child]))
+		{
+			child++;
+		}
+		if (!actionBefore(&gHeap[child], &a))
+		{
+			break;
+		}
+		gHeap[i] = gHeap[child];
+		i = child;
+	}
+	gHeap[i] = a;
+}
+
+static int heapPush(const PulseActionType *a)
+{
+	PulseActionType *h;
+	int size;
+
+	if (gHeapCount == gHeapSize)
+	{
+		size = gHeapSize ? 2 * gHeapSize : 64;
+		h = realloc(gHeap, size * sizeof(PulseActionType));
+		if (h == NULL)
+		{
+			return RELAY16_ERR_NOMEM;
+		}
+		gHeap = h;
+		gHeapSize = size;
+	}
+	gHeap[gHeapCount] = *a;
+	gHeap[gHeapCount].seq = gSeq++;
+	heapUp(gHeapCount++);
+	return RELAY16_OK;
+}
+
+static void heapPop(PulseActionType *a)
+{
+	*a = gHeap[0];
+	gHeap[0] = gHeap[--gHeapCount];
+	if (gHeapCount > 0)
+	{
+		heapDown(0);
+	}
+}
+
+/*
+ * pulseArm:
+ *	Wake the thread at the heap top due time, the caller holds gPulseLock
+ *********************************************************************************
+ */
+static void pulseArm(void)
+{
+	struct itimerspec its;
+	uint64_t due = gHeapCount ? gHeap[0].dueNs : 0;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = due / 1000000000ULL;
+	its.it_value.tv_nsec = due % 1000000000ULL;
+	timerfd_settime(gTimerFd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static int writeFind(PulseWriteType *w, int *count, Relay16Board *board,
+	uint64_t due)
+{
+	int i;
+
+	for (i = 0; i < *count; i++)
+	{
+		if (w[i].board == board)
+		{
+			return i;
+		}
+	}
+	if (*count == RELAY16_SCENE_MAX)
+	{
+		return -1;
+	}
+	w[i].board = board;
+	w[i].set = 0;
+	w[i].clr = 0;
+	w[i].firstDueNs = due;
+	w[i].timed = 0;
+	(*count)++;
+	return i;
+}
+
+/*
+ * pulseTick:
+ *	Run the changes due, one register write per board
+ *********************************************************************************
+ */
+static void pulseTick(void)
+{
+	PulseWriteType w[RELAY16_SCENE_MAX];
+	PulseActionType a;
+	uint64_t now;
+	uint64_t lateUs;
+	int count = 0;
+	int i;
+
+	now = pulseTimeNs();
+	while ( (gHeapCount > 0) && (gHeap[0].dueNs <= now))
+	{
+		i = writeFind(w, &count, gHeap[0].board, gHeap[0].dueNs);
+		if (i < 0)
+		{
+			break; // in the next round
+		}
+		heapPop(&a);
+		if (a.flush)
+		{
+			continue; // the write takes the pending coalesced changes
+		}
+		w[i].timed++;
+		if (a.state == ON)
+		{
+			w[i].set |= a.mask;
+			w[i].clr &= ~a.mask;
+		}
+		else
+		{
+			w[i].clr |= a.mask;
+			w[i].set &= ~a.mask;
+		}
+		gPulseStats.actions++;
+		if (a.remaining > 0)
+		{
+			// next edge of the train, timed from this due time, not from now
+			a.dueNs += (a.state == ON ? a.onMs : a.offMs) * 1000000ULL;
+			a.state = a.state == ON ? OFF : ON;
+			a.remaining--;
+			heapPush(&a);
+		}
+	}
+	for (i = 0; i < count; i++)
+	{
+		if ( (RELAY16_OK != boardMaskUpdate(w[i].board, SHADOW_OUT, w[i].set,
+			w[i].clr)) && w[i].timed)
+		{
+			gPulseStats.errors++;
+		}
+		if (!w[i].timed)
+		{
+			continue;
+		}
+		lateUs = (pulseTimeNs() - w[i].firstDueNs) / 1000;
+		gPulseStats.writes++;
+		gPulseStats.totalLateUs += lateUs;
+		if (lateUs > PULSE_LATE_US)
+		{
+			gPulseStats.late++;
+		}
+		if (lateUs > gPulseStats.maxLateUs)
+		{
+			gPulseStats.maxLateUs = lateUs > UINT32_MAX ? UINT32_MAX : lateUs;
+		}
+	}
+}
+
+static void* pulseThread(void *arg)
+{
+	struct sched_param sp;
+	uint64_t exp;
+
+	(void)arg;
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = PULSE_PRIORITY;
+	pthread_setschedparam(pthread_self(), SCHED_RR, &sp); // best effort
+	while (1)
+	{
+		if ( (read(gTimerFd, &exp, sizeof(exp)) != sizeof(exp)) && (errno != EINTR))
+		{
+			break;
+		}
+		// the changes wait for the bus, the timer fires again at once
+		if (relay16Lock() != RELAY16_OK)
+		{
+			usleep(PULSE_LOCK_RETRY_US);
+			pthread_mutex_lock(&gPulseLock);
+			pulseArm();
+			pthread_mutex_unlock(&gPulseLock);
+			continue;
+		}
+		pthread_mutex_lock(&gPulseLock);
+		pulseTick();
+		pulseArm();
+		pthread_cond_broadcast(&gPulseDone);
+		pthread_mutex_unlock(&gPulseLock);
+		relay16Unlock();
+	}
+	return NULL;
+}
+
+static void pulseInit(void)
+{
+	pthread_condattr_t attr;
+	pthread_attr_t tattr;
+	pthread_t th;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&gPulseDone, &attr);
+	pthread_condattr_destroy(&attr);
+	gTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (gTimerFd < 0)
+	{
+		return;
+	}
+	pthread_attr_init(&tattr);
+	pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&th, &tattr, pulseThread, NULL) != 0)
+	{
+		close(gTimerFd);
+		gTimerFd = -1;
+	}
+	pthread_attr_destroy(&tattr);
+}
+
+static int pulsePush(PulseActionType *a, uint64_t delayNs)
+{
+	int ret;
+
+	pthread_once(&gPulseOnce, pulseInit);
+	if (gTimerFd < 0)
+	{
+		return RELAY16_ERR_NOMEM;
+	}
+	pthread_mutex_lock(&gPulseLock);
+	a->dueNs = pulseTimeNs() + delayNs;
+	ret = heapPush(a);
+	if ( (ret == RELAY16_OK) && (gHeap[0].seq == gSeq - 1))
+	{
+		pulseArm(); // new heap top
+	}
+	pthread_mutex_unlock(&gPulseLock);
+	return ret;
+}
+
+static int pulseAdd(Relay16Board *board, uint16_t mask, int state,
+	uint32_t delayMs, uint32_t onMs, uint32_t offMs, int remaining)
+{
+	PulseActionType a;
+
+	if ( (board == NULL) || (mask == 0))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	memset(&a, 0, sizeof(a));
+	a.board = board;
+	a.mask = mask;
+	a.state = state;
+	a.onMs = onMs;
+	a.offMs = offMs;
+	a.remaining = remaining;
+	return pulsePush(&a, delayMs * 1000000ULL);
+}
+
+/*
+ * pulseFlushAfter:
+ *	Write the pending coalesced changes of the board in delayUs
+ *********************************************************************************
+ */
+int pulseFlushAfter(Relay16Board *b, uint32_t delayUs)
+{
+	PulseActionType a;
+
+	memset(&a, 0, sizeof(a));
+	a.board = b;
+	a.flush = 1;
+	return pulsePush(&a, delayUs * 1000ULL);
+}
+
+int relay16SwitchAfter(Relay16Board *board, uint16_t mask, int state,
+	uint32_t delayMs)
+{
+	if ( (state != OFF) && (state != ON))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	return pulseAdd(board, mask, state, delayMs, 0, 0, 0);
+}
+
+int relay16Pulse(Relay16Board *board, uint16_t mask, uint32_t delayMs,
+	uint32_t onMs, uint32_t offMs, int count)
+{
+	if ( (onMs == 0) || (count < 1) || (count > PULSE_COUNT_MAX)
+		|| ( (count > 1) && (offMs == 0)))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	return pulseAdd(board, mask, ON, delayMs, onMs, offMs, 2 * count - 1);
+}
+
+/*
+ * pulseRemove:
+ *	Drop the relays in mask from the pending changes of the board, and its
+ *	coalescing window ends if all, the caller holds gPulseLock
+ *********************************************************************************
+ */
+static void pulseRemove(Relay16Board *board, uint16_t mask, int all)
+{
+	int i;
+	int n = 0;
+
+	for (i = 0; i < gHeapCount; i++)
+	{
+		if (gHeap[i].board == board)
+		{
+			gHeap[i].mask &= ~mask;
+			gHeap[i].flush = gHeap[i].flush && !all;
+		}
+		if ( (gHeap[i].mask != 0) || gHeap[i].flush)
+		{
+			gHeap[n++] = gHeap[i];
+		}
+	}
+	gHeapCount = n;
+	for (i = n / 2 - 1; i >= 0; i--)
+	{
+		heapDown(i);
+	}
+	pulseArm();
+	pthread_cond_broadcast(&gPulseDone);
+}
+
+int relay16PulseCancel(Relay16Board *board, uint16_t mask)
+{
+	if (board == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	if (gTimerFd < 0)
+	{
+		return RELAY16_OK;
+	}
+	pthread_mutex_lock(&gPulseLock);
+	pulseRemove(board, mask, 0);
+	pthread_mutex_unlock(&gPulseLock);
+	return RELAY16_OK;
+}
+
+void pulseDetach(Relay16Board *b)
+{
+	if (gTimerFd < 0)
+	{
+		return;
+	}
+	pthread_mutex_lock(&gPulseLock);
+	pulseRemove(b, 0xffff, 1);
+	pthread_mutex_unlock(&gPulseLock);
+}
+
+static int pulsePending(Relay16Board *board)
+{
+	int i;
+
+	for (i = 0; i < gHeapCount; i++)
+	{
+		if ( (board == NULL) || (gHeap[i].board == board))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int relay16PulseWait(Relay16Board *board, uint32_t timeoutMs)
+{
+	struct timespec ts;
+	uint64_t end;
+	int ret = RELAY16_OK;
+
+	if (relay16LockHeld())
+	{
+		return RELAY16_ERR_LOCK; // the thread needs the bus lock to finish
+	}
+	if (gTimerFd < 0)
+	{
+		return RELAY16_OK;
+	}
+	end = pulseTimeNs() + timeoutMs * 1000000ULL;
+	ts.tv_sec = end / 1000000000ULL;
+	ts.tv_nsec = end % 1000000000ULL;
+	pthread_mutex_lock(&gPulseLock);
+	while (pulsePending(board) && (ret == RELAY16_OK))
+	{
+		if (timeoutMs == 0)
+		{
+			pthread_cond_wait(&gPulseDone, &gPulseLock);
+		}
+		else if (pthread_cond_timedwait(&gPulseDone, &gPulseLock, &ts) == ETIMEDOUT)
+		{
+			ret = RELAY16_ERR_TIMEOUT;
+		}
+	}
+	pthread_mutex_unlock(&gPulseLock);
+	return ret;
+}
+
+int relay16PulseStatsGet(Relay16PulseStatsType *stats, int clear)
+{
+	if (stats == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	pthread_mutex_lock(&gPulseLock);
+	*stats = gPulseStats;
+	if (clear)
+	{
+		memset(&gPulseStats, 0, sizeof(gPulseStats));
+	}
+	pthread_mutex_unlock(&gPulseLock);
+	return RELAY16_OK;
+}
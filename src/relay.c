@@ -8,44 +8,34 @@
  *	Author: Alexandru Burcea
  ***********************************************************************
  */
+#define _GNU_SOURCE /* secure_getenv */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "relay.h"
-#include "comm.h"
 #include "thread.h"
+#include "client.h"
+#include "daemon.h"
+#include "keepalive.h"
+#include "events.h"
+#include "mbtcp.h"
+#include "snapshot.h"
 
-#include <fcntl.h>
-#include <sys/stat.h>
-#include <semaphore.h>
-#include <time.h>
-#include <errno.h>
 
 #define VERSION_BASE	(int)1
 #define VERSION_MAJOR	(int)1
 #define VERSION_MINOR	(int)5
 
-#define UNUSED(X) (void)X      /* To avoid gcc/g++ warnings */
 #define CMD_ARRAY_SIZE	8
 
 #define THREAD_SAFE
-//#define DEBUG_SEM
-
-#define TIMEOUT_S 3
-
-const u16 relayMaskRemap[16] = {0x8000, 0x4000, 0x2000, 0x1000, 0x800, 0x400,
-	0x200, 0x100, 0x80, 0x40, 0x20, 0x10, 0x8, 0x4, 0x2, 0x1};
-const int relayChRemap[16] = {15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1,
-	0};
 
-int relayChSet(int dev, u8 channel, OutStateEnumType state);
-int relayChGet(int dev, u8 channel, OutStateEnumType *state);
-u16 relayToIO(u16 relay);
-u16 IOToRelay(u16 io);
-
-static void doHelp(int argc, char *argv[]);
+static int doHelp(int argc, char *argv[]);
 const CliCmdType CMD_HELP =
 	{"-h", 1, &doHelp,
 		"\t-h           Display the list of command options or one command option details\n",
@@ -53,74 +43,134 @@ const CliCmdType CMD_HELP =
 		"\tUsage:       16relind -h <param>   Display help for <param> command option\n",
 		"\tExample:     16relind -h write    Display help for \"write\" command option\n"};
 
-static void doVersion(int argc, char *argv[]);
+static int doVersion(int argc, char *argv[]);
 const CliCmdType CMD_VERSION = {"-v", 1, &doVersion,
 	"\t-v           Display the version number\n",
 	"\tUsage:       16relind -v\n", "",
 	"\tExample:     16relind -v  Display the version number\n"};
 
-static void doWarranty(int argc, char *argv[]);
+static int doWarranty(int argc, char *argv[]);
 const CliCmdType CMD_WAR = {"-warranty", 1, &doWarranty,
 	"\t-warranty    Display the warranty\n",
 	"\tUsage:       16relind -warranty\n", "",
 	"\tExample:     16relind -warranty  Display the warranty text\n"};
 
-static void doList(int argc, char *argv[]);
+static int doList(int argc, char *argv[]);
 const CliCmdType CMD_LIST =
 	{"-list", 1, &doList,
 		"\t-list:       List all 16relind boards connected, returnsb oards no and stack level for every board\n",
-		"\tUsage:       16relind -list\n", "",
+		"\tUsage:       16relind -list\n",
+		"\tUsage:       16relind -list refresh   Probe all the stack levels again instead of using the discovery cache\n",
 		"\tExample:     16relind -list display: 1,0 \n"};
 
-static void doRelayWrite(int argc, char *argv[]);
+static int doRelayWrite(int argc, char *argv[]);
 const CliCmdType CMD_WRITE = {"write", 2, &doRelayWrite,
 	"\twrite:       Set relays On/Off\n",
 	"\tUsage:       16relind <id> write <channel> <on/off>\n",
-	"\tUsage:       16relind <id> write <value>\n",
+	"\tUsage:       16relind <id> write <value, 0x<hex> or 0b<binary> accepted>\n",
 	"\tExample:     16relind 0 write 2 On; Set Relay #2 on Board #0 On\n"};
 
-static void doRelayRead(int argc, char *argv[]);
+static int doRelayMask(int argc, char *argv[]);
+const CliCmdType CMD_MASK_SET = {"set", 2, &doRelayMask,
+	"\tset:         Turn On several relays with one write\n",
+	"\tUsage:       16relind <id> set <channel list, 0x<hex> or 0b<binary> bitmap>\n", "",
+	"\tExample:     16relind 0 set 1,3,9-12; Turn On Relays #1, #3 and #9 to #12 on Board #0\n"};
+
+const CliCmdType CMD_MASK_CLEAR = {"clear", 2, &doRelayMask,
+	"\tclear:       Turn Off several relays with one write\n",
+	"\tUsage:       16relind <id> clear <channel list, 0x<hex> or 0b<binary> bitmap>\n", "",
+	"\tExample:     16relind 0 clear 0xff00; Turn Off Relays #9 to #16 on Board #0\n"};
+
+const CliCmdType CMD_MASK_TOGGLE = {"toggle", 2, &doRelayMask,
+	"\ttoggle:      Invert several relays with one write\n",
+	"\tUsage:       16relind <id> toggle <channel list, 0x<hex> or 0b<binary> bitmap>\n", "",
+	"\tExample:     16relind 0 toggle 2,4; Invert Relays #2 and #4 on Board #0\n"};
+
+static int doRelayApply(int argc, char *argv[]);
+const CliCmdType CMD_MASK_APPLY = {"apply", 2, &doRelayApply,
+	"\tapply:       Set the relays of a mask to the states in a value with one write, the others are not changed\n",
+	"\tUsage:       16relind <id> apply <channel list, 0x<hex> or 0b<binary> mask> <value>\n", "",
+	"\tExample:     16relind 0 apply 9-16 0x5500; Relays #9, #11, #13 and #15 On, #10, #12, #14 and #16 Off on Board #0\n"};
+
+static int doRelayRead(int argc, char *argv[]);
 const CliCmdType CMD_READ = {"read", 2, &doRelayRead,
 	"\tread:        Read relays status\n",
 	"\tUsage:       16relind <id> read <channel>\n",
 	"\tUsage:       16relind <id> read\n",
 	"\tExample:     16relind 0 read 2; Read Status of Relay #2 on Board #0\n"};
 
-static void doRelayFailsafeEnWrite(int argc, char *argv[]);
+static int doRelayFailsafeEnWrite(int argc, char *argv[]);
 const CliCmdType CMD_FAILSAFE_EN_WRITE = {"fsenwr", 2, &doRelayFailsafeEnWrite,
 	"\tfsenwr:       Enable/disable the failsafe state for a relay\n",
 	"\tUsage:       16relind <id> fsenwr <channel> <on/off>\n",
 	"\tUsage:       16relind <id> fsenwr <value>\n",
 	"\tExample:     16relind 0 fsenwr 2 On; Enable failsafe state for Relay #2 on Board #0 \n"};
 
-static void doRelayFailsafeEnRead(int argc, char *argv[]);
+static int doRelayFailsafeEnRead(int argc, char *argv[]);
 const CliCmdType CMD_FAILSAFE_EN_READ = {"fsenrd", 2, &doRelayFailsafeEnRead,
 	"\tfsenrd:       Read the failsafe state enable for a relay\n",
 	"\tUsage:       16relind <id> fsenrd <channel>\n",
 	"\tUsage:       16relind <id> fsenrd\n",
 	"\tExample:     16relind 0 fsenrd 2; Read if failsafe state is enabled for Relay #2 on Board #0 \n"};
 
-static void doRelayFailsafeStateWrite(int argc, char *argv[]);
+static int doRelayFailsafeStateWrite(int argc, char *argv[]);
 const CliCmdType CMD_FAILSAFE_STATE_WRITE = {"fsvwr", 2, &doRelayFailsafeStateWrite,
 	"\tfsvwr:       Enable/disable the failsafe state for a relay\n",
 	"\tUsage:       16relind <id> fsvwr <channel> <on/off>\n",
 	"\tUsage:       16relind <id> fsvwr <value>\n",
 	"\tExample:     16relind 0 fsvwr 2 On; Set failsafe state for Relay #2 on Board #0 to ON\n"};
 	
-static void doRelayFailsafeStateRead(int argc, char *argv[]);
+static int doRelayFailsafeStateRead(int argc, char *argv[]);
 const CliCmdType CMD_FAILSAFE_STATE_READ = {"fsvrd", 2, &doRelayFailsafeStateRead,
 	"\tfsvrd:       Read the failsafe state for a relay\n",
 	"\tUsage:       16relind <id> fsvrd	 <channel>\n",
 	"\tUsage:       16relind <id> fsvrd\n",
 	"\tExample:     16relind 0 fsvrd 2; Read failsafe state for Relay #2 on Board #0 \n"};	
 
-static void doLedSet(int argc, char *argv[]);
+static int doFailsafeProfile(int argc, char *argv[]);
+const CliCmdType CMD_FAILSAFE_PROFILE = {"fsprofile", 2, &doFailsafeProfile,
+	"\tfsprofile:   Read or write the failsafe enable and state of all the relays together\n",
+	"\tUsage:       16relind <id> fsprofile\n",
+	"\tUsage:       16relind <id> fsprofile <enable value> <state value>\n",
+	"\tExample:     16relind 0 fsprofile 0x00ff 0x000f; Relays #1..#8 on Board #0 go to their failsafe state, #1..#4 on, the others off\n"};
+
+static int doLedSet(int argc, char *argv[]);
 const CliCmdType CMD_LED_BLINK = {"pled", 2, &doLedSet,
 	"\tpled:        Set the power led mode (blink | on | off) \n",
 	"\tUsage:       16relind <id> pled <blink/off/on>\n", "",
 	"\tExample:     16relind 0 pled on; Set power led to always on state \n"};
 
-static void doTest(int argc, char *argv[]);
+static int doDaemon(int argc, char *argv[]);
+const CliCmdType CMD_DAEMON =
+	{"-daemon", 1, &doDaemon,
+		"\t-daemon:     Run in background, keep the boards open and serve the commands of other 16relind instances\n",
+		"\tUsage:       16relind -daemon [<socket path>]\n", "",
+		"\tExample:     16relind -daemon &  Start the daemon on /run/16relind.sock, next commands are forwarded to it\n"};
+
+static int doEvents(int argc, char *argv[]);
+const CliCmdType CMD_EVENTS =
+	{EVENTS_CMD, 1, &doEvents,
+		"\t-events:     Print a line for every change of the relays, instead of polling with \"read\"\n",
+		"\tUsage:       16relind -events [<id>...]   All the boards of the default bus without <id>\n",
+		"\tOutput:      <id> <old value> <new value> <time> <init/local/external>\n",
+		"\tExample:     16relind -events 0 1  \"0@1 0x0000 0x0004 1760600000.123456 local\": Relay #3 of Board #0 on /dev/i2c-1 turned on\n"};
+
+static int doMbtcp(int argc, char *argv[]);
+const CliCmdType CMD_MBTCP =
+	{"-mbtcp", 1, &doMbtcp,
+		"\t-mbtcp:      Run a Modbus TCP gateway to the relays of all the stacked boards (coils 0..15 = relays 1..16)\n",
+		"\tUsage:       16relind -mbtcp [<port> [<bind address> [<unit ID of stack level 0>]]]   Default 502 127.0.0.1 1\n",
+		"\tUsage:       kill -USR1 <pid>   Display the requests, the batches, the board reads and writes and the exceptions\n",
+		"\tExample:     16relind -mbtcp 1502 0.0.0.0 &  Serve the boards of the default bus to the network on port 1502, unit ID 1 = Board #0\n"};
+
+static int doBatch(int argc, char *argv[]);
+const CliCmdType CMD_BATCH =
+	{"-batch", 1, &doBatch,
+		"\t-batch:      Run the commands from a file or stdin (one per line, without \"16relind\") in one process\n",
+		"\tUsage:       16relind -batch [<file>]\n", "",
+		"\tExample:     printf \"0 write 1 on\\n0 write 2 on\\n\" | 16relind -batch  Turn on Relay #1 and #2 on Board #0\n"};
+
+static int doTest(int argc, char *argv[]);
 const CliCmdType CMD_TEST = {"test", 2, &doTest,
 	"\ttest:        Turn ON and OFF the relays until press a key\n",
 	"\tUsage:       16relind <id> test\n", " ",
@@ -132,10 +182,12 @@ char *usage = "Usage:	 16relind -h <command>\n"
 	"         16relind -list\n"
 	"         16relind <id> write <channel> <on/off>\n"
 	"         16relind <id> write <value>\n"
+	"         16relind -scene <id>:<value> [<id>:<value>...]\n"
 	"         16relind <id> read <channel>\n"
 	"         16relind <id> read\n"
 	"         16relind <id> test\n"
-	"Where: <id> = Board level id = 0..7\n"
+	"Where: <id> = Board level id = 0..7, <id>@<bus> for a board on /dev/i2c-<bus>\n"
+	"       or on the RS-485 line attached to <bus> by RELAY16_RTU=\"<bus>=<tty>[:<baud>[:<format>[:<offset>]]]\"\n"
 	"Type 16relind -h <command> for more help"; // No trailing newline needed here.
 
 char *warranty =
@@ -153,422 +205,602 @@ char *warranty =
 		"			\n"
 		"		You should have received a copy of the GNU Lesser General Public License\n"
 		"		along with this program. If not, see <http://www.gnu.org/licenses/>.";
-u16 relayToIO(u16 relay)
-{
-	u8 i;
-	u16 val = 0;
-	for (i = 0; i < 16; i++)
-	{
-		if ( (relay & (1 << i)) != 0)
-			val += relayMaskRemap[i];
-	}
-	return val;
-}
 
-u16 IOToRelay(u16 io)
+static Relay16Board *gBoard[RELAY16_BUS_MAX][RELAY16_STACK_MAX];
+// the command line writes are read back and repeated until they match
+static const Relay16VerifyCfgType gCliVerify = {RELAY16_VERIFY_RETRY,
+	RETRY_TIMES - 1, VERIFY_BACKOFF_US, VERIFY_BUDGET_MS * 1000};
+
+/*
+ * cliBusDefault:
+ *	I2C bus of the board ids without "@<bus>", RELAY16_BUS or /dev/i2c-1
+ *********************************************************************************
+ */
+int cliBusDefault(void)
 {
-	u8 i;
-	u16 val = 0;
-	for (i = 0; i < 16; i++)
+	const char *env = secure_getenv("RELAY16_BUS");
+
+	if ( (env != NULL) && (atoi(env) >= 0) && (atoi(env) < RELAY16_BUS_MAX))
 	{
-		if ( (io & relayMaskRemap[i]) != 0)
-		{
-			val += 1 << i;
-		}
+		return atoi(env);
 	}
-	return val;
+	return RELAY16_BUS_DEFAULT;
 }
 
-int relayChSet(int dev, u8 channel, OutStateEnumType state)
+/*
+ * doBoardInit:
+ *	Open the board "<stack>[@<bus>]", the handle is kept for the next commands
+ *	of this process
+ *********************************************************************************
+ */
+Relay16Board* doBoardInit(const char *id)
 {
-	int resp;
-	u8 buff[2];
-	u16 val = 0;
+	char *end = NULL;
+	int stack;
+	int bus;
+	int ret;
 
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	stack = (int)strtol(id, &end, 10);
+	if ( (end == id) || (stack < 0) || (stack > 7))
 	{
-		printf("Invalid relay nr!\n");
-		return ERROR;
+		printf("Invalid stack level [0..7]!");
+		return NULL;
+	}
+	bus = cliBusDefault();
+	if (*end == '@')
+	{
+		bus = (int)strtol(end + 1, &end, 10);
+		if ( (*end != 0) || (bus < 0) || (bus >= RELAY16_BUS_MAX))
+		{
+			printf("Invalid I2C bus [0..%d]!\n", RELAY16_BUS_MAX - 1);
+			return NULL;
+		}
 	}
-	if (FAIL == i2cMem8Read(dev, RELAY16_INPORT_REG_ADD, buff, 2))
+	if (gBoard[bus][stack] != NULL)
 	{
-		return FAIL;
+		return gBoard[bus][stack];
 	}
-	memcpy(&val, buff, 2);
-	switch (state)
+	ret = relay16OpenBus(bus, stack, &gBoard[bus][stack]);
+	switch (ret)
 	{
-	case OFF:
-		val &= ~ (1 << relayChRemap[channel - 1]);
-		memcpy(buff, &val, 2);
-		resp = i2cMem8Write(dev, RELAY16_OUTPORT_REG_ADD, buff, 2);
+	case RELAY16_OK:
+		relay16VerifySet(gBoard[bus][stack], &gCliVerify);
+		break;
+	case RELAY16_ERR_NODEV:
+		printf("16relind board id %s not detected\n", id);
 		break;
-	case ON:
-		val |= 1 << relayChRemap[channel - 1];
-		memcpy(buff, &val, 2);
-		resp = i2cMem8Write(dev, RELAY16_OUTPORT_REG_ADD, buff, 2);
+	case RELAY16_ERR_BUS:
+		printf("Failed to open the bus.\n");
 		break;
 	default:
-		printf("Invalid relay state!\n");
-		return ERROR;
+		printf("Fail to init board id %s: %s\n", id, relay16StrError(ret));
 		break;
 	}
-	return resp;
+	return gBoard[bus][stack];
 }
 
-int relayChGet(int dev, u8 channel, OutStateEnumType *state)
+/*
+ * boardCacheFlush:
+ *	Close all the boards opened by doBoardInit
+ *********************************************************************************
+ */
+void boardCacheFlush(void)
 {
-	u8 buff[2];
-	u16 val;
+	int i;
+	int j;
 
-	if (NULL == state)
+	for (i = 0; i < RELAY16_BUS_MAX; i++)
 	{
-		return ERROR;
+		for (j = 0; j < RELAY16_STACK_MAX; j++)
+		{
+			relay16Close(gBoard[i][j]);
+			gBoard[i][j] = NULL;
+		}
 	}
+}
+
+/*
+ * doRelayWrite:
+ *	Write coresponding relay channel
+ **************************************************************************************
+ */
+static int doRelayWrite(int argc, char *argv[])
+{
+	int pin = 0;
+	int state = STATE_COUNT;
+	u16 val = 0;
+	Relay16Board *board = NULL;
 
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	if ( (argc != 5) && (argc != 4))
 	{
-		printf("Invalid relay nr!\n");
+		printf("Usage: 16relind <id> write <relay number> <on/off> \n");
+		printf("Usage: 16relind <id> write <relay reg value> \n");
 		return ERROR;
 	}
 
-	if (FAIL == i2cMem8Read(dev, RELAY16_INPORT_REG_ADD, buff, 2))
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
 		return ERROR;
 	}
-	memcpy(&val, buff, 2);
-	if (val & (1 << relayChRemap[channel - 1]))
+	if (argc == 5)
 	{
-		*state = ON;
+		pin = atoi(argv[3]);
+		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
+		{
+			printf("Relay number value out of range\n");
+			return ERROR;
+		}
+
+		/**/if ( (strcasecmp(argv[4], "up") == 0)
+			|| (strcasecmp(argv[4], "on") == 0))
+			state = ON;
+		else if ( (strcasecmp(argv[4], "down") == 0)
+			|| (strcasecmp(argv[4], "off") == 0))
+			state = OFF;
+		else
+		{
+			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
+			{
+				printf("Invalid relay state!\n");
+				return ERROR;
+			}
+			state = (OutStateEnumType)atoi(argv[4]);
+		}
+
+		// read back and repeated by the library (gCliVerify)
+		if (OK != relay16ChSet(board, pin, state))
+		{
+			printf("Fail to write relay\n");
+			return ERROR;
+		}
 	}
 	else
 	{
-		*state = OFF;
+		if (OK != cliValueParse(argv[3], &val))
+		{
+			printf("Invalid relay value\n");
+			return ERROR;
+		}
+		if (OK != relay16Set(board, val))
+		{
+			printf("Fail to write relay!\n");
+			return ERROR;
+		}
 	}
 	return OK;
 }
 
-int relaySet(int dev, int val)
+/*
+ * cliValueParse:
+ *	Relay bitmap (bit 0 = relay 1) in decimal, 0x<hex> or 0b<binary>
+ *********************************************************************************
+ */
+int cliValueParse(const char *arg, uint16_t *val)
 {
-	u8 buff[2];
-	u16 rVal = 0;
+	const char *start = arg;
+	char *end = NULL;
+	unsigned long v;
+	int base = 10;
+
+	if ( (strncasecmp(arg, "0x", 2) == 0) || (strncasecmp(arg, "0b", 2) == 0))
+	{
+		base = tolower((unsigned char)arg[1]) == 'x' ? 16 : 2;
+		start = arg + 2;
+	}
+	if (!isxdigit((unsigned char)*start))
+	{
+		return ERROR; // no sign or blank
+	}
+	v = strtoul(start, &end, base);
+	if ( (end == start) || (*end != 0) || (v > 0xffff))
+	{
+		return ERROR;
+	}
+	*val = (uint16_t)v;
+	return OK;
+}
 
-	rVal = relayToIO(0xffff & val);
-	memcpy(buff, &rVal, 2);
+/*
+ * cliLineRead:
+ *	Read one line of a command or profile file. Return 1 for a line, 0 at the
+ *	end of the file and -1 for a line longer than the buffer, which is skipped
+ *	up to its end
+ *********************************************************************************
+ */
+static int cliLineRead(char *line, int size, FILE *in)
+{
+	int c;
 
-	return i2cMem8Write(dev, RELAY16_OUTPORT_REG_ADD, buff, 2);
+	if (fgets(line, size, in) == NULL)
+	{
+		return 0;
+	}
+	if ( (strchr(line, '\n') != NULL) || ( (int)strlen(line) < size - 1))
+	{
+		return 1;
+	}
+	c = fgetc(in);
+	if ( (c == EOF) || (c == '\n'))
+	{
+		return 1; // exactly full
+	}
+	while ( (c != EOF) && (c != '\n'))
+	{
+		c = fgetc(in);
+	}
+	return -1;
 }
 
-int relayGet(int dev, int *val)
+/*
+ * cliChannelsParse:
+ *	Relay bitmap from a channel list like "1,3,9-12", or 0x<hex> or 0b<binary>
+ *********************************************************************************
+ */
+int cliChannelsParse(const char *arg, uint16_t *mask)
 {
-	u8 buff[2];
-	u16 rVal = 0;
+	const char *p = arg;
+	char *end = NULL;
+	long first;
+	long last;
+	uint16_t m = 0;
 
-	if (NULL == val)
+	if ( (strncasecmp(arg, "0x", 2) == 0) || (strncasecmp(arg, "0b", 2) == 0))
 	{
-		return ERROR;
+		return cliValueParse(arg, mask);
 	}
-	if (FAIL == i2cMem8Read(dev, RELAY16_INPORT_REG_ADD, buff, 2))
+	while (1)
 	{
-		return ERROR;
+		if ( (*p < '0') || (*p > '9'))
+		{
+			return ERROR;
+		}
+		first = strtol(p, &end, 10);
+		last = first;
+		if (*end == '-')
+		{
+			p = end + 1;
+			if ( (*p < '0') || (*p > '9'))
+			{
+				return ERROR;
+			}
+			last = strtol(p, &end, 10);
+		}
+		if ( (first < CHANNEL_NR_MIN) || (last > RELAY_CH_NR_MAX) || (first > last))
+		{
+			return ERROR;
+		}
+		for (; first <= last; first++)
+		{
+			m |= 1 << (first - 1);
+		}
+		if (*end == 0)
+		{
+			break;
+		}
+		if (*end != ',')
+		{
+			return ERROR;
+		}
+		p = end + 1;
 	}
-	memcpy(&rVal, buff, 2);
-	*val = IOToRelay(rVal);
+	*mask = m;
 	return OK;
 }
-// enable failsafe state for each relay, 0 = off, 1 = on
-int relayFailsafeEnChSet(int dev, u8 channel, OutStateEnumType state)
+
+static int doRelayMask(int argc, char *argv[])
 {
-	int resp;
-	u8 buff[2];
-	u16 val = 0;
+	Relay16Board *board = NULL;
+	uint16_t mask = 0;
+	int ret;
 
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	if (argc != 4)
 	{
-		printf("Invalid relay nr!\n");
+		printf("Usage: 16relind <id> %s <channel list, 0x<hex> or 0b<binary> bitmap>\n",
+			argv[2]);
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 2))
+	if (OK != cliChannelsParse(argv[3], &mask))
 	{
-		return FAIL;
+		printf("Invalid relay list or bitmap!\n");
+		return ERROR;
 	}
-	memcpy(&val, buff, 2);
-	switch (state)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-	case OFF:
-		val &= ~ (1 << relayChRemap[channel - 1]);
-		memcpy(buff, &val, 2);
-		resp = i2cMem8Write(dev, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 2);
-		break;
-	case ON:
-		val |= 1 << relayChRemap[channel - 1];
-		memcpy(buff, &val, 2);
-		resp = i2cMem8Write(dev, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 2);
-		break;
-	default:
-		printf("Invalid relay state!\n");
 		return ERROR;
-		break;
 	}
-	return resp;
+	if (strcasecmp(argv[2], CMD_MASK_SET.name) == 0)
+	{
+		ret = relay16MaskSet(board, mask);
+	}
+	else if (strcasecmp(argv[2], CMD_MASK_CLEAR.name) == 0)
+	{
+		ret = relay16MaskClear(board, mask);
+	}
+	else
+	{
+		ret = relay16MaskToggle(board, mask);
+	}
+	if (ret != OK)
+	{
+		printf("Fail to write relays: %s\n", relay16StrError(ret));
+		return ERROR;
+	}
+	return OK;
 }
 
-int relayFailsafeEnChGet(int dev, u8 channel, OutStateEnumType *state)
+static int doRelayApply(int argc, char *argv[])
 {
-	u8 buff[2];
-	u16 val;
+	Relay16Board *board = NULL;
+	uint16_t mask = 0;
+	uint16_t val = 0;
+	int ret;
 
-	if (NULL == state)
+	if (argc != 5)
 	{
+		printf("%s", CMD_MASK_APPLY.usage1);
 		return ERROR;
 	}
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	if (OK != cliChannelsParse(argv[3], &mask))
 	{
-		printf("Invalid relay nr!\n");
+		printf("Invalid relay list or bitmap!\n");
 		return ERROR;
 	}
-
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 2))
+	if (OK != cliValueParse(argv[4], &val))
 	{
+		printf("Invalid relay value\n");
 		return ERROR;
 	}
-	memcpy(&val, buff, 2);
-	if (val & (1 << relayChRemap[channel - 1]))
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		*state = ON;
+		return ERROR;
 	}
-	else
+	ret = relay16MaskApply(board, mask, val);
+	if (ret != OK)
 	{
-		*state = OFF;
+		printf("Fail to write relays: %s\n", relay16StrError(ret));
+		return ERROR;
 	}
 	return OK;
 }
 
-int relayFailsafeEnSet(int dev, int val)
+static int cliLockedBoardInit(const char *id, Relay16Board **board)
 {
-	u8 buff[2];
-	u16 rVal = 0;
-
-	rVal = relayToIO(0xffff & val);
-	memcpy(buff, &rVal, 2);
+	// already locked when run by the daemon or in a batch
+	int locked = relay16LockHeld() == 0;
 
-	return i2cMem8Write(dev, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 2);
+	*board = NULL;
+	if (locked && (relay16Lock() != OK))
+	{
+		printf("The bus is busy, try again\n");
+		return ERROR;
+	}
+	*board = doBoardInit(id);
+	if (locked)
+	{
+		relay16Unlock();
+	}
+	return *board != NULL ? OK : ERROR;
 }
 
-int relayFailsafeEnGet(int dev, int *val)
+/*
+ * cliPulseWait:
+ *	Wait for the timed changes and display the timing, unless the command runs
+ *	in the daemon or in a batch (bus lock held), then they run in background
+ *********************************************************************************
+ */
+static int cliPulseWait(Relay16Board *board)
 {
-	u8 buff[2];
-	u16 rVal = 0;
+	Relay16PulseStatsType stats;
 
-	if (NULL == val)
+	if (OK != relay16PulseWait(board, 0))
 	{
-		return ERROR;
+		return OK;
 	}
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_FAILSAFE_EN_ADD, buff, 2))
+	relay16PulseStatsGet(&stats, 1);
+	printf("writes %u late %u errors %u latency avg %uus max %uus\n", stats.writes,
+		stats.late, stats.errors,
+		stats.writes ? (unsigned int) (stats.totalLateUs / stats.writes) : 0,
+		stats.maxLateUs);
+	return stats.errors ? ERROR : OK;
+}
+
+static int cliChannel(const char *arg)
+{
+	int ch = atoi(arg);
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > RELAY_CH_NR_MAX))
 	{
+		printf("Relay number value out of range\n");
 		return ERROR;
 	}
-	memcpy(&rVal, buff, 2);
-	*val = IOToRelay(rVal);
-	return OK;
+	return ch;
 }
 
-// set/get failsafe state for each relay, 0 = off, 1 = on
-int relayFailsafeStateChSet(int dev, u8 channel, OutStateEnumType state)
+int doPulse(int argc, char *argv[]);
+const CliCmdType CMD_PULSE = {"pulse", 2, &doPulse,
+	"\tpulse:       Turn a relay on for a time, once or several times, timed by the library instead of sleep\n",
+	"\tUsage:       16relind <id> pulse <channel> <on ms>\n",
+	"\tUsage:       16relind <id> pulse <channel> <on ms> <count> [<off ms>]\n",
+	"\tExample:     16relind 0 pulse 12 200 3 500; Pulse Relay #12 on Board #0 three times, 200ms on and 500ms off\n"};
+
+int doPulse(int argc, char *argv[])
 {
-	int resp;
-	u8 buff[2];
-	u16 val = 0;
+	Relay16Board *board = NULL;
+	int ch;
+	int onMs;
+	int offMs;
+	int count = 1;
+	int ret;
 
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	if ( (argc < 5) || (argc > 7))
 	{
-		printf("Invalid relay nr!\n");
+		printf("%s%s", CMD_PULSE.usage1, CMD_PULSE.usage2);
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, 	I2C_MEM_RELAY_FAILSAFE_VAL_ADD, buff, 2))
+	ch = cliChannel(argv[3]);
+	if (ch == ERROR)
 	{
-		return FAIL;
+		return ERROR;
 	}
-	memcpy(&val, buff, 2);
-	switch (state)
+	onMs = atoi(argv[4]);
+	if (argc > 5)
+	{
+		count = atoi(argv[5]);
+	}
+	offMs = argc > 6 ? atoi(argv[6]) : onMs;
+	if ( (onMs <= 0) || (offMs <= 0) || (count <= 0))
+	{
+		printf("Invalid pulse time or count!\n");
+		return ERROR;
+	}
+	if (OK != cliLockedBoardInit(argv[1], &board))
 	{
-	case OFF:
-		val &= ~ (1 << relayChRemap[channel - 1]);
-		memcpy(buff, &val, 2);
-		resp = i2cMem8Write(dev, I2C_MEM_RELAY_FAILSAFE_VAL_ADD, buff, 2);
-		break;
-	case ON:
-		val |= 1 << relayChRemap[channel - 1];
-		memcpy(buff, &val, 2);
-		resp = i2cMem8Write(dev, I2C_MEM_RELAY_FAILSAFE_VAL_ADD, buff, 2);
-		break;
-	default:
-		printf("Invalid relay state!\n");
 		return ERROR;
-		break;
 	}
-	return resp;
+	ret = relay16Pulse(board, 1 << (ch - 1), 0, onMs, offMs, count);
+	if (ret != OK)
+	{
+		printf("Fail to pulse the relay: %s\n", relay16StrError(ret));
+		return ERROR;
+	}
+	return cliPulseWait(board);
 }
 
-int relayFailsafeStateChGet(int dev, u8 channel, OutStateEnumType *state)
+int doDelayedWrite(int argc, char *argv[]);
+const CliCmdType CMD_DELAYED_WRITE = {"dwrite", 2, &doDelayedWrite,
+	"\tdwrite:      Set a relay On/Off after a delay\n",
+	"\tUsage:       16relind <id> dwrite <channel> <on/off> <delay ms>\n", "",
+	"\tExample:     16relind 0 dwrite 5 off 800; Turn Relay #5 on Board #0 off in 800ms\n"};
+
+int doDelayedWrite(int argc, char *argv[])
 {
-	u8 buff[2];
-	u16 val;
+	Relay16Board *board = NULL;
+	int ch;
+	int state;
+	int delayMs;
+	int ret;
 
-	if (NULL == state)
+	if (argc != 6)
 	{
+		printf("%s", CMD_DELAYED_WRITE.usage1);
 		return ERROR;
 	}
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	ch = cliChannel(argv[3]);
+	if (ch == ERROR)
 	{
-		printf("Invalid relay nr!\n");
 		return ERROR;
 	}
-
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_FAILSAFE_VAL_ADD, buff, 2))
+	if ( (strcasecmp(argv[4], "up") == 0) || (strcasecmp(argv[4], "on") == 0))
 	{
-		return ERROR;
+		state = ON;
 	}
-	memcpy(&val, buff, 2);
-	if (val & (1 << relayChRemap[channel - 1]))
+	else if ( (strcasecmp(argv[4], "down") == 0) || (strcasecmp(argv[4], "off") == 0))
 	{
-		*state = ON;
+		state = OFF;
 	}
 	else
 	{
-		*state = OFF;
+		printf("Invalid relay state!\n");
+		return ERROR;
 	}
-	return OK;
-}
-
-int relayFailsafeStateSet(int dev, int val)
-{
-	u8 buff[2];
-	u16 rVal = 0;
-
-	rVal = relayToIO(0xffff & val);
-	memcpy(buff, &rVal, 2);
-
-	return i2cMem8Write(dev, I2C_MEM_RELAY_FAILSAFE_VAL_ADD, buff, 2);
-}
-
-int relayFailsafeStateGet(int dev, int *val)
-{
-	u8 buff[2];
-	u16 rVal = 0;
-
-	if (NULL == val)
+	delayMs = atoi(argv[5]);
+	if (delayMs < 0)
 	{
+		printf("Invalid delay!\n");
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_FAILSAFE_VAL_ADD, buff, 2))
+	if (OK != cliLockedBoardInit(argv[1], &board))
 	{
 		return ERROR;
 	}
-	memcpy(&rVal, buff, 2);
-	*val = IOToRelay(rVal);
-	return OK;
+	ret = relay16SwitchAfter(board, 1 << (ch - 1), state, delayMs);
+	if (ret != OK)
+	{
+		printf("Fail to write relay: %s\n", relay16StrError(ret));
+		return ERROR;
+	}
+	return cliPulseWait(board);
 }
 
-
-
-int doBoardInit(int stack)
+/*
+ * doRelayRead:
+ *	Read relay state
+ ******************************************************************************************
+ */
+static int doRelayRead(int argc, char *argv[])
 {
-	int dev = 0;
-	int add = 0;
-	uint8_t buff[8];
+	int pin = 0;
+	u16 val = 0;
+	Relay16Board *board = NULL;
+	int state = STATE_COUNT;
 
-	if ( (stack < 0) || (stack > 7))
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		printf("Invalid stack level [0..7]!");
 		return ERROR;
 	}
-	add = (stack + RELAY16_HW_I2C_BASE_ADD) ^ 0x07;
-	dev = i2cSetup(add);
-	if (dev == -1)
-	{
-		return ERROR;
 
-	}
-	if (ERROR == i2cMem8Read(dev, RELAY16_CFG_REG_ADD, buff, 1))
+	if (argc == 4)
 	{
-		add = (stack + RELAY16_HW_I2C_ALTERNATE_BASE_ADD) ^ 0x07;
-		dev = i2cSetup(add);
-		if (dev == -1)
+		pin = atoi(argv[3]);
+		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
 		{
+			printf("Relay number value out of range!\n");
 			return ERROR;
 		}
-		if (ERROR == i2cMem8Read(dev, RELAY16_CFG_REG_ADD, buff, 1))
+
+		if (OK != relay16ChGet(board, pin, &state))
 		{
-			printf("16relind board id %d not detected\n", stack);
+			printf("Fail to read!\n");
 			return ERROR;
 		}
-	}
-	if (buff[0] != 0) //non initialized I/O Expander
-	{
-		// make all I/O pins output
-		buff[0] = 0;
-		buff[1] = 0;
-		if (0 > i2cMem8Write(dev, RELAY16_CFG_REG_ADD, buff, 2))
+		if (state != 0)
 		{
-			return ERROR;
+			printf("1\n");
 		}
-		// put all pins in 0-logic state
-		buff[0] = 0;
-		if (0 > i2cMem8Write(dev, RELAY16_OUTPORT_REG_ADD, buff, 2))
+		else
 		{
-			return ERROR;
+			printf("0\n");
 		}
 	}
-
-	return dev;
-}
-
-int boardCheck(int hwAdd)
-{
-	int dev = 0;
-	uint8_t buff[8];
-
-	hwAdd ^= 0x07;
-	dev = i2cSetup(hwAdd);
-	if (dev == -1)
+	else if (argc == 3)
 	{
-		return FAIL;
+		if (OK != relay16Get(board, &val))
+		{
+			printf("Fail to read!\n");
+			return ERROR;
+		}
+		printf("%d\n", val);
 	}
-	if (ERROR == i2cMem8Read(dev, RELAY16_CFG_REG_ADD, buff, 1))
+	else
 	{
+		printf("Usage: %s read relay value\n", argv[0]);
 		return ERROR;
 	}
 	return OK;
 }
 
-/*
- * doRelayWrite:
- *	Write coresponding relay channel
- **************************************************************************************
- */
-static void doRelayWrite(int argc, char *argv[])
+int doRelayFailsafeEnWrite(int argc, char *argv[])
 {
 	int pin = 0;
 	OutStateEnumType state = STATE_COUNT;
 	int val = 0;
-	int dev = 0;
-	OutStateEnumType stateR = STATE_COUNT;
-	int valR = 0;
-	int retry = 0;
+	Relay16Board *board = NULL;
 
 	if ( (argc != 5) && (argc != 4))
 	{
-		printf("Usage: 16relind <id> write <relay number> <on/off> \n");
-		printf("Usage: 16relind <id> write <relay reg value> \n");
-		return;
+		printf("Usage: 16relind <id> fsenwr <relay number> <on/off> \n");
+		printf("Usage: 16relind <id> fsenwr <relay reg value> \n");
+		return ERROR;
 	}
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 	if (argc == 5)
 	{
@@ -576,7 +808,7 @@ static void doRelayWrite(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
 		{
 			printf("Relay number value out of range\n");
-			return;
+			return ERROR;
 		}
 
 		/**/if ( (strcasecmp(argv[4], "up") == 0)
@@ -590,227 +822,46 @@ static void doRelayWrite(int argc, char *argv[])
 			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
 			{
 				printf("Invalid relay state!\n");
-				return;
-			}
-			state = (OutStateEnumType)atoi(argv[4]);
-		}
-
-		retry = RETRY_TIMES;
-
-		while ( (retry > 0) && (stateR != state))
-		{
-			if (OK != relayChSet(dev, pin, state))
-			{
-				printf("Fail to write relay\n");
-				return;
-			}
-			if (OK != relayChGet(dev, pin, &stateR))
-			{
-				printf("Fail to read relay\n");
-				return;
-			}
-			retry--;
-		}
-#ifdef DEBUG_I
-		if(retry < RETRY_TIMES)
-		{
-			printf("retry %d times\n", 3-retry);
-		}
-#endif
-		if (retry == 0)
-		{
-			printf("Fail to write relay\n");
-			return;
-		}
-	}
-	else
-	{
-		val = atoi(argv[3]);
-		if (val < 0 || val > 255)
-		{
-			printf("Invalid relay value\n");
-			return;
-		}
-
-		retry = RETRY_TIMES;
-		valR = -1;
-		while ( (retry > 0) && (valR != val))
-		{
-
-			if (OK != relaySet(dev, val))
-			{
-				printf("Fail to write relay!\n");
-				return;
-			}
-			if (OK != relayGet(dev, &valR))
-			{
-				printf("Fail to read relay!\n");
-				return;
-			}
-		}
-		if (retry == 0)
-		{
-			printf("Fail to write relay!\n");
-			return;
-		}
-	}
-}
-
-/*
- * doRelayRead:
- *	Read relay state
- ******************************************************************************************
- */
-static void doRelayRead(int argc, char *argv[])
-{
-	int pin = 0;
-	int val = 0;
-	int dev = 0;
-	OutStateEnumType state = STATE_COUNT;
-
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
-	{
-		return;
-	}
-
-	if (argc == 4)
-	{
-		pin = atoi(argv[3]);
-		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
-		{
-			printf("Relay number value out of range!\n");
-			return;
-		}
-
-		if (OK != relayChGet(dev, pin, &state))
-		{
-			printf("Fail to read!\n");
-			return;
-		}
-		if (state != 0)
-		{
-			printf("1\n");
-		}
-		else
-		{
-			printf("0\n");
-		}
-	}
-	else if (argc == 3)
-	{
-		if (OK != relayGet(dev, &val))
-		{
-			printf("Fail to read!\n");
-			return;
-		}
-		printf("%d\n", val);
-	}
-	else
-	{
-		printf("Usage: %s read relay value\n", argv[0]);
-		return;
-	}
-}
-
-void doRelayFailsafeEnWrite(int argc, char *argv[])
-{
-	int pin = 0;
-	OutStateEnumType state = STATE_COUNT;
-	int val = 0;
-	int dev = 0;
-	
-	int valR = 0;
-	int retry = 0;
-
-	if ( (argc != 5) && (argc != 4))
-	{
-		printf("Usage: 16relind <id> fsenwr <relay number> <on/off> \n");
-		printf("Usage: 16relind <id> fsenwr <relay reg value> \n");
-		return;
-	}
-
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
-	{
-		return;
-	}
-	if (argc == 5)
-	{
-		pin = atoi(argv[3]);
-		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
-		{
-			printf("Relay number value out of range\n");
-			return;
-		}
-
-		/**/if ( (strcasecmp(argv[4], "up") == 0)
-			|| (strcasecmp(argv[4], "on") == 0))
-			state = ON;
-		else if ( (strcasecmp(argv[4], "down") == 0)
-			|| (strcasecmp(argv[4], "off") == 0))
-			state = OFF;
-		else
-		{
-			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
-			{
-				printf("Invalid relay state!\n");
-				return;
+				return ERROR;
 			}
 			state = (OutStateEnumType)atoi(argv[4]);
 		}
 
 		
-		if (OK != relayFailsafeEnChSet(dev, pin, state))
+		if (OK != relay16FailsafeEnChSet(board, pin, state))
 		{
 			printf("Fail to write relay failsafe enable\n");
-			return;
+			return ERROR;
 		}
 	}
 	else
 	{
 		val = atoi(argv[3]);
-		if (val < 0 || val > 255)
+		if (val < 0 || val > 0xffff)
 		{
 			printf("Invalid relay value\n");
-			return;
-		}
-
-		retry = RETRY_TIMES;
-		valR = -1;
-		while ( (retry > 0) && (valR != val))
-		{
-
-			if (OK != relayFailsafeEnSet(dev, val))
-			{
-				printf("Fail to write relay failsafe enable!\n");
-				return;
-			}
-			if (OK != relayFailsafeEnGet(dev, &valR))
-			{
-				printf("Fail to read relay failsafe enable!\n");
-				return;
-			}
+			return ERROR;
 		}
-		if (retry == 0)
+		if (OK != relay16FailsafeEnSet(board, val))
 		{
 			printf("Fail to write relay failsafe enable!\n");
-			return;
+			return ERROR;
 		}
 	}
+	return OK;
 }
 
-void doRelayFailsafeEnRead(int argc, char *argv[])
+int doRelayFailsafeEnRead(int argc, char *argv[])
 {
 	int pin = 0;
-	int val = 0;
-	int dev = 0;
-	OutStateEnumType state = STATE_COUNT;
+	u16 val = 0;
+	Relay16Board *board = NULL;
+	int state = STATE_COUNT;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -819,13 +870,13 @@ void doRelayFailsafeEnRead(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
 		{
 			printf("Relay number value out of range!\n");
-			return;
+			return ERROR;
 		}
 
-		if (OK != relayFailsafeEnChGet(dev, pin, &state))
+		if (OK != relay16FailsafeEnChGet(board, pin, &state))
 		{
 			printf("Fail to read!\n");
-			return;
+			return ERROR;
 		}
 		if (state != 0)
 		{
@@ -838,39 +889,40 @@ void doRelayFailsafeEnRead(int argc, char *argv[])
 	}
 	else if (argc == 3)
 	{
-		if (OK != relayFailsafeEnGet(dev, &val))
+		if (OK != relay16FailsafeEnGet(board, &val))
 		{
 			printf("Fail to read!\n");
-			return;
+			return ERROR;
 		}
 		printf("%d\n", val);
 	}
 	else
 	{
 		printf("Usage: %s fsenrd relay failsafe enable value\n", argv[0]);
-		return;
+		return ERROR;
 	}
+	return OK;
 }
 
-void doRelayFailsafeStateWrite(int argc, char *argv[])
+int doRelayFailsafeStateWrite(int argc, char *argv[])
 {
 	int pin = 0;
 	OutStateEnumType state = STATE_COUNT;
 	int val = 0;
-	int dev = 0;
+	Relay16Board *board = NULL;
 	
 
 	if ( (argc != 5) && (argc != 4))
 	{
 		printf("Usage: 16relind <id> fstwr <relay number> <on/off> \n");
 		printf("Usage: 16relind <id> fstwr <relay reg value> \n");
-		return;
+		return ERROR;
 	}
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 	if (argc == 5)
 	{
@@ -878,7 +930,7 @@ void doRelayFailsafeStateWrite(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
 		{
 			printf("Relay number value out of range\n");
-			return;
+			return ERROR;
 		}
 
 		/**/if ( (strcasecmp(argv[4], "up") == 0)
@@ -892,49 +944,50 @@ void doRelayFailsafeStateWrite(int argc, char *argv[])
 			if ( (atoi(argv[4]) >= STATE_COUNT) || (atoi(argv[4]) < 0))
 			{
 				printf("Invalid relay state!\n");
-				return;
+				return ERROR;
 			}
 			state = (OutStateEnumType)atoi(argv[4]);
 		}
 
 		
-		if (OK != relayFailsafeStateChSet(dev, pin, state))
+		if (OK != relay16FailsafeValChSet(board, pin, state))
 		{
 			printf("Fail to write relay failsafe state\n");
-			return;
+			return ERROR;
 		}
 	}
 	else
 	{
 		val = atoi(argv[3]);
-		if (val < 0 || val > 255)
+		if (val < 0 || val > 0xffff)
 		{
 			printf("Invalid relay value\n");
-			return;
+			return ERROR;
 		}
 
 		
-		if (OK != relayFailsafeStateSet(dev, val))
+		if (OK != relay16FailsafeValSet(board, val))
 		{
 			printf("Fail to write relay failsafe state!\n");
-			return;
+			return ERROR;
 		}
 		
 	
 	}
+	return OK;
 }
 
-void doRelayFailsafeStateRead(int argc, char *argv[])
+int doRelayFailsafeStateRead(int argc, char *argv[])
 {
 	int pin = 0;
-	int val = 0;
-	int dev = 0;
-	OutStateEnumType state = STATE_COUNT;
+	u16 val = 0;
+	Relay16Board *board = NULL;
+	int state = STATE_COUNT;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -943,13 +996,13 @@ void doRelayFailsafeStateRead(int argc, char *argv[])
 		if ( (pin < CHANNEL_NR_MIN) || (pin > RELAY_CH_NR_MAX))
 		{
 			printf("Relay number value out of range!\n");
-			return;
+			return ERROR;
 		}
 
-		if (OK != relayFailsafeStateChGet(dev, pin, &state))
+		if (OK != relay16FailsafeValChGet(board, pin, &state))
 		{
 			printf("Fail to read!\n");
-			return;
+			return ERROR;
 		}
 		if (state != 0)
 		{
@@ -962,152 +1015,189 @@ void doRelayFailsafeStateRead(int argc, char *argv[])
 	}
 	else if (argc == 3)
 	{
-		if (OK != relayFailsafeStateGet(dev, &val))
+		if (OK != relay16FailsafeValGet(board, &val))
 		{
 			printf("Fail to read!\n");
-			return;
+			return ERROR;
 		}
 		printf("%d\n", val);
 	}
 	else
 	{
 		printf("Usage: %s fstrd relay failsafe state value\n", argv[0]);
-		return;
+		return ERROR;
 	}
+	return OK;
 }
 
-static void doLedSet(int argc, char *argv[])
+static int doLedSet(int argc, char *argv[])
 {
-	int dev = 0;
-	uint8_t buff[2];
+	Relay16Board *board = NULL;
+	Relay16LedModeType mode;
 
 	if (argc == 4)
 	{
-		dev = doBoardInit(atoi(argv[1]));
-		if (dev <= 0)
+		board = doBoardInit(argv[1]);
+		if (board == NULL)
 		{
-			return;
+			return ERROR;
 		}
 		if (strcasecmp(argv[3], "on") == 0)
 		{
-			buff[0] = 1;
+			mode = RELAY16_LED_ON;
 		}
 		else if (strcasecmp(argv[3], "off") == 0)
 		{
-			buff[0] = 2;
+			mode = RELAY16_LED_OFF;
 		}
 		else if (strcasecmp(argv[3], "blink") == 0)
 		{
-			buff[0] = 0;
+			mode = RELAY16_LED_BLINK;
 		}
 		else
 		{
 			printf("Invalid led mode (blink/on/off)\n");
-			return;
+			return ERROR;
 		}
-		if (0 > i2cMem8Write(dev, I2C_MEM_LED_MODE, buff, 1))
+		if (OK != relay16LedModeSet(board, mode))
 		{
 			printf(
 				"Fail to write, check if your card version supports the command\n");
-			return;
+			return ERROR;
 		}
 
 	}
 	else
 	{
 		printf("%s", CMD_LED_BLINK.usage1);
-		return;
+		return ERROR;
 	}
+	return OK;
 }
 
 
-void doBoard(int argc, char *argv[]);
+int doBoard(int argc, char *argv[]);
 const CliCmdType CMD_BOARD =
 	{"board", 2, &doBoard,
 		"\tboard:      Display the board firmware version\n",
 		"\tUsage:      16relind <id> board\n", "",
 		"\tExample:    16relind 0 board; Display the Board #0 firmware version\n"};
-void doBoard(int argc, char *argv[])
+int doBoard(int argc, char *argv[])
 {
-	int dev = 0;
-	uint8_t buff[8];
+	Relay16Board *board = NULL;
+	int major = 0;
+	int minor = 0;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;//return;
+		return ERROR;
 	}
 
 	if (argc == 3)
 	{
-		if (OK != i2cMem8Read(dev, I2C_MEM_REVISION_MAJOR_ADD, buff, 2))
+		if (OK != relay16FwVersionGet(board, &major, &minor))
 		{
 			printf("Fail to read board version!\n");
-			return;//return;
+			return ERROR;
 		}
 		
-		printf("Board Firmware Version: %02d.%02d\n", buff[0], buff[1]);
+		printf("Board Firmware Version: %02d.%02d\n", major, minor);
 		
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_BOARD.usage1);
-		return;//return;
+		return ERROR;
 	}
+	return OK;
 }
 //************************************************************* WDT *************************************************
 
-void doWdtReload(int argc, char *argv[]);
+int doWdtReload(int argc, char *argv[]);
 const CliCmdType CMD_WDT_RELOAD =
 	{"wdtr", 2, &doWdtReload,
 		"\twdtr:		Reload the watchdog timer and enable the watchdog if is disabled\n",
 		"\tUsage:		16relind <stack> wdtr\n", "",
 		"\tExample:		16relind 0 wdtr; Reload the watchdog timer on Board #0 with the period \n"};
 
-void doWdtReload(int argc, char *argv[])
+int doWdtReload(int argc, char *argv[])
 {
-	int dev = 0;
-	u8 buff[2] = {0, 0};
+	Relay16Board *board = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 3)
 	{
-		buff[0] = WDT_RESET_SIGNATURE;
-		if (OK != i2cMem8Write(dev, I2C_MEM_WDT_RESET_ADD, buff, 1))
+		if (OK != relay16WdtReload(board))
 		{
 			printf("Fail to write watchdog reset key!\n");
-			return;
+			return ERROR;
 		}
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_RELOAD.usage1);
-		return;
+		return ERROR;
+	}
+	return OK;
+}
+
+int doWdtKeepalive(int argc, char *argv[]);
+const CliCmdType CMD_WDT_KEEPALIVE =
+	{"wdtka", 2, &doWdtKeepalive,
+		"\twdtka:		Keep the watchdog reloaded from this process, at real time priority, until stopped; kill -USR1 displays the missed and late reloads\n",
+		"\tUsage:		16relind <stack> wdtka\n",
+		"\tUsage:		16relind <stack> wdtka <reload interval ms>\n",
+		"\tExample:		16relind 0 wdtka &; Reload the watchdog on Board #0 three times per watchdog period\n"};
+
+int doWdtKeepalive(int argc, char *argv[])
+{
+	Relay16Board *board = NULL;
+	int interval = 0;
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		printf("Invalid params number:\n %s%s", CMD_WDT_KEEPALIVE.usage1,
+			CMD_WDT_KEEPALIVE.usage2);
+		return ERROR;
+	}
+	if (argc == 4)
+	{
+		interval = atoi(argv[3]);
+		if (interval <= 0)
+		{
+			printf("Invalid reload interval!\n");
+			return ERROR;
+		}
 	}
+	if (OK != cliLockedBoardInit(argv[1], &board))
+	{
+		return ERROR;
+	}
+	return keepaliveRun(board, interval);
 }
 
-void doWdtSetPeriod(int argc, char *argv[]);
+int doWdtSetPeriod(int argc, char *argv[]);
 const CliCmdType CMD_WDT_SET_PERIOD =
 	{"wdtpwr", 2, &doWdtSetPeriod,
 		"\twdtpwr:		Set the watchdog period in seconds, reload command must be issue in this interval to prevent Raspberry Pi power off\n",
 		"\tUsage:		16relind <stack> wdtpwr <val> \n", "",
 		"\tExample:		16relind 0 wdtpwr 10; Set the watchdog timer period on Board #0 at 10 seconds \n"};
 
-void doWdtSetPeriod(int argc, char *argv[])
+int doWdtSetPeriod(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	u16 period;
-	u8 buff[2] = {0, 0};
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -1116,77 +1206,73 @@ void doWdtSetPeriod(int argc, char *argv[])
 		if (0 == period)
 		{
 			printf("Invalid period!\n");
-			return;
+			return ERROR;
 		}
-		memcpy(buff, &period, 2);
-		if (OK != i2cMem8Write(dev, I2C_MEM_WDT_INTERVAL_SET_ADD, buff, 2))
+		if (OK != relay16WdtPeriodSet(board, period))
 		{
 			printf("Fail to write watchdog period!\n");
-			return;
+			return ERROR;
 		}
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_SET_PERIOD.usage1);
-		return;
+		return ERROR;
 	}
-
+	return OK;
 }
 
-void doWdtGetPeriod(int argc, char *argv[]);
+int doWdtGetPeriod(int argc, char *argv[]);
 const CliCmdType CMD_WDT_GET_PERIOD =
 	{"wdtprd", 2, &doWdtGetPeriod,
 		"\twdtprd:		Get the watchdog period in seconds, reload command must be issue in this interval to prevent Raspberry Pi power off\n",
 		"\tUsage:		16relind <stack> wdtprd \n", "",
 		"\tExample:		16relind 0 wdtprd; Get the watchdog timer period on Board #0\n"};
 
-void doWdtGetPeriod(int argc, char *argv[])
+int doWdtGetPeriod(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	u16 period;
-	u8 buff[2];
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 3)
 	{
-		if (OK != i2cMem8Read(dev, I2C_MEM_WDT_INTERVAL_GET_ADD, buff, 2))
+		if (OK != relay16WdtPeriodGet(board, &period))
 		{
 			printf("Fail to read watchdog period!\n");
-			return;
+			return ERROR;
 		}
-		memcpy(&period, buff, 2);
 		printf("%d\n", (int)period);
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_GET_PERIOD.usage1);
-		return;
+		return ERROR;
 	}
-
+	return OK;
 }
 
-void doWdtSetInitPeriod(int argc, char *argv[]);
+int doWdtSetInitPeriod(int argc, char *argv[]);
 const CliCmdType CMD_WDT_SET_INIT_PERIOD =
 	{"wdtipwr", 2, &doWdtSetInitPeriod,
 		"\twdtipwr:	Set the watchdog initial period in seconds, This period is loaded after power cycle, giving Raspberry time to boot\n",
 		"\tUsage:		16relind <stack> wdtipwr <val> \n", "",
 		"\tExample:		16relind 0 wdtipwr 10; Set the watchdog timer initial period on Board #0 at 10 seconds \n"};
 
-void doWdtSetInitPeriod(int argc, char *argv[])
+int doWdtSetInitPeriod(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	u16 period;
-	u8 buff[2] = {0, 0};
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -1195,77 +1281,73 @@ void doWdtSetInitPeriod(int argc, char *argv[])
 		if (0 == period)
 		{
 			printf("Invalid period!\n");
-			return;
+			return ERROR;
 		}
-		memcpy(buff, &period, 2);
-		if (OK != i2cMem8Write(dev, I2C_MEM_WDT_INIT_INTERVAL_SET_ADD, buff, 2))
+		if (OK != relay16WdtInitPeriodSet(board, period))
 		{
 			printf("Fail to write watchdog period!\n");
-			return;
+			return ERROR;
 		}
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_SET_INIT_PERIOD.usage1);
-		return;
+		return ERROR;
 	}
-
+	return OK;
 }
 
-void doWdtGetInitPeriod(int argc, char *argv[]);
+int doWdtGetInitPeriod(int argc, char *argv[]);
 const CliCmdType CMD_WDT_GET_INIT_PERIOD =
 	{"wdtiprd", 2, &doWdtGetInitPeriod,
 		"\twdtiprd:	Get the watchdog initial period in seconds. This period is loaded after power cycle, giving Raspberry time to boot\n",
 		"\tUsage:		16relind <stack> wdtiprd \n", "",
 		"\tExample:		16relind 0 wdtiprd; Get the watchdog timer initial period on Board #0\n"};
 
-void doWdtGetInitPeriod(int argc, char *argv[])
+int doWdtGetInitPeriod(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	u16 period;
-	u8 buff[2];
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 3)
 	{
-		if (OK != i2cMem8Read(dev, I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, buff, 2))
+		if (OK != relay16WdtInitPeriodGet(board, &period))
 		{
 			printf("Fail to read watchdog period!\n");
-			return;
+			return ERROR;
 		}
-		memcpy(&period, buff, 2);
 		printf("%d\n", (int)period);
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_GET_INIT_PERIOD.usage1);
-		return;
+		return ERROR;
 	}
-
+	return OK;
 }
 
-void doWdtSetOffPeriod(int argc, char *argv[]);
+int doWdtSetOffPeriod(int argc, char *argv[]);
 const CliCmdType CMD_WDT_SET_OFF_PERIOD =
 	{"wdtopwr", 2, &doWdtSetOffPeriod,
 		"\twdtopwr:	Set the watchdog off period in seconds (max 48 days), This is the time that watchdog mantain Raspberry turned off \n",
 		"\tUsage:		16relind <stack> wdtopwr <val> \n", "",
 		"\tExample:		16relind 0 wdtopwr 10; Set the watchdog off interval on Board #0 at 10 seconds \n"};
 
-void doWdtSetOffPeriod(int argc, char *argv[])
+int doWdtSetOffPeriod(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	u32 period;
-	u8 buff[4] = {0, 0, 0, 0};
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 4)
@@ -1274,239 +1356,915 @@ void doWdtSetOffPeriod(int argc, char *argv[])
 		if ( (0 == period) || (period > WDT_MAX_OFF_INTERVAL_S))
 		{
 			printf("Invalid period!\n");
-			return;
+			return ERROR;
 		}
-		memcpy(buff, &period, 4);
-		if (OK
-			!= i2cMem8Write(dev, I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD, buff, 4))
+		if (OK != relay16WdtOffPeriodSet(board, period))
 		{
 			printf("Fail to write watchdog period!\n");
-			return;
+			return ERROR;
 		}
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_SET_OFF_PERIOD.usage1);
-		return;
+		return ERROR;
 	}
-
+	return OK;
 }
 
-void doWdtGetOffPeriod(int argc, char *argv[]);
+int doWdtGetOffPeriod(int argc, char *argv[]);
 const CliCmdType CMD_WDT_GET_OFF_PERIOD =
 	{"wdtoprd", 2, &doWdtGetOffPeriod,
 		"\twdtoprd:	Get the watchdog off period in seconds (max 48 days), This is the time that watchdog mantain Raspberry turned off \n",
 		"\tUsage:		16relind <stack> wdtoprd \n", "",
 		"\tExample:		16relind 0 wdtoprd; Get the watchdog off period on Board #0\n"};
 
-void doWdtGetOffPeriod(int argc, char *argv[])
+int doWdtGetOffPeriod(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	u32 period;
-	u8 buff[4];
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 
 	if (argc == 3)
 	{
-		if (OK
-			!= i2cMem8Read(dev, I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, buff, 4))
+		if (OK != relay16WdtOffPeriodGet(board, &period))
 		{
 			printf("Fail to read watchdog period!\n");
-			return;
+			return ERROR;
 		}
-		memcpy(&period, buff, 4);
 		printf("%d\n", (int)period);
 	}
 	else
 	{
 		printf("Invalid params number:\n %s", CMD_WDT_GET_OFF_PERIOD.usage1);
-		return;
+		return ERROR;
 	}
-
+	return OK;
 }
 
 //********************************************** RS485 *******************************************************
 
-int cfg485Set(int dev, u8 mode, u32 baud, u8 stopB, u8 parity, u8 add)
+int doRs485Read(int argc, char *argv[]);
+const CliCmdType CMD_RS485_READ = {"cfg485rd", 2, &doRs485Read,
+	"\tcfg485rd:    Read the RS485 communication settings\n",
+	"\tUsage:      16relind <id> cfg485rd\n", "",
+	"\tExample:		16relind 0 cfg485rd; Read the RS485 settings on Board #0\n"};
+
+int doRs485Read(int argc, char *argv[])
 {
-	ModbusSetingsType settings;
-	u8 buff[5];
+	Relay16Board *board = NULL;
+	Relay16Rs485CfgType cfg;
 
-	if (mode > 1)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		printf("Invalid RS485 mode : 0 = disable, 1= Modbus RTU (Slave)!\n");
 		return ERROR;
 	}
 
-	if (baud > 921600 || baud < 1200)
+	if (argc == 3)
 	{
-		if (mode == 0)
-		{
-			baud = 38400;
-		}
-		else
+		if (OK != relay16Cfg485Get(board, &cfg))
 		{
-			printf("Invalid RS485 Baudrate [1200, 921600]!\n");
+			printf("Fail to read RS485 settings!\n");
 			return ERROR;
 		}
+		printf("<mode> <baudrate> <stopbits> <parity> <add> %d %d %d %d %d\n",
+			(int)cfg.mode, (int)cfg.baud, (int)cfg.stopBits, (int)cfg.parity,
+			(int)cfg.add);
 	}
-
-	if (stopB < 1 || stopB > 2)
+	else
 	{
-		if (mode == 0)
-		{
-			stopB = 1;
-		}
-		else
-		{
-			printf("Invalid RS485 stop bits [1, 2]!\n");
-			return ERROR;
-		}
+		printf("%s", CMD_RS485_READ.usage1);
+		return ERROR;
 	}
+	return OK;
+}
+
+int doRs485Write(int argc, char *argv[]);
+const CliCmdType CMD_RS485_WRITE =
+	{"cfg485wr", 2, &doRs485Write,
+		"\tcfg485wr:    Write the RS485 communication settings\n",
+		"\tUsage:      16relind <id> cfg485wr <mode> <baudrate> <stopBits> <parity> <slaveAddr>\n",
+		"",
+		"\tExample:		 16relind 0 cfg485wr 1 9600 1 0 1; Write the RS485 settings on Board #0 \n\t\t\t(mode = Modbus RTU; baudrate = 9600 bps; stop bits one; parity none; modbus slave address = 1)\n"};
 
-	if (parity > 2)
+int doRs485Write(int argc, char *argv[])
+{
+	Relay16Board *board = NULL;
+	Relay16Rs485CfgType cfg;
+	int ret;
+
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		if (mode == 0)
-		{
-			parity = 0;
+		return ERROR;
+	}
+	if (argc == 8)
+	{
+		cfg.mode = 0xff & atoi(argv[3]);
+		cfg.baud = atoi(argv[4]);
+		cfg.stopBits = 0xff & atoi(argv[5]);
+		cfg.parity = 0xff & atoi(argv[6]);
+		cfg.add = 0xff & atoi(argv[7]);
+		ret = relay16Cfg485Set(board, &cfg);
+		if (ret == RELAY16_ERR_PARAM)
+		{
+			printf("Invalid RS485 settings: mode 0 = disable, 1 = Modbus RTU (Slave); "
+				"baudrate [1200, 921600]; stop bits [1, 2]; "
+				"parity 0 = none, 1 = even, 2 = odd; address [1, 255]!\n");
+			return ERROR;
 		}
-		else
+		if (ret != OK)
 		{
-			printf("Invalid RS485 parity 0 = none; 1 = even; 2 = odd! \n");
+			printf("Fail to write RS485 settings!\n");
 			return ERROR;
 		}
+		printf("done\n");
 	}
-	if (add < 1)
+	else
 	{
-		if (mode == 0)
-		{
-			add = 1;
+		printf("%s", CMD_RS485_WRITE.usage1);
+		return ERROR;
+	}
+	return OK;
+}
+
+int doSnapshot(int argc, char *argv[]);
+const CliCmdType CMD_SNAPSHOT =
+	{"snapshot", 2, &doSnapshot,
+		"\tsnapshot:    Save the watchdog periods, RS485 settings, failsafe profile and led mode of a board to a file\n",
+		"\tUsage:       16relind <id> snapshot <file> [bin/json]   - for stdout, binary by default\n", "",
+		"\tExample:     16relind 0 snapshot board0.json json; Save the settings of Board #0 as JSON\n"};
+
+int doSnapshot(int argc, char *argv[])
+{
+	Relay16SnapshotType snap;
+	Relay16Board *board = NULL;
+	FILE *out = stdout;
+	int json = 0;
+	int ret;
+
+	if ( (argc != 4) && (argc != 5))
+	{
+		printf("%s", CMD_SNAPSHOT.usage1);
+		return ERROR;
+	}
+	if (argc == 5)
+	{
+		if (strcasecmp(argv[4], "json") == 0)
+		{
+			json = 1;
 		}
-		else
+		else if (strcasecmp(argv[4], "bin") != 0)
 		{
-			printf("Invalid MODBUS device address: [1, 255]!\n");
+			printf("Invalid snapshot format, use bin or json\n");
 			return ERROR;
 		}
 	}
-	settings.mbBaud = baud;
-	settings.mbType = mode;
-	settings.mbParity = parity;
-	settings.mbStopB = stopB;
-	settings.add = add;
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
+	{
+		return ERROR;
+	}
+	ret = relay16SnapshotGet(board, &snap);
+	if (ret != OK)
+	{
+		printf("Fail to read the board settings: %s\n", relay16StrError(ret));
+		return ERROR;
+	}
+	if (strcmp(argv[3], "-") != 0)
+	{
+		out = fopen(argv[3], "wb");
+		if (out == NULL)
+		{
+			printf("Fail to open %s\n", argv[3]);
+			return ERROR;
+		}
+	}
+	ret = snapshotSave(out, &snap, json);
+	if (out != stdout)
+	{
+		if (fclose(out) != 0)
+		{
+			ret = ERROR;
+		}
+	}
+	if (ret != OK)
+	{
+		printf("Fail to write %s\n", argv[3]);
+		return ERROR;
+	}
+	return OK;
+}
 
-	memcpy(buff, &settings, sizeof(ModbusSetingsType));
-	if (OK != i2cMem8Write(dev, I2C_MODBUS_SETINGS_ADD, buff, 5))
+int doRestore(int argc, char *argv[]);
+const CliCmdType CMD_RESTORE =
+	{"restore", 2, &doRestore,
+		"\trestore:     Apply a snapshot file (binary or JSON) to a board, only the settings that differ are written\n",
+		"\tUsage:       16relind <id> restore <file>   - for stdin\n", "",
+		"\tExample:     16relind 1 restore board0.json; Set up Board #1 as the saved Board #0, display the changed settings and the transfers\n"};
+
+int doRestore(int argc, char *argv[])
+{
+	Relay16SnapshotType snap;
+	Relay16SnapshotStatsType stats;
+	Relay16Board *board = NULL;
+	FILE *in = stdin;
+	int ret;
+
+	if (argc != 4)
+	{
+		printf("%s", CMD_RESTORE.usage1);
+		return ERROR;
+	}
+	if (strcmp(argv[3], "-") != 0)
+	{
+		in = fopen(argv[3], "rb");
+		if (in == NULL)
+		{
+			printf("Fail to open %s\n", argv[3]);
+			return ERROR;
+		}
+	}
+	ret = snapshotLoad(in, &snap);
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+	if (ret != OK)
+	{
+		printf("Invalid snapshot file %s\n", argv[3]);
+		return ERROR;
+	}
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
+	{
+		return ERROR;
+	}
+	ret = relay16SnapshotRestore(board, &snap, &stats);
+	if (ret == RELAY16_ERR_PARAM)
+	{
+		printf("Invalid settings in the snapshot, nothing written\n");
+		return ERROR;
+	}
+	if (ret != OK)
 	{
-		printf("Fail to write RS485 settings!\n");
+		printf("Fail to restore the board settings: %s\n", relay16StrError(ret));
 		return ERROR;
 	}
+	printf("changed %d reads %d writes %d\n", stats.changed, stats.reads,
+		stats.writes);
 	return OK;
 }
 
-int cfg485Get(int dev)
+static const char *cachePolicyName[RELAY16_CACHE_POLICY_COUNT] = {"off",
+	"trust", "resync", "verify"};
+
+int doCache(int argc, char *argv[]);
+const CliCmdType CMD_CACHE =
+	{"cache", 2, &doCache,
+		"\tcache:       Set the relay registers cache policy or display the cache statistics (useful in daemon mode)\n",
+		"\tUsage:       16relind <id> cache\n",
+		"\tUsage:       16relind <id> cache <off/trust/resync/verify> [<resync period ms>]\n",
+		"\tExample:     16relind 0 cache resync 500; Re-read the relay registers of Board #0 if the copy is older than 500ms\n"};
+
+int doCache(int argc, char *argv[])
 {
-	ModbusSetingsType settings;
-	u8 buff[5];
+	Relay16Board *board = NULL;
+	Relay16CachePolicyType policy;
+	Relay16CacheStatsType stats;
+	unsigned int resyncMs = 0;
+	int i;
 
-	if (OK != i2cMem8Read(dev, I2C_MODBUS_SETINGS_ADD, buff, 5))
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
+	{
+		return ERROR;
+	}
+	if (argc == 3)
+	{
+		relay16CachePolicyGet(board, &policy, &resyncMs);
+		relay16CacheStatsGet(board, &stats, 0);
+		printf("policy %s", cachePolicyName[policy]);
+		if (policy == RELAY16_CACHE_RESYNC)
+		{
+			printf(" %ums", resyncMs);
+		}
+		printf("\nhits %u misses %u writes %u verify errors %u\n", stats.hits,
+			stats.misses, stats.writes, stats.verifyErrors);
+	}
+	else if (argc == 4 || argc == 5)
+	{
+		for (i = 0; i < RELAY16_CACHE_POLICY_COUNT; i++)
+		{
+			if (strcasecmp(argv[3], cachePolicyName[i]) == 0)
+			{
+				break;
+			}
+		}
+		if (i == RELAY16_CACHE_POLICY_COUNT)
+		{
+			printf("Invalid cache policy (off/trust/resync/verify)\n");
+			return ERROR;
+		}
+		if (argc == 5)
+		{
+			resyncMs = atoi(argv[4]);
+		}
+		relay16CachePolicySet(board, (Relay16CachePolicyType)i, resyncMs);
+	}
+	else
 	{
-		printf("Fail to read RS485 settings!\n");
+		printf("%s%s", CMD_CACHE.usage1, CMD_CACHE.usage2);
 		return ERROR;
 	}
-	memcpy(&settings, buff, sizeof(ModbusSetingsType));
-	printf("<mode> <baudrate> <stopbits> <parity> <add> %d %d %d %d %d\n",
-		(int)settings.mbType, (int)settings.mbBaud, (int)settings.mbStopB,
-		(int)settings.mbParity, (int)settings.add);
 	return OK;
 }
 
-void doRs485Read(int argc, char *argv[]);
-const CliCmdType CMD_RS485_READ = {"cfg485rd", 2, &doRs485Read,
-	"\tcfg485rd:    Read the RS485 communication settings\n",
-	"\tUsage:      16relind <id> cfg485rd\n", "",
-	"\tExample:		16relind 0 cfg485rd; Read the RS485 settings on Board #0\n"};
+static const char *verifyPolicyName[RELAY16_VERIFY_POLICY_COUNT] = {"none",
+	"readback", "retry"};
+
+int doVerify(int argc, char *argv[]);
+const CliCmdType CMD_VERIFY =
+	{"verify", 2, &doVerify,
+		"\tverify:      Set how the relay, failsafe and RS485 writes are read back or display the mismatches and retries (useful in daemon and batch mode)\n",
+		"\tUsage:       16relind <id> verify\n",
+		"\tUsage:       16relind <id> verify <none/readback/retry> [<retries> [<backoff us> [<budget ms>]]]\n",
+		"\tExample:     16relind 0 verify retry 3 500 20; Repeat a wrong write on Board #0 up to 3 times, 500us then 1ms and 2ms later, within 20ms\n"};
 
-void doRs485Read(int argc, char *argv[])
+int doVerify(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
+	Relay16VerifyCfgType cfg;
+	Relay16VerifyStatsType stats;
+	int i;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
+	{
+		return ERROR;
+	}
+	if (argc == 3)
+	{
+		relay16VerifyGet(board, &cfg);
+		relay16VerifyStatsGet(board, &stats, 0);
+		printf("policy %s", verifyPolicyName[cfg.policy]);
+		if (cfg.policy == RELAY16_VERIFY_RETRY)
+		{
+			printf(" retries %u backoff %uus", cfg.retries, cfg.backoffUs);
+		}
+		if (cfg.budgetUs != 0)
+		{
+			printf(" budget %ums", cfg.budgetUs / 1000);
+		}
+		printf("\nwrites %u mismatches %u retries %u failures %u timeouts %u\n",
+			stats.writes, stats.mismatches, stats.retries, stats.failures,
+			stats.timeouts);
+		return OK;
+	}
+	if (argc > 7)
+	{
+		printf("%s%s", CMD_VERIFY.usage1, CMD_VERIFY.usage2);
+		return ERROR;
+	}
+	for (i = 0; i < RELAY16_VERIFY_POLICY_COUNT; i++)
+	{
+		if (strcasecmp(argv[3], verifyPolicyName[i]) == 0)
+		{
+			break;
+		}
+	}
+	if (i == RELAY16_VERIFY_POLICY_COUNT)
+	{
+		printf("Invalid verify policy (none/readback/retry)\n");
+		return ERROR;
+	}
+	relay16VerifyGet(board, &cfg);
+	cfg.policy = (Relay16VerifyPolicyType)i;
+	if (argc > 4)
+	{
+		cfg.retries = atoi(argv[4]);
+	}
+	if (argc > 5)
+	{
+		cfg.backoffUs = atoi(argv[5]);
+	}
+	if (argc > 6)
+	{
+		cfg.budgetUs = atoi(argv[6]) * 1000;
+	}
+	if (OK != relay16VerifySet(board, &cfg))
 	{
-		return;
+		printf("Invalid verify settings!\n");
+		return ERROR;
 	}
+	return OK;
+}
 
+int doCoalesce(int argc, char *argv[]);
+const CliCmdType CMD_COALESCE =
+	{"coalesce", 2, &doCoalesce,
+		"\tcoalesce:    Merge the relay changes of a board over a time window into one write, or display the writes saved (useful in daemon and batch mode)\n",
+		"\tUsage:       16relind <id> coalesce\n",
+		"\tUsage:       16relind <id> coalesce <off/manual/flush/<window us>>\n",
+		"\tExample:     16relind 0 coalesce 500; Write the relay changes of Board #0 made within 500us together\n"};
+
+int doCoalesce(int argc, char *argv[])
+{
+	Relay16Board *board = NULL;
+	Relay16CoalesceStatsType stats;
+	uint32_t windowUs = 0;
+	char *end = NULL;
+	int ret = RELAY16_OK;
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		printf("%s%s", CMD_COALESCE.usage1, CMD_COALESCE.usage2);
+		return ERROR;
+	}
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
+	{
+		return ERROR;
+	}
 	if (argc == 3)
 	{
-		if (OK != cfg485Get(dev))
+		relay16CoalesceGet(board, &windowUs);
+		relay16CoalesceStatsGet(board, &stats, 0);
+		if (windowUs == RELAY16_COALESCE_OFF)
+		{
+			printf("off");
+		}
+		else if (windowUs == RELAY16_COALESCE_MANUAL)
+		{
+			printf("manual");
+		}
+		else
 		{
-			return;
+			printf("window %uus", windowUs);
 		}
+		printf("\nchanges %u flushes %u writes %u saved %u errors %u\n", stats.changes,
+			stats.flushes, stats.writes, stats.saved, stats.errors);
+		return OK;
+	}
+	if (strcasecmp(argv[3], "flush") == 0)
+	{
+		ret = relay16CoalesceFlush(board);
+	}
+	else if (strcasecmp(argv[3], "off") == 0)
+	{
+		ret = relay16CoalesceSet(board, RELAY16_COALESCE_OFF);
+	}
+	else if (strcasecmp(argv[3], "manual") == 0)
+	{
+		ret = relay16CoalesceSet(board, RELAY16_COALESCE_MANUAL);
 	}
 	else
 	{
-		printf("%s", CMD_RS485_READ.usage1);
-		return;
+		windowUs = (uint32_t)strtoul(argv[3], &end, 10);
+		if ( (end == argv[3]) || (*end != 0) || (windowUs == 0)
+			|| (windowUs == RELAY16_COALESCE_MANUAL))
+		{
+			printf("Invalid coalescing window!\n");
+			return ERROR;
+		}
+		ret = relay16CoalesceSet(board, windowUs);
 	}
+	if (ret != RELAY16_OK)
+	{
+		printf("Fail to write the pending relay changes: %s\n", relay16StrError(ret));
+		return ERROR;
+	}
+	return OK;
+}
+
+int doScene(int argc, char *argv[]);
+const CliCmdType CMD_SCENE =
+	{"-scene", 1, &doScene,
+		"\t-scene:      Set the relays of several boards at once, only the boards that change are written\n",
+		"\tUsage:       16relind -scene <id>:<value> [<id>:<value>...]\n", "",
+		"\tExample:     16relind -scene 0:0x00ff 1:0 0@3:65535; Set Board #0 and #1 on /dev/i2c-1 and Board #0 on /dev/i2c-3 together, display the write skew\n"};
+
+int doScene(int argc, char *argv[])
+{
+	Relay16Board *board[RELAY16_SCENE_MAX];
+	uint16_t val[RELAY16_SCENE_MAX];
+	Relay16SceneStatsType stats;
+	char id[CLI_LINE_MAX];
+	char *sep;
+	int count = 0;
+	int ret;
+	int i;
 
+	if ( (argc < 3) || (argc > 2 + RELAY16_SCENE_MAX))
+	{
+		printf("%s", CMD_SCENE.usage1);
+		return ERROR;
+	}
+	for (i = 2; i < argc; i++)
+	{
+		sep = strrchr(argv[i], ':');
+		if ( (sep == NULL) || (sep == argv[i]))
+		{
+			printf("Invalid scene entry \"%s\", use <id>:<value>\n", argv[i]);
+			return ERROR;
+		}
+		snprintf(id, sizeof(id), "%.*s", (int) (sep - argv[i]), argv[i]);
+		if (OK != cliValueParse(sep + 1, &val[count]))
+		{
+			printf("Invalid relay value for board id %s\n", id);
+			return ERROR;
+		}
+		board[count] = doBoardInit(id);
+		if (board[count] == NULL)
+		{
+			return ERROR;
+		}
+		count++;
+	}
+	ret = relay16SceneSet(board, val, count, &stats);
+	if (ret == RELAY16_ERR_PARAM)
+	{
+		printf("Every board id must appear only once\n");
+		return ERROR;
+	}
+	if (ret != OK)
+	{
+		printf("Fail to write relays: %s\n", relay16StrError(ret));
+		return ERROR;
+	}
+	printf("boards %d changed %d skew %uus total %uus\n", stats.boards,
+		stats.changed, stats.skewUs, stats.totalUs);
+	return OK;
 }
 
-void doRs485Write(int argc, char *argv[]);
-const CliCmdType CMD_RS485_WRITE =
-	{"cfg485wr", 2, &doRs485Write,
-		"\tcfg485wr:    Write the RS485 communication settings\n",
-		"\tUsage:      16relind <id> cfg485wr <mode> <baudrate> <stopBits> <parity> <slaveAddr>\n",
-		"",
-		"\tExample:		 16relind 0 cfg485wr 1 9600 1 0 1; Write the RS485 settings on Board #0 \n\t\t\t(mode = Modbus RTU; baudrate = 9600 bps; stop bits one; parity none; modbus slave address = 1)\n"};
+int doFailsafeProfileMany(int argc, char *argv[]);
+const CliCmdType CMD_FAILSAFE_PROFILE_MANY =
+	{"-fsprofile", 1, &doFailsafeProfileMany,
+		"\t-fsprofile:  Display the failsafe profile of all the boards of the default bus, or apply a profile file, only the boards that differ are written\n",
+		"\tUsage:       16relind -fsprofile [<file>]   One \"<id> <enable value> <state value>\" line per board, - for stdin\n", "",
+		"\tExample:     16relind -fsprofile > fs.txt; 16relind -fsprofile fs.txt  Save the failsafe profiles and restore them later\n"};
 
-void doRs485Write(int argc, char *argv[])
+static int doFailsafeProfile(int argc, char *argv[])
 {
-	int dev = 0;
-	u8 mode = 0;
-	u32 baud = 1200;
-	u8 stopB = 1;
-	u8 parity = 0;
-	u8 add = 0;
+	Relay16FailsafeProfileType profile;
+	Relay16Board *board = NULL;
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	if ( (argc != 3) && (argc != 5))
 	{
-		return;
+		printf("%s%s", CMD_FAILSAFE_PROFILE.usage1, CMD_FAILSAFE_PROFILE.usage2);
+		return ERROR;
 	}
-	if (argc == 8)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
+	{
+		return ERROR;
+	}
+	if (argc == 3)
 	{
-		mode = 0xff & atoi(argv[3]);
-		baud = atoi(argv[4]);
-		stopB = 0xff & atoi(argv[5]);
-		parity = 0xff & atoi(argv[6]);
-		add = 0xff & atoi(argv[7]);
-		if (OK != cfg485Set(dev, mode, baud, stopB, parity, add))
+		if (OK != relay16FailsafeProfileGet(board, &profile))
 		{
-			return;
+			printf("Fail to read!\n");
+			return ERROR;
 		}
-		printf("done\n");
+		printf("0x%04x 0x%04x\n", profile.en, profile.val);
+		return OK;
 	}
-	else
+	if ( (OK != cliValueParse(argv[3], &profile.en))
+		|| (OK != cliValueParse(argv[4], &profile.val)))
 	{
-		printf("%s", CMD_RS485_WRITE.usage1);
-		return;
+		printf("Invalid relay value\n");
+		return ERROR;
+	}
+	if (OK != relay16FailsafeProfileSet(board, &profile))
+	{
+		printf("Fail to write relay failsafe profile!\n");
+		return ERROR;
+	}
+	return OK;
+}
+
+/*
+ * profileDump:
+ *	Display the failsafe profile of every board of the default bus, in the
+ *	profile file format
+ *********************************************************************************
+ */
+static int profileDump(void)
+{
+	Relay16FailsafeProfileType profile;
+	Relay16Board *board;
+	uint8_t stacks = 0;
+	char id[8];
+	int ret = OK;
+	int i;
+
+	if (OK != relay16DiscoverBus(cliBusDefault(), 0, &stacks))
+	{
+		printf("Failed to open the bus.\n");
+		return ERROR;
+	}
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		if ( (stacks & (1 << i)) == 0)
+		{
+			continue;
+		}
+		snprintf(id, sizeof(id), "%d", i);
+		board = doBoardInit(id);
+		if ( (board == NULL) || (OK != relay16FailsafeProfileGet(board, &profile)))
+		{
+			printf("# %s fail to read\n", id);
+			ret = ERROR;
+			continue;
+		}
+		printf("%s 0x%04x 0x%04x\n", id, profile.en, profile.val);
+	}
+	return ret;
+}
+
+int doFailsafeProfileMany(int argc, char *argv[])
+{
+	Relay16Board *board[RELAY16_SCENE_MAX];
+	Relay16FailsafeProfileType profile[RELAY16_SCENE_MAX];
+	char line[CLI_LINE_MAX];
+	char *args[CLI_ARGS_MAX + 1];
+	FILE *in = stdin;
+	int lineNr = 0;
+	int count = 0;
+	int written = 0;
+	int ret = OK;
+	int len;
+	int n;
+
+	if (argc > 3)
+	{
+		printf("%s", CMD_FAILSAFE_PROFILE_MANY.usage1);
+		return ERROR;
+	}
+	if (argc == 2)
+	{
+		return profileDump();
+	}
+	if (strcmp(argv[2], "-") != 0)
+	{
+		in = fopen(argv[2], "r");
+		if (in == NULL)
+		{
+			printf("Fail to open %s\n", argv[2]);
+			return ERROR;
+		}
+	}
+	while ( (ret == OK) && ( (len = cliLineRead(line, sizeof(line), in)) != 0))
+	{
+		lineNr++;
+		if (len < 0)
+		{
+			printf("Profile line %d too long\n", lineNr);
+			ret = ERROR;
+			break;
+		}
+		n = cliSplit(line, args, CLI_ARGS_MAX);
+		if ( (n >= 0) && (n < 2))
+		{
+			continue;
+		}
+		if ( (n != 4) || (count == RELAY16_SCENE_MAX)
+			|| (OK != cliValueParse(args[2], &profile[count].en))
+			|| (OK != cliValueParse(args[3], &profile[count].val)))
+		{
+			printf("Invalid profile line %d, use <id> <enable value> <state value>\n",
+				lineNr);
+			ret = ERROR;
+			break;
+		}
+		board[count] = doBoardInit(args[1]);
+		if (board[count] == NULL)
+		{
+			ret = ERROR;
+			break;
+		}
+		count++;
+	}
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+	if (ret != OK)
+	{
+		return ERROR;
+	}
+	if (count == 0)
+	{
+		printf("No board in the profile file\n");
+		return ERROR;
+	}
+	ret = relay16FailsafeProfileSetMany(board, profile, count, &written);
+	if (ret == RELAY16_ERR_PARAM)
+	{
+		printf("Every board id must appear only once\n");
+		return ERROR;
+	}
+	if (ret != OK)
+	{
+		printf("Fail to write relay failsafe profile: %s, %d board(s) written\n",
+			relay16StrError(ret), written);
+		return ERROR;
+	}
+	printf("boards %d written %d skipped %d\n", count, written, count - written);
+	return OK;
+}
+
+int doReadMany(int argc, char *argv[]);
+const CliCmdType CMD_READ_MANY =
+	{"-read", 1, &doReadMany,
+		"\t-read:       Read the relays of several boards, the boards on different I2C buses are read concurrently\n",
+		"\tUsage:       16relind -read <id> [<id>...]\n", "",
+		"\tExample:     16relind -read 0 1 0@3; Read Board #0 and #1 on /dev/i2c-1 and Board #0 on /dev/i2c-3\n"};
+
+int doReadMany(int argc, char *argv[])
+{
+	Relay16Board *board[RELAY16_SCENE_MAX];
+	uint16_t val[RELAY16_SCENE_MAX];
+	int i;
+
+	if ( (argc < 3) || (argc > 2 + RELAY16_SCENE_MAX))
+	{
+		printf("%s", CMD_READ_MANY.usage1);
+		return ERROR;
+	}
+	for (i = 2; i < argc; i++)
+	{
+		board[i - 2] = doBoardInit(argv[i]);
+		if (board[i - 2] == NULL)
+		{
+			return ERROR;
+		}
+	}
+	if (OK != relay16GetMany(board, val, argc - 2))
+	{
+		printf("Fail to read!\n");
+		return ERROR;
+	}
+	for (i = 2; i < argc; i++)
+	{
+		printf("%s %d\n", argv[i], val[i - 2]);
+	}
+	return OK;
+}
+
+static const char *traceKindName[RELAY16_TRACE_KIND_COUNT] = {"read", "write",
+	"xfer", "lock", "retry"};
+
+int doTrace(int argc, char *argv[]);
+const CliCmdType CMD_TRACE =
+	{"-trace", 1, &doTrace,
+		"\t-trace:      Turn on/off the trace of the bus transactions, lock waits and write retries of all the processes, or display the last records\n",
+		"\tUsage:       16relind -trace <on/off>\n",
+		"\tUsage:       16relind -trace [<records>]\n",
+		"\tExample:     16relind -trace 20; Display the last 20 records: time, process, kind, bus, address, register, bytes, duration and result\n"};
+
+int doTrace(int argc, char *argv[])
+{
+	Relay16TraceRecType rec[RELAY16_TRACE_SIZE];
+	struct timespec mono;
+	struct timespec real;
+	struct tm tm;
+	int64_t ageNs;
+	time_t sec;
+	int count = 50;
+	int n;
+	int i;
+
+	if (argc == 3 && (strcasecmp(argv[2], "on") == 0 || strcasecmp(argv[2], "off") == 0))
+	{
+		if (OK != relay16TraceEnable(strcasecmp(argv[2], "on") == 0))
+		{
+			printf("Fail to open the trace\n");
+			return ERROR;
+		}
+		return OK;
+	}
+	if (argc == 3)
+	{
+		count = atoi(argv[2]);
+	}
+	if ( (argc > 3) || (count <= 0))
+	{
+		printf("%s%s", CMD_TRACE.usage1, CMD_TRACE.usage2);
+		return ERROR;
+	}
+	if (count > RELAY16_TRACE_SIZE)
+	{
+		count = RELAY16_TRACE_SIZE;
+	}
+	n = relay16TraceRead(rec, count);
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	for (i = 0; i < n; i++)
+	{
+		// the records keep the monotonic time, display the wall clock time
+		ageNs = (int64_t)mono.tv_sec * 1000000000LL + mono.tv_nsec
+			- (int64_t)rec[i].timeNs;
+		ageNs = (int64_t)real.tv_sec * 1000000000LL + real.tv_nsec - ageNs;
+		sec = ageNs / 1000000000LL;
+		localtime_r(&sec, &tm);
+		printf("%02d:%02d:%02d.%06d pid %d %-5s ", tm.tm_hour, tm.tm_min,
+			tm.tm_sec, (int) ( (ageNs % 1000000000LL) / 1000), (int)rec[i].pid,
+			rec[i].kind < RELAY16_TRACE_KIND_COUNT ? traceKindName[rec[i].kind] : "?");
+		if (rec[i].kind == RELAY16_TRACE_RETRY)
+		{
+			printf("bus %d 0x%02x reg 0x%02x %d attempts", rec[i].bus, rec[i].add,
+				rec[i].reg, rec[i].size);
+		}
+		else if (rec[i].kind != RELAY16_TRACE_LOCK)
+		{
+			printf("bus %d 0x%02x reg 0x%02x %d bytes", rec[i].bus, rec[i].add,
+				rec[i].reg, rec[i].size);
+		}
+		printf(" %uus %s\n", rec[i].us, rec[i].result == 0 ? "OK" : "FAIL");
+	}
+	if (!relay16TraceEnabled())
+	{
+		printf("Trace off, turn it on with \"16relind -trace on\"\n");
+	}
+	return OK;
+}
+
+int doStats(int argc, char *argv[]);
+const CliCmdType CMD_STATS =
+	{"-stats", 1, &doStats,
+		"\t-stats:      Display the latency histograms and the error counters of the traced bus transactions, lock waits and write retries\n",
+		"\tUsage:       16relind -stats\n",
+		"\tUsage:       16relind -stats clear   Display and clear the counters and the trace records\n",
+		"\tExample:     16relind -stats; \"read 120 errors 0 avg 95us max 310us\" followed by the count in every latency range\n"};
+
+int doStats(int argc, char *argv[])
+{
+	Relay16TraceStatsType stats[RELAY16_TRACE_KIND_COUNT];
+	int clear = 0;
+	int k;
+	int i;
+
+	if (argc == 3 && strcasecmp(argv[2], "clear") == 0)
+	{
+		clear = 1;
+	}
+	else if (argc != 2)
+	{
+		printf("%s%s", CMD_STATS.usage1, CMD_STATS.usage2);
+		return ERROR;
+	}
+	relay16TraceStatsGet(stats, clear);
+	printf("trace %s\n", relay16TraceEnabled() ? "on" : "off");
+	for (k = 0; k < RELAY16_TRACE_KIND_COUNT; k++)
+	{
+		printf("%-5s %u errors %u avg %uus max %uus\n", traceKindName[k],
+			stats[k].count, stats[k].errors,
+			stats[k].count ? (unsigned int) (stats[k].totalUs / stats[k].count) : 0,
+			stats[k].maxUs);
+		for (i = 0; i < RELAY16_TRACE_HIST; i++)
+		{
+			if (stats[k].hist[i] == 0)
+			{
+				continue;
+			}
+			if (i == 0)
+			{
+				printf("\t<1us %u\n", stats[k].hist[i]);
+			}
+			else if (i == RELAY16_TRACE_HIST - 1)
+			{
+				printf("\t>=%uus %u\n", 1u << (i - 1), stats[k].hist[i]);
+			}
+			else
+			{
+				printf("\t%u-%uus %u\n", 1u << (i - 1), (1u << i) - 1,
+					stats[k].hist[i]);
+			}
+		}
 	}
+	return OK;
 }
 
 const CliCmdType *gCmdArray[] = {&CMD_HELP, &CMD_WAR, &CMD_VERSION, &CMD_LIST,
-	&CMD_WRITE, &CMD_READ, &CMD_TEST, &CMD_FAILSAFE_EN_READ, &CMD_FAILSAFE_STATE_READ, 
-	&CMD_FAILSAFE_EN_WRITE, &CMD_FAILSAFE_STATE_WRITE, &CMD_LED_BLINK, &CMD_WDT_GET_INIT_PERIOD,
-	&CMD_WDT_GET_OFF_PERIOD, &CMD_WDT_GET_PERIOD, &CMD_WDT_RELOAD,
+	&CMD_DAEMON, &CMD_EVENTS, &CMD_MBTCP, &CMD_BATCH, &CMD_SCENE, &CMD_READ_MANY, &CMD_WRITE, &CMD_READ,
+	&CMD_MASK_SET, &CMD_MASK_CLEAR, &CMD_MASK_TOGGLE, &CMD_MASK_APPLY,
+	&CMD_PULSE, &CMD_DELAYED_WRITE, &CMD_TEST, &CMD_FAILSAFE_EN_READ, &CMD_FAILSAFE_STATE_READ, 
+	&CMD_FAILSAFE_EN_WRITE, &CMD_FAILSAFE_STATE_WRITE, &CMD_FAILSAFE_PROFILE,
+	&CMD_FAILSAFE_PROFILE_MANY, &CMD_LED_BLINK, &CMD_WDT_GET_INIT_PERIOD,
+	&CMD_WDT_GET_OFF_PERIOD, &CMD_WDT_GET_PERIOD, &CMD_WDT_RELOAD, &CMD_WDT_KEEPALIVE,
 	&CMD_WDT_SET_INIT_PERIOD, &CMD_WDT_SET_OFF_PERIOD, &CMD_WDT_SET_PERIOD,
-	&CMD_RS485_READ, &CMD_RS485_WRITE,&CMD_BOARD,
+	&CMD_RS485_READ, &CMD_RS485_WRITE, &CMD_SNAPSHOT, &CMD_RESTORE, &CMD_BOARD, &CMD_CACHE,
+	&CMD_VERIFY, &CMD_COALESCE, &CMD_TRACE, &CMD_STATS,
 	NULL, };
 
-static void doHelp(int argc, char *argv[])
+static int doHelp(int argc, char *argv[])
 {
 	int i = 0;
 	if (argc == 3)
@@ -1541,9 +2299,10 @@ static void doHelp(int argc, char *argv[])
 			i++;
 		}
 	}
+	return OK;
 }
 
-static void doVersion(int argc, char *argv[])
+static int doVersion(int argc, char *argv[])
 {
 	UNUSED(argc);
 	UNUSED(argv);
@@ -1551,33 +2310,38 @@ static void doVersion(int argc, char *argv[])
 	VERSION_BASE, VERSION_MAJOR, VERSION_MINOR);
 	printf("\nThis is free software with ABSOLUTELY NO WARRANTY.\n");
 	printf("For details type: 16relind -warranty\n");
-
+	return OK;
 }
 
-static void doList(int argc, char *argv[])
+static int doList(int argc, char *argv[])
 {
 	int ids[8];
 	int i;
 	int cnt = 0;
+	int refresh = 0;
+	uint8_t stacks = 0;
 
-	UNUSED(argc);
-	UNUSED(argv);
-
+	if (argc == 3 && strcasecmp(argv[2], "refresh") == 0)
+	{
+		refresh = 1;
+	}
+	else if (argc != 2)
+	{
+		printf("%s", CMD_LIST.usage1);
+		return ERROR;
+	}
+	if (OK != relay16DiscoverBus(cliBusDefault(), refresh, &stacks))
+	{
+		printf("Failed to open the bus.\n");
+		return ERROR;
+	}
 	for (i = 0; i < 8; i++)
 	{
-		if (boardCheck(RELAY16_HW_I2C_BASE_ADD + i) == OK)
+		if (stacks & (1 << i))
 		{
 			ids[cnt] = i;
 			cnt++;
 		}
-		else
-		{
-			if (boardCheck(RELAY16_HW_I2C_ALTERNATE_BASE_ADD + i) == OK)
-			{
-				ids[cnt] = i;
-				cnt++;
-			}
-		}
 	}
 	printf("%d board(s) detected\n", cnt);
 	if (cnt > 0)
@@ -1590,27 +2354,25 @@ static void doList(int argc, char *argv[])
 		printf(" %d", ids[cnt]);
 	}
 	printf("\n");
+	return OK;
 }
 
 /* 
  * Self test for production
  */
-static void doTest(int argc, char *argv[])
+static int doTest(int argc, char *argv[])
 {
-	int dev = 0;
+	Relay16Board *board = NULL;
 	int i = 0;
-	int retry = 0;
-	int relVal;
-	int valR;
 	int relayResult = 0;
 	FILE *file = NULL;
 	const u8 relayOrder[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
 		16};
 
-	dev = doBoardInit(atoi(argv[1]));
-	if (dev <= 0)
+	board = doBoardInit(argv[1]);
+	if (board == NULL)
 	{
-		return;
+		return ERROR;
 	}
 	if (argc == 4)
 	{
@@ -1624,7 +2386,6 @@ static void doTest(int argc, char *argv[])
 //relay test****************************
 	if (strcasecmp(argv[2], "test") == 0)
 	{
-		relVal = 0;
 		printf(
 			"Are all relays and LEDs turning on and off in sequence?\nPress y for Yes or any key for No....");
 		startThread();
@@ -1637,29 +2398,13 @@ static void doTest(int argc, char *argv[])
 				{
 					break;
 				}
-				valR = 0;
-				relVal = (u16)1 << (relayOrder[i] - 1);
-
-				retry = RETRY_TIMES;
-				while ( (retry > 0) && ( (valR & relVal) == 0))
-				{
-					if (OK != relayChSet(dev, relayOrder[i], ON))
-					{
-						retry = 0;
-						break;
-					}
-
-					if (OK != relayGet(dev, &valR))
-					{
-						retry = 0;
-					}
-				}
-				if (retry == 0)
+				// read back and repeated by the library (gCliVerify)
+				if (OK != relay16ChSet(board, relayOrder[i], ON))
 				{
 					printf("Fail to write relay\n");
 					if (file)
 						fclose(file);
-					return;
+					return ERROR;
 				}
 				busyWait(150);
 			}
@@ -1671,26 +2416,12 @@ static void doTest(int argc, char *argv[])
 				{
 					break;
 				}
-				valR = 0xffff;
-				relVal = (u16)1 << (relayOrder[i] - 1);
-				retry = RETRY_TIMES;
-				while ( (retry > 0) && ( (valR & relVal) != 0))
-				{
-					if (OK != relayChSet(dev, relayOrder[i], OFF))
-					{
-						retry = 0;
-					}
-					if (OK != relayGet(dev, &valR))
-					{
-						retry = 0;
-					}
-				}
-				if (retry == 0)
+				if (OK != relay16ChSet(board, relayOrder[i], OFF))
 				{
 					printf("Fail to write relay!\n");
 					if (file)
 						fclose(file);
-					return;
+					return ERROR;
 				}
 				busyWait(150);
 			}
@@ -1722,12 +2453,14 @@ static void doTest(int argc, char *argv[])
 	{
 		fclose(file);
 	}
-	relaySet(dev, 0);
+	relay16Set(board, 0);
+	return OK;
 }
 
-static void doWarranty(int argc UNU, char* argv[] UNU)
+static int doWarranty(int argc UNU, char* argv[] UNU)
 {
 	printf("%s\n", warranty);
+	return OK;
 }
 
 //static void cliInit(void)
@@ -1754,58 +2487,341 @@ static void doWarranty(int argc UNU, char* argv[] UNU)
 //
 //}
 
-int waitForI2C(sem_t *sem)
+/*
+ * cliLocalOnly:
+ *	Commands that never go through the daemon
+ *********************************************************************************
+ */
+int cliLocalOnly(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		return 1;
+	}
+	if ( (strcasecmp(argv[1], CMD_HELP.name) == 0)
+		|| (strcasecmp(argv[1], CMD_VERSION.name) == 0)
+		|| (strcasecmp(argv[1], CMD_WAR.name) == 0)
+		|| (strcasecmp(argv[1], CMD_DAEMON.name) == 0)
+		|| (strcasecmp(argv[1], CMD_EVENTS.name) == 0)
+		|| (strcasecmp(argv[1], CMD_MBTCP.name) == 0)
+		|| (strcasecmp(argv[1], CMD_BATCH.name) == 0)
+		|| (strcasecmp(argv[1], CMD_FAILSAFE_PROFILE_MANY.name) == 0)
+		|| (strcasecmp(argv[1], CMD_TRACE.name) == 0)
+		|| (strcasecmp(argv[1], CMD_STATS.name) == 0))
+	{
+		return 1;
+	}
+	if ( (argc > 2) && ( (strcasecmp(argv[2], CMD_TEST.name) == 0)
+		|| (strcasecmp(argv[2], CMD_WDT_KEEPALIVE.name) == 0)
+		|| (strcasecmp(argv[2], CMD_SNAPSHOT.name) == 0)
+		|| (strcasecmp(argv[2], CMD_RESTORE.name) == 0)))
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * cliUnlocked:
+ *	Board commands that run for a while and take the bus lock for every access
+ *	instead of for the whole command
+ *********************************************************************************
+ */
+int cliUnlocked(int argc, char *argv[])
+{
+	if ( (argc < 3) || (argv[1][0] == '-'))
+	{
+		return 0;
+	}
+	return (strcasecmp(argv[2], CMD_WDT_KEEPALIVE.name) == 0)
+		|| (strcasecmp(argv[2], CMD_PULSE.name) == 0)
+		|| (strcasecmp(argv[2], CMD_DELAYED_WRITE.name) == 0);
+}
+
+/*
+ * cliSplit:
+ *	Split a command line in arguments, argv[0] is the program name.
+ *	Double quotes keep the blanks and '#' in an argument, \" and \\ inside them
+ *	stand for a quote and a backslash (see clientLine). Everything else after
+ *	'#' is a comment. Return the argument count, -1 when the line has more
+ *	than max (argv must hold max + 1 pointers)
+ *********************************************************************************
+ */
+int cliSplit(char *line, char *argv[], int max)
+{
+	char *in = line;
+	char *out;
+	int quoted;
+	int argc = 0;
+
+	argv[argc++] = "16relind";
+	while (1)
+	{
+		while ( (*in != 0) && (strchr(" \t\r\n", *in) != NULL))
+		{
+			in++;
+		}
+		if ( (*in == 0) || (*in == '#'))
+		{
+			break;
+		}
+		if (argc == max)
+		{
+			argv[argc] = NULL;
+			return -1; // never run with arguments cut off
+		}
+		// unquoted in place, the argument never gets longer
+		argv[argc++] = out = in;
+		quoted = 0;
+		while ( (*in != 0) && (quoted || (strchr(" \t\r\n#", *in) == NULL)))
+		{
+			if (*in == '"')
+			{
+				quoted = !quoted;
+				in++;
+				continue;
+			}
+			if (quoted && (*in == '\\') && ( (in[1] == '"') || (in[1] == '\\')))
+			{
+				in++;
+			}
+			*out++ = *in++;
+		}
+		if (*in == '#')
+		{
+			*out = 0;
+			break;
+		}
+		if (*in != 0)
+		{
+			in++;
+		}
+		*out = 0;
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+/*
+ * cliExec:
+ *	Find and run the command, return the command result or CMD_NOT_FOUND
+ *********************************************************************************
+ */
+int cliExec(int argc, char *argv[])
+{
+	int i = 0;
+
+	while (NULL != gCmdArray[i])
+	{
+		if ( (gCmdArray[i]->name != NULL) && (gCmdArray[i]->namePos < argc))
+		{
+			if (strcasecmp(argv[gCmdArray[i]->namePos], gCmdArray[i]->name) == 0)
+			{
+				return gCmdArray[i]->pFunc(argc, argv);
+			}
+		}
+		i++;
+	}
+	return CMD_NOT_FOUND;
+}
+
+static long elapsedUs(const struct timespec *start)
 {
-	int semVal = 2;
 	struct timespec ts;
-	int s = 0;
 
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore initial value %d\n", semVal);
-	semVal = 2;
-#endif
-	while (semVal > 0)
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - start->tv_sec) * 1000000L
+		+ (ts.tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * doBatch:
+ *	Run one command per line from a file or stdin, in this process and with
+ *	one bus lock for the whole batch. Every command is followed by the
+ *	status line "#<line number> OK|FAIL <duration>us"
+ *********************************************************************************
+ */
+static int doBatch(int argc, char *argv[])
+{
+	FILE *in = stdin;
+	char line[CLI_LINE_MAX];
+	char *args[CLI_ARGS_MAX + 1];
+	struct timespec start;
+	struct timespec cmdStart;
+	int lineNr = 0;
+	int cnt = 0;
+	int failed = 0;
+	int len;
+	int n;
+	int ret;
+
+	if (argc > 3)
+	{
+		printf("%s", CMD_BATCH.usage1);
+		return ERROR;
+	}
+	if ( (argc == 3) && (strcmp(argv[2], "-") != 0))
 	{
-		if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+		in = fopen(argv[2], "r");
+		if (in == NULL)
 		{
-			/* handle error */
-			printf("Fail to read time \n");
-			return -1;
+			printf("Fail to open %s\n", argv[2]);
+			return ERROR;
 		}
-		ts.tv_sec += TIMEOUT_S;
-		while ( (s = sem_timedwait(sem, &ts)) == -1 && errno == EINTR)
-			continue; /* Restart if interrupted by handler */
-		sem_getvalue(sem, &semVal);
 	}
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore after wait %d\n", semVal);
-#endif
-	return 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ( (len = cliLineRead(line, sizeof(line), in)) != 0)
+	{
+		lineNr++;
+		n = len > 0 ? cliSplit(line, args, CLI_ARGS_MAX) : -1;
+		if ( (n >= 0) && (n < 2))
+		{
+			continue;
+		}
+		cnt++;
+		clock_gettime(CLOCK_MONOTONIC, &cmdStart);
+		if (len < 0)
+		{
+			printf("Line too long, at most %d characters\n", CLI_LINE_MAX - 1);
+			ret = ERROR;
+		}
+		else if (n < 0)
+		{
+			printf("Too many arguments, at most %d\n", CLI_ARGS_MAX - 1);
+			ret = ERROR;
+		}
+		else if (cliLocalOnly(n, args) && (strcasecmp(args[1], CMD_VERSION.name) != 0))
+		{
+			printf("Command \"%s\" not available in batch mode\n", args[1]);
+			ret = ERROR;
+		}
+		else
+		{
+			ret = cliExec(n, args);
+			if (ret == CMD_NOT_FOUND)
+			{
+				printf("Invalid command option\n");
+			}
+		}
+		if (ret != OK)
+		{
+			failed++;
+		}
+		printf("#%d %s %ldus\n", lineNr, ret == OK ? "OK" : "FAIL",
+			elapsedUs(&cmdStart));
+		fflush(stdout);
+	}
+	if (in != stdin)
+	{
+		fclose(in);
+	}
+	printf("#batch %d commands, %d failed, %ldus\n", cnt, failed,
+		elapsedUs(&start));
+	return failed ? ERROR : OK;
 }
 
-int releaseI2C(sem_t *sem)
+static int doDaemon(int argc, char *argv[])
 {
-	int semVal = 2;
-	sem_getvalue(sem, &semVal);
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore before post %d\n", semVal);
-#endif
-	if (semVal < 1)
+	if (argc > 3)
+	{
+		printf("%s", CMD_DAEMON.usage1);
+		return ERROR;
+	}
+	// setuid: the socket is created and opened to everybody as root
+	if ( (getuid() != geteuid())
+		&& ( (argc == 3) || (getenv("RELAY16_SOCK") != NULL)))
+	{
+		printf("The socket path can not be changed by a setuid 16relind\n");
+		return ERROR;
+	}
+	return daemonRun(argc == 3 ? argv[2] : clientSocketPath());
+}
+
+/*
+ * doMbtcp:
+ *	Modbus TCP gateway, the bus is locked for every batch of requests
+ *********************************************************************************
+ */
+static int doMbtcp(int argc, char *argv[])
+{
+	char *end;
+	long port = MBTCP_PORT_DEFAULT;
+	long offset = MBTCP_UNIT_OFFSET;
+
+	if (argc > 2)
 	{
-		if (sem_post(sem) == -1)
+		port = strtol(argv[2], &end, 10);
+		if (*end != 0)
 		{
-			printf("Fail to post SMI2C_SEM \n");
-			return -1;
+			port = 0;
 		}
 	}
-#ifdef DEBUG_SEM
-	sem_getvalue(sem, &semVal);
-	printf("Semaphore after post %d\n", semVal);
-#endif
-	return 0;
+	if (argc > 4)
+	{
+		offset = strtol(argv[4], &end, 10);
+		if (*end != 0)
+		{
+			offset = -1;
+		}
+	}
+	if ( (argc > 5) || (port <= 0) || (port > 65535) || (offset < 0)
+		|| (offset > 255 - RELAY16_STACK_MAX))
+	{
+		printf("%s", CMD_MBTCP.usage1);
+		return ERROR;
+	}
+	return mbtcpRun(cliBusDefault(), argc > 3 ? argv[3] : MBTCP_ADDR_DEFAULT,
+		(int)port, (int)offset);
+}
+
+/*
+ * doEvents:
+ *	Subscribe to the daemon event stream and copy it to the standard output,
+ *	without a daemon the boards are polled by this process
+ *********************************************************************************
+ */
+static int doEvents(int argc, char *argv[])
+{
+	char line[DAEMON_LINE_MAX];
+	char buff[DAEMON_LINE_MAX];
+	char *end = NULL;
+	int sock = -1;
+	int len;
+	int n;
+
+	if (clientLine(argc, argv, line, sizeof(line) - 1) != 0)
+	{
+		printf("%s", CMD_EVENTS.usage1);
+		return ERROR;
+	}
+	if (secure_getenv("RELAY16_NODAEMON") == NULL)
+	{
+		sock = clientConnect(clientSocketPath());
+	}
+	if (sock < 0)
+	{
+		return eventsRun(argc - 2, argv + 2);
+	}
+	len = strlen(line);
+	line[len++] = '\n';
+	if (write(sock, line, len) != len)
+	{
+		close(sock);
+		printf("Lost connection with 16relind daemon\n");
+		return ERROR;
+	}
+	// the answer end only comes if the daemon refused the subscription
+	while ( (n = read(sock, buff, sizeof(buff))) > 0)
+	{
+		end = memchr(buff, DAEMON_RESP_END, n);
+		len = end ? end - buff : n;
+		if ( (write(STDOUT_FILENO, buff, len) != len) || end)
+		{
+			break;
+		}
+	}
+	close(sock);
+	return n > 0 && end ? ERROR : OK;
 }
 
 int main(int argc, char *argv[])
@@ -1823,35 +2839,52 @@ int main(int argc, char *argv[])
 		}
 		return 1;
 	}
+	if (!cliLocalOnly(argc, argv) && (clientForward(argc, argv) == 0))
+	{
+		return 0;
+	}
+	relay16MultiBus(1);
+	if (strcasecmp(argv[1], CMD_DAEMON.name) == 0)
+	{
+		doDaemon(argc, argv);
+		return 0;
+	}
+	if (strcasecmp(argv[1], CMD_EVENTS.name) == 0)
+	{
+		// runs until the subscriber leaves, the poller locks the bus for every poll
+		return doEvents(argc, argv) == OK ? 0 : 1;
+	}
+	if (strcasecmp(argv[1], CMD_MBTCP.name) == 0)
+	{
+		return doMbtcp(argc, argv) == OK ? 0 : 1;
+	}
+	if (cliUnlocked(argc, argv))
+	{
+		// long running, the command locks the bus for every access only
+		cliExec(argc, argv);
+		return 0;
+	}
 #ifdef THREAD_SAFE
-	sem_t *semaphore = sem_open("/SMI2C_SEM", O_CREAT, 0000666, 3);
-	waitForI2C(semaphore);
+	if (relay16Lock() != OK)
+	{
+		printf("The bus is busy, try again\n");
+		return 1;
+	}
 #endif
-	i = 0;
-	while (NULL != gCmdArray[i])
+	if (CMD_NOT_FOUND == cliExec(argc, argv))
 	{
-		if ( (gCmdArray[i]->name != NULL) && (gCmdArray[i]->namePos < argc))
+		printf("Invalid command option\n");
+		i = 0;
+		while (NULL != gCmdArray[i])
 		{
-			if (strcasecmp(argv[gCmdArray[i]->namePos], gCmdArray[i]->name) == 0)
-			{
-				gCmdArray[i]->pFunc(argc, argv);
-#ifdef THREAD_SAFE
-				releaseI2C(semaphore);
-#endif
-				return 0;
-			}
+			printf("%s", gCmdArray[i]->help);
+			i++;
 		}
-		i++;
-	}
-	printf("Invalid command option\n");
-	i = 0;
-	while (NULL != gCmdArray[i])
-	{
-		printf("%s", gCmdArray[i]->help);
-		i++;
 	}
 #ifdef THREAD_SAFE
-	releaseI2C(semaphore);
+	relay16Unlock();
 #endif
+	// timed changes scheduled by a batch run once the bus is released
+	relay16PulseWait(NULL, 0);
 	return 0;
 }
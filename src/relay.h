@@ -2,8 +2,13 @@
 #define RELAY_H_
 
 #include <stdint.h>
+#include "lib16relind.h"
+
+#define UNUSED(X) (void)X      /* To avoid gcc/g++ warnings */
 
 #define RETRY_TIMES	10
+#define VERIFY_BACKOFF_US	100		/* first wait before a write is repeated */
+#define VERIFY_BUDGET_MS	100		/* time limit of a verified write */
 #define RELAY16_INPORT_REG_ADD	0x00
 #define RELAY16_OUTPORT_REG_ADD	0x02
 #define RELAY16_POLINV_REG_ADD	0x04
@@ -15,6 +20,10 @@
 #define ERROR	-1
 #define OK		0
 #define FAIL	-1
+#define CMD_NOT_FOUND	-2
+
+#define CLI_LINE_MAX	1024
+#define CLI_ARGS_MAX	(RELAY16_SCENE_MAX + 2) /* -scene with every board */
 
 #define WDT_RESET_SIGNATURE 	0xCA
 #define WDT_MAX_OFF_INTERVAL_S 4147200 //48 days
@@ -72,7 +81,7 @@ typedef struct
 {
  const char* name;
  const int namePos;
- void(*pFunc)(int, char**);
+ int(*pFunc)(int, char**);
  const char* help;
  const char* usage1;
  const char* usage2;
@@ -89,5 +98,14 @@ typedef struct
 		unsigned int add:8;
 	} ModbusSetingsType;
 
+int cliBusDefault(void);
+Relay16Board* doBoardInit(const char *id);
+void boardCacheFlush(void);
+int cliLocalOnly(int argc, char *argv[]);
+int cliUnlocked(int argc, char *argv[]);
+int cliSplit(char *line, char *argv[], int max);
+int cliValueParse(const char *arg, uint16_t *val);
+int cliChannelsParse(const char *arg, uint16_t *mask);
+int cliExec(int argc, char *argv[]);
 
 #endif //RELAY_H_
@@ -0,0 +1,705 @@
+/*
+ * rtu.c:
+ *	Modbus RTU master transport: the boards of a bus attached to an RS-485
+ *	line are reached through their Modbus slave instead of the I2C expander.
+ *	The expander ports are mapped onto the relay coils (see MODBUS.md), an
+ *	output port read is one Read Coils (0x01) request and an output port write
+ *	is one Write Multiple Coils (0x0f) request, both relay bytes in one frame.
+ *	The configuration and polarity registers read 0 (a Read Coils request
+ *	still checks the slave is there) and their writes are accepted, the slave
+ *	firmware owns the expander; the other registers are not reachable over
+ *	Modbus and fail.
+ *
+ *	Every request waits for the 3.5 character silence after the last frame
+ *	on the line, a response must start within RTU_TIMEOUT_MS after the time
+ *	the frames take on the wire.
+ *
+ *	A line is "<tty>[:<baud>[:<format>[:<offset>]]]", format 8N1, 8E1, 8O1 or
+ *	8N2, offset is the slave address of the stack level 0, attached to a bus
+ *	by relay16RtuAttach() or the RELAY16_RTU environment variable, a list of
+ *	<bus>=<line>, for example RELAY16_RTU="20=/dev/ttyUSB0:9600:8N1:1"
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define _GNU_SOURCE /* secure_getenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include "relay.h"
+#include "rtu.h"
+
+#define RTU_TTY_MAX		128
+#define RTU_SLAVE_MAX	247
+#define RTU_T35_FIXED_US	1750 /* above 19200 bps */
+
+typedef struct
+{
+	int used;
+	char tty[RTU_TTY_MAX];
+	int baud;
+	int parity; /* 0 = none, 1 = even, 2 = odd */
+	int stopBits;
+	int offset;
+	int fd;
+	int refs; /* devices open */
+	uint32_t charUs;
+	uint32_t t35Us;
+	uint64_t idleUs; /* end of the last frame on the line */
+	pthread_mutex_t lock;
+} RtuLineType;
+
+typedef struct
+{
+	int used;
+	int bus;
+	int slave;
+} RtuDevType;
+
+typedef struct
+{
+	int baud;
+	speed_t speed;
+} RtuBaudType;
+
+static const RtuBaudType gBaud[] = {{1200, B1200}, {2400, B2400}, {4800, B4800},
+	{9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200,
+		B115200}, {230400, B230400}, {460800, B460800}, {921600, B921600}};
+
+static RtuLineType gLine[RELAY16_BUS_MAX];
+static RtuDevType gRtuDev[RTU_DEV_MAX];
+static RtuStatsType gStats;
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t gEnvOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t timeUs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint16_t rtuCrc(const uint8_t *buff, int size)
+{
+	uint16_t crc = 0xffff;
+	int i;
+	int k;
+
+	for (i = 0; i < size; i++)
+	{
+		crc ^= buff[i];
+		for (k = 0; k < 8; k++)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+		}
+	}
+	return crc;
+}
+
+/*
+ * rtuT35Us:
+ *	Silence between two frames, 3.5 character times, fixed above 19200 bps
+ *********************************************************************************
+ */
+uint32_t rtuT35Us(int baud, int charBits)
+{
+	if (baud > 19200)
+	{
+		return RTU_T35_FIXED_US;
+	}
+	return (uint32_t) ( (7000000ULL * charBits + 2ULL * baud - 1) / (2ULL * baud));
+}
+
+static int baudSpeed(int baud, speed_t *speed)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(gBaud) / sizeof(gBaud[0]); i++)
+	{
+		if (gBaud[i].baud == baud)
+		{
+			*speed = gBaud[i].speed;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * lineParse:
+ *	"<tty>[:<baud>[:<format>[:<offset>]]]"
+ *********************************************************************************
+ */
+static int lineParse(const char *spec, RtuLineType *l)
+{
+	char buff[RTU_TTY_MAX + 32];
+	char *save = NULL;
+	char *tok;
+	char *end;
+	speed_t speed;
+	long v;
+
+	snprintf(buff, sizeof(buff), "%s", spec);
+	tok = strtok_r(buff, ":", &save);
+	if ( (tok == NULL) || (strlen(tok) >= RTU_TTY_MAX))
+	{
+		return -1;
+	}
+	strcpy(l->tty, tok);
+	l->baud = 9600;
+	l->parity = 0;
+	l->stopBits = 1;
+	l->offset = RTU_OFFSET_DEFAULT;
+	if ( (tok = strtok_r(NULL, ":", &save)) != NULL)
+	{
+		l->baud = (int)strtol(tok, &end, 10);
+		if ( (*end != 0) || (baudSpeed(l->baud, &speed) != 0))
+		{
+			return -1;
+		}
+		tok = strtok_r(NULL, ":", &save);
+	}
+	if (tok != NULL)
+	{
+		if ( (strlen(tok) != 3) || (tok[0] != '8') || (strchr("NEO", tok[1]) == NULL)
+			|| (tok[2] < '1') || (tok[2] > '2'))
+		{
+			return -1;
+		}
+		l->parity = tok[1] == 'N' ? 0 : tok[1] == 'E' ? 1 : 2;
+		l->stopBits = tok[2] - '0';
+		tok = strtok_r(NULL, ":", &save);
+	}
+	if (tok != NULL)
+	{
+		v = strtol(tok, &end, 10);
+		if ( (*end != 0) || (v < 0) || (v > RTU_SLAVE_MAX))
+		{
+			return -1;
+		}
+		l->offset = (int)v;
+		if (strtok_r(NULL, ":", &save) != NULL)
+		{
+			return -1;
+		}
+	}
+	l->charUs = (uint32_t) ( (1000000ULL * (9 + (l->parity != 0) + l->stopBits)
+		+ l->baud - 1) / l->baud);
+	l->t35Us = rtuT35Us(l->baud, 9 + (l->parity != 0) + l->stopBits);
+	return 0;
+}
+
+/*
+ * lineAttach:
+ *	Attach the bus to a line, NULL detaches, the caller holds gLock
+ *********************************************************************************
+ */
+static int lineAttach(int bus, const char *spec)
+{
+	RtuLineType l;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	if (gLine[bus].refs > 0)
+	{
+		return RELAY16_ERR_BUS; // boards open on the line
+	}
+	if (spec == NULL)
+	{
+		gLine[bus].used = 0;
+		return RELAY16_OK;
+	}
+	memset(&l, 0, sizeof(l));
+	if (lineParse(spec, &l) != 0)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	strcpy(gLine[bus].tty, l.tty);
+	gLine[bus].baud = l.baud;
+	gLine[bus].parity = l.parity;
+	gLine[bus].stopBits = l.stopBits;
+	gLine[bus].offset = l.offset;
+	gLine[bus].charUs = l.charUs;
+	gLine[bus].t35Us = l.t35Us;
+	gLine[bus].idleUs = 0;
+	gLine[bus].fd = -1;
+	gLine[bus].used = 1;
+	return RELAY16_OK;
+}
+
+static void envInit(void)
+{
+	const char *env = secure_getenv("RELAY16_RTU");
+	char buff[1024];
+	char *save = NULL;
+	char *tok;
+	char *end;
+	long bus;
+	int i;
+
+	for (i = 0; i < RELAY16_BUS_MAX; i++)
+	{
+		pthread_mutex_init(&gLine[i].lock, NULL);
+		gLine[i].fd = -1;
+	}
+	if (env == NULL)
+	{
+		return;
+	}
+	snprintf(buff, sizeof(buff), "%s", env);
+	pthread_mutex_lock(&gLock);
+	for (tok = strtok_r(buff, ";", &save); tok; tok = strtok_r(NULL, ";", &save))
+	{
+		bus = strtol(tok, &end, 10);
+		if ( (end != tok) && (*end == '='))
+		{
+			lineAttach((int)bus, end + 1);
+		}
+	}
+	pthread_mutex_unlock(&gLock);
+}
+
+int relay16RtuAttach(int bus, const char *line)
+{
+	int ret;
+
+	pthread_once(&gEnvOnce, envInit);
+	pthread_mutex_lock(&gLock);
+	ret = lineAttach(bus, line);
+	pthread_mutex_unlock(&gLock);
+	return ret;
+}
+
+/*
+ * rtuBus:
+ *	1 when the boards of the bus are on a Modbus RTU line
+ *********************************************************************************
+ */
+int rtuBus(int bus)
+{
+	int ret;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX))
+	{
+		return 0;
+	}
+	pthread_once(&gEnvOnce, envInit);
+	pthread_mutex_lock(&gLock);
+	ret = gLine[bus].used;
+	pthread_mutex_unlock(&gLock);
+	return ret;
+}
+
+static int lineOpen(RtuLineType *l)
+{
+	struct termios tio;
+	speed_t speed;
+	int fd;
+
+	if (baudSpeed(l->baud, &speed) != 0)
+	{
+		return -1;
+	}
+	fd = open(l->tty, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+	tio.c_cflag |= CS8 | CLOCAL | CREAD;
+	if (l->parity != 0)
+	{
+		tio.c_cflag |= PARENB | (l->parity == 2 ? PARODD : 0);
+	}
+	if (l->stopBits == 2)
+	{
+		tio.c_cflag |= CSTOPB;
+	}
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(fd, TCSANOW, &tio) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+	l->fd = fd;
+	l->idleUs = timeUs();
+	return 0;
+}
+
+static int rtuSetup(int bus, int addr)
+{
+	RtuLineType *l;
+	int slave;
+	int i;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX) || !rtuBus(bus))
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&gLock);
+	l = &gLine[bus];
+	// the stack level dipswitches select both the expander and the slave address
+	slave = l->offset + ( (addr & 0x07) ^ 0x07);
+	if ( (slave < 1) || (slave > RTU_SLAVE_MAX)
+		|| ( (l->fd < 0) && (lineOpen(l) != 0)))
+	{
+		pthread_mutex_unlock(&gLock);
+		return -1;
+	}
+	for (i = 0; i < RTU_DEV_MAX; i++)
+	{
+		if (!gRtuDev[i].used)
+		{
+			gRtuDev[i].used = 1;
+			gRtuDev[i].bus = bus;
+			gRtuDev[i].slave = slave;
+			l->refs++;
+			break;
+		}
+	}
+	if ( (i == RTU_DEV_MAX) && (l->refs == 0))
+	{
+		close(l->fd);
+		l->fd = -1;
+	}
+	pthread_mutex_unlock(&gLock);
+	return i < RTU_DEV_MAX ? i : -1;
+}
+
+static void rtuClose(int dev)
+{
+	RtuLineType *l;
+
+	if ( (dev < 0) || (dev >= RTU_DEV_MAX))
+	{
+		return;
+	}
+	pthread_mutex_lock(&gLock);
+	if (gRtuDev[dev].used)
+	{
+		gRtuDev[dev].used = 0;
+		l = &gLine[gRtuDev[dev].bus];
+		if ( (--l->refs == 0) && (l->fd >= 0))
+		{
+			close(l->fd);
+			l->fd = -1;
+		}
+	}
+	pthread_mutex_unlock(&gLock);
+}
+
+static RtuDevType* rtuDevGet(int dev)
+{
+	if ( (dev < 0) || (dev >= RTU_DEV_MAX) || !gRtuDev[dev].used)
+	{
+		return NULL;
+	}
+	return &gRtuDev[dev];
+}
+
+static int lineSend(RtuLineType *l, const uint8_t *buff, int size)
+{
+	struct pollfd pfd = {l->fd, POLLOUT, 0};
+	int n;
+
+	while (size > 0)
+	{
+		n = write(l->fd, buff, size);
+		if (n > 0)
+		{
+			buff += n;
+			size -= n;
+		}
+		else if ( (n < 0) && (errno != EAGAIN) && (errno != EINTR))
+		{
+			return -1;
+		}
+		else if (poll(&pfd, 1, RTU_TIMEOUT_MS) <= 0)
+		{
+			return -1;
+		}
+	}
+	return tcdrain(l->fd);
+}
+
+/*
+ * lineReceive:
+ *	Read a response of size bytes, or the 5 bytes of an exception response.
+ *	The first byte is expected until deadline, the rest within its
+ *	transmission time plus a slack for the USB adapters delivering in bursts
+ *********************************************************************************
+ */
+static int lineReceive(RtuLineType *l, uint8_t *buff, int size, uint64_t deadline)
+{
+	struct pollfd pfd = {l->fd, POLLIN, 0};
+	uint64_t now;
+	int got = 0;
+	int n;
+
+	while (got < size)
+	{
+		if ( (got >= 5) && (buff[1] & RTU_EXCEPTION))
+		{
+			break;
+		}
+		n = read(l->fd, buff + got, size - got);
+		now = timeUs();
+		if (n > 0)
+		{
+			got += n;
+			deadline = now + RTU_TIMEOUT_MS * 1000 / 4 + (uint64_t)l->charUs * (size - got);
+			continue;
+		}
+		if ( (n < 0) && (errno != EAGAIN) && (errno != EINTR))
+		{
+			break;
+		}
+		if (now >= deadline)
+		{
+			break;
+		}
+		if (poll(&pfd, 1, (int) ( (deadline - now + 999) / 1000)) < 0 && errno != EINTR)
+		{
+			break;
+		}
+	}
+	return got;
+}
+
+/*
+ * rtuExchange:
+ *	Send the request (the CRC is appended) and check the response of the
+ *	slave, -1 on timeout, corrupted frame or exception
+ *********************************************************************************
+ */
+static int rtuExchange(int bus, uint8_t *req, int reqSize, uint8_t *rsp, int rspSize)
+{
+	RtuLineType *l = &gLine[bus];
+	struct timespec ts;
+	uint64_t idle;
+	uint16_t crc;
+	int got;
+
+	crc = rtuCrc(req, reqSize);
+	req[reqSize++] = crc & 0xff;
+	req[reqSize++] = crc >> 8;
+	pthread_mutex_lock(&l->lock);
+	if (l->fd < 0)
+	{
+		pthread_mutex_unlock(&l->lock);
+		return -1;
+	}
+	idle = l->idleUs + l->t35Us;
+	if (timeUs() < idle)
+	{
+		ts.tv_sec = idle / 1000000;
+		ts.tv_nsec = (idle % 1000000) * 1000;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		{
+		}
+	}
+	// the end of a response given up on
+	tcflush(l->fd, TCIFLUSH);
+	__atomic_add_fetch(&gStats.frames, 1, __ATOMIC_RELAXED);
+	if (lineSend(l, req, reqSize) != 0)
+	{
+		l->idleUs = timeUs();
+		pthread_mutex_unlock(&l->lock);
+		__atomic_add_fetch(&gStats.timeouts, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	// the response time counts from its start, a pty does not wait in tcdrain
+	got = lineReceive(l, rsp, rspSize, timeUs() + RTU_TIMEOUT_MS * 1000
+		+ (uint64_t)l->charUs * (reqSize + rspSize));
+	l->idleUs = timeUs();
+	pthread_mutex_unlock(&l->lock);
+	__atomic_add_fetch(&gStats.bytes, reqSize + got, __ATOMIC_RELAXED);
+	if (got == 0)
+	{
+		__atomic_add_fetch(&gStats.timeouts, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	if ( (got < 5) || (rsp[0] != req[0])
+		|| (rtuCrc(rsp, got - 2) != (rsp[got - 2] | (rsp[got - 1] << 8))))
+	{
+		__atomic_add_fetch(&gStats.crcErrors, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	if (rsp[1] == (req[1] | RTU_EXCEPTION))
+	{
+		__atomic_add_fetch(&gStats.exceptions, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	if ( (got != rspSize) || (rsp[1] != req[1]))
+	{
+		__atomic_add_fetch(&gStats.crcErrors, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * coilsRead:
+ *	The 16 relay coils, bit 0 = relay 1
+ *********************************************************************************
+ */
+static int coilsRead(RtuDevType *d, uint16_t *val)
+{
+	uint8_t req[8] = {(uint8_t)d->slave, RTU_FC_READ_COILS, 0, 0, 0, RELAY_CH_NR_MAX};
+	uint8_t rsp[7];
+
+	if ( (rtuExchange(d->bus, req, 6, rsp, sizeof(rsp)) != 0) || (rsp[2] != 2))
+	{
+		return -1;
+	}
+	*val = rsp[3] | (rsp[4] << 8);
+	return 0;
+}
+
+static int coilsWrite(RtuDevType *d, int start, int count, uint16_t val)
+{
+	uint8_t req[11] = {(uint8_t)d->slave, RTU_FC_WRITE_COILS, 0, (uint8_t)start, 0,
+		(uint8_t)count, (uint8_t) ( (count + 7) / 8), val & 0xff, val >> 8};
+	uint8_t rsp[8];
+
+	if (rtuExchange(d->bus, req, 7 + req[6], rsp, sizeof(rsp)) != 0)
+	{
+		return -1;
+	}
+	return memcmp(rsp + 2, req + 2, 4) == 0 ? 0 : -1;
+}
+
+static int rtuRead(int dev, int add, uint8_t* buff, int size)
+{
+	RtuDevType *d = rtuDevGet(dev);
+	uint16_t val;
+	uint16_t io;
+	int a;
+	int k;
+
+	if ( (d == NULL) || (add < 0) || (add + size > RELAY16_CFG_REG_ADD + 2))
+	{
+		return -1;
+	}
+	// one request even for the configuration, the board probe needs an answer
+	if (coilsRead(d, &val) != 0)
+	{
+		return -1;
+	}
+	io = relay16ToIO(val);
+	for (k = 0; k < size; k++)
+	{
+		a = add + k;
+		if (a <= RELAY16_OUTPORT_REG_ADD + 1)
+		{
+			// the output pins read back their state on both ports
+			buff[k] = (a & 1) ? io >> 8 : io & 0xff;
+		}
+		else
+		{
+			buff[k] = 0; // no inversion, all the pins are outputs
+		}
+	}
+	return 0;
+}
+
+static int rtuWrite(int dev, int add, uint8_t* buff, int size)
+{
+	RtuDevType *d = rtuDevGet(dev);
+	uint16_t io = 0;
+	int ports = 0;
+	int a;
+	int k;
+
+	if (d == NULL)
+	{
+		return -1;
+	}
+	for (k = 0; k < size; k++)
+	{
+		a = add + k;
+		if ( (a < RELAY16_OUTPORT_REG_ADD) || (a > RELAY16_CFG_REG_ADD + 1))
+		{
+			return -1;
+		}
+		if (a <= RELAY16_OUTPORT_REG_ADD + 1)
+		{
+			io |= buff[k] << (8 * (a & 1));
+			ports |= 1 << (a & 1);
+		}
+	}
+	// port 0 drives the relays 9..16, port 1 the relays 1..8
+	switch (ports)
+	{
+	case 3:
+		return coilsWrite(d, 0, RELAY_CH_NR_MAX, relay16FromIO(io));
+	case 1:
+		return coilsWrite(d, 8, 8, relay16FromIO(io) >> 8);
+	case 2:
+		return coilsWrite(d, 0, 8, relay16FromIO(io) & 0xff);
+	default:
+		return 0;
+	}
+}
+
+static int rtuTransfer(int dev, I2cRegMsgType* msgs, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if ( (msgs[i].read ? rtuRead(dev, msgs[i].add, msgs[i].buff, msgs[i].size)
+			: rtuWrite(dev, msgs[i].add, msgs[i].buff, msgs[i].size)) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static const I2cTransportType gRtuTransport = {"modbus-rtu", rtuSetup, rtuRead,
+	rtuWrite, rtuTransfer, rtuClose};
+
+const I2cTransportType* rtuTransport(void)
+{
+	return &gRtuTransport;
+}
+
+void rtuStatsGet(RtuStatsType *stats, int clear)
+{
+	if (stats != NULL)
+	{
+		stats->frames = __atomic_load_n(&gStats.frames, __ATOMIC_RELAXED);
+		stats->bytes = __atomic_load_n(&gStats.bytes, __ATOMIC_RELAXED);
+		stats->timeouts = __atomic_load_n(&gStats.timeouts, __ATOMIC_RELAXED);
+		stats->crcErrors = __atomic_load_n(&gStats.crcErrors, __ATOMIC_RELAXED);
+		stats->exceptions = __atomic_load_n(&gStats.exceptions, __ATOMIC_RELAXED);
+	}
+	if (clear)
+	{
+		memset(&gStats, 0, sizeof(gStats));
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef RTU_H_
+#define RTU_H_
+
+#include <stdint.h>
+
+#include "comm.h"
+
+#define RTU_DEV_MAX		64
+#define RTU_FRAME_MAX	256
+#define RTU_TIMEOUT_MS	100 /* slave response time, after the request is sent */
+#define RTU_OFFSET_DEFAULT	1
+
+#define RTU_FC_READ_COILS	0x01
+#define RTU_FC_WRITE_COILS	0x0f
+#define RTU_EXCEPTION		0x80
+
+typedef struct
+{
+	uint32_t frames; /* requests sent */
+	uint32_t bytes; /* sent and received */
+	uint32_t timeouts;
+	uint32_t crcErrors; /* and malformed responses */
+	uint32_t exceptions;
+} RtuStatsType;
+
+const I2cTransportType* rtuTransport(void);
+int rtuBus(int bus);
+uint16_t rtuCrc(const uint8_t *buff, int size);
+uint32_t rtuT35Us(int baud, int charBits);
+void rtuStatsGet(RtuStatsType *stats, int clear);
+
+#endif //RTU_H_
@@ -0,0 +1,569 @@
+/*
+ * sim.c:
+ *	Simulated bus transport: the boards are modeled as the register file of
+ *	relay.h (expander ports, failsafe, watchdog, RS485 and revision registers)
+ *	on both base addresses and all the stack levels. Every transaction can
+ *	take a fixed time and can fail with an injected NACK or carry a flipped
+ *	bit, the random sequence is repeatable for a given seed.
+ *
+ *	Selected by the RELAY16_SIM environment variable, a list of settings:
+ *	  boards=<stack>[@<bus>][:alt],...  boards present, alt = 0x38 base address
+ *	  latency=<us>                      time of every transaction
+ *	  byte=<us>                         extra time for every byte transferred
+ *	  nack=<probability>                injected NACK per transaction
+ *	  biterr=<probability>              one flipped data bit per transaction
+ *	  seed=<n>                          random sequence
+ *	  state=<file>                      keep the registers in a file, shared
+ *	                                    by the processes (CLI, daemon)
+ *	for example RELAY16_SIM="boards=0,1,0@3:alt;latency=100;nack=0.01"
+ *	An empty value simulates one board, stack level 0 on /dev/i2c-1.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#define _GNU_SOURCE /* secure_getenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "relay.h"
+#include "sim.h"
+
+#define SIM_REG_SIZE	256
+#define SIM_STATE_MAGIC	0x53523136
+#define SIM_FW_MAJOR	1
+#define SIM_FW_MINOR	0
+#define SIM_MSG_MAX		32
+
+typedef struct
+{
+	uint32_t magic;
+	uint8_t reg[RELAY16_BUS_MAX][RELAY16_STACK_MAX][SIM_REG_SIZE];
+} SimStateType;
+
+typedef struct
+{
+	int used;
+	int bus;
+	int addr;
+} SimDevType;
+
+typedef struct
+{
+	uint8_t present[RELAY16_BUS_MAX][RELAY16_STACK_MAX];
+	uint8_t alt[RELAY16_BUS_MAX][RELAY16_STACK_MAX];
+	unsigned int latencyUs;
+	unsigned int byteUs;
+	double nack;
+	double bitErr;
+	uint64_t seed;
+	char state[256];
+} SimCfgType;
+
+static SimCfgType gCfg;
+static int gConfigured = 0;
+static SimStateType *gState = NULL;
+static SimDevType gSimDev[SIM_DEV_MAX];
+static SimStatsType gStats;
+static uint64_t gRand[RELAY16_BUS_MAX];
+static pthread_mutex_t gBusLock[RELAY16_BUS_MAX];
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void regPowerOn(uint8_t *r)
+{
+	memset(r, 0, SIM_REG_SIZE);
+	// expander reset state, all the pins are inputs
+	r[RELAY16_OUTPORT_REG_ADD] = 0xff;
+	r[RELAY16_OUTPORT_REG_ADD + 1] = 0xff;
+	r[RELAY16_CFG_REG_ADD] = 0xff;
+	r[RELAY16_CFG_REG_ADD + 1] = 0xff;
+	r[I2C_MEM_DIAG_3V3_MV_ADD] = 3300 & 0xff;
+	r[I2C_MEM_DIAG_3V3_MV_ADD + 1] = 3300 >> 8;
+	r[I2C_MEM_DIAG_TEMPERATURE_ADD] = 30;
+	r[I2C_MEM_DIAG_5V_ADD] = 5000 & 0xff;
+	r[I2C_MEM_DIAG_5V_ADD + 1] = 5000 >> 8;
+	r[I2C_MEM_REVISION_MAJOR_ADD] = SIM_FW_MAJOR;
+	r[I2C_MEM_REVISION_MINOR_ADD] = SIM_FW_MINOR;
+}
+
+/*
+ * simStateOpen:
+ *	Map the register file, from the state file when configured
+ *********************************************************************************
+ */
+static int simStateOpen(void)
+{
+	SimStateType *st;
+	int fd = -1;
+	int i;
+	int j;
+
+	if (gCfg.state[0] != 0)
+	{
+		fd = open(gCfg.state, O_RDWR | O_CREAT, 0666);
+		if ( (fd < 0) || (ftruncate(fd, sizeof(SimStateType)) != 0))
+		{
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			return -1;
+		}
+		st = mmap(NULL, sizeof(SimStateType), PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, 0);
+		close(fd);
+	}
+	else
+	{
+		st = mmap(NULL, sizeof(SimStateType), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (st == MAP_FAILED)
+	{
+		return -1;
+	}
+	if (st->magic != SIM_STATE_MAGIC)
+	{
+		for (i = 0; i < RELAY16_BUS_MAX; i++)
+		{
+			for (j = 0; j < RELAY16_STACK_MAX; j++)
+			{
+				regPowerOn(st->reg[i][j]);
+			}
+		}
+		st->magic = SIM_STATE_MAGIC;
+	}
+	gState = st;
+	return 0;
+}
+
+static int simParseBoards(char *list)
+{
+	char *save = NULL;
+	char *tok;
+	char *end;
+	long stack;
+	long bus;
+
+	for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+	{
+		bus = RELAY16_BUS_DEFAULT;
+		stack = strtol(tok, &end, 10);
+		if ( (end == tok) || (stack < 0) || (stack >= RELAY16_STACK_MAX))
+		{
+			return -1;
+		}
+		if (*end == '@')
+		{
+			bus = strtol(end + 1, &end, 10);
+			if ( (bus < 0) || (bus >= RELAY16_BUS_MAX))
+			{
+				return -1;
+			}
+		}
+		gCfg.present[bus][stack] = 1;
+		if (strcmp(end, ":alt") == 0)
+		{
+			gCfg.alt[bus][stack] = 1;
+		}
+		else if (*end != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * simConfigure:
+ *	Parse the settings (see the top of the file), before the first transaction
+ *********************************************************************************
+ */
+int simConfigure(const char *spec)
+{
+	char buff[1024];
+	char *save = NULL;
+	char *tok;
+	char *val;
+	int boards = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&gLock);
+	memset(&gCfg, 0, sizeof(gCfg));
+	gCfg.seed = 1;
+	snprintf(buff, sizeof(buff), "%s", spec != NULL ? spec : "");
+	for (tok = strtok_r(buff, ";", &save); tok; tok = strtok_r(NULL, ";", &save))
+	{
+		val = strchr(tok, '=');
+		if (val == NULL)
+		{
+			ret = -1;
+			break;
+		}
+		*val++ = 0;
+		if (strcmp(tok, "boards") == 0)
+		{
+			boards = 1;
+			ret = simParseBoards(val);
+		}
+		else if (strcmp(tok, "latency") == 0)
+		{
+			gCfg.latencyUs = (unsigned int)atoi(val);
+		}
+		else if (strcmp(tok, "byte") == 0)
+		{
+			gCfg.byteUs = (unsigned int)atoi(val);
+		}
+		else if (strcmp(tok, "nack") == 0)
+		{
+			gCfg.nack = atof(val);
+		}
+		else if (strcmp(tok, "biterr") == 0)
+		{
+			gCfg.bitErr = atof(val);
+		}
+		else if (strcmp(tok, "seed") == 0)
+		{
+			gCfg.seed = strtoull(val, NULL, 0);
+		}
+		else if (strcmp(tok, "state") == 0)
+		{
+			snprintf(gCfg.state, sizeof(gCfg.state), "%s", val);
+		}
+		else
+		{
+			ret = -1;
+		}
+		if (ret != 0)
+		{
+			break;
+		}
+	}
+	if (!boards)
+	{
+		gCfg.present[RELAY16_BUS_DEFAULT][0] = 1;
+	}
+	gConfigured = 1;
+	pthread_mutex_unlock(&gLock);
+	return ret;
+}
+
+static uint64_t simRand(int bus)
+{
+	uint64_t x = gRand[bus];
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	gRand[bus] = x;
+	return x;
+}
+
+static int simChance(int bus, double p)
+{
+	if (p <= 0)
+	{
+		return 0;
+	}
+	return (simRand(bus) % 1000000) < (uint64_t) (p * 1000000);
+}
+
+static void simDelay(int bytes)
+{
+	struct timespec ts;
+	uint64_t end;
+	uint64_t now;
+
+	if ( (gCfg.latencyUs == 0) && (gCfg.byteUs == 0))
+	{
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	end = now + gCfg.latencyUs + (uint64_t)gCfg.byteUs * bytes;
+	// busy wait, a sleep would add the scheduler latency to the model
+	while (now < end)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+}
+
+static uint8_t simRegRead(const uint8_t *r, int add)
+{
+	int port;
+	uint8_t cfg;
+
+	if (add == RELAY16_INPORT_REG_ADD || add == RELAY16_INPORT_REG_ADD + 1)
+	{
+		// the output pins read back their state, the inputs are pulled up
+		port = add - RELAY16_INPORT_REG_ADD;
+		cfg = r[RELAY16_CFG_REG_ADD + port];
+		return ( (r[RELAY16_OUTPORT_REG_ADD + port] & ~cfg) | cfg)
+			^ (r[RELAY16_POLINV_REG_ADD + port] & cfg);
+	}
+	return r[add];
+}
+
+static void simRegWrite(uint8_t *r, int add, uint8_t val)
+{
+	if ( (add < RELAY16_OUTPORT_REG_ADD)
+		|| ( (add >= I2C_MEM_DIAG_3V3_MV_ADD) && (add < I2C_MEM_WDT_RESET_ADD))
+		|| ( (add >= I2C_MEM_WDT_INTERVAL_GET_ADD)
+			&& (add < I2C_MEM_WDT_INIT_INTERVAL_SET_ADD))
+		|| ( (add >= I2C_MEM_WDT_INIT_INTERVAL_GET_ADD)
+			&& (add < I2C_MEM_WDT_CLEAR_RESET_COUNT_ADD))
+		|| ( (add >= I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD)
+			&& (add < I2C_MODBUS_SETINGS_ADD))
+		|| ( (add > I2C_MEM_CPU_RESET) && (add <= I2C_MEM_REVISION_MINOR_ADD)))
+	{
+		return; // read only
+	}
+	switch (add)
+	{
+	case I2C_MEM_WDT_RESET_ADD:
+	case I2C_MEM_CPU_RESET:
+		return; // commands
+	case I2C_MEM_WDT_CLEAR_RESET_COUNT_ADD:
+		if (val == WDT_RESET_SIGNATURE)
+		{
+			r[I2C_MEM_WDT_RESET_COUNT_ADD] = 0;
+			r[I2C_MEM_WDT_RESET_COUNT_ADD + 1] = 0;
+		}
+		return;
+	default:
+		break;
+	}
+	r[add] = val;
+	// the watchdog settings are read back from the "get" registers
+	if ( (add >= I2C_MEM_WDT_INTERVAL_SET_ADD)
+		&& (add < I2C_MEM_WDT_INTERVAL_GET_ADD))
+	{
+		r[add + 2] = val;
+	}
+	else if ( (add >= I2C_MEM_WDT_INIT_INTERVAL_SET_ADD)
+		&& (add < I2C_MEM_WDT_INIT_INTERVAL_GET_ADD))
+	{
+		r[add + 2] = val;
+	}
+	else if ( (add >= I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD)
+		&& (add < I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD))
+	{
+		r[add + 4] = val;
+	}
+}
+
+static int simInit(void)
+{
+	int i;
+
+	pthread_mutex_lock(&gLock);
+	if (gState == NULL)
+	{
+		if (!gConfigured)
+		{
+			pthread_mutex_unlock(&gLock);
+			simConfigure(secure_getenv("RELAY16_SIM"));
+			pthread_mutex_lock(&gLock);
+		}
+		for (i = 0; i < RELAY16_BUS_MAX; i++)
+		{
+			pthread_mutex_init(&gBusLock[i], NULL);
+			gRand[i] = (gCfg.seed + i) * 0x9E3779B97F4A7C15ULL | 1;
+		}
+		if (simStateOpen() != 0)
+		{
+			pthread_mutex_unlock(&gLock);
+			return -1;
+		}
+	}
+	pthread_mutex_unlock(&gLock);
+	return 0;
+}
+
+static int simSetup(int bus, int addr)
+{
+	int exists = (bus == RELAY16_BUS_DEFAULT);
+	int i;
+
+	if ( (bus < 0) || (bus >= RELAY16_BUS_MAX) || (simInit() != 0))
+	{
+		return -1;
+	}
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		exists |= gCfg.present[bus][i];
+	}
+	if (!exists)
+	{
+		return -1; // no /dev/i2c-<bus>
+	}
+	pthread_mutex_lock(&gLock);
+	for (i = 0; i < SIM_DEV_MAX; i++)
+	{
+		if (!gSimDev[i].used)
+		{
+			gSimDev[i].used = 1;
+			gSimDev[i].bus = bus;
+			gSimDev[i].addr = addr;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&gLock);
+	return i < SIM_DEV_MAX ? i : -1;
+}
+
+static void simClose(int dev)
+{
+	if ( (dev >= 0) && (dev < SIM_DEV_MAX))
+	{
+		pthread_mutex_lock(&gLock);
+		gSimDev[dev].used = 0;
+		pthread_mutex_unlock(&gLock);
+	}
+}
+
+/*
+ * simBoard:
+ *	Register file of the board answering at the device address, NULL if none
+ *********************************************************************************
+ */
+static uint8_t* simBoard(int dev, int *bus)
+{
+	SimDevType *d;
+	int base;
+	int i;
+
+	if ( (dev < 0) || (dev >= SIM_DEV_MAX) || !gSimDev[dev].used)
+	{
+		return NULL;
+	}
+	d = &gSimDev[dev];
+	*bus = d->bus;
+	for (i = 0; i < RELAY16_STACK_MAX; i++)
+	{
+		base = gCfg.alt[d->bus][i] ? RELAY16_HW_I2C_ALTERNATE_BASE_ADD :
+			RELAY16_HW_I2C_BASE_ADD;
+		if (gCfg.present[d->bus][i] && ( ( (base + i) ^ 0x07) == d->addr))
+		{
+			return gState->reg[d->bus][i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * simTransfer:
+ *	One bus transaction made of register reads and writes
+ *********************************************************************************
+ */
+static int simTransfer(int dev, I2cRegMsgType* msgs, int count)
+{
+	uint8_t buff[SIM_MSG_MAX];
+	uint8_t *r;
+	int bytes = 0;
+	int bus = 0;
+	int i;
+	int k;
+	int bit;
+
+	r = simBoard(dev, &bus);
+	for (i = 0; i < count; i++)
+	{
+		bytes += msgs[i].size + 1;
+	}
+	__atomic_add_fetch(&gStats.transactions, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&gStats.bytes, bytes, __ATOMIC_RELAXED);
+	if (r == NULL)
+	{
+		__atomic_add_fetch(&gStats.absent, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	pthread_mutex_lock(&gBusLock[bus]);
+	simDelay(bytes);
+	if (simChance(bus, gCfg.nack))
+	{
+		pthread_mutex_unlock(&gBusLock[bus]);
+		__atomic_add_fetch(&gStats.nacks, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	bit = simChance(bus, gCfg.bitErr) ? (int) (simRand(bus) % (8 * (bytes - count)))
+		: -1;
+	if (bit >= 0)
+	{
+		__atomic_add_fetch(&gStats.bitErrors, 1, __ATOMIC_RELAXED);
+	}
+	for (i = 0; i < count; i++)
+	{
+		if (msgs[i].read)
+		{
+			for (k = 0; k < msgs[i].size; k++)
+			{
+				msgs[i].buff[k] = simRegRead(r, (msgs[i].add + k) & 0xff);
+			}
+		}
+		else
+		{
+			memcpy(buff, msgs[i].buff, msgs[i].size);
+		}
+		if ( (bit >= 0) && (bit < 8 * msgs[i].size))
+		{
+			(msgs[i].read ? msgs[i].buff : buff)[bit / 8] ^= 1 << (bit % 8);
+		}
+		bit -= 8 * msgs[i].size;
+		if (!msgs[i].read)
+		{
+			for (k = 0; k < msgs[i].size; k++)
+			{
+				simRegWrite(r, (msgs[i].add + k) & 0xff, buff[k]);
+			}
+		}
+	}
+	pthread_mutex_unlock(&gBusLock[bus]);
+	return 0;
+}
+
+static int simRead(int dev, int add, uint8_t* buff, int size)
+{
+	I2cRegMsgType msg = {(uint8_t)add, 1, (uint8_t)size, buff};
+
+	return simTransfer(dev, &msg, 1);
+}
+
+static int simWrite(int dev, int add, uint8_t* buff, int size)
+{
+	I2cRegMsgType msg = {(uint8_t)add, 0, (uint8_t)size, buff};
+
+	return simTransfer(dev, &msg, 1);
+}
+
+static const I2cTransportType gSimTransport = {"sim", simSetup, simRead,
+	simWrite, simTransfer, simClose};
+
+const I2cTransportType* simTransport(void)
+{
+	return &gSimTransport;
+}
+
+void simStatsGet(SimStatsType *stats, int clear)
+{
+	if (stats != NULL)
+	{
+		stats->transactions = __atomic_load_n(&gStats.transactions, __ATOMIC_RELAXED);
+		stats->bytes = __atomic_load_n(&gStats.bytes, __ATOMIC_RELAXED);
+		stats->nacks = __atomic_load_n(&gStats.nacks, __ATOMIC_RELAXED);
+		stats->bitErrors = __atomic_load_n(&gStats.bitErrors, __ATOMIC_RELAXED);
+		stats->absent = __atomic_load_n(&gStats.absent, __ATOMIC_RELAXED);
+	}
+	if (clear)
+	{
+		memset(&gStats, 0, sizeof(gStats));
+	}
+}
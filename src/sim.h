@@ -0,0 +1,23 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdint.h>
+
+#include "comm.h"
+
+#define SIM_DEV_MAX		64
+
+typedef struct
+{
+	uint32_t transactions;
+	uint32_t bytes;
+	uint32_t nacks; /* injected */
+	uint32_t bitErrors; /* injected */
+	uint32_t absent; /* transactions to an address without a board */
+} SimStatsType;
+
+const I2cTransportType* simTransport(void);
+int simConfigure(const char *spec);
+void simStatsGet(SimStatsType *stats, int clear);
+
+#endif //SIM_H_
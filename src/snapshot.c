@@ -0,0 +1,235 @@
+/*
+ * snapshot.c:
+ *	Snapshot files of the board configuration, binary or JSON.
+ *
+ *	The binary format (little endian) is the magic "16RS", the version, the
+ *	size of the settings, the settings and the Modbus CRC of all the previous
+ *	bytes. Version 1 settings: the watchdog period (2 bytes), initial period
+ *	(2) and power off period (4), the RS485 mode (1), baud rate (4), stop bits
+ *	(1), parity (1) and Modbus address (1), the failsafe enable (2) and value
+ *	(2), bit 0 = relay 1, and the led mode (1).
+ *
+ *	The JSON variant has the same settings by name, the reader only looks for
+ *	the keys, which are unique.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "relay.h"
+#include "rtu.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_HEAD_SIZE	6
+#define SNAPSHOT_BIN_SIZE	(SNAPSHOT_HEAD_SIZE + SNAPSHOT_DATA_SIZE + 2)
+#define SNAPSHOT_JSON_FORMAT	"16relind-snapshot"
+
+static u8* put16(u8 *p, u16 val)
+{
+	p[0] = val & 0xff;
+	p[1] = val >> 8;
+	return p + 2;
+}
+
+static u8* put32(u8 *p, u32 val)
+{
+	p = put16(p, val & 0xffff);
+	return put16(p, val >> 16);
+}
+
+static u16 get16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 get32(const u8 *p)
+{
+	return get16(p) | ((u32)get16(p + 2) << 16);
+}
+
+static int binSave(FILE *f, const Relay16SnapshotType *snap)
+{
+	u8 buff[SNAPSHOT_BIN_SIZE];
+	u8 *p = buff;
+
+	memcpy(p, SNAPSHOT_MAGIC, 4);
+	p += 4;
+	*p++ = SNAPSHOT_VERSION;
+	*p++ = SNAPSHOT_DATA_SIZE;
+	p = put16(p, snap->wdtPeriod);
+	p = put16(p, snap->wdtInitPeriod);
+	p = put32(p, snap->wdtOffPeriod);
+	*p++ = snap->rs485.mode;
+	p = put32(p, snap->rs485.baud);
+	*p++ = snap->rs485.stopBits;
+	*p++ = snap->rs485.parity;
+	*p++ = snap->rs485.add;
+	p = put16(p, snap->failsafeEn);
+	p = put16(p, snap->failsafeVal);
+	*p++ = snap->ledMode;
+	put16(p, rtuCrc(buff, p - buff));
+	return fwrite(buff, 1, sizeof(buff), f) == sizeof(buff) ? OK : ERROR;
+}
+
+static int binLoad(const u8 *buff, int size, Relay16SnapshotType *snap)
+{
+	const u8 *p = buff + SNAPSHOT_HEAD_SIZE;
+
+	if ( (size != SNAPSHOT_BIN_SIZE) || (buff[4] != SNAPSHOT_VERSION)
+		|| (buff[5] != SNAPSHOT_DATA_SIZE)
+		|| (rtuCrc(buff, size - 2) != get16(buff + size - 2)))
+	{
+		return ERROR;
+	}
+	memset(snap, 0, sizeof(*snap));
+	snap->wdtPeriod = get16(p);
+	snap->wdtInitPeriod = get16(p + 2);
+	snap->wdtOffPeriod = get32(p + 4);
+	snap->rs485.mode = p[8];
+	snap->rs485.baud = get32(p + 9);
+	snap->rs485.stopBits = p[13];
+	snap->rs485.parity = p[14];
+	snap->rs485.add = p[15];
+	snap->failsafeEn = get16(p + 16);
+	snap->failsafeVal = get16(p + 18);
+	snap->ledMode = p[20];
+	return OK;
+}
+
+static int jsonSave(FILE *f, const Relay16SnapshotType *snap)
+{
+	fprintf(f, "{\n\t\"format\": \"%s\",\n\t\"version\": %d,\n",
+		SNAPSHOT_JSON_FORMAT, SNAPSHOT_VERSION);
+	fprintf(f, "\t\"wdt_period\": %u,\n\t\"wdt_init_period\": %u,\n"
+		"\t\"wdt_off_period\": %u,\n", snap->wdtPeriod, snap->wdtInitPeriod,
+		snap->wdtOffPeriod);
+	fprintf(f, "\t\"rs485\": {\"mode\": %u, \"baud\": %u, \"stop_bits\": %u,"
+		" \"parity\": %u, \"address\": %u},\n", snap->rs485.mode, snap->rs485.baud,
+		snap->rs485.stopBits, snap->rs485.parity, snap->rs485.add);
+	fprintf(f, "\t\"failsafe_en\": %u,\n\t\"failsafe_val\": %u,\n"
+		"\t\"led_mode\": %u\n}\n", snap->failsafeEn, snap->failsafeVal,
+		snap->ledMode);
+	return ferror(f) ? ERROR : OK;
+}
+
+/*
+ * jsonNumber:
+ *	Value of "key": <number> in the text, at most max
+ *********************************************************************************
+ */
+static int jsonNumber(const char *txt, const char *key, u32 max, u32 *val)
+{
+	char pattern[32];
+	const char *p;
+	char *end = NULL;
+	unsigned long num;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+	p = strstr(txt, pattern);
+	if (p == NULL)
+	{
+		return ERROR;
+	}
+	p += strlen(pattern);
+	while (isspace((unsigned char)*p))
+	{
+		p++;
+	}
+	if (*p++ != ':')
+	{
+		return ERROR;
+	}
+	while (isspace((unsigned char)*p))
+	{
+		p++;
+	}
+	if (!isdigit((unsigned char)*p))
+	{
+		return ERROR;
+	}
+	num = strtoul(p, &end, 10);
+	if (num > max)
+	{
+		return ERROR;
+	}
+	*val = (u32)num;
+	return OK;
+}
+
+static int jsonLoad(const char *txt, Relay16SnapshotType *snap)
+{
+	static const struct
+	{
+		const char *key;
+		u32 max;
+	} keys[] = {{"version", SNAPSHOT_VERSION}, {"wdt_period", 0xffff},
+		{"wdt_init_period", 0xffff}, {"wdt_off_period", 0xffffffff},
+		{"mode", 0xff}, {"baud", 0xffffff}, {"stop_bits", 0xff}, {"parity", 0xff},
+		{"address", 0xff}, {"failsafe_en", 0xffff}, {"failsafe_val", 0xffff},
+		{"led_mode", 0xff}};
+	u32 val[sizeof(keys) / sizeof(keys[0])];
+	unsigned int i;
+
+	if (strstr(txt, "\"" SNAPSHOT_JSON_FORMAT "\"") == NULL)
+	{
+		return ERROR;
+	}
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++)
+	{
+		if (OK != jsonNumber(txt, keys[i].key, keys[i].max, &val[i]))
+		{
+			return ERROR;
+		}
+	}
+	if (val[0] != SNAPSHOT_VERSION)
+	{
+		return ERROR;
+	}
+	memset(snap, 0, sizeof(*snap));
+	snap->wdtPeriod = val[1];
+	snap->wdtInitPeriod = val[2];
+	snap->wdtOffPeriod = val[3];
+	snap->rs485.mode = val[4];
+	snap->rs485.baud = val[5];
+	snap->rs485.stopBits = val[6];
+	snap->rs485.parity = val[7];
+	snap->rs485.add = val[8];
+	snap->failsafeEn = val[9];
+	snap->failsafeVal = val[10];
+	snap->ledMode = val[11];
+	return OK;
+}
+
+int snapshotSave(FILE *f, const Relay16SnapshotType *snap, int json)
+{
+	return json ? jsonSave(f, snap) : binSave(f, snap);
+}
+
+/*
+ * snapshotLoad:
+ *	Read a binary or JSON snapshot file
+ *********************************************************************************
+ */
+int snapshotLoad(FILE *f, Relay16SnapshotType *snap)
+{
+	char buff[SNAPSHOT_FILE_MAX + 1];
+	int size;
+
+	size = fread(buff, 1, SNAPSHOT_FILE_MAX + 1, f);
+	if ( (size <= 0) || (size > SNAPSHOT_FILE_MAX))
+	{
+		return ERROR;
+	}
+	if ( (size >= SNAPSHOT_HEAD_SIZE) && (memcmp(buff, SNAPSHOT_MAGIC, 4) == 0))
+	{
+		return binLoad((u8*)buff, size, snap);
+	}
+	buff[size] = 0;
+	return jsonLoad(buff, snap);
+}
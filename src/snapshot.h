@@ -0,0 +1,16 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include <stdio.h>
+
+#include "lib16relind.h"
+
+#define SNAPSHOT_MAGIC			"16RS"
+#define SNAPSHOT_VERSION		1
+#define SNAPSHOT_DATA_SIZE		21	/* settings of a version 1 snapshot */
+#define SNAPSHOT_FILE_MAX		4096
+
+int snapshotSave(FILE *f, const Relay16SnapshotType *snap, int json);
+int snapshotLoad(FILE *f, Relay16SnapshotType *snap);
+
+#endif //SNAPSHOT_H_
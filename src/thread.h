@@ -10,6 +10,7 @@
 
 
 void busyWait(int ms);
+int piHiPri(const int pri);
 void startThread(void);
 int checkThreadResult(void);
 
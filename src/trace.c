@@ -0,0 +1,374 @@
+/*
+ * trace.c:
+ *	Latency trace of the bus transactions, the bus lock waits and the CLI write
+ *	retries. The records go to a ring in a shared memory segment, so the trace
+ *	of every process using the library (the daemon included) can be dumped from
+ *	the command line. Each record is written under a sequence number, the
+ *	readers drop the records overwritten while they copy them.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define TRACE_MAGIC		0x31365254
+#define TRACE_DEV_MAX	64
+
+typedef struct
+{
+	uint64_t seq; /* index + 1 of the record, 0 while written */
+	Relay16TraceRecType rec;
+} TraceSlotType;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t enabled;
+	uint64_t head; /* next record index */
+	uint64_t base; /* first record index since the last clear */
+	Relay16TraceStatsType stats[RELAY16_TRACE_KIND_COUNT];
+	TraceSlotType ring[RELAY16_TRACE_SIZE];
+} TraceShmType;
+
+typedef struct
+{
+	int dev;
+	int bus;
+	int add;
+} TraceDevType;
+
+static TraceShmType *gTrace = NULL;
+static pthread_once_t gTraceOnce = PTHREAD_ONCE_INIT;
+static TraceDevType gTraceDev[TRACE_DEV_MAX];
+static pthread_mutex_t gTraceDevLock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t gTracePid = 0; /* getpid() is a system call, reset in the fork children */
+
+static void traceForkChild(void)
+{
+	gTracePid = 0;
+}
+
+/*
+ * traceOpen:
+ *	Map the trace segment, the process creating it initializes it
+ *********************************************************************************
+ */
+static void traceOpen(void)
+{
+	TraceShmType *t;
+	int created = 1;
+	int fd;
+	int i;
+
+	for (i = 0; i < TRACE_DEV_MAX; i++)
+	{
+		gTraceDev[i].dev = -1;
+	}
+	pthread_atfork(NULL, NULL, traceForkChild);
+	fd = shm_open(TRACE_NAME, O_RDWR | O_CREAT | O_EXCL, 0666);
+	if (fd < 0 && errno == EEXIST)
+	{
+		created = 0;
+		fd = shm_open(TRACE_NAME, O_RDWR, 0);
+	}
+	if (fd < 0)
+	{
+		return;
+	}
+	if (created)
+	{
+		fchmod(fd, 0666);
+		if (ftruncate(fd, sizeof(TraceShmType)) != 0)
+		{
+			close(fd);
+			shm_unlink(TRACE_NAME);
+			return;
+		}
+	}
+	t = mmap(NULL, sizeof(TraceShmType), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0);
+	close(fd);
+	if (t == MAP_FAILED)
+	{
+		return;
+	}
+	if (created)
+	{
+		// the new segment is zero filled: tracing off, empty ring
+		__atomic_store_n(&t->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		for (i = 0; i < 100; i++)
+		{
+			if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) == TRACE_MAGIC)
+			{
+				break;
+			}
+			usleep(1000);
+		}
+		if (i == 100)
+		{
+			munmap(t, sizeof(TraceShmType));
+			shm_unlink(TRACE_NAME);
+			return;
+		}
+	}
+	gTrace = t;
+}
+
+static TraceShmType* trace(void)
+{
+	pthread_once(&gTraceOnce, traceOpen);
+	return gTrace;
+}
+
+static uint64_t traceTimeNs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t traceStart(void)
+{
+	TraceShmType *t = trace();
+
+	if ( (t == NULL) || !__atomic_load_n(&t->enabled, __ATOMIC_RELAXED))
+	{
+		return 0;
+	}
+	return traceTimeNs();
+}
+
+static int traceBucket(uint32_t us)
+{
+	int i = us ? 32 - __builtin_clz(us) : 0;
+
+	return i < RELAY16_TRACE_HIST ? i : RELAY16_TRACE_HIST - 1;
+}
+
+void traceRecord(Relay16TraceKindType kind, int bus, int add, int reg,
+	int size, int result, uint64_t start)
+{
+	TraceShmType *t = gTrace;
+	Relay16TraceStatsType *st;
+	TraceSlotType *slot;
+	uint64_t idx;
+	uint64_t ns;
+	uint32_t us;
+	uint32_t max;
+
+	if ( (start == 0) || (t == NULL) || (kind >= RELAY16_TRACE_KIND_COUNT))
+	{
+		return;
+	}
+	ns = traceTimeNs() - start;
+	us = ns / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t) (ns / 1000);
+	st = &t->stats[kind];
+	__atomic_add_fetch(&st->count, 1, __ATOMIC_RELAXED);
+	if (result != 0)
+	{
+		__atomic_add_fetch(&st->errors, 1, __ATOMIC_RELAXED);
+	}
+	__atomic_add_fetch(&st->totalUs, us, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->hist[traceBucket(us)], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&st->maxUs, __ATOMIC_RELAXED);
+	while (us > max
+		&& !__atomic_compare_exchange_n(&st->maxUs, &max, us, 0, __ATOMIC_RELAXED,
+			__ATOMIC_RELAXED))
+		;
+
+	idx = __atomic_fetch_add(&t->head, 1, __ATOMIC_RELAXED);
+	slot = &t->ring[idx % RELAY16_TRACE_SIZE];
+	__atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->rec.timeNs = start;
+	slot->rec.us = us;
+	if (gTracePid == 0)
+	{
+		gTracePid = getpid();
+	}
+	slot->rec.pid = gTracePid;
+	slot->rec.kind = kind;
+	slot->rec.bus = bus;
+	slot->rec.add = add;
+	slot->rec.reg = reg;
+	slot->rec.size = size > 255 ? 255 : size;
+	slot->rec.result = result;
+	__atomic_store_n(&slot->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * traceDevSet:
+ *	Remember the bus and the address behind a transport handle for the records
+ *********************************************************************************
+ */
+void traceDevSet(int dev, int bus, int add)
+{
+	int i;
+	int pos = -1;
+
+	trace(); // initializes the table
+	pthread_mutex_lock(&gTraceDevLock);
+	for (i = 0; i < TRACE_DEV_MAX; i++)
+	{
+		if (gTraceDev[i].dev == dev)
+		{
+			pos = i;
+			break;
+		}
+		if ( (pos < 0) && (gTraceDev[i].dev < 0))
+		{
+			pos = i;
+		}
+	}
+	if (pos >= 0)
+	{
+		gTraceDev[pos].dev = dev;
+		gTraceDev[pos].bus = bus;
+		gTraceDev[pos].add = add;
+	}
+	pthread_mutex_unlock(&gTraceDevLock);
+}
+
+void traceDevClear(int dev)
+{
+	int i;
+
+	pthread_mutex_lock(&gTraceDevLock);
+	for (i = 0; i < TRACE_DEV_MAX; i++)
+	{
+		if (gTraceDev[i].dev == dev)
+		{
+			gTraceDev[i].dev = -1;
+		}
+	}
+	pthread_mutex_unlock(&gTraceDevLock);
+}
+
+void traceIo(Relay16TraceKindType kind, int dev, int reg, int size,
+	int result, uint64_t start)
+{
+	int bus = 0;
+	int add = 0;
+	int i;
+
+	if (start == 0)
+	{
+		return;
+	}
+	pthread_mutex_lock(&gTraceDevLock);
+	for (i = 0; i < TRACE_DEV_MAX; i++)
+	{
+		if (gTraceDev[i].dev == dev)
+		{
+			bus = gTraceDev[i].bus;
+			add = gTraceDev[i].add;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&gTraceDevLock);
+	traceRecord(kind, bus, add, reg, size, result, start);
+}
+
+int relay16TraceEnable(int enable)
+{
+	TraceShmType *t = trace();
+
+	if (t == NULL)
+	{
+		return RELAY16_ERR_NOMEM;
+	}
+	__atomic_store_n(&t->enabled, enable ? 1 : 0, __ATOMIC_RELAXED);
+	return RELAY16_OK;
+}
+
+int relay16TraceEnabled(void)
+{
+	TraceShmType *t = trace();
+
+	return (t != NULL) && __atomic_load_n(&t->enabled, __ATOMIC_RELAXED);
+}
+
+int relay16TraceRead(Relay16TraceRecType *rec, int max)
+{
+	TraceShmType *t = trace();
+	TraceSlotType *slot;
+	uint64_t head;
+	uint64_t idx;
+	int n = 0;
+
+	if ( (rec == NULL) || (max < 0))
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	if (t == NULL)
+	{
+		return 0;
+	}
+	head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+	idx = __atomic_load_n(&t->base, __ATOMIC_RELAXED);
+	if (head - idx > (uint64_t)max)
+	{
+		idx = head - max;
+	}
+	if (head - idx > RELAY16_TRACE_SIZE)
+	{
+		idx = head - RELAY16_TRACE_SIZE;
+	}
+	for (; idx < head; idx++)
+	{
+		slot = &t->ring[idx % RELAY16_TRACE_SIZE];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != idx + 1)
+		{
+			continue;
+		}
+		rec[n] = slot->rec;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == idx + 1)
+		{
+			n++;
+		}
+	}
+	return n;
+}
+
+int relay16TraceStatsGet(Relay16TraceStatsType stats[RELAY16_TRACE_KIND_COUNT],
+	int clear)
+{
+	TraceShmType *t = trace();
+
+	if (stats == NULL)
+	{
+		return RELAY16_ERR_PARAM;
+	}
+	if (t == NULL)
+	{
+		memset(stats, 0, sizeof(t->stats));
+		return RELAY16_OK;
+	}
+	memcpy(stats, t->stats, sizeof(t->stats));
+	if (clear)
+	{
+		// records in progress may still land in the cleared counters
+		memset(t->stats, 0, sizeof(t->stats));
+		__atomic_store_n(&t->base, __atomic_load_n(&t->head, __ATOMIC_RELAXED),
+			__ATOMIC_RELAXED);
+	}
+	return RELAY16_OK;
+}
@@ -0,0 +1,22 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#include "lib16relind.h"
+
+#define TRACE_NAME	"/16relind_trace"
+
+/*
+ * traceStart returns 0 when the tracing is off and traceRecord / traceIo
+ * ignore a 0 start, so the call sites cost one test when off
+ */
+uint64_t traceStart(void);
+void traceRecord(Relay16TraceKindType kind, int bus, int add, int reg,
+	int size, int result, uint64_t start);
+void traceIo(Relay16TraceKindType kind, int dev, int reg, int size,
+	int result, uint64_t start);
+void traceDevSet(int dev, int bus, int add);
+void traceDevClear(int dev);
+
+#endif //TRACE_H_
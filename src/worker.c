@@ -0,0 +1,213 @@
+/*
+ * worker.c:
+ *	One worker thread per I2C bus. A list of jobs spanning several buses is
+ *	split by bus, each worker runs the jobs of its bus in order and the caller
+ *	waits for all of them, so the transfers on different buses overlap.
+ *	The workers are started on the first use of their bus and never stop.
+ *
+ *	Copyright (c) 2016-2026 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "lib16relind.h"
+#include "worker.h"
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int pending;
+} BusBatchType;
+
+typedef struct BusTask
+{
+	struct BusTask *next;
+	int bus;
+	BusJobType *jobs;
+	int count;
+	BusBatchType *batch;
+} BusTaskType;
+
+typedef struct
+{
+	int started;
+	pthread_t thread;
+	pthread_cond_t cond;
+	BusTaskType *head;
+	BusTaskType *tail;
+} BusWorkerType;
+
+static BusWorkerType gWorker[RELAY16_BUS_MAX];
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static int gEnabled = 0;
+
+static void busTaskRun(BusTaskType *task)
+{
+	int i;
+
+	for (i = 0; i < task->count; i++)
+	{
+		if (task->jobs[i].bus == task->bus)
+		{
+			task->jobs[i].fn(task->jobs[i].arg);
+		}
+	}
+}
+
+static void* busWorker(void *arg)
+{
+	BusWorkerType *w = arg;
+	BusTaskType *task;
+	BusBatchType *batch;
+
+	pthread_mutex_lock(&gLock);
+	while (1)
+	{
+		while (w->head == NULL)
+		{
+			pthread_cond_wait(&w->cond, &gLock);
+		}
+		task = w->head;
+		w->head = task->next;
+		if (w->head == NULL)
+		{
+			w->tail = NULL;
+		}
+		pthread_mutex_unlock(&gLock);
+
+		busTaskRun(task);
+		batch = task->batch;
+		pthread_mutex_lock(&batch->lock);
+		if (--batch->pending == 0)
+		{
+			pthread_cond_signal(&batch->cond);
+		}
+		pthread_mutex_unlock(&batch->lock);
+
+		pthread_mutex_lock(&gLock);
+	}
+	return NULL;
+}
+
+/*
+ * busWorkerPost:
+ *	Queue a task on the bus worker, gLock held. Return 0 if the worker can not
+ *	be started, the caller runs the task itself.
+ *********************************************************************************
+ */
+static int busWorkerPost(BusTaskType *task)
+{
+	BusWorkerType *w = &gWorker[task->bus];
+
+	if (!w->started)
+	{
+		pthread_cond_init(&w->cond, NULL);
+		if (pthread_create(&w->thread, NULL, busWorker, w) != 0)
+		{
+			pthread_cond_destroy(&w->cond);
+			return 0;
+		}
+		pthread_detach(w->thread);
+		w->started = 1;
+	}
+	task->next = NULL;
+	if (w->tail != NULL)
+	{
+		w->tail->next = task;
+	}
+	else
+	{
+		w->head = task;
+	}
+	w->tail = task;
+	pthread_cond_signal(&w->cond);
+	return 1;
+}
+
+void busWorkersEnable(int enable)
+{
+	pthread_mutex_lock(&gLock);
+	gEnabled = enable;
+	pthread_mutex_unlock(&gLock);
+}
+
+int busWorkersEnabled(void)
+{
+	int enabled;
+
+	pthread_mutex_lock(&gLock);
+	enabled = gEnabled;
+	pthread_mutex_unlock(&gLock);
+	return enabled;
+}
+
+/*
+ * busJobsRun:
+ *	Run the jobs, concurrently per bus when the workers are enabled and the
+ *	jobs span more than one bus, otherwise in order in the calling thread
+ *********************************************************************************
+ */
+void busJobsRun(BusJobType *jobs, int count)
+{
+	BusTaskType task[RELAY16_BUS_MAX];
+	int posted[RELAY16_BUS_MAX] = {0};
+	BusBatchType batch;
+	int tasks = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < count; i++)
+	{
+		for (j = 0; (j < tasks) && (task[j].bus != jobs[i].bus); j++)
+			;
+		if (j == tasks)
+		{
+			task[tasks].bus = jobs[i].bus;
+			task[tasks].jobs = jobs;
+			task[tasks].count = count;
+			task[tasks].batch = &batch;
+			tasks++;
+		}
+	}
+	if ( (tasks < 2) || !busWorkersEnabled())
+	{
+		for (i = 0; i < count; i++)
+		{
+			jobs[i].fn(jobs[i].arg);
+		}
+		return;
+	}
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+	batch.pending = 0;
+
+	// the first bus is served by the calling thread
+	pthread_mutex_lock(&gLock);
+	pthread_mutex_lock(&batch.lock);
+	for (i = 1; i < tasks; i++)
+	{
+		posted[i] = busWorkerPost(&task[i]);
+		batch.pending += posted[i];
+	}
+	pthread_mutex_unlock(&batch.lock);
+	pthread_mutex_unlock(&gLock);
+
+	for (i = 0; i < tasks; i++)
+	{
+		if (!posted[i])
+		{
+			busTaskRun(&task[i]);
+		}
+	}
+	pthread_mutex_lock(&batch.lock);
+	while (batch.pending > 0)
+	{
+		pthread_cond_wait(&batch.cond, &batch.lock);
+	}
+	pthread_mutex_unlock(&batch.lock);
+	pthread_cond_destroy(&batch.cond);
+	pthread_mutex_destroy(&batch.lock);
+}
@@ -0,0 +1,15 @@
+#ifndef WORKER_H_
+#define WORKER_H_
+
+typedef struct
+{
+	int bus;
+	void (*fn)(void *arg);
+	void *arg;
+} BusJobType;
+
+void busWorkersEnable(int enable);
+int busWorkersEnabled(void);
+void busJobsRun(BusJobType *jobs, int count);
+
+#endif //WORKER_H_